@@ -0,0 +1,807 @@
+#include "main.h"
+#include <opcua_string.h>
+#include <opcua_thread.h>
+#include <opcua_semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#define INDEX_MAGIC "WPCPIDX1"
+#define INDEX_BROWSE_BATCH 100
+#define MAX_DIRTY_NODES 1024
+
+const OpcUa_CharA* g_indexFile;
+OpcUa_UInt32 g_indexInterval = 3600;
+
+// all offsets are relative to the start of the file, string offsets to the start of the string section
+struct index_header_t {
+  char magic[8];
+  OpcUa_UInt32 size;
+  OpcUa_UInt32 namespaceHash;
+  OpcUa_UInt32 noOfSlots;
+  OpcUa_UInt32 noOfNodes;
+  OpcUa_UInt32 noOfReferences;
+  OpcUa_UInt32 slots;
+  OpcUa_UInt32 nodes;
+  OpcUa_UInt32 references;
+  OpcUa_UInt32 strings;
+};
+
+struct index_node_t {
+  OpcUa_UInt32 id;
+  OpcUa_UInt32 hash;
+  OpcUa_UInt32 firstReference;
+  OpcUa_UInt32 noOfReferences;
+};
+
+struct index_reference_t {
+  OpcUa_UInt32 id;
+  OpcUa_UInt32 browseName;
+  OpcUa_UInt32 displayName;
+  OpcUa_UInt32 typeDefinition;
+};
+
+// strings are stored once with a length prefix and padded to 4 bytes
+struct index_builder_t {
+  OpcUa_Byte* strings;
+  OpcUa_UInt32 stringsSize;
+  OpcUa_UInt32 stringsCapacity;
+  OpcUa_UInt32* stringIndex;
+  OpcUa_UInt32 stringIndexSize;
+  OpcUa_UInt32 noOfStrings;
+  struct index_node_t* nodes;
+  OpcUa_UInt32 noOfNodes;
+  OpcUa_UInt32 nodesCapacity;
+  OpcUa_UInt32* nodeIndex;
+  OpcUa_UInt32 nodeIndexSize;
+  struct index_reference_t* references;
+  OpcUa_UInt32 noOfReferences;
+  OpcUa_UInt32 referencesCapacity;
+};
+
+struct dirty_node_t {
+  OpcUa_UInt32 hash;
+  OpcUa_UInt32 generation;
+};
+
+static HANDLE g_indexFileHandle = INVALID_HANDLE_VALUE;
+static HANDLE g_indexMapping;
+static const OpcUa_Byte* g_index;
+static OpcUa_Mutex g_indexMutex;
+
+// nodes changed since the index was built are browsed on the server until the next crawl
+static OpcUa_UInt32 g_namespaceHash;
+static OpcUa_UInt32 g_generation = 1;
+static OpcUa_UInt32 g_invalidGeneration;
+static OpcUa_Boolean g_indexValid;
+static struct dirty_node_t g_dirtyNodes[MAX_DIRTY_NODES];
+static OpcUa_UInt32 g_noOfDirtyNodes;
+
+static OpcUa_Thread g_crawlerThread;
+static OpcUa_Semaphore g_crawlerSemaphore;
+static volatile LONG g_crawlerShutdown;
+
+static const struct index_header_t* indexHeader(void)
+{
+  return (const struct index_header_t*)g_index;
+}
+
+static const OpcUa_Byte* indexString(OpcUa_UInt32 offset, OpcUa_UInt32* length)
+{
+  const OpcUa_Byte* string = g_index + indexHeader()->strings + offset;
+  memcpy(length, string, sizeof(*length));
+  return string + sizeof(*length);
+}
+
+static OpcUa_UInt32 formatNodeId(const OpcUa_NodeId* nodeId, char* buffer, uint32_t size)
+{
+  struct wpcp_value_t id;
+  toWpcpId(nodeId, &id, buffer, size);
+  return (OpcUa_UInt32)id.value.length;
+}
+
+static const struct index_node_t* findNode(const char* id, OpcUa_UInt32 length, OpcUa_UInt32 hash)
+{
+  const struct index_header_t* header = indexHeader();
+  const OpcUa_UInt32* slots = (const OpcUa_UInt32*)(g_index + header->slots);
+  const struct index_node_t* nodes = (const struct index_node_t*)(g_index + header->nodes);
+
+  for (OpcUa_UInt32 slot = hash & (header->noOfSlots - 1); slots[slot]; slot = (slot + 1) & (header->noOfSlots - 1)) {
+    const struct index_node_t* node = &nodes[slots[slot] - 1];
+    OpcUa_UInt32 nodeLength;
+    const OpcUa_Byte* nodeId = indexString(node->id, &nodeLength);
+    if (node->hash == hash && nodeLength == length && !memcmp(nodeId, id, length))
+      return node;
+  }
+
+  return NULL;
+}
+
+static void unmapIndex(void)
+{
+  if (g_index)
+    UnmapViewOfFile(g_index);
+  if (g_indexMapping)
+    CloseHandle(g_indexMapping);
+  if (g_indexFileHandle != INVALID_HANDLE_VALUE)
+    CloseHandle(g_indexFileHandle);
+
+  g_index = NULL;
+  g_indexMapping = NULL;
+  g_indexFileHandle = INVALID_HANDLE_VALUE;
+}
+
+static OpcUa_Boolean isIndexString(OpcUa_UInt32 offset)
+{
+  const struct index_header_t* header = indexHeader();
+  OpcUa_UInt32 length;
+
+  if (header->strings + (OpcUa_UInt64)offset + sizeof(length) > header->size)
+    return OpcUa_False;
+  indexString(offset, &length);
+  return header->strings + (OpcUa_UInt64)offset + sizeof(length) + length <= header->size;
+}
+
+// every slot, reference range and string of the sections has to stay within them
+static OpcUa_Boolean checkIndex(void)
+{
+  const struct index_header_t* header = indexHeader();
+  const OpcUa_UInt32* slots = (const OpcUa_UInt32*)(g_index + header->slots);
+  const struct index_node_t* nodes = (const struct index_node_t*)(g_index + header->nodes);
+  const struct index_reference_t* references = (const struct index_reference_t*)(g_index + header->references);
+
+  // a probe only ends at an empty slot
+  OpcUa_Boolean empty = OpcUa_False;
+  for (OpcUa_UInt32 i = 0; i < header->noOfSlots; ++i) {
+    if (slots[i] > header->noOfNodes)
+      return OpcUa_False;
+    empty |= !slots[i];
+  }
+  if (!empty)
+    return OpcUa_False;
+
+  for (OpcUa_UInt32 i = 0; i < header->noOfNodes; ++i) {
+    if ((OpcUa_UInt64)nodes[i].firstReference + nodes[i].noOfReferences > header->noOfReferences || !isIndexString(nodes[i].id))
+      return OpcUa_False;
+  }
+
+  for (OpcUa_UInt32 i = 0; i < header->noOfReferences; ++i) {
+    if (!isIndexString(references[i].id) || !isIndexString(references[i].browseName) ||
+        !isIndexString(references[i].displayName) || !isIndexString(references[i].typeDefinition))
+      return OpcUa_False;
+  }
+
+  return OpcUa_True;
+}
+
+// the file is only trusted if all sections lie within it
+static OpcUa_Boolean mapIndex(void)
+{
+  LARGE_INTEGER size;
+
+  g_indexFileHandle = CreateFileA(g_indexFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (g_indexFileHandle == INVALID_HANDLE_VALUE)
+    return OpcUa_False;
+
+  if (GetFileSizeEx(g_indexFileHandle, &size) && size.QuadPart >= (LONGLONG)sizeof(struct index_header_t) && size.QuadPart < 0xFFFFFFFF)
+    g_indexMapping = CreateFileMappingA(g_indexFileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (g_indexMapping)
+    g_index = MapViewOfFile(g_indexMapping, FILE_MAP_READ, 0, 0, 0);
+  if (!g_index) {
+    unmapIndex();
+    return OpcUa_False;
+  }
+
+  const struct index_header_t* header = indexHeader();
+  OpcUa_UInt64 fileSize = (OpcUa_UInt64)size.QuadPart;
+  if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) || header->size != fileSize ||
+      !header->noOfSlots || (header->noOfSlots & (header->noOfSlots - 1)) ||
+      header->slots + (OpcUa_UInt64)header->noOfSlots * sizeof(OpcUa_UInt32) > fileSize ||
+      header->nodes + (OpcUa_UInt64)header->noOfNodes * sizeof(struct index_node_t) > fileSize ||
+      header->references + (OpcUa_UInt64)header->noOfReferences * sizeof(struct index_reference_t) > fileSize ||
+      header->strings > fileSize || !checkIndex()) {
+    unmapIndex();
+    return OpcUa_False;
+  }
+
+  return OpcUa_True;
+}
+
+static OpcUa_Boolean isDirty(OpcUa_UInt32 hash)
+{
+  for (OpcUa_UInt32 i = 0; i < g_noOfDirtyNodes; ++i) {
+    if (g_dirtyNodes[i].hash == hash)
+      return OpcUa_True;
+  }
+  return OpcUa_False;
+}
+
+static const struct index_node_t* lookupNode(const OpcUa_NodeId* nodeId)
+{
+  char buffer[1024];
+  OpcUa_UInt32 length = formatNodeId(nodeId, buffer, sizeof(buffer));
+  OpcUa_UInt32 hash = hashBuffer(HASH_INITIAL, buffer, length);
+
+  if (!g_index || !g_indexValid || isDirty(hash))
+    return NULL;
+
+  return findNode(buffer, length, hash);
+}
+
+// the references are copied, so the answer does not depend on the index staying mapped or valid until it is returned
+struct addressspace_browse_t {
+  OpcUa_UInt32 noOfReferences;
+  OpcUa_Byte strings[1];
+};
+
+static OpcUa_UInt32 indexStringSize(OpcUa_UInt32 offset)
+{
+  OpcUa_UInt32 length;
+  indexString(offset, &length);
+  return sizeof(length) + length;
+}
+
+static OpcUa_Byte* copyIndexString(OpcUa_Byte* target, OpcUa_UInt32 offset)
+{
+  OpcUa_UInt32 size = indexStringSize(offset);
+  memcpy(target, g_index + indexHeader()->strings + offset, size);
+  return target + size;
+}
+
+static const OpcUa_Byte* nextString(const OpcUa_Byte* string, const char** data, OpcUa_UInt32* length)
+{
+  memcpy(length, string, sizeof(*length));
+  *data = (const char*)string + sizeof(*length);
+  return string + sizeof(*length) + *length;
+}
+
+// each reference is stored as its id, browse name, display name and type definition
+struct addressspace_browse_t* addressspace_browse(const OpcUa_NodeId* nodeId)
+{
+  struct addressspace_browse_t* browse = NULL;
+
+  if (!g_indexFile)
+    return NULL;
+
+  OpcUa_Mutex_Lock(g_indexMutex);
+  const struct index_node_t* node = lookupNode(nodeId);
+  if (node) {
+    const struct index_reference_t* references = (const struct index_reference_t*)(g_index + indexHeader()->references) + node->firstReference;
+    size_t size = 0;
+    for (OpcUa_UInt32 i = 0; i < node->noOfReferences; ++i)
+      size += indexStringSize(references[i].id) + indexStringSize(references[i].browseName) + indexStringSize(references[i].displayName) + indexStringSize(references[i].typeDefinition);
+
+    browse = malloc(sizeof(struct addressspace_browse_t) + size);
+    browse->noOfReferences = node->noOfReferences;
+    OpcUa_Byte* target = browse->strings;
+    for (OpcUa_UInt32 i = 0; i < node->noOfReferences; ++i) {
+      target = copyIndexString(target, references[i].id);
+      target = copyIndexString(target, references[i].browseName);
+      target = copyIndexString(target, references[i].displayName);
+      target = copyIndexString(target, references[i].typeDefinition);
+    }
+  }
+  OpcUa_Mutex_Unlock(g_indexMutex);
+
+  stats_add(browse ? STATS_BROWSE_INDEX_HITS : STATS_BROWSE_INDEX_MISSES, 1);
+  return browse;
+}
+
+void addressspace_returnBrowse(struct wpcp_result_t* result, struct addressspace_browse_t* browse)
+{
+  const OpcUa_Byte* string = browse->strings;
+  wpcp_return_browse(result, NULL, browse->noOfReferences);
+
+  for (OpcUa_UInt32 i = 0; i < browse->noOfReferences; ++i) {
+    const char* browseName;
+    const char* displayName;
+    OpcUa_UInt32 browseNameLength;
+    OpcUa_UInt32 displayNameLength;
+    struct wpcp_value_t id;
+    struct wpcp_value_t type;
+    OpcUa_UInt32 length;
+
+    id.type = WPCP_VALUE_TYPE_TEXT_STRING;
+    string = nextString(string, &id.data.text_string, &length);
+    id.value.length = length;
+    string = nextString(string, &browseName, &browseNameLength);
+    string = nextString(string, &displayName, &displayNameLength);
+    type.type = WPCP_VALUE_TYPE_TEXT_STRING;
+    string = nextString(string, &type.data.text_string, &length);
+    type.value.length = length;
+
+    search_add(id.data.text_string, id.value.length, browseName, browseNameLength, displayName, displayNameLength, type.data.text_string, type.value.length);
+    wpcp_return_browse_item(result, &id, browseName, browseNameLength, displayName, displayNameLength, NULL, 0, &type, NULL, 0);
+  }
+
+  free(browse);
+}
+
+// invalidates a single node or everything if no node is given
+void addressspace_invalidate(const OpcUa_NodeId* nodeId)
+{
+  if (!g_indexFile)
+    return;
+
+  OpcUa_Mutex_Lock(g_indexMutex);
+  if (nodeId && g_noOfDirtyNodes < MAX_DIRTY_NODES) {
+    char buffer[1024];
+    OpcUa_UInt32 length = formatNodeId(nodeId, buffer, sizeof(buffer));
+    g_dirtyNodes[g_noOfDirtyNodes].hash = hashBuffer(HASH_INITIAL, buffer, length);
+    g_dirtyNodes[g_noOfDirtyNodes].generation = g_generation;
+    ++g_noOfDirtyNodes;
+  } else {
+    g_indexValid = OpcUa_False;
+    g_invalidGeneration = g_generation;
+  }
+  OpcUa_Mutex_Unlock(g_indexMutex);
+
+  OpcUa_Semaphore_Post(g_crawlerSemaphore, 1);
+}
+
+// a changed namespace array shifts the namespace indices the index was built with
+void addressspace_checkNamespaces(void)
+{
+  OpcUa_UInt32 hash = path_getNamespaceHash();
+
+  if (!g_indexFile || !hash)
+    return;
+
+  OpcUa_Mutex_Lock(g_indexMutex);
+  g_namespaceHash = hash;
+  OpcUa_Boolean changed = g_index && indexHeader()->namespaceHash != hash;
+  if (changed) {
+    g_indexValid = OpcUa_False;
+    g_invalidGeneration = g_generation;
+  }
+  OpcUa_Mutex_Unlock(g_indexMutex);
+
+  if (changed)
+    OpcUa_Semaphore_Post(g_crawlerSemaphore, 1);
+}
+
+static OpcUa_UInt32 internString(struct index_builder_t* builder, const void* data, OpcUa_UInt32 length)
+{
+  OpcUa_UInt32 hash = hashBuffer(HASH_INITIAL, data, length);
+
+  if (2 * (builder->noOfStrings + 1) > builder->stringIndexSize) {
+    OpcUa_UInt32 size = builder->stringIndexSize ? 2 * builder->stringIndexSize : 4096;
+    OpcUa_UInt32* index = calloc(size, sizeof(*index));
+    for (OpcUa_UInt32 i = 0; i < builder->stringIndexSize; ++i) {
+      if (!builder->stringIndex[i])
+        continue;
+      OpcUa_UInt32 offset = builder->stringIndex[i] - 1;
+      OpcUa_UInt32 stringLength;
+      memcpy(&stringLength, builder->strings + offset, sizeof(stringLength));
+      OpcUa_UInt32 slot = hashBuffer(HASH_INITIAL, builder->strings + offset + sizeof(stringLength), stringLength) & (size - 1);
+      while (index[slot])
+        slot = (slot + 1) & (size - 1);
+      index[slot] = builder->stringIndex[i];
+    }
+    free(builder->stringIndex);
+    builder->stringIndex = index;
+    builder->stringIndexSize = size;
+  }
+
+  OpcUa_UInt32 slot = hash & (builder->stringIndexSize - 1);
+  while (builder->stringIndex[slot]) {
+    OpcUa_UInt32 offset = builder->stringIndex[slot] - 1;
+    OpcUa_UInt32 stringLength;
+    memcpy(&stringLength, builder->strings + offset, sizeof(stringLength));
+    if (stringLength == length && !memcmp(builder->strings + offset + sizeof(stringLength), data, length))
+      return offset;
+    slot = (slot + 1) & (builder->stringIndexSize - 1);
+  }
+
+  OpcUa_UInt32 size = (sizeof(length) + length + 3) & ~3u;
+  if (builder->stringsSize + size > builder->stringsCapacity) {
+    builder->stringsCapacity = builder->stringsCapacity ? 2 * builder->stringsCapacity : 65536;
+    if (builder->stringsCapacity < builder->stringsSize + size)
+      builder->stringsCapacity = builder->stringsSize + size;
+    builder->strings = realloc(builder->strings, builder->stringsCapacity);
+  }
+
+  OpcUa_UInt32 offset = builder->stringsSize;
+  memset(builder->strings + offset, 0, size);
+  memcpy(builder->strings + offset, &length, sizeof(length));
+  memcpy(builder->strings + offset + sizeof(length), data, length);
+  builder->stringsSize += size;
+  builder->stringIndex[slot] = offset + 1;
+  builder->noOfStrings += 1;
+
+  return offset;
+}
+
+// interned strings are unique, so the string offset identifies a node
+static OpcUa_UInt32 addNode(struct index_builder_t* builder, const void* id, OpcUa_UInt32 length)
+{
+  OpcUa_UInt32 offset = internString(builder, id, length);
+  OpcUa_UInt32 hash = hashBuffer(HASH_INITIAL, id, length);
+
+  if (2 * (builder->noOfNodes + 1) > builder->nodeIndexSize) {
+    OpcUa_UInt32 size = builder->nodeIndexSize ? 2 * builder->nodeIndexSize : 4096;
+    OpcUa_UInt32* index = calloc(size, sizeof(*index));
+    for (OpcUa_UInt32 i = 0; i < builder->noOfNodes; ++i) {
+      OpcUa_UInt32 slot = builder->nodes[i].hash & (size - 1);
+      while (index[slot])
+        slot = (slot + 1) & (size - 1);
+      index[slot] = i + 1;
+    }
+    free(builder->nodeIndex);
+    builder->nodeIndex = index;
+    builder->nodeIndexSize = size;
+  }
+
+  OpcUa_UInt32 slot = hash & (builder->nodeIndexSize - 1);
+  while (builder->nodeIndex[slot]) {
+    if (builder->nodes[builder->nodeIndex[slot] - 1].id == offset)
+      return builder->nodeIndex[slot] - 1;
+    slot = (slot + 1) & (builder->nodeIndexSize - 1);
+  }
+
+  if (builder->noOfNodes == builder->nodesCapacity) {
+    builder->nodesCapacity = builder->nodesCapacity ? 2 * builder->nodesCapacity : 4096;
+    builder->nodes = realloc(builder->nodes, builder->nodesCapacity * sizeof(*builder->nodes));
+  }
+
+  struct index_node_t* node = &builder->nodes[builder->noOfNodes];
+  node->id = offset;
+  node->hash = hash;
+  node->firstReference = 0;
+  node->noOfReferences = 0;
+  builder->nodeIndex[slot] = builder->noOfNodes + 1;
+
+  return builder->noOfNodes++;
+}
+
+static void addReference(struct index_builder_t* builder, OpcUa_UInt32 nodeNr, const void* id, OpcUa_UInt32 idLength, const void* browseName, OpcUa_UInt32 browseNameLength, const void* displayName, OpcUa_UInt32 displayNameLength, const void* typeDefinition, OpcUa_UInt32 typeDefinitionLength, OpcUa_Boolean local)
+{
+  if (builder->noOfReferences == builder->referencesCapacity) {
+    builder->referencesCapacity = builder->referencesCapacity ? 2 * builder->referencesCapacity : 4096;
+    builder->references = realloc(builder->references, builder->referencesCapacity * sizeof(*builder->references));
+  }
+
+  struct index_reference_t* reference = &builder->references[builder->noOfReferences++];
+  reference->id = internString(builder, id, idLength);
+  reference->browseName = internString(builder, browseName, browseNameLength);
+  reference->displayName = internString(builder, displayName, displayNameLength);
+  reference->typeDefinition = internString(builder, typeDefinition, typeDefinitionLength);
+  builder->nodes[nodeNr].noOfReferences += 1;
+  search_add(id, idLength, browseName, browseNameLength, displayName, displayNameLength, typeDefinition, typeDefinitionLength);
+
+  // targets on other servers are returned but not crawled
+  if (local)
+    addNode(builder, id, idLength);
+}
+
+static void addReferenceDescriptions(struct index_builder_t* builder, OpcUa_UInt32 nodeNr, OpcUa_Int32 noOfReferences, const OpcUa_ReferenceDescription* references)
+{
+  for (OpcUa_Int32 i = 0; i < noOfReferences; ++i) {
+    const OpcUa_ReferenceDescription* referenceDescription = &references[i];
+    const OpcUa_String* browseName = &referenceDescription->BrowseName.Name;
+    const OpcUa_String* displayName = &referenceDescription->DisplayName.Text;
+    char idBuffer[1024];
+    char typeBuffer[1024];
+    OpcUa_UInt32 idLength = formatNodeId(&referenceDescription->NodeId.NodeId, idBuffer, sizeof(idBuffer));
+    OpcUa_UInt32 typeLength = formatNodeId(&referenceDescription->TypeDefinition.NodeId, typeBuffer, sizeof(typeBuffer));
+
+    addReference(builder, nodeNr, idBuffer, idLength,
+      OpcUa_String_GetRawString(browseName), OpcUa_String_StrSize(browseName),
+      OpcUa_String_GetRawString(displayName), OpcUa_String_StrSize(displayName),
+      typeBuffer, typeLength, referenceDescription->NodeId.ServerIndex == 0);
+  }
+}
+
+// the references of the old index are copied if the node did not change since it was built
+static OpcUa_Boolean reuseNode(struct index_builder_t* builder, OpcUa_UInt32 nodeNr)
+{
+  OpcUa_UInt32 idLength;
+  const OpcUa_Byte* id = builder->strings + builder->nodes[nodeNr].id;
+  memcpy(&idLength, id, sizeof(idLength));
+  id += sizeof(idLength);
+
+  OpcUa_Mutex_Lock(g_indexMutex);
+  const struct index_node_t* node = g_index && g_indexValid && !isDirty(builder->nodes[nodeNr].hash) ? findNode((const char*)id, idLength, builder->nodes[nodeNr].hash) : NULL;
+  OpcUa_Mutex_Unlock(g_indexMutex);
+
+  if (!node)
+    return OpcUa_False;
+
+  // only the crawler replaces the mapping, so it stays valid without the lock
+  const struct index_reference_t* references = (const struct index_reference_t*)(g_index + indexHeader()->references);
+  for (OpcUa_UInt32 i = 0; i < node->noOfReferences; ++i) {
+    const struct index_reference_t* reference = &references[node->firstReference + i];
+    OpcUa_UInt32 idLength, browseNameLength, displayNameLength, typeDefinitionLength;
+    const OpcUa_Byte* targetId = indexString(reference->id, &idLength);
+    const OpcUa_Byte* browseName = indexString(reference->browseName, &browseNameLength);
+    const OpcUa_Byte* displayName = indexString(reference->displayName, &displayNameLength);
+    const OpcUa_Byte* typeDefinition = indexString(reference->typeDefinition, &typeDefinitionLength);
+    addReference(builder, nodeNr, targetId, idLength, browseName, browseNameLength, displayName, displayNameLength, typeDefinition, typeDefinitionLength, OpcUa_True);
+  }
+
+  return OpcUa_True;
+}
+
+// follows the continuation points of a single node, so its references stay contiguous
+static OpcUa_StatusCode browseNextNode(struct index_builder_t* builder, OpcUa_UInt32 nodeNr, OpcUa_ByteString* continuationPoint)
+{
+  OpcUa_StatusCode statusCode = OpcUa_Good;
+
+  while (continuationPoint->Length > 0 && OpcUa_IsGood(statusCode)) {
+    OpcUa_RequestHeader requestHeader;
+    OpcUa_ResponseHeader responseHeader;
+    OpcUa_Int32 noOfResults = 0;
+    OpcUa_BrowseResult* results = NULL;
+    OpcUa_Int32 noOfDiagnosticInfos = 0;
+    OpcUa_DiagnosticInfo* diagnosticInfos = NULL;
+
+    OpcUa_ResponseHeader_Initialize(&responseHeader);
+    statusCode = OpcUa_ClientApi_BrowseNext(
+      setupRequestHeader(&requestHeader),
+      &requestHeader,
+      g_crawlerShutdown ? OpcUa_True : OpcUa_False,
+      1,
+      continuationPoint,
+      &responseHeader,
+      &noOfResults,
+      &results,
+      &noOfDiagnosticInfos,
+      &diagnosticInfos);
+
+    if (OpcUa_IsGood(statusCode))
+      statusCode = responseHeader.ServiceResult;
+    OpcUa_ResponseHeader_Clear(&responseHeader);
+    OpcUa_ByteString_Clear(continuationPoint);
+
+    if (OpcUa_IsGood(statusCode) && noOfResults == 1 && !g_crawlerShutdown) {
+      addReferenceDescriptions(builder, nodeNr, results[0].NoOfReferences, results[0].References);
+      *continuationPoint = results[0].ContinuationPoint;
+      OpcUa_ByteString_Initialize(&results[0].ContinuationPoint);
+    }
+
+    for (OpcUa_Int32 i = 0; i < noOfResults; ++i)
+      OpcUa_BrowseResult_Clear(&results[i]);
+    OpcUa_Memory_Free(results);
+  }
+
+  OpcUa_ByteString_Clear(continuationPoint);
+  return statusCode;
+}
+
+static OpcUa_StatusCode browseNodes(struct index_builder_t* builder, OpcUa_Int32 count, const OpcUa_UInt32* nodeNrs)
+{
+  OpcUa_BrowseDescription browseDescription[INDEX_BROWSE_BATCH];
+  OpcUa_ViewDescription viewDescription;
+  OpcUa_ViewDescription_Initialize(&viewDescription);
+
+  for (OpcUa_Int32 i = 0; i < count; ++i) {
+    struct wpcp_value_t id;
+    OpcUa_BrowseDescription_Initialize(&browseDescription[i]);
+    OpcUa_UInt32 length;
+    memcpy(&length, builder->strings + builder->nodes[nodeNrs[i]].id, sizeof(length));
+    id.type = WPCP_VALUE_TYPE_TEXT_STRING;
+    id.data.text_string = (const char*)builder->strings + builder->nodes[nodeNrs[i]].id + sizeof(length);
+    id.value.length = length;
+    toNodeId(&id, &browseDescription[i].NodeId);
+    browseDescription[i].BrowseDirection = OpcUa_BrowseDirection_Forward;
+    browseDescription[i].IncludeSubtypes = OpcUa_True;
+    browseDescription[i].ReferenceTypeId.Identifier.Numeric = OpcUaId_HierarchicalReferences;
+    browseDescription[i].ResultMask = OpcUa_BrowseResultMask_All;
+  }
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_ResponseHeader responseHeader;
+  OpcUa_Int32 noOfResults = 0;
+  OpcUa_BrowseResult* results = NULL;
+  OpcUa_Int32 noOfDiagnosticInfos = 0;
+  OpcUa_DiagnosticInfo* diagnosticInfos = NULL;
+
+  OpcUa_ResponseHeader_Initialize(&responseHeader);
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_Browse(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    &viewDescription,
+    g_browsePageSize,
+    count,
+    browseDescription,
+    &responseHeader,
+    &noOfResults,
+    &results,
+    &noOfDiagnosticInfos,
+    &diagnosticInfos);
+
+  if (OpcUa_IsGood(statusCode))
+    statusCode = responseHeader.ServiceResult;
+  OpcUa_ResponseHeader_Clear(&responseHeader);
+
+  for (OpcUa_Int32 i = 0; i < noOfResults; ++i) {
+    if (OpcUa_IsGood(statusCode) && i < count) {
+      builder->nodes[nodeNrs[i]].firstReference = builder->noOfReferences;
+      addReferenceDescriptions(builder, nodeNrs[i], results[i].NoOfReferences, results[i].References);
+      statusCode = browseNextNode(builder, nodeNrs[i], &results[i].ContinuationPoint);
+    }
+    OpcUa_BrowseResult_Clear(&results[i]);
+  }
+  OpcUa_Memory_Free(results);
+
+  for (OpcUa_Int32 i = 0; i < count; ++i)
+    OpcUa_BrowseDescription_Clear(&browseDescription[i]);
+
+  return statusCode;
+}
+
+static OpcUa_Boolean writeIndex(const struct index_builder_t* builder, OpcUa_UInt32 namespaceHash, const char* fileName)
+{
+  struct index_header_t header;
+  memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+  header.namespaceHash = namespaceHash;
+  header.noOfSlots = 16;
+  while (header.noOfSlots < 2 * builder->noOfNodes)
+    header.noOfSlots *= 2;
+  header.noOfNodes = builder->noOfNodes;
+  header.noOfReferences = builder->noOfReferences;
+  header.slots = sizeof(header);
+  header.nodes = header.slots + header.noOfSlots * sizeof(OpcUa_UInt32);
+  header.references = header.nodes + header.noOfNodes * sizeof(struct index_node_t);
+  header.strings = header.references + header.noOfReferences * sizeof(struct index_reference_t);
+  header.size = header.strings + builder->stringsSize;
+
+  OpcUa_UInt32* slots = calloc(header.noOfSlots, sizeof(*slots));
+  for (OpcUa_UInt32 i = 0; i < builder->noOfNodes; ++i) {
+    OpcUa_UInt32 slot = builder->nodes[i].hash & (header.noOfSlots - 1);
+    while (slots[slot])
+      slot = (slot + 1) & (header.noOfSlots - 1);
+    slots[slot] = i + 1;
+  }
+
+  FILE* file = fopen(fileName, "wb");
+  OpcUa_Boolean written = file &&
+    fwrite(&header, sizeof(header), 1, file) == 1 &&
+    fwrite(slots, sizeof(*slots), header.noOfSlots, file) == header.noOfSlots &&
+    fwrite(builder->nodes, sizeof(*builder->nodes), builder->noOfNodes, file) == builder->noOfNodes &&
+    fwrite(builder->references, sizeof(*builder->references), builder->noOfReferences, file) == builder->noOfReferences &&
+    fwrite(builder->strings, 1, builder->stringsSize, file) == builder->stringsSize;
+  if (file && fclose(file))
+    written = OpcUa_False;
+
+  free(slots);
+  return written;
+}
+
+static void clearBuilder(struct index_builder_t* builder)
+{
+  free(builder->strings);
+  free(builder->stringIndex);
+  free(builder->nodes);
+  free(builder->nodeIndex);
+  free(builder->references);
+}
+
+// walks the hierarchical references from the objects folder, the nodes array doubles as the queue
+// the old index keeps serving browses until the new one is published
+static OpcUa_Boolean crawl(OpcUa_Boolean full)
+{
+  struct index_builder_t builder;
+  memset(&builder, 0, sizeof(builder));
+
+  OpcUa_Mutex_Lock(g_indexMutex);
+  OpcUa_UInt32 generation = ++g_generation;
+  OpcUa_UInt32 namespaceHash = g_namespaceHash;
+  OpcUa_Mutex_Unlock(g_indexMutex);
+
+  OpcUa_NodeId root;
+  char rootBuffer[64];
+  OpcUa_NodeId_Initialize(&root);
+  root.Identifier.Numeric = OpcUaId_ObjectsFolder;
+  addNode(&builder, rootBuffer, formatNodeId(&root, rootBuffer, sizeof(rootBuffer)));
+
+  OpcUa_UInt32 limit = chunk_getLimit(OPERATION_LIMIT_BROWSE);
+  OpcUa_Int32 batchSize = limit && limit < INDEX_BROWSE_BATCH ? (OpcUa_Int32)limit : INDEX_BROWSE_BATCH;
+  OpcUa_UInt32 nodeNrs[INDEX_BROWSE_BATCH];
+  OpcUa_Int32 count = 0;
+  OpcUa_StatusCode statusCode = OpcUa_Good;
+
+  for (OpcUa_UInt32 next = 0; OpcUa_IsGood(statusCode) && !g_crawlerShutdown && (next < builder.noOfNodes || count); ) {
+    if (next < builder.noOfNodes) {
+      OpcUa_UInt32 nodeNr = next++;
+      builder.nodes[nodeNr].firstReference = builder.noOfReferences;
+      if (!full && reuseNode(&builder, nodeNr))
+        continue;
+      nodeNrs[count++] = nodeNr;
+      if (count < batchSize && next < builder.noOfNodes)
+        continue;
+    }
+
+    statusCode = browseNodes(&builder, count, nodeNrs);
+    count = 0;
+  }
+
+  OpcUa_Boolean published = OpcUa_False;
+  if (OpcUa_IsGood(statusCode) && !g_crawlerShutdown) {
+    char fileName[1024];
+    OpcUa_SnPrintfA(fileName, sizeof(fileName), "%s.tmp", g_indexFile);
+
+    if (writeIndex(&builder, namespaceHash, fileName)) {
+      OpcUa_Mutex_Lock(g_indexMutex);
+      unmapIndex();
+      MoveFileExA(fileName, g_indexFile, MOVEFILE_REPLACE_EXISTING);
+      published = mapIndex();
+
+      // changes reported while crawling are kept for the next run
+      OpcUa_UInt32 kept = 0;
+      for (OpcUa_UInt32 i = 0; i < g_noOfDirtyNodes; ++i) {
+        if (g_dirtyNodes[i].generation >= generation)
+          g_dirtyNodes[kept++] = g_dirtyNodes[i];
+      }
+      g_noOfDirtyNodes = kept;
+      g_indexValid = published && g_invalidGeneration < generation && g_namespaceHash == namespaceHash;
+      OpcUa_Mutex_Unlock(g_indexMutex);
+
+      printf("Address space index rebuilt with %u nodes and %u references\n", builder.noOfNodes, builder.noOfReferences);
+      stats_add(STATS_BROWSE_INDEX_REBUILDS, 1);
+    }
+  }
+
+  clearBuilder(&builder);
+  return published;
+}
+
+static OpcUa_Boolean isIndexCurrent(void)
+{
+  OpcUa_Mutex_Lock(g_indexMutex);
+  OpcUa_Boolean current = g_index && g_indexValid && !g_noOfDirtyNodes;
+  OpcUa_Mutex_Unlock(g_indexMutex);
+  return current;
+}
+
+// model changes trigger an incremental crawl, the interval a full one
+static OpcUa_Void crawlerThread(OpcUa_Void* pArgument)
+{
+  OpcUa_Boolean full = OpcUa_False;
+  OpcUa_Boolean pending = !isIndexCurrent();
+
+  while (!g_crawlerShutdown) {
+    if (!pending)
+      full = OpcUa_Semaphore_TimedWait(g_crawlerSemaphore, g_indexInterval * 1000) != OpcUa_Good;
+    if (g_crawlerShutdown)
+      break;
+
+    pending = !crawl(full);
+    if (pending)
+      OpcUa_Semaphore_TimedWait(g_crawlerSemaphore, g_reconnectInterval * 1000);
+  }
+}
+
+void addressspace_initialize(void)
+{
+  if (!g_indexFile)
+    return;
+
+  OpcUa_Mutex_Create(&g_indexMutex);
+  OpcUa_Semaphore_Create(&g_crawlerSemaphore, 0, 1);
+
+  if (mapIndex()) {
+    g_indexValid = OpcUa_True;
+    printf("Address space index loaded with %u nodes\n", indexHeader()->noOfNodes);
+  }
+  addressspace_checkNamespaces();
+
+  OpcUa_Thread_Create(&g_crawlerThread, crawlerThread, NULL);
+  OpcUa_Thread_Start(g_crawlerThread);
+}
+
+void addressspace_clear(void)
+{
+  if (!g_indexFile)
+    return;
+
+  InterlockedExchange(&g_crawlerShutdown, 1);
+  OpcUa_Semaphore_Post(g_crawlerSemaphore, 1);
+  OpcUa_Thread_WaitForShutdown(g_crawlerThread, OPCUA_INFINITE);
+  OpcUa_Thread_Delete(&g_crawlerThread);
+  OpcUa_Semaphore_Delete(&g_crawlerSemaphore);
+
+  unmapIndex();
+  OpcUa_Mutex_Delete(&g_indexMutex);
+}
@@ -0,0 +1,188 @@
+#include "main.h"
+#include "kernel.h"
+#include <stdlib.h>
+#include <math.h>
+
+#define AGGREGATE_MAX_INTERVALS 100000
+#define AGGREGATE_TICKS_PER_MILLISECOND 10000
+
+// good numeric samples of a raw read as structure of arrays, so the kernels run over contiguous doubles,
+// durations hold the time until the next sample in ticks
+struct aggregate_samples_t {
+  OpcUa_Int32 count;
+  OpcUa_UInt64* times;
+  OpcUa_Double* values;
+  OpcUa_Double* durations;
+};
+
+static OpcUa_Boolean loadSamples(struct aggregate_samples_t* samples, OpcUa_Int32 noOfValues, const OpcUa_DataValue* values, OpcUa_UInt64 endTime)
+{
+  samples->count = 0;
+  samples->times = malloc(noOfValues * (sizeof(OpcUa_UInt64) + 2 * sizeof(OpcUa_Double)) + 1);
+  samples->values = (OpcUa_Double*)&samples->times[noOfValues];
+  samples->durations = &samples->values[noOfValues];
+  if (!samples->times)
+    return OpcUa_False;
+
+  for (OpcUa_Int32 i = 0; i < noOfValues; ++i) {
+    if (!OpcUa_IsGood(values[i].StatusCode) || OpcUa_IsBad(variantToDouble(&values[i].Value, &samples->values[samples->count])))
+      continue;
+    samples->times[samples->count++] = toUInt64(&values[i].SourceTimestamp);
+  }
+
+  for (OpcUa_Int32 i = 0; i < samples->count; ++i) {
+    OpcUa_UInt64 next = i + 1 < samples->count ? samples->times[i + 1] : endTime;
+    samples->durations[i] = next > samples->times[i] ? (OpcUa_Double)(next - samples->times[i]) : 0.0;
+  }
+
+  return OpcUa_True;
+}
+
+// values are held until the next sample, the value before the interval covers its beginning
+static OpcUa_Boolean getTimeAverage(const struct aggregate_samples_t* samples, OpcUa_Int32 first, OpcUa_Int32 count, OpcUa_UInt64 start, OpcUa_UInt64 end, OpcUa_Double* result)
+{
+  OpcUa_Double sum = 0.0;
+  OpcUa_Double duration = 0.0;
+
+  if (first > 0) {
+    OpcUa_UInt64 until = count ? samples->times[first] : end;
+    sum += samples->values[first - 1] * (OpcUa_Double)(until - start);
+    duration += (OpcUa_Double)(until - start);
+  }
+  if (count) {
+    OpcUa_Int32 last = first + count - 1;
+    OpcUa_UInt64 lastEnd = samples->times[last] + (OpcUa_UInt64)samples->durations[last];
+    OpcUa_Double lastDuration = (OpcUa_Double)((lastEnd < end ? lastEnd : end) - samples->times[last]);
+    sum += kernel_weightedSum(&samples->values[first], &samples->durations[first], count - 1) + samples->values[last] * lastDuration;
+    duration += (OpcUa_Double)(samples->times[last] - samples->times[first]) + lastDuration;
+  }
+
+  if (duration <= 0.0) {
+    if (!count)
+      return OpcUa_False;
+    *result = samples->values[first + count - 1];
+    return OpcUa_True;
+  }
+
+  *result = sum / duration;
+  return OpcUa_True;
+}
+
+static void computeInterval(OpcUa_UInt32 aggregateType, const struct aggregate_samples_t* samples, OpcUa_Int32 first, OpcUa_Int32 count, OpcUa_UInt64 start, OpcUa_UInt64 end, OpcUa_DataValue* result)
+{
+  const OpcUa_Double* values = &samples->values[first];
+  OpcUa_Double value = 0.0;
+
+  OpcUa_DataValue_Initialize(result);
+  result->SourceTimestamp.dwHighDateTime = (OpcUa_UInt32)(start >> 32);
+  result->SourceTimestamp.dwLowDateTime = (OpcUa_UInt32)(start & 0xFFFFFFFF);
+
+  if (aggregateType == OpcUaId_AggregateFunction_Count) {
+    result->Value.Datatype = OpcUaType_Int32;
+    result->Value.Value.Int32 = count;
+    return;
+  }
+
+  if (aggregateType == OpcUaId_AggregateFunction_TimeAverage) {
+    if (getTimeAverage(samples, first, count, start, end, &value)) {
+      result->Value.Datatype = OpcUaType_Double;
+      result->Value.Value.Double = value;
+    } else
+      result->StatusCode = OpcUa_BadNoData;
+    return;
+  }
+
+  if (!count) {
+    result->StatusCode = OpcUa_BadNoData;
+    return;
+  }
+
+  switch (aggregateType) {
+  case OpcUaId_AggregateFunction_Start:
+    value = values[0];
+    break;
+  case OpcUaId_AggregateFunction_End:
+    value = values[count - 1];
+    break;
+  case OpcUaId_AggregateFunction_Minimum:
+    value = kernel_minimum(values, count);
+    break;
+  case OpcUaId_AggregateFunction_Maximum:
+    value = kernel_maximum(values, count);
+    break;
+  case OpcUaId_AggregateFunction_Average:
+    value = kernel_sum(values, count) / count;
+    break;
+  case OpcUaId_AggregateFunction_Delta:
+    value = values[count - 1] - values[0];
+    break;
+  case OpcUaId_AggregateFunction_StandardDeviationSample:
+    value = count > 1 ? sqrt(kernel_squaredDeviation(values, count, kernel_sum(values, count) / count) / (count - 1)) : 0.0;
+    break;
+  }
+
+  result->Value.Datatype = OpcUaType_Double;
+  result->Value.Value.Double = value;
+}
+
+OpcUa_Boolean aggregate_isSupported(OpcUa_UInt32 aggregateType)
+{
+  switch (aggregateType) {
+  case OpcUaId_AggregateFunction_Start:
+  case OpcUaId_AggregateFunction_End:
+  case OpcUaId_AggregateFunction_Minimum:
+  case OpcUaId_AggregateFunction_Maximum:
+  case OpcUaId_AggregateFunction_Average:
+  case OpcUaId_AggregateFunction_TimeAverage:
+  case OpcUaId_AggregateFunction_Count:
+  case OpcUaId_AggregateFunction_Delta:
+  case OpcUaId_AggregateFunction_StandardDeviationSample:
+    return OpcUa_True;
+  default:
+    return OpcUa_False;
+  }
+}
+
+// computes processed values from the raw values of [startTime, endTime), one per processing interval starting at startTime
+OpcUa_StatusCode aggregate_compute(OpcUa_UInt32 aggregateType, OpcUa_UInt64 startTime, OpcUa_UInt64 endTime, OpcUa_Double processingInterval, OpcUa_Int32 noOfValues, const OpcUa_DataValue* values, OpcUa_Int32* noOfResults, OpcUa_DataValue** results)
+{
+  struct aggregate_samples_t samples;
+
+  if (!aggregate_isSupported(aggregateType))
+    return OpcUa_BadAggregateNotSupported;
+  if (!startTime || endTime <= startTime || processingInterval < 0.0)
+    return OpcUa_BadInvalidArgument;
+
+  OpcUa_UInt64 interval = (OpcUa_UInt64)(processingInterval * AGGREGATE_TICKS_PER_MILLISECOND);
+  if (!interval || interval > endTime - startTime)
+    interval = endTime - startTime;
+  OpcUa_UInt64 noOfIntervals = (endTime - startTime + interval - 1) / interval;
+  if (noOfIntervals > AGGREGATE_MAX_INTERVALS)
+    return OpcUa_BadInvalidArgument;
+
+  *results = OpcUa_Memory_Alloc((OpcUa_UInt32)noOfIntervals * sizeof(OpcUa_DataValue));
+  if (!*results || !loadSamples(&samples, noOfValues, values, endTime)) {
+    OpcUa_Memory_Free(*results);
+    *results = NULL;
+    return OpcUa_BadOutOfMemory;
+  }
+
+  OpcUa_Int32 first = 0;
+  while (first < samples.count && samples.times[first] < startTime)
+    ++first;
+
+  for (OpcUa_UInt64 i = 0; i < noOfIntervals; ++i) {
+    OpcUa_UInt64 start = startTime + i * interval;
+    OpcUa_UInt64 end = start + interval < endTime ? start + interval : endTime;
+    OpcUa_Int32 last = first;
+    while (last < samples.count && samples.times[last] < end)
+      ++last;
+
+    computeInterval(aggregateType, &samples, first, last - first, start, end, &(*results)[i]);
+    first = last;
+  }
+
+  free(samples.times);
+  *noOfResults = (OpcUa_Int32)noOfIntervals;
+  return OpcUa_Good;
+}
@@ -0,0 +1,134 @@
+// the lane kernels of the aggregates against plain loops with a single accumulator over millions of samples
+#include "bench.h"
+#include "kernel.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define REPEATS 10
+
+// the plain loops live in this translation unit, the kernels in theirs, so neither is inlined into the timing loop
+static double scalarSum(const double* values, int32_t count)
+{
+  double sum = 0.0;
+  for (int32_t i = 0; i < count; ++i)
+    sum += values[i];
+  return sum;
+}
+
+static double scalarWeightedSum(const double* values, const double* weights, int32_t count)
+{
+  double sum = 0.0;
+  for (int32_t i = 0; i < count; ++i)
+    sum += values[i] * weights[i];
+  return sum;
+}
+
+static double scalarSquaredDeviation(const double* values, int32_t count, double mean)
+{
+  double sum = 0.0;
+  for (int32_t i = 0; i < count; ++i)
+    sum += (values[i] - mean) * (values[i] - mean);
+  return sum;
+}
+
+static double scalarMinimum(const double* values, int32_t count)
+{
+  double minimum = values[0];
+  for (int32_t i = 1; i < count; ++i)
+    minimum = values[i] < minimum ? values[i] : minimum;
+  return minimum;
+}
+
+static double scalarMaximum(const double* values, int32_t count)
+{
+  double maximum = values[0];
+  for (int32_t i = 1; i < count; ++i)
+    maximum = values[i] > maximum ? values[i] : maximum;
+  return maximum;
+}
+
+enum operation_t {
+  OPERATION_SUM,
+  OPERATION_WEIGHTED_SUM,
+  OPERATION_SQUARED_DEVIATION,
+  OPERATION_MINIMUM,
+  OPERATION_MAXIMUM,
+  OPERATION_COUNT
+};
+
+static const char* const g_operationNames[OPERATION_COUNT] = { "sum", "weighted", "deviation", "minimum", "maximum" };
+
+static double runKernel(enum operation_t operation, const double* values, const double* weights, int32_t count)
+{
+  switch (operation) {
+  case OPERATION_SUM: return kernel_sum(values, count);
+  case OPERATION_WEIGHTED_SUM: return kernel_weightedSum(values, weights, count);
+  case OPERATION_SQUARED_DEVIATION: return kernel_squaredDeviation(values, count, 50.0);
+  case OPERATION_MINIMUM: return kernel_minimum(values, count);
+  default: return kernel_maximum(values, count);
+  }
+}
+
+static double runScalar(enum operation_t operation, const double* values, const double* weights, int32_t count)
+{
+  switch (operation) {
+  case OPERATION_SUM: return scalarSum(values, count);
+  case OPERATION_WEIGHTED_SUM: return scalarWeightedSum(values, weights, count);
+  case OPERATION_SQUARED_DEVIATION: return scalarSquaredDeviation(values, count, 50.0);
+  case OPERATION_MINIMUM: return scalarMinimum(values, count);
+  default: return scalarMaximum(values, count);
+  }
+}
+
+// sums differ only by the order of the additions, minimum and maximum have to match exactly
+static bool equivalent(enum operation_t operation, double kernel, double scalar)
+{
+  if (operation == OPERATION_MINIMUM || operation == OPERATION_MAXIMUM)
+    return kernel == scalar;
+  return fabs(kernel - scalar) <= 1e-9 * fabs(scalar);
+}
+
+int main(int argc, char** argv)
+{
+  int32_t count = argc > 1 ? (int32_t)strtol(argv[1], NULL, 10) : 10000000;
+  if (count <= 0) {
+    fprintf(stderr, "usage: %s [samples]\n", argv[0]);
+    return 2;
+  }
+
+  // a sine with noise in the value range of a process value, durations around one second in ticks
+  double* values = malloc(count * sizeof(double));
+  double* weights = malloc(count * sizeof(double));
+  srand(1);
+  for (int32_t i = 0; i < count; ++i) {
+    values[i] = 50.0 + 40.0 * sin(i * 0.001) + (double)rand() / RAND_MAX;
+    weights[i] = 1e7 + (double)(rand() % 1000);
+  }
+
+  bool ok = true;
+  for (int32_t operation = 0; operation < OPERATION_COUNT; ++operation) {
+    double kernel = 0.0;
+    double scalar = 0.0;
+
+    double start = bench_now();
+    for (int32_t i = 0; i < REPEATS; ++i)
+      kernel = runKernel(operation, values, weights, count);
+    double kernelElapsed = bench_now() - start;
+
+    start = bench_now();
+    for (int32_t i = 0; i < REPEATS; ++i)
+      scalar = runScalar(operation, values, weights, count);
+    double scalarElapsed = bench_now() - start;
+
+    double samples = (double)count * REPEATS;
+    bool same = equivalent(operation, kernel, scalar);
+    printf("%-10s %10d samples  lanes %6.3f ns each  scalar %6.3f ns each  speedup %5.2fx%s\n", g_operationNames[operation], count, kernelElapsed * 1e9 / samples, scalarElapsed * 1e9 / samples, scalarElapsed / kernelElapsed, same ? "" : ", RESULTS DIFFER");
+    ok = ok && same;
+  }
+
+  free(values);
+  free(weights);
+  return ok ? 0 : 1;
+}
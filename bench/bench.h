@@ -0,0 +1,101 @@
+// threads, a mutex and a clock for the benchmarks, which build without the OPC UA stack
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// has to outlive the start of the thread, callers keep one per thread
+struct bench_thread_start_t {
+  void (*run)(void* argument);
+  void* argument;
+};
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef HANDLE bench_thread_t;
+typedef CRITICAL_SECTION bench_mutex_t;
+
+static DWORD WINAPI bench_thread_main(LPVOID start)
+{
+  struct bench_thread_start_t* threadStart = start;
+  threadStart->run(threadStart->argument);
+  return 0;
+}
+
+static inline void bench_thread_start(bench_thread_t* thread, struct bench_thread_start_t* start)
+{
+  *thread = CreateThread(NULL, 0, bench_thread_main, start, 0, NULL);
+}
+
+static inline void bench_thread_join(bench_thread_t thread)
+{
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+static inline void bench_mutex_init(bench_mutex_t* mutex) { InitializeCriticalSection(mutex); }
+static inline void bench_mutex_lock(bench_mutex_t* mutex) { EnterCriticalSection(mutex); }
+static inline void bench_mutex_unlock(bench_mutex_t* mutex) { LeaveCriticalSection(mutex); }
+static inline void bench_mutex_destroy(bench_mutex_t* mutex) { DeleteCriticalSection(mutex); }
+static inline void bench_sleep(uint32_t milliseconds) { Sleep(milliseconds); }
+static inline void bench_yield(void) { SwitchToThread(); }
+
+static inline double bench_now(void)
+{
+  LARGE_INTEGER counter;
+  LARGE_INTEGER frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+typedef pthread_t bench_thread_t;
+typedef pthread_mutex_t bench_mutex_t;
+
+static void* bench_thread_main(void* start)
+{
+  struct bench_thread_start_t* threadStart = start;
+  threadStart->run(threadStart->argument);
+  return NULL;
+}
+
+static inline void bench_thread_start(bench_thread_t* thread, struct bench_thread_start_t* start)
+{
+  pthread_create(thread, NULL, bench_thread_main, start);
+}
+
+static inline void bench_thread_join(bench_thread_t thread)
+{
+  pthread_join(thread, NULL);
+}
+
+static inline void bench_mutex_init(bench_mutex_t* mutex) { pthread_mutex_init(mutex, NULL); }
+static inline void bench_mutex_lock(bench_mutex_t* mutex) { pthread_mutex_lock(mutex); }
+static inline void bench_mutex_unlock(bench_mutex_t* mutex) { pthread_mutex_unlock(mutex); }
+static inline void bench_mutex_destroy(bench_mutex_t* mutex) { pthread_mutex_destroy(mutex); }
+
+static inline void bench_sleep(uint32_t milliseconds)
+{
+  struct timespec duration = { milliseconds / 1000, (long)(milliseconds % 1000) * 1000000 };
+  nanosleep(&duration, NULL);
+}
+
+static inline void bench_yield(void)
+{
+  sched_yield();
+}
+
+static inline double bench_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+#endif
+
+#endif
@@ -0,0 +1,29 @@
+// the subset of the Win32 atomics used by the benchmarked units, so they build with gcc and clang too
+#ifndef BENCH_COMPAT_WINDOWS_H
+#define BENCH_COMPAT_WINDOWS_H
+
+#include <stdint.h>
+
+typedef int32_t LONG;
+
+static inline LONG InterlockedCompareExchange(volatile LONG* destination, LONG exchange, LONG comparand)
+{
+  return __sync_val_compare_and_swap(destination, comparand, exchange);
+}
+
+static inline LONG InterlockedExchange(volatile LONG* target, LONG value)
+{
+  return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedIncrement(volatile LONG* addend)
+{
+  return __sync_add_and_fetch(addend, 1);
+}
+
+static inline LONG InterlockedDecrement(volatile LONG* addend)
+{
+  return __sync_sub_and_fetch(addend, 1);
+}
+
+#endif
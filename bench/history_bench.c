@@ -0,0 +1,185 @@
+// sliced raw history reads against one unsliced read of a mock historian, which answers after a latency per request and value
+#include "bench.h"
+#include "slice.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TICKS_PER_SECOND 10000000ULL
+#define SAMPLE_COUNT 100000
+#define CHECK_RANGES 1000
+
+struct historian_t {
+  uint64_t* timestamps;
+  int32_t count;
+  uint32_t latency;
+  uint32_t valuesPerMillisecond;
+};
+
+// irregular gaps with every tenth sample on a whole second, so slice bounds can hit a sample exactly
+static void historian_init(struct historian_t* historian, uint32_t latency, uint32_t valuesPerMillisecond)
+{
+  historian->timestamps = malloc(SAMPLE_COUNT * sizeof(uint64_t));
+  historian->count = SAMPLE_COUNT;
+  historian->latency = latency;
+  historian->valuesPerMillisecond = valuesPerMillisecond;
+
+  srand(1);
+  uint64_t timestamp = TICKS_PER_SECOND;
+  for (int32_t i = 0; i < SAMPLE_COUNT; ++i) {
+    historian->timestamps[i] = timestamp;
+    timestamp += i % 10 == 9 ? TICKS_PER_SECOND - timestamp % TICKS_PER_SECOND : 1 + (uint64_t)rand() % (2 * TICKS_PER_SECOND / 10);
+  }
+}
+
+static int32_t historian_lowerBound(const struct historian_t* historian, uint64_t timestamp)
+{
+  int32_t low = 0;
+  int32_t high = historian->count;
+  while (low < high) {
+    int32_t middle = low + (high - low) / 2;
+    if (historian->timestamps[middle] < timestamp)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+// the raw values of [start, end), like the gateway requests them
+static int32_t historian_read(const struct historian_t* historian, uint64_t start, uint64_t end, int32_t* first)
+{
+  *first = historian_lowerBound(historian, start);
+  int32_t count = historian_lowerBound(historian, end) - *first;
+  if (historian->latency)
+    bench_sleep(historian->latency + (historian->valuesPerMillisecond ? count / historian->valuesPerMillisecond : 0));
+  return count;
+}
+
+// the concatenated slices have to return exactly the values of the unsliced read, in the same order
+static bool checkSlices(const struct historian_t* historian, uint64_t start, uint64_t end, uint64_t length)
+{
+  int32_t first;
+  int32_t count = historian_read(historian, start, end, &first);
+  int32_t slices = slice_count(start, end, length);
+  int32_t next = first;
+
+  for (int32_t i = 0; i < slices; ++i) {
+    uint64_t sliceStart;
+    uint64_t sliceEnd;
+    int32_t sliceFirst;
+    slice_bounds(start, end, slices, i, &sliceStart, &sliceEnd);
+    int32_t sliceCount = historian_read(historian, sliceStart, sliceEnd, &sliceFirst);
+    if (sliceCount && sliceFirst != next)
+      return false;
+    next += sliceCount;
+  }
+
+  return next == first + count;
+}
+
+struct worker_t {
+  const struct historian_t* historian;
+  bench_mutex_t* mutex;
+  uint64_t start;
+  uint64_t end;
+  int32_t slices;
+  int32_t* nextSlice;
+  int32_t* values;
+};
+
+// like the gateway, a bounded number of slices is outstanding at once
+static void worker_run(void* argument)
+{
+  struct worker_t* worker = argument;
+  for (;;) {
+    bench_mutex_lock(worker->mutex);
+    int32_t nr = (*worker->nextSlice)++;
+    bench_mutex_unlock(worker->mutex);
+    if (nr >= worker->slices)
+      return;
+
+    uint64_t sliceStart;
+    uint64_t sliceEnd;
+    int32_t first;
+    slice_bounds(worker->start, worker->end, worker->slices, nr, &sliceStart, &sliceEnd);
+    int32_t count = historian_read(worker->historian, sliceStart, sliceEnd, &first);
+
+    bench_mutex_lock(worker->mutex);
+    *worker->values += count;
+    bench_mutex_unlock(worker->mutex);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  int32_t slices = argc > 1 ? (int32_t)strtol(argv[1], NULL, 10) : 16;
+  int32_t concurrency = argc > 2 ? (int32_t)strtol(argv[2], NULL, 10) : 8;
+  uint32_t latency = argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 10) : 20;
+  if (slices <= 0 || slices > SLICE_MAX_COUNT || concurrency <= 0) {
+    fprintf(stderr, "usage: %s [slices, at most %d] [concurrency] [latency ms]\n", argv[0], SLICE_MAX_COUNT);
+    return 2;
+  }
+
+  struct historian_t historian;
+  historian_init(&historian, 0, 0);
+  uint64_t first = historian.timestamps[0];
+  uint64_t last = historian.timestamps[historian.count - 1];
+
+  // random ranges, some starting or ending on a sample, with slice lengths down to a single tick
+  bool ok = true;
+  for (int32_t i = 0; i < CHECK_RANGES && ok; ++i) {
+    uint64_t start = first - TICKS_PER_SECOND + (uint64_t)((double)rand() / RAND_MAX * (last - first));
+    uint64_t end = start + 1 + (uint64_t)((double)rand() / RAND_MAX * (last - start));
+    if (i % 4 == 0)
+      start = historian.timestamps[rand() % historian.count];
+    if (i % 4 == 1)
+      end = historian.timestamps[rand() % historian.count] + 1;
+    if (end <= start)
+      end = start + 1;
+    uint64_t length = i % 8 == 0 ? 1 : 1 + (end - start) / (1 + (uint64_t)rand() % (2 * SLICE_MAX_COUNT));
+    if (i % 4 == 2) {
+      // whole seconds for the range and the slices put every bound onto a sample
+      start -= start % TICKS_PER_SECOND;
+      length = TICKS_PER_SECOND * (1 + (uint64_t)rand() % 100);
+      end = start + length * (1 + (uint64_t)rand() % SLICE_MAX_COUNT);
+    }
+    ok = checkSlices(&historian, start, end, length);
+    if (!ok)
+      printf("range %llu..%llu in slices of %llu ticks differs from the unsliced read\n", (unsigned long long)start, (unsigned long long)end, (unsigned long long)length);
+  }
+  printf("%d ranges sliced and unsliced: %s\n", CHECK_RANGES, ok ? "equal" : "DIFFERENT");
+
+  // the whole history, answered at 1000 values per millisecond after the latency of the request
+  historian.latency = latency;
+  historian.valuesPerMillisecond = 1000;
+  int32_t unused;
+
+  double start = bench_now();
+  int32_t unslicedValues = historian_read(&historian, first, last + 1, &unused);
+  double unslicedElapsed = bench_now() - start;
+
+  bench_mutex_t mutex;
+  bench_mutex_init(&mutex);
+  int32_t nextSlice = 0;
+  int32_t slicedValues = 0;
+  struct worker_t worker = { &historian, &mutex, first, last + 1, slices, &nextSlice, &slicedValues };
+  struct bench_thread_start_t threadStart = { worker_run, &worker };
+  bench_thread_t* threads = malloc(concurrency * sizeof(bench_thread_t));
+
+  start = bench_now();
+  for (int32_t i = 0; i < concurrency; ++i)
+    bench_thread_start(&threads[i], &threadStart);
+  for (int32_t i = 0; i < concurrency; ++i)
+    bench_thread_join(threads[i]);
+  double slicedElapsed = bench_now() - start;
+
+  ok = ok && slicedValues == unslicedValues;
+  printf("%d values  unsliced %8.1f ms  %d slices by %d %8.1f ms  speedup %5.2fx%s\n", unslicedValues, unslicedElapsed * 1e3, slices, concurrency, slicedElapsed * 1e3, unslicedElapsed / slicedElapsed, slicedValues == unslicedValues ? "" : ", VALUES DIFFER");
+
+  bench_mutex_destroy(&mutex);
+  free(threads);
+  free(historian.timestamps);
+  return ok ? 0 : 1;
+}
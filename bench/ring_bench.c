@@ -0,0 +1,170 @@
+// several publish callback threads acknowledge messages while one thread drains them into Publish requests,
+// compared with the mutex protected array the ring replaced
+#include "bench.h"
+#include "ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PRODUCERS 64
+#define ACKNOWLEDGEMENTS_PER_PUBLISH 256
+
+struct locked_array_t {
+  bench_mutex_t mutex;
+  uint32_t count;
+  struct ring_entry_t* entries;
+  uint32_t takenCount;
+  uint32_t takenPos;
+  struct ring_entry_t* taken;
+};
+
+struct queue_t {
+  bool (*push)(struct queue_t* queue, const struct ring_entry_t* entry);
+  int32_t (*take)(struct queue_t* queue, struct ring_entry_t* entries, int32_t maxCount);
+  struct ring_t* ring;
+  struct locked_array_t array;
+};
+
+struct producer_t {
+  struct queue_t* queue;
+  uint32_t id;
+  uint32_t count;
+  uint64_t retries;
+};
+
+static struct ring_t g_ring;
+
+static bool pushRing(struct queue_t* queue, const struct ring_entry_t* entry)
+{
+  return ring_push(queue->ring, entry);
+}
+
+static int32_t takeRing(struct queue_t* queue, struct ring_entry_t* entries, int32_t maxCount)
+{
+  return ring_take(queue->ring, entries, maxCount);
+}
+
+// the previous implementation grew the array for every acknowledgement
+static bool pushArray(struct queue_t* queue, const struct ring_entry_t* entry)
+{
+  bench_mutex_lock(&queue->array.mutex);
+  queue->array.entries = realloc(queue->array.entries, (queue->array.count + 1) * sizeof(struct ring_entry_t));
+  queue->array.entries[queue->array.count++] = *entry;
+  bench_mutex_unlock(&queue->array.mutex);
+  return true;
+}
+
+// kickofPublish() took the whole array at once, it is handed out in Publish sized parts here
+static int32_t takeArray(struct queue_t* queue, struct ring_entry_t* entries, int32_t maxCount)
+{
+  struct locked_array_t* array = &queue->array;
+
+  if (array->takenPos == array->takenCount) {
+    free(array->taken);
+    bench_mutex_lock(&array->mutex);
+    array->taken = array->entries;
+    array->takenCount = array->count;
+    array->entries = NULL;
+    array->count = 0;
+    bench_mutex_unlock(&array->mutex);
+    array->takenPos = 0;
+  }
+
+  int32_t count = array->takenCount - array->takenPos < (uint32_t)maxCount ? (int32_t)(array->takenCount - array->takenPos) : maxCount;
+  memcpy(entries, array->taken + array->takenPos, count * sizeof(struct ring_entry_t));
+  array->takenPos += count;
+  return count;
+}
+
+static void produce(void* argument)
+{
+  struct producer_t* producer = argument;
+
+  for (uint32_t i = 1; i <= producer->count; ++i) {
+    struct ring_entry_t entry = { producer->id, i };
+    // a full ring drops in the gateway, here the producer lets the consumer catch up
+    while (!producer->queue->push(producer->queue, &entry)) {
+      producer->retries += 1;
+      bench_yield();
+    }
+  }
+}
+
+// every producer has to arrive complete and in its own order
+static bool consume(struct queue_t* queue, uint32_t producers, uint32_t count)
+{
+  uint32_t next[MAX_PRODUCERS];
+  uint64_t remaining = (uint64_t)producers * count;
+  struct ring_entry_t entries[ACKNOWLEDGEMENTS_PER_PUBLISH];
+  bool ordered = true;
+
+  for (uint32_t i = 0; i < producers; ++i)
+    next[i] = 1;
+
+  while (remaining) {
+    int32_t taken = queue->take(queue, entries, ACKNOWLEDGEMENTS_PER_PUBLISH);
+    for (int32_t i = 0; i < taken; ++i) {
+      if (entries[i].subscriptionId >= producers || entries[i].sequenceNumber != next[entries[i].subscriptionId]++)
+        ordered = false;
+    }
+    remaining -= taken;
+    if (!taken)
+      bench_yield();
+  }
+
+  return ordered;
+}
+
+static bool run(const char* name, struct queue_t* queue, uint32_t producers, uint32_t count)
+{
+  struct producer_t states[MAX_PRODUCERS];
+  struct bench_thread_start_t starts[MAX_PRODUCERS];
+  bench_thread_t threads[MAX_PRODUCERS];
+  uint64_t retries = 0;
+
+  double start = bench_now();
+  for (uint32_t i = 0; i < producers; ++i) {
+    states[i].queue = queue;
+    states[i].id = i;
+    states[i].count = count;
+    states[i].retries = 0;
+    starts[i].run = produce;
+    starts[i].argument = &states[i];
+    bench_thread_start(&threads[i], &starts[i]);
+  }
+
+  bool ordered = consume(queue, producers, count);
+  for (uint32_t i = 0; i < producers; ++i) {
+    bench_thread_join(threads[i]);
+    retries += states[i].retries;
+  }
+  double elapsed = bench_now() - start;
+
+  double total = (double)producers * count;
+  printf("%-8s %2u threads %10.0f acknowledgements %8.3f s %12.0f per second %10.0f ns each, full %llu times%s\n", name, producers, total, elapsed, total / elapsed, elapsed * 1e9 / total, (unsigned long long)retries, ordered ? "" : ", LOST OR REORDERED");
+  return ordered;
+}
+
+int main(int argc, char** argv)
+{
+  uint32_t producers = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 4;
+  uint32_t count = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1000000;
+  if (!producers || producers > MAX_PRODUCERS || !count) {
+    fprintf(stderr, "usage: %s [threads 1-%d] [acknowledgements per thread]\n", argv[0], MAX_PRODUCERS);
+    return 2;
+  }
+
+  struct queue_t ring = { .push = pushRing, .take = takeRing, .ring = &g_ring };
+  ring_initialize(&g_ring);
+
+  struct queue_t array = { .push = pushArray, .take = takeArray };
+  bench_mutex_init(&array.array.mutex);
+
+  bool ok = run("ring", &ring, producers, count);
+  ok = run("locked", &array, producers, count) && ok;
+
+  bench_mutex_destroy(&array.array.mutex);
+  free(array.array.entries);
+  free(array.array.taken);
+  return ok ? 0 : 1;
+}
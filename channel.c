@@ -3,37 +3,92 @@
 #include <opcua_core.h>
 #include <opcua_p_crypto.h>
 #include <opcua_clientapi.h>
+#include <opcua_thread.h>
+#include <opcua_semaphore.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <windows.h>
 
 static OpcUa_Int32 g_sessionRequestedLifetime = 10000;
 static OpcUa_Double g_sessionTimeout = 60000; // 1 minute
-static OpcUa_Double g_subscriptionPublishInterval = 0;
 static OpcUa_UInt32 g_maxRequestMessageSize = 0;
-
-static OpcUa_UInt32 g_subscriptionLifetimeCount;
-static OpcUa_UInt32 g_subscriptionMaxKeepAliveCount;
-static const OpcUa_UInt32 g_subscriptionMaxNotificationsPerPublish = 128;
 static const OpcUa_Byte g_subscriptionPriority = 0;
 
 static OpcUa_NodeId g_authenticationToken;// = 0;
 static OpcUa_Channel g_channel;
-OpcUa_UInt32 g_subscriptionId;
+static OpcUa_Mutex g_channelMutex;
+// replaced by the last recovery, requests may still be encoded on them until the next one
+static OpcUa_Channel g_retiredChannel;
+static OpcUa_NodeId g_retiredAuthenticationToken;
+static const OpcUa_CharA* g_url;
+static const OpcUa_CharA* g_uri;
+
+OpcUa_UInt32 g_reconnectInterval = 5;
+static OpcUa_Thread g_recoveryThread;
+static OpcUa_Semaphore g_recoverySemaphore;
+static volatile LONG g_recoveryPending;
+static volatile LONG g_shutdown;
+
+// a message received ahead of a gap, or the marker of a message which is no longer available
+struct pending_message_t {
+  struct pending_message_t* next;
+  OpcUa_UInt32 sequenceNumber;
+  OpcUa_Boolean lost;
+  OpcUa_NotificationMessage notificationMessage;
+};
 
+// messages are dispatched strictly in sequence order, lastSequenceNumber is the last one dispatched or given up,
+// highestSequenceNumber the last one the server is known to have sent
+struct subscription_state_t {
+  OpcUa_UInt32 subscriptionId;
+  OpcUa_UInt32 lastSequenceNumber;
+  OpcUa_UInt32 highestSequenceNumber;
+  OpcUa_UInt32 republishSequenceNumber;
+  OpcUa_UInt32 republishOutstanding;
+  OpcUa_UInt32 gapResponses;
+  OpcUa_Boolean dispatching;
+  struct pending_message_t* pending;
+  OpcUa_UInt32 maxNotificationsPerPublish;
+  OpcUa_DateTime lastPublishTime;
+};
 
-static OpcUa_UInt32 g_noOfSubscriptionAcknowledgements;
-static OpcUa_SubscriptionAcknowledgement* g_subscriptionAcknowledgements;
-static OpcUa_Mutex g_subscriptionAcknowledgementsMutex;
+static struct subscription_state_t* g_subscriptionStates;
+static OpcUa_Int32 g_noOfSubscriptionStates;
+static OpcUa_Mutex g_subscriptionStatesMutex;
 
+OpcUa_UInt32 g_publishMinDepth = 2;
+OpcUa_UInt32 g_publishMaxDepth = 10;
+static volatile LONG g_publishDepth;
+static volatile LONG g_publishOutstanding;
+static volatile LONG g_publishEpoch;
 
-static void addSubscriptionAcknowledgement(OpcUa_UInt32 subscriptionId, OpcUa_UInt32 sequenceNumber)
+#define ACKNOWLEDGEMENTS_PER_PUBLISH 256
+#define MAX_REPUBLISH_OUTSTANDING 64
+
+static struct ring_t g_acknowledgements;
+
+static bool addSubscriptionAcknowledgement(OpcUa_UInt32 subscriptionId, OpcUa_UInt32 sequenceNumber)
 {
-  OpcUa_UInt32 nr = g_noOfSubscriptionAcknowledgements++;
-  OpcUa_Mutex_Lock(g_subscriptionAcknowledgementsMutex);
-  g_subscriptionAcknowledgements = OpcUa_Memory_ReAlloc(g_subscriptionAcknowledgements, sizeof(*g_subscriptionAcknowledgements) * g_noOfSubscriptionAcknowledgements);
-  g_subscriptionAcknowledgements[nr].SubscriptionId = subscriptionId;
-  g_subscriptionAcknowledgements[nr].SequenceNumber = sequenceNumber;
-  OpcUa_Mutex_Unlock(g_subscriptionAcknowledgementsMutex);
+  struct ring_entry_t entry = { subscriptionId, sequenceNumber };
+
+  if (ring_push(&g_acknowledgements, &entry))
+    return true;
+
+  stats_add(STATS_PUBLISH_ACKNOWLEDGEMENTS_DROPPED, 1);
+  return false;
+}
+
+static OpcUa_Int32 takeSubscriptionAcknowledgements(OpcUa_SubscriptionAcknowledgement* acknowledgements, OpcUa_Int32 maxCount)
+{
+  struct ring_entry_t entries[ACKNOWLEDGEMENTS_PER_PUBLISH];
+  OpcUa_Int32 count = ring_take(&g_acknowledgements, entries, maxCount < ACKNOWLEDGEMENTS_PER_PUBLISH ? maxCount : ACKNOWLEDGEMENTS_PER_PUBLISH);
+
+  for (OpcUa_Int32 i = 0; i < count; ++i) {
+    acknowledgements[i].SubscriptionId = entries[i].subscriptionId;
+    acknowledgements[i].SequenceNumber = entries[i].sequenceNumber;
+  }
+
+  return count;
 }
 
 OpcUa_Channel setupRequestHeader(OpcUa_RequestHeader *requestHeader)
@@ -41,8 +96,38 @@ OpcUa_Channel setupRequestHeader(OpcUa_RequestHeader *requestHeader)
   OpcUa_RequestHeader_Initialize(requestHeader);
   requestHeader->TimeoutHint = 300000;
   requestHeader->Timestamp = OpcUa_DateTime_UtcNow();
+
+  OpcUa_Mutex_Lock(g_channelMutex);
   requestHeader->AuthenticationToken = g_authenticationToken;
-  return g_channel;
+  OpcUa_Channel channel = g_channel;
+  OpcUa_Mutex_Unlock(g_channelMutex);
+
+  return channel;
+}
+
+static void switchChannel(OpcUa_Channel channel)
+{
+  OpcUa_Mutex_Lock(g_channelMutex);
+  OpcUa_Channel retiredChannel = g_retiredChannel;
+  g_retiredChannel = g_channel;
+  g_channel = channel;
+  OpcUa_Mutex_Unlock(g_channelMutex);
+
+  if (g_retiredChannel)
+    OpcUa_Channel_Disconnect(g_retiredChannel);
+  if (retiredChannel)
+    OpcUa_Channel_Delete(&retiredChannel);
+}
+
+static void switchAuthenticationToken(OpcUa_NodeId* authenticationToken)
+{
+  OpcUa_Mutex_Lock(g_channelMutex);
+  OpcUa_NodeId retiredAuthenticationToken = g_retiredAuthenticationToken;
+  g_retiredAuthenticationToken = g_authenticationToken;
+  g_authenticationToken = *authenticationToken;
+  OpcUa_Mutex_Unlock(g_channelMutex);
+
+  OpcUa_NodeId_Clear(&retiredAuthenticationToken);
 }
 
 static OpcUa_StatusCode opcua_cmi(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
@@ -58,76 +143,539 @@ static OpcUa_StatusCode opcua_cmi(OpcUa_Channel hChannel, OpcUa_Void* pResponse,
   return 0;
 }
 
-OpcUa_StatusCode kickofPublish(void);
+static struct subscription_state_t* findSubscriptionState(OpcUa_UInt32 subscriptionId)
+{
+  for (OpcUa_Int32 i = 0; i < g_noOfSubscriptionStates; ++i) {
+    if (g_subscriptionStates[i].subscriptionId == subscriptionId)
+      return &g_subscriptionStates[i];
+  }
+  return NULL;
+}
+
+static void kickofPublish(void);
+
+void registerSubscription(OpcUa_UInt32 subscriptionId, OpcUa_UInt32 maxNotificationsPerPublish)
+{
+  OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+  if (!findSubscriptionState(subscriptionId)) {
+    g_subscriptionStates = OpcUa_Memory_ReAlloc(g_subscriptionStates, sizeof(*g_subscriptionStates) * (g_noOfSubscriptionStates + 1));
+    struct subscription_state_t* state = &g_subscriptionStates[g_noOfSubscriptionStates++];
+    state->subscriptionId = subscriptionId;
+    state->lastSequenceNumber = 0;
+    state->highestSequenceNumber = 0;
+    state->republishSequenceNumber = 0;
+    state->republishOutstanding = 0;
+    state->gapResponses = 0;
+    state->dispatching = OpcUa_False;
+    state->pending = NULL;
+    state->maxNotificationsPerPublish = maxNotificationsPerPublish;
+    OpcUa_DateTime_Initialize(&state->lastPublishTime);
+  }
+  OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
+
+  kickofPublish();
+}
+
+static void freePendingMessages(struct pending_message_t* message)
+{
+  while (message) {
+    struct pending_message_t* next = message->next;
+    OpcUa_NotificationMessage_Clear(&message->notificationMessage);
+    free(message);
+    message = next;
+  }
+}
+
+void unregisterSubscription(OpcUa_UInt32 subscriptionId)
+{
+  struct pending_message_t* pending = NULL;
+
+  OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+  struct subscription_state_t* state = findSubscriptionState(subscriptionId);
+  if (state) {
+    pending = state->pending;
+    *state = g_subscriptionStates[--g_noOfSubscriptionStates];
+  }
+  OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
+
+  freePendingMessages(pending);
+}
+
+static OpcUa_UInt32 getMaxNotificationsPerPublish(OpcUa_UInt32 subscriptionId)
+{
+  OpcUa_UInt32 maxNotificationsPerPublish = 0;
+
+  OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+  struct subscription_state_t* state = findSubscriptionState(subscriptionId);
+  if (state)
+    maxNotificationsPerPublish = state->maxNotificationsPerPublish;
+  OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
+
+  return maxNotificationsPerPublish;
+}
+
+// every publish response without a gap confirms that the values of the subscription are current
+OpcUa_Boolean getSubscriptionPublishTime(OpcUa_UInt32 subscriptionId, OpcUa_DateTime* publishTime)
+{
+  OpcUa_Boolean found = OpcUa_False;
+
+  OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+  struct subscription_state_t* state = findSubscriptionState(subscriptionId);
+  if (state) {
+    *publishTime = state->lastPublishTime;
+    found = OpcUa_True;
+  }
+  OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
+
+  return found;
+}
+
+static OpcUa_Boolean isConnectionLost(OpcUa_StatusCode statusCode)
+{
+  switch (statusCode) {
+  case OpcUa_BadSessionIdInvalid:
+  case OpcUa_BadSessionClosed:
+  case OpcUa_BadSessionNotActivated:
+  case OpcUa_BadSecureChannelIdInvalid:
+  case OpcUa_BadSecureChannelClosed:
+  case OpcUa_BadConnectionClosed:
+    return OpcUa_True;
+  default:
+    return OpcUa_False;
+  }
+}
+
+static void triggerRecovery(void)
+{
+  if (!InterlockedCompareExchange(&g_recoveryPending, 1, 0))
+    OpcUa_Semaphore_Post(g_recoverySemaphore, 1);
+}
+
+// publish callbacks adjust the depth concurrently, so the clamped value is only stored if nobody changed it meanwhile
+static void publishAdjustDepth(LONG delta)
+{
+  LONG current = g_publishDepth;
+
+  for (;;) {
+    LONG depth = current + delta;
+    if (depth < (LONG)g_publishMinDepth)
+      depth = g_publishMinDepth;
+    if (depth > (LONG)g_publishMaxDepth)
+      depth = g_publishMaxDepth;
+
+    LONG previous = InterlockedCompareExchange(&g_publishDepth, depth, current);
+    if (previous == current) {
+      stats_set(STATS_PUBLISH_DEPTH, depth);
+      return;
+    }
+    current = previous;
+  }
+}
+
+static OpcUa_UInt32 countNotifications(const OpcUa_NotificationMessage* notificationMessage)
+{
+  OpcUa_UInt32 noOfNotifications = 0;
+
+  for (OpcUa_Int32 i = 0; i < notificationMessage->NoOfNotificationData; ++i) {
+    const OpcUa_ExtensionObject* notificationData = &notificationMessage->NotificationData[i];
+
+    if (notificationData->Encoding != OpcUa_ExtensionObjectEncoding_EncodeableObject || notificationData->Body.EncodeableObject.Object == OpcUa_Null || notificationData->Body.EncodeableObject.Type == OpcUa_Null)
+      continue;
+
+    if (notificationData->Body.EncodeableObject.Type->TypeId == OpcUaId_DataChangeNotification)
+      noOfNotifications += ((const OpcUa_DataChangeNotification*)notificationData->Body.EncodeableObject.Object)->NoOfMonitoredItems;
+    else if (notificationData->Body.EncodeableObject.Type->TypeId == OpcUaId_EventNotificationList)
+      noOfNotifications += ((const OpcUa_EventNotificationList*)notificationData->Body.EncodeableObject.Object)->NoOfEvents;
+  }
+
+  return noOfNotifications;
+}
+
+static void dispatchNotificationMessage(OpcUa_UInt32 subscriptionId, const OpcUa_NotificationMessage* notificationMessage)
+{
+  for (OpcUa_Int32 i = 0; i < notificationMessage->NoOfNotificationData; ++i) {
+    OpcUa_ExtensionObject* notificationData = &notificationMessage->NotificationData[i];
+
+    if (notificationData->Encoding != OpcUa_ExtensionObjectEncoding_EncodeableObject || notificationData->Body.EncodeableObject.Object == OpcUa_Null || notificationData->Body.EncodeableObject.Type == OpcUa_Null)
+      continue;
+
+    if (notificationData->Body.EncodeableObject.Type->TypeId == OpcUaId_DataChangeNotification) {
+      OpcUa_DataChangeNotification* notification = notificationData->Body.EncodeableObject.Object;
+      opcua_publishDataChangeNotification(subscriptionId, notification->NoOfMonitoredItems, notification->MonitoredItems);
+    } else if (notificationData->Body.EncodeableObject.Type->TypeId == OpcUaId_EventNotificationList) {
+      OpcUa_EventNotificationList* notification = notificationData->Body.EncodeableObject.Object;
+      if (metadata_isSubscription(subscriptionId))
+        metadata_handleEvents(notification->NoOfEvents, notification->Events);
+      else
+        opcua_publishEventNotificationList(subscriptionId, notification->NoOfEvents, notification->Events);
+    } else if (notificationData->Body.EncodeableObject.Type->TypeId == OpcUaId_StatusChangeNotification) {
+      OpcUa_StatusChangeNotification* notification = notificationData->Body.EncodeableObject.Object;
+      printf("STATUS: %x\n", notification->Status);
+    } else {
+      assert(false);
+    }
+  }
+}
+
+// takes the content of notificationMessage, a NULL message marks the sequence number as lost,
+// returns false for duplicates and for messages arriving after their gap was given up
+static OpcUa_Boolean queueNotificationMessage(struct subscription_state_t* state, OpcUa_UInt32 sequenceNumber, OpcUa_NotificationMessage* notificationMessage)
+{
+  if (sequenceNumber <= state->lastSequenceNumber)
+    return OpcUa_False;
+
+  struct pending_message_t** entry = &state->pending;
+  while (*entry && (*entry)->sequenceNumber < sequenceNumber)
+    entry = &(*entry)->next;
+  if (*entry && (*entry)->sequenceNumber == sequenceNumber)
+    return OpcUa_False;
+
+  struct pending_message_t* message = malloc(sizeof(struct pending_message_t));
+  message->sequenceNumber = sequenceNumber;
+  message->lost = notificationMessage == NULL;
+  if (notificationMessage) {
+    message->notificationMessage = *notificationMessage;
+    OpcUa_NotificationMessage_Initialize(notificationMessage);
+  } else
+    OpcUa_NotificationMessage_Initialize(&message->notificationMessage);
+  message->next = *entry;
+  *entry = message;
+
+  if (sequenceNumber > state->highestSequenceNumber)
+    state->highestSequenceNumber = sequenceNumber;
+  return OpcUa_True;
+}
+
+static OpcUa_Boolean isMessageMissing(const struct subscription_state_t* state, OpcUa_UInt32 sequenceNumber)
+{
+  const struct pending_message_t* message = state->pending;
+
+  if (sequenceNumber <= state->lastSequenceNumber)
+    return OpcUa_False;
+  while (message && message->sequenceNumber < sequenceNumber)
+    message = message->next;
+  return !message || message->sequenceNumber != sequenceNumber;
+}
+
+// only one thread dispatches the messages of a subscription, the others just queue theirs
+static void dispatchPendingMessages(OpcUa_UInt32 subscriptionId)
+{
+  OpcUa_Boolean dispatching = OpcUa_False;
+
+  for (;;) {
+    struct pending_message_t* message = NULL;
+
+    OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+    struct subscription_state_t* state = findSubscriptionState(subscriptionId);
+    if (state && (dispatching || !state->dispatching)) {
+      if (state->pending && state->pending->sequenceNumber == state->lastSequenceNumber + 1) {
+        message = state->pending;
+        state->pending = message->next;
+        state->lastSequenceNumber = message->sequenceNumber;
+        state->dispatching = dispatching = OpcUa_True;
+      } else
+        state->dispatching = OpcUa_False;
+    }
+    OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
+
+    if (!message)
+      return;
+
+    if (message->lost)
+      stats_add(STATS_PUBLISH_MESSAGES_LOST, 1);
+    else
+      dispatchNotificationMessage(subscriptionId, &message->notificationMessage);
+    OpcUa_NotificationMessage_Clear(&message->notificationMessage);
+    free(message);
+  }
+}
+
+// returns false if the message was not queued, so it must not be acknowledged again
+static OpcUa_Boolean receiveNotificationMessage(OpcUa_UInt32 subscriptionId, OpcUa_UInt32 sequenceNumber, OpcUa_NotificationMessage* notificationMessage)
+{
+  OpcUa_Boolean queued = OpcUa_False;
+  OpcUa_Boolean held = OpcUa_False;
+
+  OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+  struct subscription_state_t* state = findSubscriptionState(subscriptionId);
+  if (state) {
+    queued = queueNotificationMessage(state, sequenceNumber, notificationMessage);
+    held = queued && sequenceNumber != state->lastSequenceNumber + 1;
+  }
+  OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
+
+  if (!queued) {
+    stats_add(STATS_PUBLISH_MESSAGES_DUPLICATE, 1);
+    return OpcUa_False;
+  }
+
+  if (held)
+    stats_add(STATS_PUBLISH_MESSAGES_HELD, 1);
+  else
+    dispatchPendingMessages(subscriptionId);
+  return OpcUa_True;
+}
+
+static void giveUpMessage(OpcUa_UInt32 subscriptionId, OpcUa_UInt32 sequenceNumber)
+{
+  OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+  struct subscription_state_t* state = findSubscriptionState(subscriptionId);
+  if (state)
+    queueNotificationMessage(state, sequenceNumber, NULL);
+  OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
+
+  dispatchPendingMessages(subscriptionId);
+}
+
+struct RepublishHelper {
+  OpcUa_UInt32 subscriptionId;
+  OpcUa_UInt32 sequenceNumber;
+};
+
+static void republishGap(OpcUa_UInt32 subscriptionId);
+
+static OpcUa_StatusCode opc_republish(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+{
+  struct RepublishHelper* helper = pCallbackData;
+  OpcUa_RepublishResponse* republishResponse = pResponse;
+  OpcUa_StatusCode statusCode = OpcUa_IsGood(uStatus) ? republishResponse->ResponseHeader.ServiceResult : uStatus;
+  OpcUa_Boolean retry = OpcUa_IsBad(statusCode) && statusCode != OpcUa_BadMessageNotAvailable;
+
+  OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+  struct subscription_state_t* state = findSubscriptionState(helper->subscriptionId);
+  if (state) {
+    state->republishOutstanding -= 1;
+    // requested again by the next confirmation of the gap
+    if (retry && state->republishSequenceNumber >= helper->sequenceNumber)
+      state->republishSequenceNumber = helper->sequenceNumber - 1;
+  }
+  OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
+
+  if (OpcUa_IsGood(statusCode)) {
+    stats_add(STATS_RECOVERY_REPUBLISHED, 1);
+    if (receiveNotificationMessage(helper->subscriptionId, helper->sequenceNumber, &republishResponse->NotificationMessage))
+      addSubscriptionAcknowledgement(helper->subscriptionId, helper->sequenceNumber);
+  } else if (!retry)
+    giveUpMessage(helper->subscriptionId, helper->sequenceNumber);
+
+  if (!retry)
+    republishGap(helper->subscriptionId);
+
+  free(helper);
+  return OpcUa_Good;
+}
+
+// requests the missing messages of a confirmed gap, at most MAX_REPUBLISH_OUTSTANDING at once,
+// the next ones follow as the responses arrive
+static void republishGap(OpcUa_UInt32 subscriptionId)
+{
+  OpcUa_UInt32 missing[MAX_REPUBLISH_OUTSTANDING];
+  OpcUa_UInt32 noOfMissing = 0;
+
+  OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+  struct subscription_state_t* state = findSubscriptionState(subscriptionId);
+  if (state && state->gapResponses > 1) {
+    OpcUa_UInt32 sequenceNumber = state->republishSequenceNumber > state->lastSequenceNumber ? state->republishSequenceNumber : state->lastSequenceNumber;
+    while (state->republishOutstanding + noOfMissing < MAX_REPUBLISH_OUTSTANDING && sequenceNumber < state->highestSequenceNumber) {
+      if (isMessageMissing(state, ++sequenceNumber))
+        missing[noOfMissing++] = sequenceNumber;
+    }
+    state->republishSequenceNumber = sequenceNumber;
+    state->republishOutstanding += noOfMissing;
+  }
+  OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
+
+  for (OpcUa_UInt32 i = 0; i < noOfMissing; ++i) {
+    struct RepublishHelper* helper = malloc(sizeof(struct RepublishHelper));
+    helper->subscriptionId = subscriptionId;
+    helper->sequenceNumber = missing[i];
+
+    OpcUa_RequestHeader requestHeader;
+    OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginRepublish(
+      setupRequestHeader(&requestHeader),
+      &requestHeader,
+      subscriptionId,
+      missing[i],
+      opc_republish,
+      helper);
+    if (OpcUa_IsGood(statusCode))
+      continue;
+
+    // the remaining ones are requested again by the next confirmation of the gap
+    free(helper);
+    OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+    state = findSubscriptionState(subscriptionId);
+    if (state) {
+      state->republishOutstanding -= noOfMissing - i;
+      if (state->republishSequenceNumber >= missing[i])
+        state->republishSequenceNumber = missing[i] - 1;
+    }
+    OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
+    break;
+  }
+}
+
+// a gap may just be a response still in flight on another thread, so it is only republished
+// once a later publish response of the subscription still sees it
+static void checkGap(OpcUa_UInt32 subscriptionId, OpcUa_UInt32 knownSequenceNumber)
+{
+  OpcUa_Boolean gap = OpcUa_False;
+
+  OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+  struct subscription_state_t* state = findSubscriptionState(subscriptionId);
+  if (state) {
+    if (knownSequenceNumber > state->highestSequenceNumber)
+      state->highestSequenceNumber = knownSequenceNumber;
+    gap = state->lastSequenceNumber < state->highestSequenceNumber;
+    state->gapResponses = gap ? state->gapResponses + 1 : 0;
+    // the values of the subscription are only current without a gap
+    if (!gap)
+      state->lastPublishTime = OpcUa_DateTime_UtcNow();
+  }
+  OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
+
+  if (gap)
+    republishGap(subscriptionId);
+}
 
 static OpcUa_StatusCode opc_publish(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
 {
   OpcUa_PublishResponse* publishResponse = (OpcUa_PublishResponse*)pResponse;
 
+  if ((LONG)(intptr_t)pCallbackData != g_publishEpoch)
+    return uStatus;
+
+  stats_set(STATS_PUBLISH_OUTSTANDING, InterlockedDecrement(&g_publishOutstanding));
+
   if (OpcUa_IsGood(uStatus) && OpcUa_IsGood(publishResponse->ResponseHeader.ServiceResult)) {
+    OpcUa_NotificationMessage* notificationMessage = &publishResponse->NotificationMessage;
+    OpcUa_UInt32 subscriptionId = publishResponse->SubscriptionId;
+    OpcUa_UInt32 sequenceNumber = notificationMessage->SequenceNumber;
+    OpcUa_Boolean keepAlive = notificationMessage->NoOfNotificationData == 0;
+    OpcUa_UInt32 noOfNotifications = countNotifications(notificationMessage);
+    OpcUa_UInt32 maxNotificationsPerPublish = getMaxNotificationsPerPublish(subscriptionId);
+    OpcUa_DateTime publishTime = notificationMessage->PublishTime;
+
+    if (publishResponse->MoreNotifications || (maxNotificationsPerPublish && noOfNotifications >= maxNotificationsPerPublish))
+      publishAdjustDepth(1);
+    else if (keepAlive)
+      publishAdjustDepth(-1);
+
     kickofPublish();
 
-    addSubscriptionAcknowledgement(publishResponse->SubscriptionId, publishResponse->NotificationMessage.SequenceNumber);
-
-    if (publishResponse->NotificationMessage.NoOfNotificationData) {
-      for (OpcUa_Int32 i = 0; i < publishResponse->NotificationMessage.NoOfNotificationData; ++i) {
-        OpcUa_ExtensionObject* notificationData = &publishResponse->NotificationMessage.NotificationData[i];
-
-        if (notificationData->Encoding != OpcUa_ExtensionObjectEncoding_EncodeableObject || notificationData->Body.EncodeableObject.Object == OpcUa_Null || notificationData[i].Body.EncodeableObject.Type == OpcUa_Null)
-          continue;
-
-        if (notificationData->Body.EncodeableObject.Type->TypeId == OpcUaId_DataChangeNotification) {
-          OpcUa_DataChangeNotification* notification = notificationData->Body.EncodeableObject.Object;
-          opcua_publishDataChangeNotification(publishResponse->SubscriptionId, notification->NoOfMonitoredItems, notification->MonitoredItems);
-        } else if (notificationData->Body.EncodeableObject.Type->TypeId == OpcUaId_EventNotificationList) {
-          OpcUa_EventNotificationList* notification = notificationData->Body.EncodeableObject.Object;
-          opcua_publishEventNotificationList(publishResponse->SubscriptionId, notification->NoOfEvents, notification->Events);
-        } else if (notificationData->Body.EncodeableObject.Type->TypeId == OpcUaId_StatusChangeNotification) {
-          OpcUa_StatusChangeNotification* notification = notificationData->Body.EncodeableObject.Object;
-          printf("STATUS: %x\n", notification->Status);
-        } else {
-          assert(false);
-        }
-      }
+    if (!keepAlive) {
+      // the message is moved into the queue of the subscription, later ones wait there for a gap to close
+      if (receiveNotificationMessage(subscriptionId, sequenceNumber, notificationMessage))
+        addSubscriptionAcknowledgement(subscriptionId, sequenceNumber);
+
+      OpcUa_DateTime now = OpcUa_DateTime_UtcNow();
+      OpcUa_Int64 latency = (OpcUa_Int64)(toUInt64(&now) - toUInt64(&publishTime)) / 10000;
+      if (latency < 0)
+        latency = 0;
+      stats_add(STATS_PUBLISH_NOTIFICATIONS, noOfNotifications);
+      stats_add(STATS_PUBLISH_LATENCY_TOTAL, latency * noOfNotifications);
+      stats_max(STATS_PUBLISH_LATENCY_MAX, latency);
     } else {
-      // keep alive
+      stats_add(STATS_PUBLISH_KEEPALIVES, 1);
     }
+
+    // a keep alive carries the sequence number of the next notification message
+    checkGap(subscriptionId, keepAlive ? sequenceNumber - 1 : sequenceNumber);
+  } else {
+    OpcUa_StatusCode serviceResult = OpcUa_IsGood(uStatus) ? publishResponse->ResponseHeader.ServiceResult : uStatus;
+
+    if (serviceResult == OpcUa_BadTooManyPublishRequests)
+      publishAdjustDepth(-1);
+    else if (serviceResult == OpcUa_BadTimeout)
+      kickofPublish();
+    else if (isConnectionLost(serviceResult))
+      triggerRecovery();
   }
 
   return uStatus;
 }
 
-OpcUa_StatusCode kickofPublish(void)
+static void kickofPublish(void)
+{
+  if (g_recoveryPending || !g_noOfSubscriptionStates)
+    return;
+
+  for (;;) {
+    LONG outstanding = InterlockedIncrement(&g_publishOutstanding);
+    if (outstanding > g_publishDepth) {
+      InterlockedDecrement(&g_publishOutstanding);
+      return;
+    }
+
+    OpcUa_SubscriptionAcknowledgement acknowledgements[ACKNOWLEDGEMENTS_PER_PUBLISH];
+    OpcUa_Int32 noOfAcknowledgements = takeSubscriptionAcknowledgements(acknowledgements, ACKNOWLEDGEMENTS_PER_PUBLISH);
+
+    OpcUa_RequestHeader requestHeader;
+    OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginPublish(
+      setupRequestHeader(&requestHeader),
+      &requestHeader,
+      noOfAcknowledgements,
+      acknowledgements,
+      opc_publish,
+      (OpcUa_Void*)(intptr_t)g_publishEpoch);
+
+    if (!OpcUa_IsGood(statusCode)) {
+      for (OpcUa_Int32 i = 0; i < noOfAcknowledgements; ++i)
+        addSubscriptionAcknowledgement(acknowledgements[i].SubscriptionId, acknowledgements[i].SequenceNumber);
+      InterlockedDecrement(&g_publishOutstanding);
+      return;
+    }
+
+    stats_set(STATS_PUBLISH_OUTSTANDING, outstanding);
+  }
+}
+
+OpcUa_StatusCode createSubscription(OpcUa_Double publishingInterval, OpcUa_UInt32 lifetimeCount, OpcUa_UInt32 maxKeepAliveCount, OpcUa_UInt32 maxNotificationsPerPublish, OpcUa_UInt32* subscriptionId)
 {
-  OpcUa_StatusCode statusCode;
   OpcUa_RequestHeader requestHeader;
-  OpcUa_Channel channel = setupRequestHeader(&requestHeader);
-  OpcUa_Thread_Sleep(100);
-  OpcUa_Mutex_Lock(g_subscriptionAcknowledgementsMutex);
-  statusCode = OpcUa_ClientApi_BeginPublish(
-    channel,
+  OpcUa_ResponseHeader responseHeader;
+  OpcUa_Double revisedPublishingInterval;
+  OpcUa_UInt32 revisedLifetimeCount;
+  OpcUa_UInt32 revisedMaxKeepAliveCount;
+
+  OpcUa_ResponseHeader_Initialize(&responseHeader);
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_CreateSubscription(
+    setupRequestHeader(&requestHeader),
     &requestHeader,
-    g_noOfSubscriptionAcknowledgements,
-    g_subscriptionAcknowledgements,
-    opc_publish,
-    NULL);
-  g_noOfSubscriptionAcknowledgements = 0;
-  OpcUa_Mutex_Unlock(g_subscriptionAcknowledgementsMutex);
+    publishingInterval,
+    lifetimeCount,
+    maxKeepAliveCount,
+    maxNotificationsPerPublish,
+    OpcUa_True,
+    g_subscriptionPriority,
+    &responseHeader,
+    subscriptionId,
+    &revisedPublishingInterval,
+    &revisedLifetimeCount,
+    &revisedMaxKeepAliveCount);
+
+  if (OpcUa_IsGood(statusCode))
+    statusCode = responseHeader.ServiceResult;
+  OpcUa_ResponseHeader_Clear(&responseHeader);
+
+  if (OpcUa_IsGood(statusCode))
+    registerSubscription(*subscriptionId, maxNotificationsPerPublish);
+
   return statusCode;
 }
 
+static OpcUa_StatusCode channelStateChanged(OpcUa_Channel hChannel, OpcUa_Void* pCallbackData, OpcUa_Channel_Event eEvent, OpcUa_StatusCode uStatus)
+{
+  if (eEvent == eOpcUa_Channel_Event_Disconnected && !g_shutdown)
+    triggerRecovery();
+  return OpcUa_Good;
+}
 
-
-OpcUa_StatusCode initializeOpcUa(const OpcUa_CharA* url, const OpcUa_CharA* uri)
+static OpcUa_StatusCode connectChannel(OpcUa_Channel* channel)
 {
   OpcUa_StatusCode statusCode;
-  OpcUa_RequestHeader requestHeader;
-  OpcUa_ResponseHeader responseHeader;
-  OpcUa_String sessionName = OPCUA_STRING_STATICINITIALIZEWITH("wpcp2opcua", 10);
   OpcUa_String securityPolicy = OPCUA_STRING_STATICINITIALIZEWITH(OpcUa_SecurityPolicy_None, sizeof(OpcUa_SecurityPolicy_None)-1);
 
-  OpcUa_Mutex_Create(&g_subscriptionAcknowledgementsMutex);
-
   OpcUa_ByteString clientCertificate;
   OpcUa_ByteString clientPrivateKey;
   OpcUa_ByteString serverCertificate;
@@ -157,12 +705,12 @@ OpcUa_StatusCode initializeOpcUa(const OpcUa_CharA* url, const OpcUa_CharA* uri)
   certificateStoreConfiguration.PkiType = OpcUa_NO_PKI;
 #endif
 
-  OpcUa_Channel_Create(&g_channel, OpcUa_Channel_SerializerType_Binary);
+  OpcUa_Channel_Create(channel, OpcUa_Channel_SerializerType_Binary);
   statusCode = OpcUa_Channel_Connect(
-    g_channel,
-    url,
+    *channel,
+    g_url,
     OpcUa_TransportProfile_UaTcp,
-    NULL,
+    channelStateChanged,
     NULL,
     &clientCertificate,
     &clientPrivateKey,
@@ -174,129 +722,444 @@ OpcUa_StatusCode initializeOpcUa(const OpcUa_CharA* url, const OpcUa_CharA* uri)
     &securityToken,
     100000);
 
-  {
-    OpcUa_ApplicationDescription applicationDescription;
-    OpcUa_String serverUri = OPCUA_STRING_STATICINITIALIZEWITH((OpcUa_CharA*)uri, OpcUa_StrLenA(uri));
-    OpcUa_String endpointUrl = OPCUA_STRING_STATICINITIALIZEWITH((OpcUa_CharA*)url, OpcUa_StrLenA(url));
-    OpcUa_ByteString clientNonce;
-    OpcUa_ByteString clientCertificate;
-    OpcUa_NodeId sessionId;
-    OpcUa_ByteString serverNonce;
-    OpcUa_ByteString serverCertificate;
-    OpcUa_Int32 noOfServerEndpoints;
-    OpcUa_EndpointDescription* serverEndpoints;
-    OpcUa_Int32 noOfServerSoftwareCertificates;
-    OpcUa_SignedSoftwareCertificate* serverSoftwareCertificates;
-    OpcUa_SignatureData serverSignature;
-
-    OpcUa_ApplicationDescription_Initialize(&applicationDescription);
-    OpcUa_ByteString_Initialize(&clientNonce);
-    OpcUa_ByteString_Initialize(&clientCertificate);
-    OpcUa_NodeId_Initialize(&sessionId);
-    OpcUa_ByteString_Initialize(&serverNonce);
-    OpcUa_ByteString_Initialize(&serverCertificate);
-    OpcUa_SignatureData_Initialize(&serverSignature);
-
-    OpcUa_RequestHeader_Initialize(&requestHeader);
-    OpcUa_ResponseHeader_Initialize(&responseHeader);
-    statusCode = OpcUa_ClientApi_CreateSession(
-      g_channel,
-      &requestHeader,
-      &applicationDescription,
-      &serverUri,
-      &endpointUrl,
-      &sessionName,
-      &clientNonce,
-      &clientCertificate,
-      g_sessionTimeout,
-      g_maxRequestMessageSize,
-      &responseHeader,
-      &sessionId,
-      &g_authenticationToken,
-      &g_sessionTimeout,
-      &serverNonce,
-      &serverCertificate,
-      &noOfServerEndpoints,
-      &serverEndpoints,
-      &noOfServerSoftwareCertificates,
-      &serverSoftwareCertificates,
-      &serverSignature,
-      &g_maxRequestMessageSize);
-
-    if (OpcUa_IsBad(statusCode) || OpcUa_IsBad(responseHeader.ServiceResult)) {
-      printf("Can not create session\n");
-      exit(1);
+  if (OpcUa_IsBad(statusCode))
+    OpcUa_Channel_Delete(channel);
+
+  return statusCode;
+}
+
+static OpcUa_StatusCode createSession(void)
+{
+  OpcUa_StatusCode statusCode;
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_ResponseHeader responseHeader;
+  OpcUa_String sessionName = OPCUA_STRING_STATICINITIALIZEWITH("wpcp2opcua", 10);
+  OpcUa_ApplicationDescription applicationDescription;
+  OpcUa_String serverUri = OPCUA_STRING_STATICINITIALIZEWITH((OpcUa_CharA*)g_uri, OpcUa_StrLenA(g_uri));
+  OpcUa_String endpointUrl = OPCUA_STRING_STATICINITIALIZEWITH((OpcUa_CharA*)g_url, OpcUa_StrLenA(g_url));
+  OpcUa_ByteString clientNonce;
+  OpcUa_ByteString clientCertificate;
+  OpcUa_NodeId sessionId;
+  OpcUa_NodeId authenticationToken;
+  OpcUa_ByteString serverNonce;
+  OpcUa_ByteString serverCertificate;
+  OpcUa_Int32 noOfServerEndpoints;
+  OpcUa_EndpointDescription* serverEndpoints;
+  OpcUa_Int32 noOfServerSoftwareCertificates;
+  OpcUa_SignedSoftwareCertificate* serverSoftwareCertificates;
+  OpcUa_SignatureData serverSignature;
+
+  OpcUa_ApplicationDescription_Initialize(&applicationDescription);
+  OpcUa_ByteString_Initialize(&clientNonce);
+  OpcUa_ByteString_Initialize(&clientCertificate);
+  OpcUa_NodeId_Initialize(&sessionId);
+  OpcUa_NodeId_Initialize(&authenticationToken);
+  OpcUa_ByteString_Initialize(&serverNonce);
+  OpcUa_ByteString_Initialize(&serverCertificate);
+  OpcUa_SignatureData_Initialize(&serverSignature);
+
+  OpcUa_RequestHeader_Initialize(&requestHeader);
+  OpcUa_ResponseHeader_Initialize(&responseHeader);
+  statusCode = OpcUa_ClientApi_CreateSession(
+    g_channel,
+    &requestHeader,
+    &applicationDescription,
+    &serverUri,
+    &endpointUrl,
+    &sessionName,
+    &clientNonce,
+    &clientCertificate,
+    g_sessionTimeout,
+    g_maxRequestMessageSize,
+    &responseHeader,
+    &sessionId,
+    &authenticationToken,
+    &g_sessionTimeout,
+    &serverNonce,
+    &serverCertificate,
+    &noOfServerEndpoints,
+    &serverEndpoints,
+    &noOfServerSoftwareCertificates,
+    &serverSoftwareCertificates,
+    &serverSignature,
+    &g_maxRequestMessageSize);
+
+  if (OpcUa_IsGood(statusCode))
+    statusCode = responseHeader.ServiceResult;
+  OpcUa_ResponseHeader_Clear(&responseHeader);
+
+  // requests of other threads may still use the previous token
+  if (OpcUa_IsGood(statusCode))
+    switchAuthenticationToken(&authenticationToken);
+  else
+    OpcUa_NodeId_Clear(&authenticationToken);
+
+  return statusCode;
+}
+
+static OpcUa_StatusCode activateSession(void)
+{
+  OpcUa_StatusCode statusCode;
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_ResponseHeader responseHeader;
+  OpcUa_SignatureData clientSignature;
+  OpcUa_ExtensionObject userIdentityToken;
+  OpcUa_SignatureData userTokenSignature;
+  OpcUa_ByteString serverNonce;
+  OpcUa_Int32 noOfResults = 0;
+  OpcUa_StatusCode* results = 0;
+  OpcUa_Int32 noOfDiagnosticInfos = 0;
+  OpcUa_DiagnosticInfo* diagnosticInfos = 0;
+
+  OpcUa_SignatureData_Initialize(&clientSignature);
+  OpcUa_ExtensionObject_Initialize(&userIdentityToken);
+  OpcUa_SignatureData_Initialize(&userTokenSignature);
+  OpcUa_ByteString_Initialize(&serverNonce);
+
+  OpcUa_ResponseHeader_Initialize(&responseHeader);
+  statusCode = OpcUa_ClientApi_ActivateSession(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    &clientSignature,
+    0,
+    NULL,
+    0,
+    NULL,
+    &userIdentityToken,
+    &userTokenSignature,
+    &responseHeader,
+    &serverNonce,
+    &noOfResults,
+    &results,
+    &noOfDiagnosticInfos,
+    &diagnosticInfos);
+
+  if (OpcUa_IsGood(statusCode))
+    statusCode = responseHeader.ServiceResult;
+  OpcUa_ResponseHeader_Clear(&responseHeader);
+  OpcUa_ByteString_Clear(&serverNonce);
+  OpcUa_Memory_Free(results);
+  for (OpcUa_Int32 i = 0; i < noOfDiagnosticInfos; ++i)
+    OpcUa_DiagnosticInfo_Clear(&diagnosticInfos[i]);
+  OpcUa_Memory_Free(diagnosticInfos);
+
+  return statusCode;
+}
+
+// the message is dispatched in order with the others, returns a bad status code if it is not available
+static OpcUa_StatusCode republishMessage(OpcUa_UInt32 subscriptionId, OpcUa_UInt32 sequenceNumber)
+{
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_ResponseHeader responseHeader;
+  OpcUa_NotificationMessage notificationMessage;
+
+  OpcUa_NotificationMessage_Initialize(&notificationMessage);
+  OpcUa_ResponseHeader_Initialize(&responseHeader);
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_Republish(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    subscriptionId,
+    sequenceNumber,
+    &responseHeader,
+    &notificationMessage);
+
+  if (OpcUa_IsGood(statusCode))
+    statusCode = responseHeader.ServiceResult;
+  OpcUa_ResponseHeader_Clear(&responseHeader);
+
+  if (OpcUa_IsGood(statusCode)) {
+    stats_add(STATS_RECOVERY_REPUBLISHED, 1);
+    if (receiveNotificationMessage(subscriptionId, sequenceNumber, &notificationMessage))
+      addSubscriptionAcknowledgement(subscriptionId, sequenceNumber);
+  }
+
+  OpcUa_NotificationMessage_Clear(&notificationMessage);
+  return statusCode;
+}
+
+// every message up to sequenceNumber which has not arrived by now will not arrive anymore
+static void giveUpMissingMessages(OpcUa_UInt32 subscriptionId, OpcUa_UInt32 sequenceNumber)
+{
+  OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+  struct subscription_state_t* state = findSubscriptionState(subscriptionId);
+  if (state) {
+    for (OpcUa_UInt32 i = state->lastSequenceNumber + 1; i <= sequenceNumber; ++i) {
+      if (isMessageMissing(state, i))
+        queueNotificationMessage(state, i, NULL);
     }
+    state->gapResponses = 0;
+  }
+  OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
 
-    OpcUa_ResponseHeader_Clear(&responseHeader);
+  dispatchPendingMessages(subscriptionId);
+}
+
+struct subscription_range_t {
+  OpcUa_UInt32 subscriptionId;
+  OpcUa_UInt32 lastSequenceNumber;
+  OpcUa_UInt32 highestSequenceNumber;
+};
+
+static OpcUa_Int32 copySubscriptionRanges(struct subscription_range_t** ranges)
+{
+  OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+  OpcUa_Int32 count = g_noOfSubscriptionStates;
+  *ranges = malloc(sizeof(**ranges) * (count + 1));
+  for (OpcUa_Int32 i = 0; i < count; ++i) {
+    (*ranges)[i].subscriptionId = g_subscriptionStates[i].subscriptionId;
+    (*ranges)[i].lastSequenceNumber = g_subscriptionStates[i].lastSequenceNumber;
+    (*ranges)[i].highestSequenceNumber = g_subscriptionStates[i].highestSequenceNumber;
   }
+  OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
 
-  {
-    OpcUa_SignatureData clientSignature;
-    OpcUa_ExtensionObject userIdentityToken;
-    OpcUa_SignatureData userTokenSignature;
-    OpcUa_ByteString serverNonce;
-    OpcUa_Int32 noOfResults = 0;
-    OpcUa_StatusCode* results = 0;
-    OpcUa_Int32 noOfDiagnosticInfos = 0;
-    OpcUa_DiagnosticInfo* diagnosticInfos = 0;
-
-    OpcUa_SignatureData_Initialize(&clientSignature);
-    OpcUa_ExtensionObject_Initialize(&userIdentityToken);
-    OpcUa_SignatureData_Initialize(&userTokenSignature);
-    OpcUa_ByteString_Initialize(&serverNonce);
-
-    OpcUa_ResponseHeader_Initialize(&responseHeader);
-    statusCode = OpcUa_ClientApi_ActivateSession(
-      setupRequestHeader(&requestHeader),
-      &requestHeader,
-      &clientSignature,
-      0,
-      NULL,
-      0,
-      NULL,
-      &userIdentityToken,
-      &userTokenSignature,
-      &responseHeader,
-      &serverNonce,
-      &noOfResults,
-      &results,
-      &noOfDiagnosticInfos,
-      &diagnosticInfos);
-
-    if (OpcUa_IsBad(statusCode) || OpcUa_IsBad(responseHeader.ServiceResult)) {
-      printf("Can not activate session\n");
-      exit(1);
+  return count;
+}
+
+// the reactivated session still holds the messages which were not acknowledged, the ones beyond
+// the highest known sequence number were sent while the connection broke down
+static OpcUa_StatusCode republishAvailable(void)
+{
+  struct subscription_range_t* ranges;
+  OpcUa_Int32 count = copySubscriptionRanges(&ranges);
+  OpcUa_StatusCode statusCode = OpcUa_Good;
+
+  for (OpcUa_Int32 i = 0; i < count; ++i) {
+    OpcUa_UInt32 subscriptionId = ranges[i].subscriptionId;
+
+    for (OpcUa_UInt32 sequenceNumber = ranges[i].lastSequenceNumber + 1;; ++sequenceNumber) {
+      OpcUa_Boolean missing = OpcUa_True;
+
+      OpcUa_Mutex_Lock(g_subscriptionStatesMutex);
+      struct subscription_state_t* state = findSubscriptionState(subscriptionId);
+      if (state)
+        missing = isMessageMissing(state, sequenceNumber);
+      OpcUa_Mutex_Unlock(g_subscriptionStatesMutex);
+
+      if (!state)
+        break;
+      if (!missing)
+        continue;
+
+      statusCode = republishMessage(subscriptionId, sequenceNumber);
+      if (isConnectionLost(statusCode)) {
+        free(ranges);
+        return statusCode;
+      }
+      if (OpcUa_IsBad(statusCode) && sequenceNumber > ranges[i].highestSequenceNumber)
+        break;
     }
 
-    OpcUa_ResponseHeader_Clear(&responseHeader);
+    giveUpMissingMessages(subscriptionId, ranges[i].highestSequenceNumber);
+  }
+
+  free(ranges);
+  return OpcUa_Good;
+}
+
+static OpcUa_StatusCode transferSubscriptions(OpcUa_Int32* noOfLostSubscriptions, OpcUa_UInt32** lostSubscriptionIds)
+{
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_ResponseHeader responseHeader;
+  OpcUa_Int32 noOfResults = 0;
+  OpcUa_TransferResult* results = NULL;
+  OpcUa_Int32 noOfDiagnosticInfos = 0;
+  OpcUa_DiagnosticInfo* diagnosticInfos = NULL;
+
+  struct subscription_range_t* ranges;
+  OpcUa_Int32 count = copySubscriptionRanges(&ranges);
+  OpcUa_UInt32* subscriptionIds = malloc(sizeof(*subscriptionIds) * (count + 1));
+
+  for (OpcUa_Int32 i = 0; i < count; ++i)
+    subscriptionIds[i] = ranges[i].subscriptionId;
+
+  *noOfLostSubscriptions = 0;
+  *lostSubscriptionIds = subscriptionIds;
+
+  if (!count) {
+    free(ranges);
+    return OpcUa_Good;
   }
 
   OpcUa_ResponseHeader_Initialize(&responseHeader);
-  statusCode = OpcUa_ClientApi_CreateSubscription(
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_TransferSubscriptions(
     setupRequestHeader(&requestHeader),
     &requestHeader,
-    g_subscriptionPublishInterval,
-    g_subscriptionLifetimeCount,
-    g_subscriptionMaxKeepAliveCount,
-    g_subscriptionMaxNotificationsPerPublish,
-    OpcUa_True,
-    g_subscriptionPriority,
+    count,
+    subscriptionIds,
+    OpcUa_False,
     &responseHeader,
-    &g_subscriptionId,
-    &g_subscriptionPublishInterval,
-    &g_subscriptionLifetimeCount,
-    &g_subscriptionMaxKeepAliveCount);
+    &noOfResults,
+    &results,
+    &noOfDiagnosticInfos,
+    &diagnosticInfos);
+
+  if (OpcUa_IsGood(statusCode))
+    statusCode = responseHeader.ServiceResult;
+  OpcUa_ResponseHeader_Clear(&responseHeader);
+
+  for (OpcUa_Int32 i = 0; !isConnectionLost(statusCode) && i < count; ++i) {
+    OpcUa_UInt32 subscriptionId = ranges[i].subscriptionId;
+
+    if (OpcUa_IsBad(statusCode) || i >= noOfResults || OpcUa_IsBad(results[i].StatusCode)) {
+      (*lostSubscriptionIds)[(*noOfLostSubscriptions)++] = subscriptionId;
+      continue;
+    }
+
+    stats_add(STATS_RECOVERY_SUBSCRIPTIONS_TRANSFERRED, 1);
+
+    OpcUa_UInt32 highestSequenceNumber = ranges[i].highestSequenceNumber;
+    for (OpcUa_Int32 j = 0; j < results[i].NoOfAvailableSequenceNumbers; ++j) {
+      OpcUa_UInt32 sequenceNumber = results[i].AvailableSequenceNumbers[j];
+
+      if (sequenceNumber <= ranges[i].lastSequenceNumber)
+        continue;
+      if (sequenceNumber > highestSequenceNumber)
+        highestSequenceNumber = sequenceNumber;
+
+      OpcUa_StatusCode republishStatusCode = republishMessage(subscriptionId, sequenceNumber);
+      if (isConnectionLost(republishStatusCode)) {
+        statusCode = republishStatusCode;
+        break;
+      }
+    }
+
+    // the messages which are not available anymore are skipped, not waited for
+    if (!isConnectionLost(statusCode))
+      giveUpMissingMessages(subscriptionId, highestSequenceNumber);
+  }
+
+  if (!isConnectionLost(statusCode))
+    statusCode = OpcUa_Good;
+
+  for (OpcUa_Int32 i = 0; i < noOfResults; ++i)
+    OpcUa_TransferResult_Clear(&results[i]);
+  OpcUa_Memory_Free(results);
+  for (OpcUa_Int32 i = 0; i < noOfDiagnosticInfos; ++i)
+    OpcUa_DiagnosticInfo_Clear(&diagnosticInfos[i]);
+  OpcUa_Memory_Free(diagnosticInfos);
+  free(ranges);
+
+  return statusCode;
+}
+
+static OpcUa_StatusCode recover(void)
+{
+  OpcUa_StatusCode statusCode;
+  OpcUa_Channel channel;
+
+  statusCode = connectChannel(&channel);
+  if (OpcUa_IsBad(statusCode))
+    return statusCode;
+
+  switchChannel(channel);
+
+  statusCode = activateSession();
+  if (OpcUa_IsGood(statusCode))
+    return republishAvailable();
+
+  statusCode = createSession();
+  if (OpcUa_IsGood(statusCode))
+    statusCode = activateSession();
+  if (OpcUa_IsBad(statusCode))
+    return statusCode;
+
+  // the server may have been restarted with a different configuration
+  chunk_readLimits();
+  path_checkNamespaces();
+  addressspace_checkNamespaces();
+
+  // model changes may have been missed while disconnected
+  metadata_invalidate(NULL);
+
+  OpcUa_Int32 noOfLostSubscriptions;
+  OpcUa_UInt32* lostSubscriptionIds;
+  statusCode = transferSubscriptions(&noOfLostSubscriptions, &lostSubscriptionIds);
+  for (OpcUa_Int32 i = 0; OpcUa_IsGood(statusCode) && i < noOfLostSubscriptions; ++i) {
+    if (metadata_isSubscription(lostSubscriptionIds[i])) {
+      unregisterSubscription(lostSubscriptionIds[i]);
+      lostSubscriptionIds[i--] = lostSubscriptionIds[--noOfLostSubscriptions];
+      metadata_subscribe();
+    }
+  }
+  if (OpcUa_IsGood(statusCode) && noOfLostSubscriptions) {
+    for (OpcUa_Int32 i = 0; i < noOfLostSubscriptions; ++i)
+      unregisterSubscription(lostSubscriptionIds[i]);
+    stats_add(STATS_RECOVERY_ITEMS_REBUILT, opcua_recreateSubscriptions(noOfLostSubscriptions, lostSubscriptionIds));
+  }
+  free(lostSubscriptionIds);
+
+  return statusCode;
+}
+
+static OpcUa_Void recoveryThread(OpcUa_Void* pArgument)
+{
+  while (!g_shutdown) {
+    OpcUa_Semaphore_Wait(g_recoverySemaphore);
+    if (g_shutdown)
+      break;
 
-  if (OpcUa_IsBad(statusCode) || OpcUa_IsBad(responseHeader.ServiceResult)) {
-    printf("Can not create subscription\n");
+    OpcUa_DateTime start = OpcUa_DateTime_UtcNow();
+    printf("Connection lost, recovering\n");
+
+    InterlockedIncrement(&g_publishEpoch);
+    InterlockedExchange(&g_publishOutstanding, 0);
+
+    while (!g_shutdown && OpcUa_IsBad(recover()))
+      OpcUa_Thread_Sleep(g_reconnectInterval * 1000);
+
+    OpcUa_DateTime end = OpcUa_DateTime_UtcNow();
+    stats_add(STATS_RECOVERY_COUNT, 1);
+    stats_set(STATS_RECOVERY_TIME_LAST, (toUInt64(&end) - toUInt64(&start)) / 10000);
+
+    InterlockedExchange(&g_recoveryPending, 0);
+    kickofPublish();
+  }
+}
+
+OpcUa_StatusCode initializeOpcUa(const OpcUa_CharA* url, const OpcUa_CharA* uri)
+{
+  OpcUa_StatusCode statusCode;
+
+  g_url = url;
+  g_uri = uri;
+
+  ring_initialize(&g_acknowledgements);
+  OpcUa_Mutex_Create(&g_channelMutex);
+  OpcUa_Mutex_Create(&g_subscriptionStatesMutex);
+  OpcUa_Semaphore_Create(&g_recoverySemaphore, 0, 1);
+  metadata_initialize();
+  search_initialize();
+  path_initialize();
+
+  statusCode = connectChannel(&g_channel);
+
+  statusCode = createSession();
+  if (OpcUa_IsBad(statusCode)) {
+    printf("Can not create session\n");
     exit(1);
   }
 
-  OpcUa_ResponseHeader_Clear(&responseHeader);
+  statusCode = activateSession();
+  if (OpcUa_IsBad(statusCode)) {
+    printf("Can not activate session\n");
+    exit(1);
+  }
 
-  kickofPublish();
-  kickofPublish();
+  if (OpcUa_IsBad(chunk_readLimits()))
+    printf("Can not read operation limits, sending batches unsplit\n");
+
+  path_checkNamespaces();
+  addressspace_initialize();
+
+  if (g_publishMaxDepth < g_publishMinDepth)
+    g_publishMaxDepth = g_publishMinDepth;
+  publishAdjustDepth(g_publishMinDepth);
+
+  if (OpcUa_IsBad(metadata_subscribe()))
+    printf("Can not subscribe model changes, metadata expires by time only\n");
+
+  OpcUa_Thread_Create(&g_recoveryThread, recoveryThread, NULL);
+  OpcUa_Thread_Start(g_recoveryThread);
 
   return statusCode;
 }
@@ -304,7 +1167,24 @@ OpcUa_StatusCode initializeOpcUa(const OpcUa_CharA* url, const OpcUa_CharA* uri)
 OpcUa_StatusCode clearOpcUa(void)
 {
   OpcUa_StatusCode statusCode = OpcUa_Good;
-  OpcUa_Mutex_Delete(&g_subscriptionAcknowledgementsMutex);
-  OpcUa_Memory_Free(g_subscriptionAcknowledgements);
+
+  InterlockedExchange(&g_shutdown, 1);
+  OpcUa_Semaphore_Post(g_recoverySemaphore, 1);
+  OpcUa_Thread_WaitForShutdown(g_recoveryThread, OPCUA_INFINITE);
+  OpcUa_Thread_Delete(&g_recoveryThread);
+  OpcUa_Semaphore_Delete(&g_recoverySemaphore);
+  addressspace_clear();
+  search_clear();
+  path_clear();
+
+  for (OpcUa_Int32 i = 0; i < g_noOfSubscriptionStates; ++i)
+    freePendingMessages(g_subscriptionStates[i].pending);
+  OpcUa_Mutex_Delete(&g_subscriptionStatesMutex);
+  OpcUa_Memory_Free(g_subscriptionStates);
+  if (g_retiredChannel)
+    OpcUa_Channel_Delete(&g_retiredChannel);
+  OpcUa_NodeId_Clear(&g_retiredAuthenticationToken);
+  OpcUa_Mutex_Delete(&g_channelMutex);
+  metadata_clear();
   return statusCode;
 }
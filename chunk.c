@@ -0,0 +1,121 @@
+#include "main.h"
+#include <wpcp_lws.h>
+#include <stdlib.h>
+
+OpcUa_UInt32 g_chunkWindow = 4;
+
+static OpcUa_UInt32 g_operationLimits[OPERATION_LIMIT_COUNT];
+
+static const OpcUa_UInt32 g_operationLimitNodeIds[OPERATION_LIMIT_COUNT] = {
+#define XX(id, name) OpcUaId_Server_ServerCapabilities_OperationLimits_##name,
+  OPERATION_LIMITS(XX)
+#undef XX
+};
+
+OpcUa_UInt32 chunk_getLimit(enum operation_limit_t limit)
+{
+  return g_operationLimits[limit];
+}
+
+// a missing or unreadable limit is treated as unlimited
+OpcUa_StatusCode chunk_readLimits(void)
+{
+  OpcUa_ReadValueId readValueId[OPERATION_LIMIT_COUNT];
+  for (OpcUa_Int32 i = 0; i < OPERATION_LIMIT_COUNT; ++i) {
+    OpcUa_ReadValueId_Initialize(&readValueId[i]);
+    readValueId[i].NodeId.Identifier.Numeric = g_operationLimitNodeIds[i];
+    readValueId[i].AttributeId = OpcUa_Attributes_Value;
+  }
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_ResponseHeader responseHeader;
+  OpcUa_Int32 noOfResults = 0;
+  OpcUa_DataValue* results = NULL;
+  OpcUa_Int32 noOfDiagnosticInfos = 0;
+  OpcUa_DiagnosticInfo* diagnosticInfos = NULL;
+
+  OpcUa_ResponseHeader_Initialize(&responseHeader);
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_Read(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    0.0,
+    OpcUa_TimestampsToReturn_Neither,
+    OPERATION_LIMIT_COUNT,
+    readValueId,
+    &responseHeader,
+    &noOfResults,
+    &results,
+    &noOfDiagnosticInfos,
+    &diagnosticInfos);
+
+  if (OpcUa_IsGood(statusCode))
+    statusCode = responseHeader.ServiceResult;
+  OpcUa_ResponseHeader_Clear(&responseHeader);
+
+  for (OpcUa_Int32 i = 0; i < OPERATION_LIMIT_COUNT; ++i) {
+    const OpcUa_DataValue* dataValue = OpcUa_IsGood(statusCode) && i < noOfResults ? &results[i] : NULL;
+    if (dataValue && OpcUa_IsGood(dataValue->StatusCode) && dataValue->Value.Datatype == OpcUaType_UInt32)
+      g_operationLimits[i] = dataValue->Value.Value.UInt32;
+    else
+      g_operationLimits[i] = 0;
+  }
+
+  for (OpcUa_Int32 i = 0; i < noOfResults; ++i)
+    OpcUa_DataValue_Clear(&results[i]);
+  OpcUa_Memory_Free(results);
+
+  return statusCode;
+}
+
+// the wpcp lock is released while a chunk begins, so the request is sent without blocking the connections
+// and a response completing synchronously takes the lock once, the thread dispatching finishes the chunker
+static void dispatch(struct chunker_t* chunker)
+{
+  if (chunker->dispatching)
+    return;
+
+  OpcUa_Int32 window = g_chunkWindow ? g_chunkWindow : 1;
+  chunker->dispatching = OpcUa_True;
+  while (chunker->inFlight < window && chunker->offset < chunker->count) {
+    struct chunk_t* chunk = malloc(sizeof(struct chunk_t));
+    chunk->chunker = chunker;
+    chunk->offset = chunker->offset;
+    chunk->count = chunker->count - chunker->offset < chunker->size ? chunker->count - chunker->offset : chunker->size;
+    chunker->offset += chunk->count;
+    chunker->inFlight += 1;
+    wpcp_lws_unlock();
+    chunker->begin(chunk);
+    wpcp_lws_lock();
+  }
+  chunker->dispatching = OpcUa_False;
+
+  if (chunker->completed == chunker->count)
+    chunker->finish(chunker->context);
+}
+
+// has to be called with the wpcp lock held exactly once
+void chunk_start(struct chunker_t* chunker, OpcUa_UInt32 limit, OpcUa_Int32 count, void* context, chunk_begin_t begin, chunk_finish_t finish)
+{
+  chunker->context = context;
+  chunker->count = count;
+  chunker->size = limit && limit < (OpcUa_UInt32)count ? (OpcUa_Int32)limit : count;
+  chunker->offset = 0;
+  chunker->inFlight = 0;
+  chunker->completed = 0;
+  chunker->dispatching = OpcUa_False;
+  chunker->begin = begin;
+  chunker->finish = finish;
+
+  dispatch(chunker);
+}
+
+// has to be called with the wpcp lock held exactly once
+void chunk_complete(struct chunk_t* chunk)
+{
+  struct chunker_t* chunker = chunk->chunker;
+
+  chunker->inFlight -= 1;
+  chunker->completed += chunk->count;
+  free(chunk);
+  dispatch(chunker);
+}
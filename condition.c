@@ -0,0 +1,187 @@
+#include "main.h"
+#include <stdlib.h>
+#include <string.h>
+
+// conditions of one alarm monitored item by key, changed conditions wait in a list until they are published
+struct condition_table_t {
+  struct condition_t** index;
+  OpcUa_UInt32 indexSize;
+  OpcUa_UInt32 count;
+  struct condition_t* pending;
+  struct condition_t** pendingTail;
+};
+
+static struct condition_t** findCondition(struct condition_table_t* table, const char* key, uint32_t keyLength, OpcUa_UInt32 hash)
+{
+  struct condition_t** entry = &table->index[hash & (table->indexSize - 1)];
+  while (*entry && ((*entry)->hash != hash || (*entry)->keyLength != keyLength || memcmp((*entry)->key, key, keyLength)))
+    entry = &(*entry)->next;
+  return entry;
+}
+
+static void growIndex(struct condition_table_t* table)
+{
+  OpcUa_UInt32 size = table->indexSize ? table->indexSize * 2 : 16;
+  struct condition_t** index = calloc(size, sizeof(struct condition_t*));
+
+  for (OpcUa_UInt32 i = 0; i < table->indexSize; ++i) {
+    struct condition_t* condition = table->index[i];
+    while (condition) {
+      struct condition_t* next = condition->next;
+      condition->next = index[condition->hash & (size - 1)];
+      index[condition->hash & (size - 1)] = condition;
+      condition = next;
+    }
+  }
+
+  free(table->index);
+  table->index = index;
+  table->indexSize = size;
+}
+
+static void freeCondition(struct condition_t* condition)
+{
+  free(condition->data);
+  free(condition);
+  stats_add(STATS_ALARM_CONDITIONS, -1);
+}
+
+struct condition_table_t* condition_createTable(void)
+{
+  struct condition_table_t* table = malloc(sizeof(struct condition_table_t));
+  table->index = NULL;
+  table->indexSize = 0;
+  table->count = 0;
+  table->pending = NULL;
+  table->pendingTail = &table->pending;
+  growIndex(table);
+  return table;
+}
+
+void condition_deleteTable(struct condition_table_t* table)
+{
+  if (!table)
+    return;
+
+  condition_clear(table);
+  free(table->index);
+  free(table);
+}
+
+void condition_clear(struct condition_table_t* table)
+{
+  for (OpcUa_UInt32 i = 0; i < table->indexSize; ++i) {
+    while (table->index[i]) {
+      struct condition_t* condition = table->index[i];
+      table->index[i] = condition->next;
+      freeCondition(condition);
+    }
+  }
+
+  table->count = 0;
+  table->pending = NULL;
+  table->pendingTail = &table->pending;
+}
+
+// stores the latest state of a condition, the strings are copied
+struct condition_t* condition_update(struct condition_table_t* table, const char* key, uint32_t keyLength, const struct wpcp_value_t* token, const struct wpcp_value_t* id, double time, OpcUa_UInt16 severity, const char* message, uint32_t messageLength, bool retain, bool acknowledged, bool confirmed)
+{
+  OpcUa_UInt32 hash = hashBuffer(HASH_INITIAL, key, keyLength);
+  struct condition_t** entry = findCondition(table, key, keyLength, hash);
+  struct condition_t* condition = *entry;
+
+  if (!condition) {
+    if (table->count >= table->indexSize) {
+      growIndex(table);
+      entry = findCondition(table, key, keyLength, hash);
+    }
+
+    condition = malloc(sizeof(struct condition_t) + keyLength);
+    condition->next = NULL;
+    condition->nextPending = NULL;
+    condition->hash = hash;
+    condition->pending = false;
+    condition->keyLength = keyLength;
+    memcpy(condition->key, key, keyLength);
+    condition->data = NULL;
+    *entry = condition;
+    table->count += 1;
+    stats_add(STATS_ALARM_CONDITIONS, 1);
+  }
+
+  free(condition->data);
+  condition->data = malloc(token->value.length + id->value.length + messageLength + 1);
+  condition->token = condition->data;
+  condition->tokenLength = token->value.length;
+  memcpy(condition->token, token->data.text_string, token->value.length);
+  condition->id = condition->token + condition->tokenLength;
+  condition->idLength = id->value.length;
+  memcpy(condition->id, id->data.text_string, id->value.length);
+  condition->message = condition->id + condition->idLength;
+  condition->messageLength = messageLength;
+  memcpy(condition->message, message, messageLength);
+
+  condition->time = time;
+  condition->severity = severity;
+  condition->retain = retain;
+  condition->acknowledged = acknowledged;
+  condition->confirmed = confirmed;
+  return condition;
+}
+
+// a condition which is no longer retained is not part of a refresh anymore
+void condition_remove(struct condition_table_t* table, struct condition_t* condition)
+{
+  struct condition_t** entry = findCondition(table, condition->key, condition->keyLength, condition->hash);
+  *entry = condition->next;
+  table->count -= 1;
+
+  if (condition->pending) {
+    struct condition_t** pending = &table->pending;
+    while (*pending != condition)
+      pending = &(*pending)->nextPending;
+    *pending = condition->nextPending;
+    if (table->pendingTail == &condition->nextPending)
+      table->pendingTail = pending;
+  }
+
+  freeCondition(condition);
+}
+
+// returns false if the condition was already waiting, so only its latest state gets published
+bool condition_queue(struct condition_table_t* table, struct condition_t* condition)
+{
+  if (condition->pending)
+    return false;
+
+  condition->pending = true;
+  condition->nextPending = NULL;
+  *table->pendingTail = condition;
+  table->pendingTail = &condition->nextPending;
+  return true;
+}
+
+// calls the callback for every waiting condition in the order of their first change
+void condition_flush(struct condition_table_t* table, condition_callback_t callback, void* user)
+{
+  struct condition_t* condition = table->pending;
+  table->pending = NULL;
+  table->pendingTail = &table->pending;
+
+  while (condition) {
+    struct condition_t* next = condition->nextPending;
+    condition->pending = false;
+    callback(user, condition);
+    if (!condition->retain)
+      condition_remove(table, condition);
+    condition = next;
+  }
+}
+
+void condition_forEach(struct condition_table_t* table, condition_callback_t callback, void* user)
+{
+  for (OpcUa_UInt32 i = 0; i < table->indexSize; ++i) {
+    for (struct condition_t* condition = table->index[i]; condition; condition = condition->next)
+      callback(user, condition);
+  }
+}
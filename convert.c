@@ -32,6 +32,9 @@ OpcUa_StatusCode toNodeId(const struct wpcp_value_t* id, OpcUa_NodeId* nodeId)
   if (id->type != WPCP_VALUE_TYPE_TEXT_STRING)
     return OpcUa_BadInvalidArgument;
 
+  if (path_isPath(id))
+    return path_toNodeId(id, nodeId);
+
   OpcUa_NodeId_Initialize(nodeId);
 
   if (length > 3 && str[0] == 'n' && str[1] == 's' && str[2] == '=' && str[3] != ';') {
@@ -68,6 +71,14 @@ OpcUa_StatusCode toNodeId(const struct wpcp_value_t* id, OpcUa_NodeId* nodeId)
   return OpcUa_Bad;
 }
 
+// paths missing in the cache are resolved together by path_resolveBatch
+OpcUa_StatusCode toNodeIdBatched(const struct wpcp_value_t* id, OpcUa_NodeId* nodeId, struct path_batch_t** batch)
+{
+  if (id->type == WPCP_VALUE_TYPE_TEXT_STRING && path_isPath(id))
+    return path_toNodeIdBatched(id, nodeId, batch);
+  return toNodeId(id, nodeId);
+}
+
 OpcUa_StatusCode toVariant(const struct wpcp_value_t* value, OpcUa_Variant* variant)
 {
   OpcUa_Variant_Initialize(variant);
@@ -134,6 +145,184 @@ OpcUa_StatusCode toVariant(const struct wpcp_value_t* value, OpcUa_Variant* vari
   return OpcUa_Bad;
 }
 
+OpcUa_StatusCode toDouble(const struct wpcp_value_t* value, OpcUa_Double* result)
+{
+  if (value->type == WPCP_VALUE_TYPE_UINT64)
+    *result = (OpcUa_Double)value->value.uint;
+  else if (value->type == WPCP_VALUE_TYPE_INT64)
+    *result = (OpcUa_Double)value->value.sint;
+  else if (value->type == WPCP_VALUE_TYPE_FLOAT)
+    *result = value->value.flt;
+  else if (value->type == WPCP_VALUE_TYPE_DOUBLE)
+    *result = value->value.dbl;
+  else
+    return OpcUa_BadInvalidArgument;
+
+  return OpcUa_Good;
+}
+
+OpcUa_StatusCode variantToDouble(const OpcUa_Variant* variant, OpcUa_Double* result)
+{
+  if (variant->ArrayType != OpcUa_VariantArrayType_Scalar)
+    return OpcUa_BadInvalidArgument;
+
+  switch (variant->Datatype) {
+#define XX(type) \
+  case OpcUaType_##type: \
+    *result = (OpcUa_Double)variant->Value.type; \
+    return OpcUa_Good;
+  XX(SByte)
+  XX(Byte)
+  XX(Int16)
+  XX(UInt16)
+  XX(Int32)
+  XX(UInt32)
+  XX(Int64)
+  XX(UInt64)
+  XX(Float)
+  XX(Double)
+#undef XX
+  default:
+    return OpcUa_BadInvalidArgument;
+  }
+}
+
+const struct wpcp_value_t* findAdditional(const struct wpcp_key_value_pair_t* additional, uint32_t additional_count, const char* key)
+{
+  size_t key_length = strlen(key);
+
+  for (uint32_t i = 0; i < additional_count; ++i) {
+    if (additional[i].key_length == key_length && !memcmp(additional[i].key, key, key_length))
+      return &additional[i].value;
+  }
+
+  return NULL;
+}
+
+const struct wpcp_value_t* findMapValue(const struct wpcp_value_t* map, const char* key)
+{
+  size_t key_length = strlen(key);
+
+  if (!map || map->type != WPCP_VALUE_TYPE_MAP)
+    return NULL;
+
+  const struct wpcp_value_t* entry = map->data.first_child;
+  for (uint32_t i = 0; i < map->value.length && entry && entry->next; ++i, entry = entry->next->next) {
+    if (entry->type == WPCP_VALUE_TYPE_TEXT_STRING && entry->value.length == key_length && !memcmp(entry->data.text_string, key, key_length))
+      return entry->next;
+  }
+
+  return NULL;
+}
+
+OpcUa_UInt32 hashBuffer(OpcUa_UInt32 hash, const void* data, size_t length)
+{
+  const OpcUa_Byte* bytes = data;
+
+  for (size_t i = 0; i < length; ++i)
+    hash = (hash ^ bytes[i]) * 16777619u;
+
+  return hash;
+}
+
+OpcUa_UInt32 hashNodeId(const OpcUa_NodeId* nodeId)
+{
+  const OpcUa_Byte* data = NULL;
+  size_t length = 0;
+  OpcUa_UInt32 hash = HASH_INITIAL;
+
+  switch (nodeId->IdentifierType) {
+  case OpcUa_IdentifierType_Numeric:
+    data = (const OpcUa_Byte*)&nodeId->Identifier.Numeric;
+    length = sizeof(nodeId->Identifier.Numeric);
+    break;
+  case OpcUa_IdentifierType_String:
+    data = (const OpcUa_Byte*)OpcUa_String_GetRawString(&nodeId->Identifier.String);
+    length = OpcUa_String_StrSize(&nodeId->Identifier.String);
+    break;
+  case OpcUa_IdentifierType_Guid:
+    data = (const OpcUa_Byte*)nodeId->Identifier.Guid;
+    length = data ? sizeof(*nodeId->Identifier.Guid) : 0;
+    break;
+  case OpcUa_IdentifierType_Opaque:
+    data = nodeId->Identifier.ByteString.Data;
+    length = nodeId->Identifier.ByteString.Length > 0 ? nodeId->Identifier.ByteString.Length : 0;
+    break;
+  }
+
+  hash = hashBuffer(hash, &nodeId->NamespaceIndex, sizeof(nodeId->NamespaceIndex));
+  hash = hashBuffer(hash, &nodeId->IdentifierType, sizeof(nodeId->IdentifierType));
+  return hashBuffer(hash, data, length);
+}
+
+static size_t appendKeyBytes(char* buffer, size_t size, size_t offset, const void* data, size_t length)
+{
+  if (offset + length <= size)
+    memcpy(buffer + offset, data, length);
+  return offset + length;
+}
+
+static size_t appendWpcpKey(const struct wpcp_value_t* value, char* buffer, size_t size, size_t offset)
+{
+  OpcUa_Byte type = (OpcUa_Byte)value->type;
+  const struct wpcp_value_t* child;
+  uint32_t count;
+
+  offset = appendKeyBytes(buffer, size, offset, &type, sizeof(type));
+
+  switch (value->type) {
+  case WPCP_VALUE_TYPE_UINT64:
+  case WPCP_VALUE_TYPE_INT64:
+  case WPCP_VALUE_TYPE_SIMPLE_VALUE:
+    offset = appendKeyBytes(buffer, size, offset, &value->value.uint, sizeof(value->value.uint));
+    break;
+
+  case WPCP_VALUE_TYPE_FLOAT:
+    offset = appendKeyBytes(buffer, size, offset, &value->value.flt, sizeof(value->value.flt));
+    break;
+
+  case WPCP_VALUE_TYPE_DOUBLE:
+    offset = appendKeyBytes(buffer, size, offset, &value->value.dbl, sizeof(value->value.dbl));
+    break;
+
+  case WPCP_VALUE_TYPE_BYTE_STRING:
+    offset = appendKeyBytes(buffer, size, offset, &value->value.length, sizeof(value->value.length));
+    offset = appendKeyBytes(buffer, size, offset, value->data.byte_string, value->value.length);
+    break;
+
+  case WPCP_VALUE_TYPE_TEXT_STRING:
+    offset = appendKeyBytes(buffer, size, offset, &value->value.length, sizeof(value->value.length));
+    offset = appendKeyBytes(buffer, size, offset, value->data.text_string, value->value.length);
+    break;
+
+  case WPCP_VALUE_TYPE_TAG:
+    offset = appendKeyBytes(buffer, size, offset, &value->value.uint, sizeof(value->value.uint));
+    if (value->data.first_child)
+      offset = appendWpcpKey(value->data.first_child, buffer, size, offset);
+    break;
+
+  case WPCP_VALUE_TYPE_ARRAY:
+  case WPCP_VALUE_TYPE_MAP:
+    count = value->type == WPCP_VALUE_TYPE_MAP ? value->value.length * 2 : value->value.length;
+    offset = appendKeyBytes(buffer, size, offset, &value->value.length, sizeof(value->value.length));
+    child = value->data.first_child;
+    for (uint32_t i = 0; i < count && child; ++i, child = child->next)
+      offset = appendWpcpKey(child, buffer, size, offset);
+    break;
+
+  default:
+    break;
+  }
+
+  return offset;
+}
+
+// serializes a value into a byte sequence usable as a lookup key, returns the required size like snprintf
+size_t toWpcpKey(const struct wpcp_value_t* value, char* buffer, size_t size)
+{
+  return value ? appendWpcpKey(value, buffer, size, 0) : 0;
+}
+
 double toWpcpTime(const OpcUa_DateTime* timestamp, OpcUa_UInt16 picoseconds)
 {
   OpcUa_UInt64 ts = timestamp->dwHighDateTime;
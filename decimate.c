@@ -0,0 +1,117 @@
+#include "main.h"
+#include <stdlib.h>
+
+// the range is split into buckets of equal time, each bucket keeps only its minimum and maximum,
+// so peaks survive while the memory is bounded by the number of points and not by the length of the range
+struct decimator_t {
+  OpcUa_UInt64 startTime;
+  OpcUa_UInt64 width;
+  OpcUa_UInt64 bucket;
+  OpcUa_Boolean hasMinimum;
+  OpcUa_Boolean hasMaximum;
+  OpcUa_Double minimumValue;
+  OpcUa_Double maximumValue;
+  OpcUa_DataValue minimum;
+  OpcUa_DataValue maximum;
+  OpcUa_Int32 noOfValues;
+  OpcUa_Int32 size;
+  OpcUa_DataValue* values;
+};
+
+static OpcUa_DataValue* appendValue(struct decimator_t* decimator)
+{
+  if (decimator->noOfValues == decimator->size) {
+    decimator->size = decimator->size ? decimator->size * 2 : 64;
+    decimator->values = OpcUa_Memory_ReAlloc(decimator->values, decimator->size * sizeof(OpcUa_DataValue));
+  }
+  return &decimator->values[decimator->noOfValues++];
+}
+
+// a bucket holds a maximum only besides a minimum, both are emitted in time order
+static void flushBucket(struct decimator_t* decimator)
+{
+  if (decimator->hasMaximum && toUInt64(&decimator->maximum.SourceTimestamp) < toUInt64(&decimator->minimum.SourceTimestamp)) {
+    *appendValue(decimator) = decimator->maximum;
+    *appendValue(decimator) = decimator->minimum;
+  } else {
+    if (decimator->hasMinimum)
+      *appendValue(decimator) = decimator->minimum;
+    if (decimator->hasMaximum)
+      *appendValue(decimator) = decimator->maximum;
+  }
+
+  decimator->hasMinimum = OpcUa_False;
+  decimator->hasMaximum = OpcUa_False;
+}
+
+struct decimator_t* decimate_create(OpcUa_UInt64 startTime, OpcUa_UInt64 endTime, OpcUa_UInt32 points)
+{
+  OpcUa_UInt64 buckets = points > 1 ? points / 2 : 1;
+
+  struct decimator_t* decimator = malloc(sizeof(struct decimator_t));
+  decimator->startTime = startTime;
+  decimator->width = endTime > startTime ? (endTime - startTime + buckets - 1) / buckets : 1;
+  decimator->bucket = 0;
+  decimator->hasMinimum = OpcUa_False;
+  decimator->hasMaximum = OpcUa_False;
+  decimator->noOfValues = 0;
+  decimator->size = 0;
+  decimator->values = NULL;
+  return decimator;
+}
+
+// takes ownership of the content of dataValue, values without a good numeric value are passed through
+void decimate_add(struct decimator_t* decimator, OpcUa_DataValue* dataValue)
+{
+  OpcUa_UInt64 time = toUInt64(&dataValue->SourceTimestamp);
+  OpcUa_UInt64 bucket = time > decimator->startTime ? (time - decimator->startTime) / decimator->width : 0;
+  OpcUa_Double value;
+
+  stats_add(STATS_HISTORY_DECIMATION_IN, 1);
+
+  if (bucket != decimator->bucket) {
+    flushBucket(decimator);
+    decimator->bucket = bucket;
+  }
+
+  if (!OpcUa_IsGood(dataValue->StatusCode) || OpcUa_IsBad(variantToDouble(&dataValue->Value, &value))) {
+    flushBucket(decimator);
+    *appendValue(decimator) = *dataValue;
+    return;
+  }
+
+  // a single value of a bucket is kept once
+  if (!decimator->hasMinimum) {
+    decimator->minimum = *dataValue;
+    decimator->minimumValue = value;
+    decimator->hasMinimum = OpcUa_True;
+  } else if (value < decimator->minimumValue) {
+    if (decimator->hasMaximum)
+      OpcUa_DataValue_Clear(&decimator->minimum);
+    else {
+      decimator->maximum = decimator->minimum;
+      decimator->maximumValue = decimator->minimumValue;
+      decimator->hasMaximum = OpcUa_True;
+    }
+    decimator->minimum = *dataValue;
+    decimator->minimumValue = value;
+  } else if (!decimator->hasMaximum || value > decimator->maximumValue) {
+    if (decimator->hasMaximum)
+      OpcUa_DataValue_Clear(&decimator->maximum);
+    decimator->maximum = *dataValue;
+    decimator->maximumValue = value;
+    decimator->hasMaximum = OpcUa_True;
+  } else
+    OpcUa_DataValue_Clear(dataValue);
+}
+
+// hands over the reduced values and frees the decimator
+void decimate_finish(struct decimator_t* decimator, OpcUa_Int32* noOfValues, OpcUa_DataValue** values)
+{
+  flushBucket(decimator);
+  stats_add(STATS_HISTORY_DECIMATION_OUT, decimator->noOfValues);
+
+  *noOfValues = decimator->noOfValues;
+  *values = decimator->values;
+  free(decimator);
+}
@@ -0,0 +1,83 @@
+#include "kernel.h"
+
+// the kernels keep independent accumulators per lane, so the compiler can map them onto vector registers
+double kernel_sum(const double* values, int32_t count)
+{
+  double sum[KERNEL_LANES] = { 0.0 };
+  int32_t i = 0;
+
+  for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+    for (int32_t lane = 0; lane < KERNEL_LANES; ++lane)
+      sum[lane] += values[i + lane];
+  }
+  for (; i < count; ++i)
+    sum[0] += values[i];
+
+  return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+double kernel_weightedSum(const double* values, const double* weights, int32_t count)
+{
+  double sum[KERNEL_LANES] = { 0.0 };
+  int32_t i = 0;
+
+  for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+    for (int32_t lane = 0; lane < KERNEL_LANES; ++lane)
+      sum[lane] += values[i + lane] * weights[i + lane];
+  }
+  for (; i < count; ++i)
+    sum[0] += values[i] * weights[i];
+
+  return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+double kernel_squaredDeviation(const double* values, int32_t count, double mean)
+{
+  double sum[KERNEL_LANES] = { 0.0 };
+  int32_t i = 0;
+
+  for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+    for (int32_t lane = 0; lane < KERNEL_LANES; ++lane) {
+      double deviation = values[i + lane] - mean;
+      sum[lane] += deviation * deviation;
+    }
+  }
+  for (; i < count; ++i)
+    sum[0] += (values[i] - mean) * (values[i] - mean);
+
+  return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+double kernel_minimum(const double* values, int32_t count)
+{
+  double minimum[KERNEL_LANES] = { values[0], values[0], values[0], values[0] };
+  int32_t i = 0;
+
+  for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+    for (int32_t lane = 0; lane < KERNEL_LANES; ++lane)
+      minimum[lane] = values[i + lane] < minimum[lane] ? values[i + lane] : minimum[lane];
+  }
+  for (; i < count; ++i)
+    minimum[0] = values[i] < minimum[0] ? values[i] : minimum[0];
+
+  for (int32_t lane = 1; lane < KERNEL_LANES; ++lane)
+    minimum[0] = minimum[lane] < minimum[0] ? minimum[lane] : minimum[0];
+  return minimum[0];
+}
+
+double kernel_maximum(const double* values, int32_t count)
+{
+  double maximum[KERNEL_LANES] = { values[0], values[0], values[0], values[0] };
+  int32_t i = 0;
+
+  for (; i + KERNEL_LANES <= count; i += KERNEL_LANES) {
+    for (int32_t lane = 0; lane < KERNEL_LANES; ++lane)
+      maximum[lane] = values[i + lane] > maximum[lane] ? values[i + lane] : maximum[lane];
+  }
+  for (; i < count; ++i)
+    maximum[0] = values[i] > maximum[0] ? values[i] : maximum[0];
+
+  for (int32_t lane = 1; lane < KERNEL_LANES; ++lane)
+    maximum[0] = maximum[lane] > maximum[0] ? maximum[lane] : maximum[0];
+  return maximum[0];
+}
@@ -0,0 +1,9 @@
+#include <stdint.h>
+
+#define KERNEL_LANES 4
+
+double kernel_sum(const double* values, int32_t count);
+double kernel_weightedSum(const double* values, const double* weights, int32_t count);
+double kernel_squaredDeviation(const double* values, int32_t count, double mean);
+double kernel_minimum(const double* values, int32_t count);
+double kernel_maximum(const double* values, int32_t count);
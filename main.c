@@ -8,6 +8,22 @@ static OpcUa_ProxyStubConfiguration g_proxyStubConfiguration;
 static OpcUa_Boolean arg_opcua_trace = OpcUa_False;
 static const char* arg_opcua_url = NULL;
 static const char* arg_opcua_uri = "";
+static OpcUa_UInt32 arg_stats_interval = 0;
+
+static const char* parse_uint32(const char* value, OpcUa_UInt32* result)
+{
+  char* end;
+
+  if (!value)
+    return "no value sepcified";
+
+  unsigned long number = strtoul(value, &end, 10);
+  if (end == value || *end)
+    return "invalid value";
+
+  *result = (OpcUa_UInt32)number;
+  return NULL;
+}
 
 static const char* handle_argument(const char* key, const char* value)
 {
@@ -32,6 +48,58 @@ static const char* handle_argument(const char* key, const char* value)
     return NULL;
   }
 
+  if (!strcmp(key, "opcua.publish.min"))
+    return parse_uint32(value, &g_publishMinDepth);
+
+  if (!strcmp(key, "opcua.publish.max"))
+    return parse_uint32(value, &g_publishMaxDepth);
+
+  if (!strcmp(key, "opcua.reconnect.interval"))
+    return parse_uint32(value, &g_reconnectInterval);
+
+  if (!strcmp(key, "opcua.metadata.ttl"))
+    return parse_uint32(value, &g_metadataTtl);
+
+  if (!strcmp(key, "opcua.chunk.window"))
+    return parse_uint32(value, &g_chunkWindow);
+
+  if (!strcmp(key, "opcua.read.window"))
+    return parse_uint32(value, &g_readWindow);
+
+  if (!strcmp(key, "opcua.browse.pagesize"))
+    return parse_uint32(value, &g_browsePageSize);
+
+  if (!strcmp(key, "opcua.history.slice"))
+    return parse_uint32(value, &g_historySlice);
+
+  if (!strcmp(key, "opcua.history.concurrency"))
+    return parse_uint32(value, &g_historyConcurrency);
+
+  if (!strcmp(key, "opcua.history.buffer.size"))
+    return parse_uint32(value, &g_historyBufferSize);
+
+  if (!strcmp(key, "opcua.history.buffer.depth"))
+    return parse_uint32(value, &g_historyBufferDepth);
+
+  if (!strcmp(key, "opcua.alarm.coalesce"))
+    return parse_uint32(value, &g_alarmCoalesce);
+
+  if (!strcmp(key, "opcua.client.budget"))
+    return parse_uint32(value, &g_clientBudget);
+
+  if (!strcmp(key, "opcua.index.file")) {
+    if (!value)
+      return "no value sepcified";
+    g_indexFile = value;
+    return NULL;
+  }
+
+  if (!strcmp(key, "opcua.index.interval"))
+    return parse_uint32(value, &g_indexInterval);
+
+  if (!strcmp(key, "stats.interval"))
+    return parse_uint32(value, &arg_stats_interval);
+
   return "unknown option";
 }
 
@@ -55,11 +123,20 @@ static void start(void)
 #endif
 
   statusCode = initializeOpcUa(arg_opcua_url, arg_opcua_uri);
+  read_start();
+  alarm_start();
+  publish_start();
+
+  stats_start(arg_stats_interval);
 }
 
 static void stop(void)
 {
   OpcUa_StatusCode statusCode;
+  stats_stop();
+  read_stop();
+  alarm_stop();
+  publish_stop();
   statusCode = clearOpcUa();
 
   OpcUa_ProxyStub_Clear();
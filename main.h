@@ -7,10 +7,147 @@
 #include <opcua_clientapi.h>
 #include <opcua_types.h>
 #include <wpcp.h>
+#include "ring.h"
+
+#define STATS_COUNTERS(XX) \
+  XX(PUBLISH_DEPTH, "publish.depth") \
+  XX(PUBLISH_OUTSTANDING, "publish.outstanding") \
+  XX(PUBLISH_KEEPALIVES, "publish.keepalives") \
+  XX(PUBLISH_ACKNOWLEDGEMENTS_DROPPED, "publish.acknowledgements.dropped") \
+  XX(PUBLISH_NOTIFICATIONS, "publish.notifications") \
+  XX(PUBLISH_LATENCY_TOTAL, "publish.latency.total") \
+  XX(PUBLISH_LATENCY_MAX, "publish.latency.max") \
+  XX(PUBLISH_MESSAGES_DUPLICATE, "publish.messages.duplicate") \
+  XX(PUBLISH_MESSAGES_HELD, "publish.messages.held") \
+  XX(PUBLISH_MESSAGES_LOST, "publish.messages.lost") \
+  XX(RECOVERY_COUNT, "recovery.count") \
+  XX(RECOVERY_TIME_LAST, "recovery.time.last") \
+  XX(RECOVERY_SUBSCRIPTIONS_TRANSFERRED, "recovery.subscriptions.transferred") \
+  XX(RECOVERY_ITEMS_REBUILT, "recovery.items.rebuilt") \
+  XX(RECOVERY_REPUBLISHED, "recovery.republished") \
+  XX(SUBSCRIPTION_GROUPS, "subscription.groups") \
+  XX(SUBSCRIPTION_ENTRIES, "subscription.entries") \
+  XX(SUBSCRIPTION_STALE_NOTIFICATIONS, "subscription.stale.notifications") \
+  XX(SUBSCRIPTION_MONITORED_ITEMS, "subscription.monitoreditems") \
+  XX(SUBSCRIPTION_CONDITION_REFRESHES, "subscription.conditionrefreshes") \
+  XX(READ_CACHE_HITS, "read.cache.hits") \
+  XX(READ_CACHE_MISSES, "read.cache.misses") \
+  XX(METADATA_HITS, "metadata.hits") \
+  XX(METADATA_MISSES, "metadata.misses") \
+  XX(READ_BATCHES, "read.batches") \
+  XX(READ_BATCHES_MERGED, "read.batches.merged") \
+  XX(READ_OPERATIONS, "read.operations") \
+  XX(READ_OPERATIONS_DEDUPLICATED, "read.operations.deduplicated") \
+  XX(READ_WINDOW_LATENCY_TOTAL, "read.window.latency.total") \
+  XX(READ_WINDOW_LATENCY_MAX, "read.window.latency.max") \
+  XX(BROWSE_INDEX_HITS, "browse.index.hits") \
+  XX(BROWSE_INDEX_MISSES, "browse.index.misses") \
+  XX(BROWSE_INDEX_REBUILDS, "browse.index.rebuilds") \
+  XX(PATH_HITS, "path.hits") \
+  XX(PATH_MISSES, "path.misses") \
+  XX(PATH_REBUILDS, "path.rebuilds") \
+  XX(HISTORY_BUFFER_HITS, "history.buffer.hits") \
+  XX(HISTORY_BUFFER_MISSES, "history.buffer.misses") \
+  XX(HISTORY_BUFFER_SAMPLES, "history.buffer.samples") \
+  XX(HISTORY_BUFFER_BYTES, "history.buffer.bytes") \
+  XX(HISTORY_AGGREGATED, "history.aggregated") \
+  XX(HISTORY_DECIMATION_IN, "history.decimation.in") \
+  XX(HISTORY_DECIMATION_OUT, "history.decimation.out") \
+  XX(ALARM_CONDITIONS, "alarm.conditions") \
+  XX(ALARM_COALESCED, "alarm.coalesced") \
+  XX(ALARM_REPUBLISHED_LOCAL, "alarm.republished.local") \
+  XX(CLIENTS, "clients") \
+  XX(CLIENT_QUEUED, "client.queued") \
+  XX(CLIENT_CONFLATED, "client.conflated") \
+  XX(CLIENT_DROPPED, "client.dropped")
+
+enum stats_t {
+#define XX(id, name) STATS_##id,
+  STATS_COUNTERS(XX)
+#undef XX
+  STATS_COUNT
+};
+
+#define OPERATION_LIMITS(XX) \
+  XX(READ, MaxNodesPerRead) \
+  XX(WRITE, MaxNodesPerWrite) \
+  XX(BROWSE, MaxNodesPerBrowse) \
+  XX(MONITORED_ITEMS, MaxMonitoredItemsPerCall) \
+  XX(HISTORY_READ_DATA, MaxNodesPerHistoryReadData) \
+  XX(HISTORY_READ_EVENTS, MaxNodesPerHistoryReadEvents) \
+  XX(METHOD_CALL, MaxNodesPerMethodCall) \
+  XX(TRANSLATE_BROWSE_PATHS, MaxNodesPerTranslateBrowsePathsToNodeIds)
+
+enum operation_limit_t {
+#define XX(id, name) OPERATION_LIMIT_##id,
+  OPERATION_LIMITS(XX)
+#undef XX
+  OPERATION_LIMIT_COUNT
+};
+
+struct chunk_t;
+typedef void (*chunk_begin_t)(struct chunk_t* chunk);
+typedef void (*chunk_finish_t)(void* context);
+
+// splits a batch of operations into requests within an operation limit and keeps up to g_chunkWindow of them in flight,
+// begin runs without the wpcp lock and finish with it
+struct chunker_t {
+  void* context;
+  OpcUa_Int32 count;
+  OpcUa_Int32 size;
+  OpcUa_Int32 offset;
+  OpcUa_Int32 inFlight;
+  OpcUa_Int32 completed;
+  OpcUa_Boolean dispatching;
+  chunk_begin_t begin;
+  chunk_finish_t finish;
+};
+
+struct chunk_t {
+  struct chunker_t* chunker;
+  OpcUa_Int32 offset;
+  OpcUa_Int32 count;
+};
+
+#define SLAB_INDEX_BITS 20
+#define SLAB_GENERATION_MASK ((1u << (32 - SLAB_INDEX_BITS)) - 1)
+
+// chunked storage with stable element addresses, handles combine slot index and generation
+struct slab_t {
+  size_t elementSize;
+  size_t slotSize;
+  OpcUa_Byte** chunks;
+  OpcUa_UInt32* live;
+  OpcUa_UInt32 noOfChunks;
+  OpcUa_UInt16* generations;
+  OpcUa_UInt32 noOfGenerations;
+  OpcUa_UInt32 freeList;
+  OpcUa_UInt32 count;
+};
+
+#define SLAB_STATIC_INITIALIZER(type) { .elementSize = sizeof(type) }
+
+extern OpcUa_UInt32 g_publishMinDepth;
+extern OpcUa_UInt32 g_publishMaxDepth;
+extern OpcUa_UInt32 g_reconnectInterval;
+extern OpcUa_UInt32 g_metadataTtl;
+extern OpcUa_UInt32 g_chunkWindow;
+extern OpcUa_UInt32 g_readWindow;
+extern OpcUa_UInt32 g_browsePageSize;
+extern OpcUa_UInt32 g_historySlice;
+extern OpcUa_UInt32 g_historyConcurrency;
+extern OpcUa_UInt32 g_historyBufferSize;
+extern OpcUa_UInt32 g_historyBufferDepth;
+extern OpcUa_UInt32 g_alarmCoalesce;
+extern OpcUa_UInt32 g_clientBudget;
+extern const OpcUa_CharA* g_indexFile;
+extern OpcUa_UInt32 g_indexInterval;
 
 void handle_alarm(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* token, const struct wpcp_value_t* acknowledge, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count);
 void browse(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* id, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count);
 void read_data(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* id, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count);
+void read_start(void);
+void read_stop(void);
 void write_data(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* id, const struct wpcp_value_t* value, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count);
 void read_history_data(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* id, const struct wpcp_value_t* starttime, const struct wpcp_value_t* endtime, const struct wpcp_value_t* maxresults, const struct wpcp_value_t* aggregation, const struct wpcp_value_t* interval, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count);
 void read_history_alarm(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* id, const struct wpcp_value_t* starttime, const struct wpcp_value_t* endtime, const struct wpcp_value_t* maxresults, const struct wpcp_value_t* filter, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count);
@@ -18,9 +155,25 @@ void subscribe_data(void* user, struct wpcp_result_t* result, struct wpcp_subscr
 void subscribe_alarm(void* user, struct wpcp_result_t* result, struct wpcp_subscription_t* subscription, const struct wpcp_value_t* id, const struct wpcp_value_t* filter, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count);
 void unsubscribe(void* user, struct wpcp_result_t* result, struct wpcp_subscription_t* subscription, void** context, uint32_t remaining);
 void republish(void* user, struct wpcp_publish_handle_t* publish_handle, struct wpcp_subscription_t* subscription);
+void alarm_start(void);
+void alarm_stop(void);
+void publish_start(void);
+void publish_stop(void);
+void publish_printStats(void);
+
+OpcUa_StatusCode toDouble(const struct wpcp_value_t* value, OpcUa_Double* result);
+OpcUa_StatusCode variantToDouble(const OpcUa_Variant* variant, OpcUa_Double* result);
+const struct wpcp_value_t* findAdditional(const struct wpcp_key_value_pair_t* additional, uint32_t additional_count, const char* key);
+const struct wpcp_value_t* findMapValue(const struct wpcp_value_t* map, const char* key);
+#define HASH_INITIAL 2166136261u
 
+OpcUa_UInt32 hashBuffer(OpcUa_UInt32 hash, const void* data, size_t length);
+OpcUa_UInt32 hashNodeId(const OpcUa_NodeId* nodeId);
+size_t toWpcpKey(const struct wpcp_value_t* value, char* buffer, size_t size);
 OpcUa_StatusCode toDateTime(const struct wpcp_value_t* id, OpcUa_DateTime* dateTime);
 OpcUa_StatusCode toNodeId(const struct wpcp_value_t* id, OpcUa_NodeId* nodeId);
+struct path_batch_t;
+OpcUa_StatusCode toNodeIdBatched(const struct wpcp_value_t* id, OpcUa_NodeId* nodeId, struct path_batch_t** batch);
 OpcUa_StatusCode toVariant(const struct wpcp_value_t* value, OpcUa_Variant* variant);
 double toWpcpTime(const OpcUa_DateTime* timestamp, OpcUa_UInt16 picoseconds);
 bool toWpcpId(const OpcUa_NodeId* nodeid, struct wpcp_value_t* value, char* buffer, uint32_t buffer_length);
@@ -30,9 +183,132 @@ bool toWpcpValue2(const OpcUa_Variant* variant, struct wpcp_value_t* value, char
 OpcUa_Channel setupRequestHeader(OpcUa_RequestHeader* requestHeader);
 OpcUa_StatusCode initializeOpcUa(const OpcUa_CharA* url, const OpcUa_CharA* uri);
 OpcUa_StatusCode clearOpcUa(void);
+OpcUa_StatusCode createSubscription(OpcUa_Double publishingInterval, OpcUa_UInt32 lifetimeCount, OpcUa_UInt32 maxKeepAliveCount, OpcUa_UInt32 maxNotificationsPerPublish, OpcUa_UInt32* subscriptionId);
+void registerSubscription(OpcUa_UInt32 subscriptionId, OpcUa_UInt32 maxNotificationsPerPublish);
+void unregisterSubscription(OpcUa_UInt32 subscriptionId);
+OpcUa_Boolean getSubscriptionPublishTime(OpcUa_UInt32 subscriptionId, OpcUa_DateTime* publishTime);
+OpcUa_UInt64 toUInt64(const OpcUa_DateTime* dateTime);
+
+OpcUa_UInt32 chunk_getLimit(enum operation_limit_t limit);
+OpcUa_StatusCode chunk_readLimits(void);
+void chunk_start(struct chunker_t* chunker, OpcUa_UInt32 limit, OpcUa_Int32 count, void* context, chunk_begin_t begin, chunk_finish_t finish);
+void chunk_complete(struct chunk_t* chunk);
+
+void* slab_alloc(struct slab_t* slab, OpcUa_UInt32* handle);
+void slab_free(struct slab_t* slab, OpcUa_UInt32 handle);
+void* slab_get(const struct slab_t* slab, OpcUa_UInt32 handle);
+OpcUa_UInt32 slab_size(const struct slab_t* slab);
+void* slab_at(const struct slab_t* slab, OpcUa_UInt32 index);
+void slab_clear(struct slab_t* slab);
+
+void stats_add(enum stats_t stat, int64_t value);
+void stats_set(enum stats_t stat, int64_t value);
+void stats_max(enum stats_t stat, int64_t value);
+int64_t stats_get(enum stats_t stat);
+void stats_start(OpcUa_UInt32 interval);
+void stats_stop(void);
 
 void variant2string(const struct wpcp_value_t* value, char* buffer, size_t size);
 
 
 void opcua_publishDataChangeNotification(OpcUa_UInt32 subscriptionId, OpcUa_Int32 noOfMonitoredItems, const OpcUa_MonitoredItemNotification* monitoredItems);
 void opcua_publishEventNotificationList(OpcUa_UInt32 subscriptionId, OpcUa_Int32 noOfEvents, const OpcUa_EventFieldList* events);
+struct node_metadata_t {
+  OpcUa_NodeId dataType;
+  OpcUa_Int32 valueRank;
+  OpcUa_Byte accessLevel;
+};
+
+void metadata_initialize(void);
+void metadata_clear(void);
+OpcUa_Boolean metadata_get(const OpcUa_NodeId* nodeId, struct node_metadata_t* metadata);
+void metadata_put(const OpcUa_NodeId* nodeId, const struct node_metadata_t* metadata);
+void metadata_invalidate(const OpcUa_NodeId* nodeId);
+OpcUa_StatusCode metadata_subscribe(void);
+OpcUa_Boolean metadata_isSubscription(OpcUa_UInt32 subscriptionId);
+void metadata_handleEvents(OpcUa_Int32 noOfEvents, const OpcUa_EventFieldList* events);
+
+struct addressspace_browse_t;
+void addressspace_initialize(void);
+void addressspace_clear(void);
+void addressspace_checkNamespaces(void);
+struct addressspace_browse_t* addressspace_browse(const OpcUa_NodeId* nodeId);
+void addressspace_returnBrowse(struct wpcp_result_t* result, struct addressspace_browse_t* browse);
+void addressspace_invalidate(const OpcUa_NodeId* nodeId);
+
+struct search_query_t {
+  OpcUa_UInt32 offset;
+  OpcUa_UInt32 limit;
+  OpcUa_Boolean prefix;
+  OpcUa_UInt32 length;
+  char text[1];
+};
+
+void search_initialize(void);
+void search_clear(void);
+void search_add(const char* id, OpcUa_UInt32 idLength, const char* browseName, OpcUa_UInt32 browseNameLength, const char* displayName, OpcUa_UInt32 displayNameLength, const char* typeDefinition, OpcUa_UInt32 typeDefinitionLength);
+struct search_query_t* search_createQuery(const struct wpcp_key_value_pair_t* additional, uint32_t additional_count);
+void search_returnBrowse(struct wpcp_result_t* result, const struct search_query_t* query);
+
+void path_initialize(void);
+void path_clear(void);
+void path_checkNamespaces(void);
+OpcUa_UInt32 path_getNamespaceHash(void);
+OpcUa_Boolean path_isPath(const struct wpcp_value_t* id);
+OpcUa_StatusCode path_toNodeId(const struct wpcp_value_t* id, OpcUa_NodeId* nodeId);
+OpcUa_StatusCode path_toNodeIdBatched(const struct wpcp_value_t* id, OpcUa_NodeId* nodeId, struct path_batch_t** batch);
+void path_resolveBatch(struct path_batch_t* batch, chunk_finish_t done, void* context);
+
+OpcUa_Boolean aggregate_isSupported(OpcUa_UInt32 aggregateType);
+OpcUa_StatusCode aggregate_compute(OpcUa_UInt32 aggregateType, OpcUa_UInt64 startTime, OpcUa_UInt64 endTime, OpcUa_Double processingInterval, OpcUa_Int32 noOfValues, const OpcUa_DataValue* values, OpcUa_Int32* noOfResults, OpcUa_DataValue** results);
+
+struct decimator_t;
+
+struct decimator_t* decimate_create(OpcUa_UInt64 startTime, OpcUa_UInt64 endTime, OpcUa_UInt32 points);
+void decimate_add(struct decimator_t* decimator, OpcUa_DataValue* dataValue);
+void decimate_finish(struct decimator_t* decimator, OpcUa_Int32* noOfValues, OpcUa_DataValue** values);
+
+struct series_t;
+
+struct series_t* series_create(void);
+void series_delete(struct series_t* series);
+void series_reset(struct series_t* series);
+void series_append(struct series_t* series, const OpcUa_DataValue* dataValue);
+OpcUa_Boolean series_read(struct series_t* series, OpcUa_UInt64 startTime, OpcUa_UInt64 endTime, OpcUa_UInt32 maxValues, OpcUa_Int32* noOfDataValues, OpcUa_DataValue** dataValues);
+
+struct condition_t {
+  struct condition_t* next;
+  struct condition_t* nextPending;
+  OpcUa_UInt32 hash;
+  bool pending;
+  bool retain;
+  bool acknowledged;
+  bool confirmed;
+  OpcUa_UInt16 severity;
+  double time;
+  char* data;
+  char* token;
+  uint32_t tokenLength;
+  char* id;
+  uint32_t idLength;
+  char* message;
+  uint32_t messageLength;
+  uint32_t keyLength;
+  char key[1];
+};
+
+struct condition_table_t;
+typedef void (*condition_callback_t)(void* user, struct condition_t* condition);
+
+struct condition_table_t* condition_createTable(void);
+void condition_deleteTable(struct condition_table_t* table);
+void condition_clear(struct condition_table_t* table);
+struct condition_t* condition_update(struct condition_table_t* table, const char* key, uint32_t keyLength, const struct wpcp_value_t* token, const struct wpcp_value_t* id, double time, OpcUa_UInt16 severity, const char* message, uint32_t messageLength, bool retain, bool acknowledged, bool confirmed);
+void condition_remove(struct condition_table_t* table, struct condition_t* condition);
+bool condition_queue(struct condition_table_t* table, struct condition_t* condition);
+void condition_flush(struct condition_table_t* table, condition_callback_t callback, void* user);
+void condition_forEach(struct condition_table_t* table, condition_callback_t callback, void* user);
+
+OpcUa_Boolean getBufferedHistory(const OpcUa_NodeId* nodeId, const OpcUa_DateTime* startTime, const OpcUa_DateTime* endTime, OpcUa_UInt32 maxValues, OpcUa_Int32* noOfDataValues, OpcUa_DataValue** dataValues);
+OpcUa_Boolean getCachedDataValue(const OpcUa_NodeId* nodeId, OpcUa_Double maxAge, OpcUa_DataValue* dataValue);
+OpcUa_UInt32 opcua_recreateSubscriptions(OpcUa_Int32 noOfSubscriptionIds, const OpcUa_UInt32* subscriptionIds);
@@ -0,0 +1,278 @@
+#include "main.h"
+#include <opcua_string.h>
+#include <assert.h>
+#include <stdlib.h>
+
+OpcUa_UInt32 g_metadataTtl = 300;
+
+struct metadata_entry_t {
+  OpcUa_NodeId nodeId;
+  OpcUa_UInt32 hash;
+  OpcUa_UInt64 expires;
+  struct node_metadata_t metadata;
+  struct metadata_entry_t* next;
+};
+
+static struct metadata_entry_t** g_metadataIndex;
+static OpcUa_UInt32 g_metadataIndexSize;
+static OpcUa_UInt32 g_metadataCount;
+static OpcUa_Mutex g_metadataMutex;
+static volatile OpcUa_UInt32 g_modelChangeSubscriptionId;
+
+static const char* g_modelChangeFields[] = { "EventType", "Changes" };
+
+static OpcUa_UInt64 now(void)
+{
+  OpcUa_DateTime dateTime = OpcUa_DateTime_UtcNow();
+  return toUInt64(&dateTime);
+}
+
+static void freeEntry(struct metadata_entry_t* entry)
+{
+  OpcUa_NodeId_Clear(&entry->nodeId);
+  OpcUa_NodeId_Clear(&entry->metadata.dataType);
+  free(entry);
+  --g_metadataCount;
+}
+
+static struct metadata_entry_t** findEntry(const OpcUa_NodeId* nodeId, OpcUa_UInt32 hash)
+{
+  struct metadata_entry_t** entry = &g_metadataIndex[hash & (g_metadataIndexSize - 1)];
+
+  while (*entry && ((*entry)->hash != hash || OpcUa_NodeId_Compare(&(*entry)->nodeId, nodeId)))
+    entry = &(*entry)->next;
+
+  return entry;
+}
+
+static void growIndex(void)
+{
+  OpcUa_UInt32 size = g_metadataIndexSize ? 2 * g_metadataIndexSize : 256;
+  struct metadata_entry_t** index = calloc(size, sizeof(*index));
+
+  for (OpcUa_UInt32 i = 0; i < g_metadataIndexSize; ++i) {
+    struct metadata_entry_t* entry = g_metadataIndex[i];
+    while (entry) {
+      struct metadata_entry_t* next = entry->next;
+      entry->next = index[entry->hash & (size - 1)];
+      index[entry->hash & (size - 1)] = entry;
+      entry = next;
+    }
+  }
+
+  free(g_metadataIndex);
+  g_metadataIndex = index;
+  g_metadataIndexSize = size;
+}
+
+void metadata_initialize(void)
+{
+  OpcUa_Mutex_Create(&g_metadataMutex);
+}
+
+void metadata_clear(void)
+{
+  metadata_invalidate(NULL);
+  free(g_metadataIndex);
+  g_metadataIndex = NULL;
+  g_metadataIndexSize = 0;
+  OpcUa_Mutex_Delete(&g_metadataMutex);
+}
+
+OpcUa_Boolean metadata_get(const OpcUa_NodeId* nodeId, struct node_metadata_t* metadata)
+{
+  OpcUa_UInt32 hash = hashNodeId(nodeId);
+  OpcUa_Boolean found = OpcUa_False;
+
+  OpcUa_Mutex_Lock(g_metadataMutex);
+  if (g_metadataIndexSize) {
+    struct metadata_entry_t** entry = findEntry(nodeId, hash);
+    if (*entry && (*entry)->expires < now()) {
+      struct metadata_entry_t* expired = *entry;
+      *entry = expired->next;
+      freeEntry(expired);
+    } else if (*entry) {
+      *metadata = (*entry)->metadata;
+      OpcUa_NodeId_CopyTo(&(*entry)->metadata.dataType, &metadata->dataType);
+      found = OpcUa_True;
+    }
+  }
+  OpcUa_Mutex_Unlock(g_metadataMutex);
+
+  stats_add(found ? STATS_METADATA_HITS : STATS_METADATA_MISSES, 1);
+  return found;
+}
+
+void metadata_put(const OpcUa_NodeId* nodeId, const struct node_metadata_t* metadata)
+{
+  OpcUa_UInt32 hash = hashNodeId(nodeId);
+
+  OpcUa_Mutex_Lock(g_metadataMutex);
+  if (g_metadataCount >= g_metadataIndexSize)
+    growIndex();
+
+  struct metadata_entry_t** entry = findEntry(nodeId, hash);
+  if (!*entry) {
+    *entry = malloc(sizeof(struct metadata_entry_t));
+    OpcUa_NodeId_CopyTo(nodeId, &(*entry)->nodeId);
+    (*entry)->hash = hash;
+    (*entry)->next = NULL;
+    ++g_metadataCount;
+  } else
+    OpcUa_NodeId_Clear(&(*entry)->metadata.dataType);
+
+  (*entry)->expires = now() + (OpcUa_UInt64)g_metadataTtl * 10000000;
+  (*entry)->metadata = *metadata;
+  OpcUa_NodeId_CopyTo(&metadata->dataType, &(*entry)->metadata.dataType);
+  OpcUa_Mutex_Unlock(g_metadataMutex);
+}
+
+// invalidates a single node or everything if no node is given
+void metadata_invalidate(const OpcUa_NodeId* nodeId)
+{
+  OpcUa_Mutex_Lock(g_metadataMutex);
+  if (nodeId && g_metadataIndexSize) {
+    struct metadata_entry_t** entry = findEntry(nodeId, hashNodeId(nodeId));
+    struct metadata_entry_t* current = *entry;
+    if (current) {
+      *entry = current->next;
+      freeEntry(current);
+    }
+  } else if (!nodeId) {
+    for (OpcUa_UInt32 i = 0; i < g_metadataIndexSize; ++i) {
+      while (g_metadataIndex[i]) {
+        struct metadata_entry_t* current = g_metadataIndex[i];
+        g_metadataIndex[i] = current->next;
+        freeEntry(current);
+      }
+    }
+  }
+  OpcUa_Mutex_Unlock(g_metadataMutex);
+}
+
+// model changes are reported via a separate subscription on the server object
+OpcUa_StatusCode metadata_subscribe(void)
+{
+  OpcUa_UInt32 subscriptionId;
+  OpcUa_StatusCode statusCode = createSubscription(1000.0, 60, 20, 0, &subscriptionId);
+  if (OpcUa_IsBad(statusCode))
+    return statusCode;
+
+  OpcUa_QualifiedName browsePath[2];
+  OpcUa_SimpleAttributeOperand selectClauses[2];
+  for (OpcUa_Int32 i = 0; i < 2; ++i) {
+    OpcUa_QualifiedName_Initialize(&browsePath[i]);
+    OpcUa_String_AttachReadOnly(&browsePath[i].Name, g_modelChangeFields[i]);
+    OpcUa_SimpleAttributeOperand_Initialize(&selectClauses[i]);
+    selectClauses[i].TypeDefinitionId.Identifier.Numeric = OpcUaId_BaseEventType;
+    selectClauses[i].AttributeId = OpcUa_Attributes_Value;
+    selectClauses[i].NoOfBrowsePath = 1;
+    selectClauses[i].BrowsePath = &browsePath[i];
+  }
+  selectClauses[1].TypeDefinitionId.Identifier.Numeric = OpcUaId_GeneralModelChangeEventType;
+
+  OpcUa_NodeId eventType;
+  OpcUa_NodeId_Initialize(&eventType);
+  eventType.Identifier.Numeric = OpcUaId_BaseModelChangeEventType;
+
+  OpcUa_LiteralOperand literal;
+  OpcUa_LiteralOperand_Initialize(&literal);
+  literal.Value.Datatype = OpcUaType_NodeId;
+  literal.Value.Value.NodeId = &eventType;
+
+  OpcUa_ExtensionObject filterOperand;
+  OpcUa_ExtensionObject_Initialize(&filterOperand);
+  filterOperand.Encoding = OpcUa_ExtensionObjectEncoding_EncodeableObject;
+  filterOperand.Body.EncodeableObject.Type = &OpcUa_LiteralOperand_EncodeableType;
+  filterOperand.Body.EncodeableObject.Object = &literal;
+
+  OpcUa_ContentFilterElement element;
+  OpcUa_ContentFilterElement_Initialize(&element);
+  element.FilterOperator = OpcUa_FilterOperator_OfType;
+  element.NoOfFilterOperands = 1;
+  element.FilterOperands = &filterOperand;
+
+  OpcUa_EventFilter eventFilter;
+  OpcUa_EventFilter_Initialize(&eventFilter);
+  eventFilter.NoOfSelectClauses = 2;
+  eventFilter.SelectClauses = selectClauses;
+  eventFilter.WhereClause.NoOfElements = 1;
+  eventFilter.WhereClause.Elements = &element;
+
+  OpcUa_MonitoredItemCreateRequest monitoredItemCreateRequest;
+  OpcUa_MonitoredItemCreateRequest_Initialize(&monitoredItemCreateRequest);
+  monitoredItemCreateRequest.ItemToMonitor.NodeId.Identifier.Numeric = OpcUaId_Server;
+  monitoredItemCreateRequest.ItemToMonitor.AttributeId = OpcUa_Attributes_EventNotifier;
+  monitoredItemCreateRequest.MonitoringMode = OpcUa_MonitoringMode_Reporting;
+  monitoredItemCreateRequest.RequestedParameters.Filter.Encoding = OpcUa_ExtensionObjectEncoding_EncodeableObject;
+  monitoredItemCreateRequest.RequestedParameters.Filter.Body.EncodeableObject.Type = &OpcUa_EventFilter_EncodeableType;
+  monitoredItemCreateRequest.RequestedParameters.Filter.Body.EncodeableObject.Object = &eventFilter;
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_ResponseHeader responseHeader;
+  OpcUa_Int32 noOfResults = 0;
+  OpcUa_MonitoredItemCreateResult* results = NULL;
+  OpcUa_Int32 noOfDiagnosticInfos = 0;
+  OpcUa_DiagnosticInfo* diagnosticInfos = NULL;
+
+  OpcUa_ResponseHeader_Initialize(&responseHeader);
+  statusCode = OpcUa_ClientApi_CreateMonitoredItems(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    subscriptionId,
+    OpcUa_TimestampsToReturn_Neither,
+    1,
+    &monitoredItemCreateRequest,
+    &responseHeader,
+    &noOfResults,
+    &results,
+    &noOfDiagnosticInfos,
+    &diagnosticInfos);
+
+  if (OpcUa_IsGood(statusCode))
+    statusCode = responseHeader.ServiceResult;
+  if (OpcUa_IsGood(statusCode))
+    statusCode = noOfResults == 1 ? results[0].StatusCode : OpcUa_Bad;
+
+  OpcUa_ResponseHeader_Clear(&responseHeader);
+  OpcUa_Memory_Free(results);
+
+  if (OpcUa_IsGood(statusCode))
+    g_modelChangeSubscriptionId = subscriptionId;
+  else
+    unregisterSubscription(subscriptionId);
+
+  return statusCode;
+}
+
+OpcUa_Boolean metadata_isSubscription(OpcUa_UInt32 subscriptionId)
+{
+  return subscriptionId && subscriptionId == g_modelChangeSubscriptionId;
+}
+
+static void invalidateNode(const OpcUa_NodeId* nodeId)
+{
+  metadata_invalidate(nodeId);
+  addressspace_invalidate(nodeId);
+}
+
+void metadata_handleEvents(OpcUa_Int32 noOfEvents, const OpcUa_EventFieldList* events)
+{
+  for (OpcUa_Int32 i = 0; i < noOfEvents; ++i) {
+    const OpcUa_Variant* changes = events[i].NoOfEventFields == 2 ? &events[i].EventFields[1] : NULL;
+
+    // a model change without details may affect any node
+    if (!changes || changes->Datatype != OpcUaType_ExtensionObject || changes->ArrayType != OpcUa_VariantArrayType_Array) {
+      invalidateNode(NULL);
+      continue;
+    }
+
+    for (OpcUa_Int32 j = 0; j < changes->Value.Array.Length; ++j) {
+      const OpcUa_ExtensionObject* change = &changes->Value.Array.Value.ExtensionObjectArray[j];
+      if (change->Encoding == OpcUa_ExtensionObjectEncoding_EncodeableObject && change->Body.EncodeableObject.Type == &OpcUa_ModelChangeStructureDataType_EncodeableType)
+        invalidateNode(&((const OpcUa_ModelChangeStructureDataType*)change->Body.EncodeableObject.Object)->Affected);
+      else
+        invalidateNode(NULL);
+    }
+  }
+}
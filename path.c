@@ -0,0 +1,560 @@
+#include "main.h"
+#include <opcua_string.h>
+#include <wpcp_lws.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PATH_PREFIX "nsu="
+#define PATH_SEPARATOR ";p="
+
+// resolved ids are keyed by their full text, e.g. nsu=urn:plc;p=Line1/Motor/Speed,
+// a path which does not exist is kept with its status code for the namespace table it was resolved with
+struct path_entry_t {
+  char* key;
+  OpcUa_UInt32 length;
+  OpcUa_UInt32 hash;
+  OpcUa_NodeId nodeId;
+  OpcUa_StatusCode statusCode;
+  OpcUa_UInt32 namespaceHash;
+  struct path_entry_t* next;
+};
+
+struct path_request_t {
+  const char* key;
+  OpcUa_UInt32 length;
+  OpcUa_NodeId nodeId;
+  OpcUa_StatusCode statusCode;
+};
+
+// the paths of a batch missing in the cache, resolved together once the last item of the batch arrived
+struct path_batch_t {
+  OpcUa_Int32 count;
+  OpcUa_Int32 size;
+  struct path_request_t* requests;
+  OpcUa_NodeId** nodeIds;
+  struct chunker_t chunker;
+  chunk_finish_t done;
+  void* context;
+};
+
+// the browse paths of one TranslateBrowsePathsToNodeIds request, requests without a valid path are not sent
+struct path_translate_t {
+  struct chunk_t* chunk;
+  struct path_request_t* requests;
+  OpcUa_Int32 noOfBrowsePaths;
+  OpcUa_Int32* requestNr;
+  OpcUa_BrowsePath* browsePaths;
+};
+
+static struct path_entry_t** g_pathIndex;
+static OpcUa_UInt32 g_pathIndexSize;
+static OpcUa_UInt32 g_pathCount;
+static OpcUa_Mutex g_pathMutex;
+static OpcUa_String* g_namespaceUris;
+static OpcUa_Int32 g_noOfNamespaceUris;
+static OpcUa_UInt32 g_namespaceHash;
+
+static struct path_entry_t** findEntry(const char* key, OpcUa_UInt32 length, OpcUa_UInt32 hash)
+{
+  struct path_entry_t** entry = &g_pathIndex[hash & (g_pathIndexSize - 1)];
+
+  while (*entry && ((*entry)->hash != hash || (*entry)->length != length || memcmp((*entry)->key, key, length)))
+    entry = &(*entry)->next;
+
+  return entry;
+}
+
+static void growIndex(void)
+{
+  OpcUa_UInt32 size = g_pathIndexSize ? 2 * g_pathIndexSize : 256;
+  struct path_entry_t** index = calloc(size, sizeof(*index));
+
+  for (OpcUa_UInt32 i = 0; i < g_pathIndexSize; ++i) {
+    struct path_entry_t* entry = g_pathIndex[i];
+    while (entry) {
+      struct path_entry_t* next = entry->next;
+      entry->next = index[entry->hash & (size - 1)];
+      index[entry->hash & (size - 1)] = entry;
+      entry = next;
+    }
+  }
+
+  free(g_pathIndex);
+  g_pathIndex = index;
+  g_pathIndexSize = size;
+}
+
+static void putEntry(const char* key, OpcUa_UInt32 length, const OpcUa_NodeId* nodeId, OpcUa_StatusCode statusCode)
+{
+  OpcUa_UInt32 hash = hashBuffer(HASH_INITIAL, key, length);
+
+  OpcUa_Mutex_Lock(g_pathMutex);
+  if (g_pathCount >= g_pathIndexSize)
+    growIndex();
+
+  struct path_entry_t** entry = findEntry(key, length, hash);
+  if (!*entry) {
+    *entry = malloc(sizeof(struct path_entry_t));
+    (*entry)->key = malloc(length);
+    memcpy((*entry)->key, key, length);
+    (*entry)->length = length;
+    (*entry)->hash = hash;
+    (*entry)->next = NULL;
+    ++g_pathCount;
+  } else
+    OpcUa_NodeId_Clear(&(*entry)->nodeId);
+  OpcUa_NodeId_CopyTo(nodeId, &(*entry)->nodeId);
+  (*entry)->statusCode = statusCode;
+  (*entry)->namespaceHash = g_namespaceHash;
+  OpcUa_Mutex_Unlock(g_pathMutex);
+}
+
+static OpcUa_Boolean getEntry(const char* key, OpcUa_UInt32 length, OpcUa_NodeId* nodeId, OpcUa_StatusCode* statusCode)
+{
+  OpcUa_UInt32 hash = hashBuffer(HASH_INITIAL, key, length);
+
+  OpcUa_Mutex_Lock(g_pathMutex);
+  struct path_entry_t** entry = g_pathIndexSize ? findEntry(key, length, hash) : NULL;
+  OpcUa_Boolean found = entry && *entry && (OpcUa_IsGood((*entry)->statusCode) || (*entry)->namespaceHash == g_namespaceHash);
+  if (found) {
+    OpcUa_NodeId_CopyTo(&(*entry)->nodeId, nodeId);
+    *statusCode = (*entry)->statusCode;
+  }
+  OpcUa_Mutex_Unlock(g_pathMutex);
+
+  stats_add(found ? STATS_PATH_HITS : STATS_PATH_MISSES, 1);
+  return found;
+}
+
+static void clearEntries(void)
+{
+  for (OpcUa_UInt32 i = 0; i < g_pathIndexSize; ++i) {
+    struct path_entry_t* entry = g_pathIndex[i];
+    while (entry) {
+      struct path_entry_t* next = entry->next;
+      OpcUa_NodeId_Clear(&entry->nodeId);
+      free(entry->key);
+      free(entry);
+      entry = next;
+    }
+    g_pathIndex[i] = NULL;
+  }
+  g_pathCount = 0;
+}
+
+OpcUa_Boolean path_isPath(const struct wpcp_value_t* id)
+{
+  return id->type == WPCP_VALUE_TYPE_TEXT_STRING && id->value.length > 4 && !memcmp(id->data.text_string, PATH_PREFIX, 4);
+}
+
+// the browse names of the path are qualified with the namespace of the given uri
+static OpcUa_StatusCode toBrowsePath(const char* key, OpcUa_UInt32 length, OpcUa_BrowsePath* browsePath)
+{
+  const char* uri = key + strlen(PATH_PREFIX);
+  const char* end = key + length;
+  const char* path = uri;
+
+  while (path + strlen(PATH_SEPARATOR) <= end && memcmp(path, PATH_SEPARATOR, strlen(PATH_SEPARATOR)))
+    ++path;
+  if (path + strlen(PATH_SEPARATOR) >= end)
+    return OpcUa_BadInvalidArgument;
+
+  OpcUa_Int32 namespaceIndex = -1;
+  OpcUa_UInt32 uriLength = (OpcUa_UInt32)(path - uri);
+  OpcUa_Mutex_Lock(g_pathMutex);
+  for (OpcUa_Int32 i = 0; i < g_noOfNamespaceUris && namespaceIndex < 0; ++i) {
+    if (OpcUa_String_StrSize(&g_namespaceUris[i]) == uriLength && !memcmp(OpcUa_String_GetRawString(&g_namespaceUris[i]), uri, uriLength))
+      namespaceIndex = i;
+  }
+  OpcUa_Mutex_Unlock(g_pathMutex);
+  if (namespaceIndex < 0)
+    return OpcUa_BadNodeIdUnknown;
+
+  path += strlen(PATH_SEPARATOR);
+  OpcUa_Int32 noOfElements = 1;
+  for (const char* c = path; c < end; ++c) {
+    if (*c == '/')
+      ++noOfElements;
+  }
+
+  OpcUa_BrowsePath_Initialize(browsePath);
+  browsePath->StartingNode.Identifier.Numeric = OpcUaId_ObjectsFolder;
+  browsePath->RelativePath.NoOfElements = noOfElements;
+  browsePath->RelativePath.Elements = OpcUa_Memory_Alloc(noOfElements * sizeof(OpcUa_RelativePathElement));
+
+  for (OpcUa_Int32 i = 0; i < noOfElements; ++i) {
+    OpcUa_RelativePathElement* element = &browsePath->RelativePath.Elements[i];
+    const char* name = path;
+    while (path < end && *path != '/')
+      ++path;
+
+    OpcUa_RelativePathElement_Initialize(element);
+    element->ReferenceTypeId.Identifier.Numeric = OpcUaId_HierarchicalReferences;
+    element->IncludeSubtypes = OpcUa_True;
+    element->TargetName.NamespaceIndex = (OpcUa_UInt16)namespaceIndex;
+    OpcUa_String_AttachToString((OpcUa_StringA)name, (OpcUa_UInt32)(path - name), (OpcUa_UInt32)(path - name), OpcUa_True, OpcUa_False, &element->TargetName.Name);
+    ++path;
+  }
+
+  return OpcUa_Good;
+}
+
+static struct path_translate_t* createTranslate(OpcUa_Int32 count, struct path_request_t* requests)
+{
+  struct path_translate_t* translate = malloc(sizeof(struct path_translate_t) + count * (sizeof(OpcUa_BrowsePath) + sizeof(OpcUa_Int32)));
+  translate->chunk = NULL;
+  translate->requests = requests;
+  translate->noOfBrowsePaths = 0;
+  translate->browsePaths = (OpcUa_BrowsePath*)(translate + 1);
+  translate->requestNr = (OpcUa_Int32*)(translate->browsePaths + count);
+
+  for (OpcUa_Int32 i = 0; i < count; ++i) {
+    requests[i].statusCode = toBrowsePath(requests[i].key, requests[i].length, &translate->browsePaths[translate->noOfBrowsePaths]);
+    if (OpcUa_IsGood(requests[i].statusCode))
+      translate->requestNr[translate->noOfBrowsePaths++] = i;
+  }
+
+  return translate;
+}
+
+// only a local target which matched the full path counts
+static void finishTranslate(struct path_translate_t* translate, OpcUa_StatusCode statusCode, OpcUa_Int32 noOfResults, const OpcUa_BrowsePathResult* results)
+{
+  for (OpcUa_Int32 i = 0; i < translate->noOfBrowsePaths; ++i) {
+    struct path_request_t* request = &translate->requests[translate->requestNr[i]];
+    const OpcUa_BrowsePathResult* result = OpcUa_IsGood(statusCode) && i < noOfResults ? &results[i] : NULL;
+    request->statusCode = result ? result->StatusCode : statusCode;
+    if (OpcUa_IsGood(request->statusCode))
+      request->statusCode = OpcUa_BadNoMatch;
+
+    for (OpcUa_Int32 j = 0; result && OpcUa_IsGood(result->StatusCode) && j < result->NoOfTargets; ++j) {
+      const OpcUa_BrowsePathTarget* target = &result->Targets[j];
+      if (target->RemainingPathIndex == OpcUa_UInt32_Max && target->TargetId.ServerIndex == 0) {
+        OpcUa_NodeId_CopyTo(&target->TargetId.NodeId, &request->nodeId);
+        request->statusCode = OpcUa_Good;
+        break;
+      }
+    }
+  }
+
+  for (OpcUa_Int32 i = 0; i < translate->noOfBrowsePaths; ++i)
+    OpcUa_BrowsePath_Clear(&translate->browsePaths[i]);
+  free(translate);
+}
+
+static void translateChunk(OpcUa_Int32 count, struct path_request_t* requests)
+{
+  struct path_translate_t* translate = createTranslate(count, requests);
+  OpcUa_StatusCode statusCode = OpcUa_Good;
+  OpcUa_Int32 noOfResults = 0;
+  OpcUa_BrowsePathResult* results = NULL;
+
+  if (translate->noOfBrowsePaths) {
+    OpcUa_RequestHeader requestHeader;
+    OpcUa_ResponseHeader responseHeader;
+    OpcUa_Int32 noOfDiagnosticInfos = 0;
+    OpcUa_DiagnosticInfo* diagnosticInfos = NULL;
+
+    OpcUa_ResponseHeader_Initialize(&responseHeader);
+    statusCode = OpcUa_ClientApi_TranslateBrowsePathsToNodeIds(
+      setupRequestHeader(&requestHeader),
+      &requestHeader,
+      translate->noOfBrowsePaths,
+      translate->browsePaths,
+      &responseHeader,
+      &noOfResults,
+      &results,
+      &noOfDiagnosticInfos,
+      &diagnosticInfos);
+
+    if (OpcUa_IsGood(statusCode))
+      statusCode = responseHeader.ServiceResult;
+    OpcUa_ResponseHeader_Clear(&responseHeader);
+  }
+
+  finishTranslate(translate, statusCode, noOfResults, results);
+
+  for (OpcUa_Int32 i = 0; i < noOfResults; ++i)
+    OpcUa_BrowsePathResult_Clear(&results[i]);
+  OpcUa_Memory_Free(results);
+}
+
+// failures of the service itself are not cached, the path may resolve with the next request
+static OpcUa_Boolean isPathUnknown(OpcUa_StatusCode statusCode)
+{
+  switch (statusCode) {
+  case OpcUa_BadNoMatch:
+  case OpcUa_BadNodeIdUnknown:
+  case OpcUa_BadBrowseNameInvalid:
+  case OpcUa_BadInvalidArgument:
+    return OpcUa_True;
+  default:
+    return OpcUa_False;
+  }
+}
+
+static void cacheResults(OpcUa_Int32 count, const struct path_request_t* requests)
+{
+  for (OpcUa_Int32 i = 0; i < count; ++i) {
+    if (OpcUa_IsGood(requests[i].statusCode) || isPathUnknown(requests[i].statusCode))
+      putEntry(requests[i].key, requests[i].length, &requests[i].nodeId, requests[i].statusCode);
+  }
+}
+
+// resolves all paths with as few requests as the operation limit allows and caches the results,
+// blocks for the round trips and is only used off the connection thread or for single ids
+static void resolvePaths(OpcUa_Int32 count, struct path_request_t* requests)
+{
+  OpcUa_UInt32 limit = chunk_getLimit(OPERATION_LIMIT_TRANSLATE_BROWSE_PATHS);
+  OpcUa_Int32 size = limit && limit < (OpcUa_UInt32)count ? (OpcUa_Int32)limit : count;
+
+  for (OpcUa_Int32 i = 0; i < count; ++i)
+    OpcUa_NodeId_Initialize(&requests[i].nodeId);
+
+  for (OpcUa_Int32 offset = 0; offset < count; offset += size)
+    translateChunk(count - offset < size ? count - offset : size, &requests[offset]);
+
+  cacheResults(count, requests);
+}
+
+// an unresolvable path results in a null node id, which the server rejects
+OpcUa_StatusCode path_toNodeId(const struct wpcp_value_t* id, OpcUa_NodeId* nodeId)
+{
+  OpcUa_StatusCode statusCode;
+
+  OpcUa_NodeId_Initialize(nodeId);
+  if (getEntry(id->data.text_string, id->value.length, nodeId, &statusCode))
+    return statusCode;
+
+  struct path_request_t request = { .key = id->data.text_string, .length = id->value.length };
+  resolvePaths(1, &request);
+  *nodeId = request.nodeId;
+  return request.statusCode;
+}
+
+// a miss leaves the node id null until path_resolveBatch, so nodeId has to stay in place until then
+OpcUa_StatusCode path_toNodeIdBatched(const struct wpcp_value_t* id, OpcUa_NodeId* nodeId, struct path_batch_t** batch)
+{
+  OpcUa_StatusCode statusCode;
+
+  OpcUa_NodeId_Initialize(nodeId);
+  if (getEntry(id->data.text_string, id->value.length, nodeId, &statusCode))
+    return statusCode;
+
+  if (!*batch)
+    *batch = calloc(1, sizeof(struct path_batch_t));
+  struct path_batch_t* pending = *batch;
+  if (pending->count == pending->size) {
+    pending->size = pending->size ? 2 * pending->size : 16;
+    pending->requests = realloc(pending->requests, pending->size * sizeof(struct path_request_t));
+    pending->nodeIds = realloc(pending->nodeIds, pending->size * sizeof(OpcUa_NodeId*));
+  }
+
+  // the text of the id only lives as long as the callback of its item
+  char* key = malloc(id->value.length);
+  memcpy(key, id->data.text_string, id->value.length);
+  pending->requests[pending->count].key = key;
+  pending->requests[pending->count].length = id->value.length;
+  pending->nodeIds[pending->count++] = nodeId;
+  return OpcUa_Good;
+}
+
+static OpcUa_StatusCode opcua_translate_paths(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+{
+  struct path_translate_t* translate = pCallbackData;
+  struct chunk_t* chunk = translate->chunk;
+  OpcUa_TranslateBrowsePathsToNodeIdsResponse* pTranslateResponse = pResponse;
+  OpcUa_StatusCode statusCode = uStatus;
+
+  if (OpcUa_IsGood(statusCode) && pTranslateResponse)
+    statusCode = pTranslateResponse->ResponseHeader.ServiceResult;
+  finishTranslate(translate, statusCode, pTranslateResponse ? pTranslateResponse->NoOfResults : 0, pTranslateResponse ? pTranslateResponse->Results : NULL);
+
+  wpcp_lws_lock();
+  chunk_complete(chunk);
+  wpcp_lws_unlock();
+
+  return OpcUa_Good;
+}
+
+static void beginTranslate(struct chunk_t* chunk)
+{
+  struct path_batch_t* batch = chunk->chunker->context;
+  struct path_translate_t* translate = createTranslate(chunk->count, &batch->requests[chunk->offset]);
+  translate->chunk = chunk;
+
+  if (!translate->noOfBrowsePaths) {
+    opcua_translate_paths(OpcUa_Null, OpcUa_Null, OpcUa_Null, translate, OpcUa_Good);
+    return;
+  }
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginTranslateBrowsePathsToNodeIds(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    translate->noOfBrowsePaths,
+    translate->browsePaths,
+    opcua_translate_paths,
+    translate);
+  if (!OpcUa_IsGood(statusCode))
+    opcua_translate_paths(OpcUa_Null, OpcUa_Null, OpcUa_Null, translate, statusCode);
+}
+
+static void finishBatch(void* context)
+{
+  struct path_batch_t* batch = context;
+
+  cacheResults(batch->count, batch->requests);
+  for (OpcUa_Int32 i = 0; i < batch->count; ++i) {
+    *batch->nodeIds[i] = batch->requests[i].nodeId;
+    free((char*)batch->requests[i].key);
+  }
+
+  batch->done(batch->context);
+  free(batch->requests);
+  free(batch->nodeIds);
+  free(batch);
+}
+
+// has to be called with the wpcp lock held exactly once, done is called with it held once the node ids are written,
+// right away if nothing was missing in the cache
+void path_resolveBatch(struct path_batch_t* batch, chunk_finish_t done, void* context)
+{
+  if (!batch) {
+    done(context);
+    return;
+  }
+
+  batch->done = done;
+  batch->context = context;
+  for (OpcUa_Int32 i = 0; i < batch->count; ++i)
+    OpcUa_NodeId_Initialize(&batch->requests[i].nodeId);
+
+  chunk_start(&batch->chunker, chunk_getLimit(OPERATION_LIMIT_TRANSLATE_BROWSE_PATHS), batch->count, batch, beginTranslate, finishBatch);
+}
+
+// all cached paths are resolved again, since their browse names refer to other namespace indices now
+static void rebuildCache(void)
+{
+  OpcUa_Mutex_Lock(g_pathMutex);
+  struct path_request_t* requests = malloc((g_pathCount ? g_pathCount : 1) * sizeof(struct path_request_t));
+  OpcUa_Int32 count = 0;
+  for (OpcUa_UInt32 i = 0; i < g_pathIndexSize; ++i) {
+    for (struct path_entry_t* entry = g_pathIndex[i]; entry; entry = entry->next) {
+      // paths which did not exist are looked up again when used
+      if (OpcUa_IsBad(entry->statusCode))
+        continue;
+      char* key = malloc(entry->length);
+      memcpy(key, entry->key, entry->length);
+      requests[count].key = key;
+      requests[count++].length = entry->length;
+    }
+  }
+  clearEntries();
+  OpcUa_Mutex_Unlock(g_pathMutex);
+
+  resolvePaths(count, requests);
+
+  for (OpcUa_Int32 i = 0; i < count; ++i) {
+    OpcUa_NodeId_Clear(&requests[i].nodeId);
+    free((char*)requests[i].key);
+  }
+  free(requests);
+
+  stats_add(STATS_PATH_REBUILDS, 1);
+}
+
+OpcUa_UInt32 path_getNamespaceHash(void)
+{
+  OpcUa_Mutex_Lock(g_pathMutex);
+  OpcUa_UInt32 hash = g_namespaceHash;
+  OpcUa_Mutex_Unlock(g_pathMutex);
+  return hash;
+}
+
+void path_checkNamespaces(void)
+{
+  OpcUa_ReadValueId readValueId;
+  OpcUa_ReadValueId_Initialize(&readValueId);
+  readValueId.NodeId.Identifier.Numeric = OpcUaId_Server_NamespaceArray;
+  readValueId.AttributeId = OpcUa_Attributes_Value;
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_ResponseHeader responseHeader;
+  OpcUa_Int32 noOfResults = 0;
+  OpcUa_DataValue* results = NULL;
+  OpcUa_Int32 noOfDiagnosticInfos = 0;
+  OpcUa_DiagnosticInfo* diagnosticInfos = NULL;
+
+  OpcUa_ResponseHeader_Initialize(&responseHeader);
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_Read(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    0.0,
+    OpcUa_TimestampsToReturn_Neither,
+    1,
+    &readValueId,
+    &responseHeader,
+    &noOfResults,
+    &results,
+    &noOfDiagnosticInfos,
+    &diagnosticInfos);
+
+  if (OpcUa_IsGood(statusCode))
+    statusCode = responseHeader.ServiceResult;
+  OpcUa_ResponseHeader_Clear(&responseHeader);
+
+  OpcUa_Boolean changed = OpcUa_False;
+  if (OpcUa_IsGood(statusCode) && noOfResults == 1 && results[0].Value.Datatype == OpcUaType_String && results[0].Value.ArrayType == OpcUa_VariantArrayType_Array) {
+    OpcUa_Int32 noOfNamespaceUris = results[0].Value.Value.Array.Length;
+    OpcUa_String* namespaceUris = results[0].Value.Value.Array.Value.StringArray;
+    OpcUa_UInt32 hash = HASH_INITIAL;
+    for (OpcUa_Int32 i = 0; i < noOfNamespaceUris; ++i) {
+      OpcUa_UInt32 length = OpcUa_String_StrSize(&namespaceUris[i]);
+      hash = hashBuffer(hash, &length, sizeof(length));
+      hash = hashBuffer(hash, OpcUa_String_GetRawString(&namespaceUris[i]), length);
+    }
+
+    // the array is moved out of the result
+    OpcUa_Mutex_Lock(g_pathMutex);
+    changed = g_namespaceHash && g_namespaceHash != hash;
+    for (OpcUa_Int32 i = 0; i < g_noOfNamespaceUris; ++i)
+      OpcUa_String_Clear(&g_namespaceUris[i]);
+    OpcUa_Memory_Free(g_namespaceUris);
+    g_namespaceUris = namespaceUris;
+    g_noOfNamespaceUris = noOfNamespaceUris;
+    g_namespaceHash = hash;
+    OpcUa_Mutex_Unlock(g_pathMutex);
+
+    OpcUa_Variant_Initialize(&results[0].Value);
+  }
+
+  for (OpcUa_Int32 i = 0; i < noOfResults; ++i)
+    OpcUa_DataValue_Clear(&results[i]);
+  OpcUa_Memory_Free(results);
+
+  if (changed)
+    rebuildCache();
+}
+
+void path_initialize(void)
+{
+  OpcUa_Mutex_Create(&g_pathMutex);
+}
+
+void path_clear(void)
+{
+  clearEntries();
+  free(g_pathIndex);
+  g_pathIndex = NULL;
+  g_pathIndexSize = 0;
+
+  for (OpcUa_Int32 i = 0; i < g_noOfNamespaceUris; ++i)
+    OpcUa_String_Clear(&g_namespaceUris[i]);
+  OpcUa_Memory_Free(g_namespaceUris);
+  g_namespaceUris = NULL;
+  g_noOfNamespaceUris = 0;
+  g_namespaceHash = 0;
+
+  OpcUa_Mutex_Delete(&g_pathMutex);
+}
@@ -2,29 +2,177 @@
 #include <opcua_string.h>
 #include <wpcp_lws.h>
 #include <assert.h>
+#include <inttypes.h>
+#include <math.h>
 #include <stdlib.h>
 
-extern OpcUa_UInt32 g_subscriptionId;
+#define MAX_MONITORED_ITEMS_PER_RECREATE 1000
+#define CLIENT_FLUSH_INTERVAL 50
+
+struct rate_class_t {
+  OpcUa_Double publishingInterval;
+  OpcUa_UInt32 lifetimeCount;
+  OpcUa_UInt32 maxKeepAliveCount;
+  OpcUa_UInt32 maxNotificationsPerPublish;
+};
+
+// keep alive every few seconds and a lifetime of at least three keep alive intervals
+static const struct rate_class_t g_rateClasses[] = {
+  {     0.0, 300, 100, 1024 },
+  {   100.0, 150,  50, 1024 },
+  {   250.0,  60,  20,  512 },
+  {  1000.0,  30,  10,  256 },
+  {  5000.0,  12,   3,  128 },
+  { 30000.0,   6,   1,  128 }
+};
+
+#define RATE_CLASS_COUNT ((OpcUa_Int32)(sizeof(g_rateClasses) / sizeof(g_rateClasses[0])))
+
+enum subscription_group_state_t {
+  SUBSCRIPTION_GROUP_STATE_NONE,
+  SUBSCRIPTION_GROUP_STATE_CREATING,
+  SUBSCRIPTION_GROUP_STATE_READY
+};
+
+struct SubscribeHelperBatch;
+struct SubscribeHelperItem;
+
+struct subscription_group_t {
+  enum subscription_group_state_t state;
+  OpcUa_UInt32 subscriptionId;
+  size_t count;
+  struct SubscribeHelperBatch* waiting;
+};
+
+static struct subscription_group_t g_groups[RATE_CLASS_COUNT];
 
 enum subscription_type_t {
   SUBSCRIPTION_TYPE_STATE_DATA,
   SUBSCRIPTION_TYPE_FILTER_ALARM
 };
 
-struct subscription_entry_t {
+enum refresh_state_t {
+  REFRESH_STATE_IDLE,
+  REFRESH_STATE_REQUESTED,
+  REFRESH_STATE_RUNNING
+};
+
+enum monitored_item_state_t {
+  MONITORED_ITEM_STATE_CREATING,
+  MONITORED_ITEM_STATE_READY,
+  MONITORED_ITEM_STATE_FAILED
+};
+
+struct subscription_entry_t;
+
+// monitoring parameters of a data item, part of the key to share monitored items
+struct data_change_parameters_t {
+  OpcUa_Double samplingInterval;
+  OpcUa_Double deadbandValue;
+  OpcUa_UInt32 deadbandType;
+  OpcUa_UInt32 trigger;
+  OpcUa_UInt32 queueSize;
+  OpcUa_Boolean discardOldest;
+};
+
+// one OPC UA monitored item shared by all subscriptions of the same node, rate class and filter,
+// event items get an OPC UA subscription of their own to keep ConditionRefresh local to them
+struct monitored_item_t {
+  OpcUa_UInt32 handle;
   enum subscription_type_t type;
-  struct wpcp_publish_handle_t* publish_handle;
-  bool receivedInitalValue;
-  size_t count;
+  enum monitored_item_state_t state;
   OpcUa_NodeId nodeId;
+  char* key;
+  size_t keyLength;
+  OpcUa_UInt32 hash;
+  OpcUa_Int32 rateClass;
+  OpcUa_ExtensionObject filter;
+  struct data_change_parameters_t parameters;
+  OpcUa_Double deadband;
   OpcUa_UInt32 subscriptionId;
   OpcUa_UInt32 monitoredItemId;
+  size_t refcount;
+  bool indexed;
+  bool hasValue;
+  OpcUa_DataValue value;
+  bool buffered;
+  struct series_t* series;
+  struct condition_table_t* conditions;
+  bool conditionsComplete;
+  bool flushQueued;
+  struct monitored_item_t* nextFlush;
+  enum refresh_state_t refreshState;
+  struct subscription_entry_t* subscribers;
+  struct SubscribeHelperItem* waiting;
+  struct monitored_item_t* next;
+};
+
+struct subscription_entry_t {
+  OpcUa_UInt32 handle;
+  enum subscription_type_t type;
+  struct wpcp_publish_handle_t* publish_handle;
+  size_t count;
+  struct monitored_item_t* monitoredItem;
+  struct subscription_entry_t* nextSubscriber;
   struct wpcp_publish_handle_t* republish_publish_handle;
+  bool refreshing;
+  struct client_t* client;
+  bool valueQueued;
+  struct subscription_entry_t* nextQueued;
+};
+
+struct queued_alarm_t {
+  struct queued_alarm_t* next;
+  struct subscription_entry_t* sube;
+  bool retain;
+  bool acknowledged;
+  bool hasConfirmed;
+  bool confirmed;
+  OpcUa_UInt16 severity;
+  double time;
+  struct wpcp_value_t token;
+  struct wpcp_value_t id;
+  const char* key;
+  uint32_t keyLength;
+  const char* message;
+  uint32_t messageLength;
+  char data[1];
 };
 
-struct subscription_entry_t g_subs[4096];
-size_t g_subss;
+// notifications of a WPCP connection waiting for delivery, data subscriptions are queued at most once and
+// publish the latest value of their monitored item, alarms are queued as copies and never dropped
+struct client_t {
+  void* user;
+  uint32_t id;
+  size_t refcount;
+  struct client_t* next;
+  struct subscription_entry_t* values;
+  struct subscription_entry_t** valuesTail;
+  struct queued_alarm_t* alarms;
+  struct queued_alarm_t** alarmsTail;
+  uint64_t conflated;
+  uint64_t dropped;
+};
+
+static struct slab_t g_subs = SLAB_STATIC_INITIALIZER(struct subscription_entry_t);
+static struct slab_t g_monitoredItems = SLAB_STATIC_INITIALIZER(struct monitored_item_t);
+static struct monitored_item_t** g_monitoredItemIndex;
+static OpcUa_UInt32 g_monitoredItemIndexSize;
+
+OpcUa_UInt32 g_alarmCoalesce;
+
+// alarm monitored items with coalesced conditions waiting for the next flush
+static struct monitored_item_t* g_flushQueue;
+static OpcUa_Timer g_flushTimer;
 
+OpcUa_UInt32 g_clientBudget;
+
+// guards the clients and their queues together with what data change notifications touch: the monitored item slab,
+// the subscribers of the items and their values, always taken after the wpcp lock
+static OpcUa_Mutex g_clientMutex;
+static struct client_t* g_clients;
+static uint32_t g_clientIds;
+static OpcUa_Timer g_clientTimer;
 
 static const char* bns[] = { "EventId", "EventType", "Message", "SourceNode", "Time", "ConditionId", "BranchId", "Retain", "AckedState", "Severity", "ConfirmedState", "Comment", NULL };
 
@@ -60,34 +208,980 @@ static OpcUa_SimpleAttributeOperand* getSelectClauses(OpcUa_Int32* noOfSelectCla
   return selectClauses;
 }
 
-void opcua_publishDataChangeNotification(OpcUa_UInt32 subscriptionId, OpcUa_Int32 noOfMonitoredItems, const OpcUa_MonitoredItemNotification* monitoredItems)
+static void* initializeFilterOperand(OpcUa_ExtensionObject* filterOperand, OpcUa_EncodeableType* type)
+{
+  void* operand;
+  OpcUa_EncodeableObject_CreateExtension(type, filterOperand, &operand);
+  return operand;
+}
+
+static void initializeContentFilterElement(OpcUa_ContentFilterElement* element, OpcUa_FilterOperator filterOperator, OpcUa_Int32 noOfFilterOperands)
+{
+  OpcUa_ContentFilterElement_Initialize(element);
+  element->FilterOperator = filterOperator;
+  element->NoOfFilterOperands = noOfFilterOperands;
+  element->FilterOperands = OpcUa_Memory_Alloc(noOfFilterOperands * sizeof(OpcUa_ExtensionObject));
+  for (OpcUa_Int32 i = 0; i < noOfFilterOperands; ++i)
+    OpcUa_ExtensionObject_Initialize(&element->FilterOperands[i]);
+}
+
+static void initializeLogicalElement(OpcUa_ContentFilterElement* element, OpcUa_FilterOperator filterOperator, OpcUa_UInt32 first, OpcUa_UInt32 second)
 {
-  assert(subscriptionId == g_subscriptionId);
+  initializeContentFilterElement(element, filterOperator, 2);
+  ((OpcUa_ElementOperand*)initializeFilterOperand(&element->FilterOperands[0], &OpcUa_ElementOperand_EncodeableType))->Index = first;
+  ((OpcUa_ElementOperand*)initializeFilterOperand(&element->FilterOperands[1], &OpcUa_ElementOperand_EncodeableType))->Index = second;
+}
+
+static void initializeSeverityElement(OpcUa_ContentFilterElement* element, OpcUa_UInt16 severity)
+{
+  initializeContentFilterElement(element, OpcUa_FilterOperator_GreaterThanOrEqual, 2);
+
+  OpcUa_SimpleAttributeOperand* attribute = initializeFilterOperand(&element->FilterOperands[0], &OpcUa_SimpleAttributeOperand_EncodeableType);
+  attribute->TypeDefinitionId.Identifier.Numeric = OpcUaId_BaseEventType;
+  attribute->AttributeId = OpcUa_Attributes_Value;
+  attribute->NoOfBrowsePath = 1;
+  attribute->BrowsePath = OpcUa_Memory_Alloc(sizeof(OpcUa_QualifiedName));
+  OpcUa_QualifiedName_Initialize(attribute->BrowsePath);
+  OpcUa_String_AttachCopy(&attribute->BrowsePath->Name, "Severity");
+
+  OpcUa_LiteralOperand* literal = initializeFilterOperand(&element->FilterOperands[1], &OpcUa_LiteralOperand_EncodeableType);
+  literal->Value.Datatype = OpcUaType_UInt16;
+  literal->Value.Value.UInt16 = severity;
+}
 
+static void initializeOfTypeElement(OpcUa_ContentFilterElement* element, const OpcUa_NodeId* eventType)
+{
+  initializeContentFilterElement(element, OpcUa_FilterOperator_OfType, 1);
+
+  OpcUa_LiteralOperand* literal = initializeFilterOperand(&element->FilterOperands[0], &OpcUa_LiteralOperand_EncodeableType);
+  literal->Value.Datatype = OpcUaType_NodeId;
+  literal->Value.Value.NodeId = OpcUa_Memory_Alloc(sizeof(OpcUa_NodeId));
+  OpcUa_NodeId_CopyTo(eventType, literal->Value.Value.NodeId);
+}
+
+// compiles severity and types of the WPCP filter into "Severity >= severity AND (OfType(t1) OR (OfType(t2) OR ...))",
+// the source is handled by monitoring the source node itself
+static void initializeWhereClause(OpcUa_ContentFilter* whereClause, const struct wpcp_value_t* filter)
+{
+  const struct wpcp_value_t* severityValue = findMapValue(filter, "severity");
+  const struct wpcp_value_t* typesValue = findMapValue(filter, "types");
+  OpcUa_NodeId types[32];
+  OpcUa_Int32 noOfTypes = 0;
+  OpcUa_Double severity = 0.0;
+  OpcUa_Int32 noOfElements = 0;
+
+  if (severityValue && OpcUa_IsGood(toDouble(severityValue, &severity)) && severity > 0.0)
+    noOfElements += 1;
+  else
+    severityValue = NULL;
+
+  if (typesValue && typesValue->type == WPCP_VALUE_TYPE_ARRAY) {
+    const struct wpcp_value_t* child = typesValue->data.first_child;
+    for (uint32_t i = 0; i < typesValue->value.length && child && noOfTypes < 32; ++i, child = child->next) {
+      if (OpcUa_IsGood(toNodeId(child, &types[noOfTypes])))
+        noOfTypes += 1;
+    }
+  } else if (typesValue && OpcUa_IsGood(toNodeId(typesValue, &types[0])))
+    noOfTypes = 1;
+
+  if (noOfTypes)
+    noOfElements += 2 * noOfTypes - 1;
+  if (severityValue && noOfTypes)
+    noOfElements += 1;
+
+  OpcUa_ContentFilter_Initialize(whereClause);
+  if (!noOfElements)
+    return;
+
+  whereClause->NoOfElements = noOfElements;
+  whereClause->Elements = OpcUa_Memory_Alloc(noOfElements * sizeof(OpcUa_ContentFilterElement));
+
+  OpcUa_Int32 nr = 0;
+  if (severityValue && noOfTypes)
+    initializeLogicalElement(&whereClause->Elements[nr++], OpcUa_FilterOperator_And, 1, 2);
+  if (severityValue)
+    initializeSeverityElement(&whereClause->Elements[nr++], severity > OpcUa_UInt16_Max ? OpcUa_UInt16_Max : (OpcUa_UInt16)severity);
+
+  for (OpcUa_Int32 i = 0; i < noOfTypes; ++i) {
+    if (i + 1 < noOfTypes) {
+      initializeLogicalElement(&whereClause->Elements[nr], OpcUa_FilterOperator_Or, nr + 1, nr + 2);
+      nr += 1;
+    }
+    initializeOfTypeElement(&whereClause->Elements[nr++], &types[i]);
+    OpcUa_NodeId_Clear(&types[i]);
+  }
+
+  assert(nr == noOfElements);
+}
+
+static void initializeEventFilter(OpcUa_ExtensionObject* filter, const struct wpcp_value_t* wpcpFilter)
+{
+  OpcUa_EventFilter* eventFilter;
+
+  OpcUa_EncodeableObject_CreateExtension(&OpcUa_EventFilter_EncodeableType, filter, &eventFilter);
+  OpcUa_EventFilter_Initialize(eventFilter);
+  eventFilter->SelectClauses = getSelectClauses(&eventFilter->NoOfSelectClauses);
+  initializeWhereClause(&eventFilter->WhereClause, wpcpFilter);
+}
+
+static void clearMonitoredItemFilter(OpcUa_ExtensionObject* filter)
+{
+  if (filter->Encoding == OpcUa_ExtensionObjectEncoding_EncodeableObject && filter->Body.EncodeableObject.Type == &OpcUa_EventFilter_EncodeableType) {
+    OpcUa_EventFilter* eventFilter = filter->Body.EncodeableObject.Object;
+    eventFilter->NoOfSelectClauses = 0;
+    eventFilter->SelectClauses = NULL;
+  }
+
+  OpcUa_ExtensionObject_Clear(filter);
+}
+
+// libwpcp passes the user of the session to its callbacks, so it identifies the connection
+static struct client_t* acquireClient(void* user)
+{
+  struct client_t* client = g_clients;
+  while (client && client->user != user)
+    client = client->next;
+
+  if (!client) {
+    client = malloc(sizeof(struct client_t));
+    client->user = user;
+    client->id = ++g_clientIds;
+    client->refcount = 0;
+    client->values = NULL;
+    client->valuesTail = &client->values;
+    client->alarms = NULL;
+    client->alarmsTail = &client->alarms;
+    client->conflated = 0;
+    client->dropped = 0;
+    client->next = g_clients;
+    g_clients = client;
+    stats_add(STATS_CLIENTS, 1);
+  }
+
+  client->refcount += 1;
+  return client;
+}
+
+static void releaseClient(struct client_t* client)
+{
+  client->refcount -= 1;
+  if (client->refcount)
+    return;
+
+  struct client_t** entry = &g_clients;
+  while (*entry != client)
+    entry = &(*entry)->next;
+  *entry = client->next;
+
+  free(client);
+  stats_add(STATS_CLIENTS, -1);
+}
+
+static void dropQueued(struct client_t* client, OpcUa_UInt32 count)
+{
+  client->dropped += count;
+  stats_add(STATS_CLIENT_QUEUED, -(int64_t)count);
+  stats_add(STATS_CLIENT_DROPPED, count);
+}
+
+// notifications of a subscription which is gone are dropped
+static void purgeQueued(struct subscription_entry_t* sube)
+{
+  struct client_t* client = sube->client;
+
+  if (sube->valueQueued) {
+    struct subscription_entry_t** entry = &client->values;
+    while (*entry != sube)
+      entry = &(*entry)->nextQueued;
+    *entry = sube->nextQueued;
+    if (client->valuesTail == &sube->nextQueued)
+      client->valuesTail = entry;
+    sube->valueQueued = false;
+    dropQueued(client, 1);
+  }
+
+  struct queued_alarm_t** entry = &client->alarms;
+  while (*entry) {
+    struct queued_alarm_t* alarm = *entry;
+    if (alarm->sube != sube) {
+      entry = &alarm->next;
+      continue;
+    }
+    *entry = alarm->next;
+    free(alarm);
+    dropQueued(client, 1);
+  }
+  client->alarmsTail = entry;
+}
+
+static struct subscription_entry_t* allocateSubscriptionEntry(enum subscription_type_t type, void* user)
+{
+  OpcUa_UInt32 handle;
+  struct subscription_entry_t* sube = slab_alloc(&g_subs, &handle);
+  if (!sube)
+    return NULL;
+  sube->handle = handle;
+  sube->type = type;
+  sube->valueQueued = false;
+  OpcUa_Mutex_Lock(g_clientMutex);
+  sube->client = g_clientBudget ? acquireClient(user) : NULL;
+  OpcUa_Mutex_Unlock(g_clientMutex);
+  stats_add(STATS_SUBSCRIPTION_ENTRIES, 1);
+  return sube;
+}
+
+static void freeSubscriptionEntry(struct subscription_entry_t* sube)
+{
+  if (sube->client) {
+    OpcUa_Mutex_Lock(g_clientMutex);
+    purgeQueued(sube);
+    releaseClient(sube->client);
+    OpcUa_Mutex_Unlock(g_clientMutex);
+  }
+  slab_free(&g_subs, sube->handle);
+  stats_add(STATS_SUBSCRIPTION_ENTRIES, -1);
+}
+
+static struct monitored_item_t* findMonitoredItem(enum subscription_type_t type, const OpcUa_NodeId* nodeId, const char* key, size_t keyLength, OpcUa_UInt32 hash, OpcUa_Int32 rateClass)
+{
+  if (!g_monitoredItemIndexSize)
+    return NULL;
+
+  struct monitored_item_t* monitoredItem = g_monitoredItemIndex[hash & (g_monitoredItemIndexSize - 1)];
+  while (monitoredItem) {
+    if (monitoredItem->hash == hash && monitoredItem->type == type && monitoredItem->rateClass == rateClass && monitoredItem->keyLength == keyLength &&
+      !OpcUa_NodeId_Compare(&monitoredItem->nodeId, nodeId) && (!keyLength || !memcmp(monitoredItem->key, key, keyLength)))
+      return monitoredItem;
+    monitoredItem = monitoredItem->next;
+  }
+
+  return NULL;
+}
+
+static void indexMonitoredItem(struct monitored_item_t* monitoredItem)
+{
+  if (g_monitoredItems.count > g_monitoredItemIndexSize) {
+    OpcUa_UInt32 size = g_monitoredItemIndexSize ? 2 * g_monitoredItemIndexSize : 256;
+    struct monitored_item_t** index = calloc(size, sizeof(*index));
+
+    for (OpcUa_UInt32 i = 0; i < g_monitoredItemIndexSize; ++i) {
+      struct monitored_item_t* entry = g_monitoredItemIndex[i];
+      while (entry) {
+        struct monitored_item_t* next = entry->next;
+        entry->next = index[entry->hash & (size - 1)];
+        index[entry->hash & (size - 1)] = entry;
+        entry = next;
+      }
+    }
+
+    free(g_monitoredItemIndex);
+    g_monitoredItemIndex = index;
+    g_monitoredItemIndexSize = size;
+  }
+
+  struct monitored_item_t** bucket = &g_monitoredItemIndex[monitoredItem->hash & (g_monitoredItemIndexSize - 1)];
+  monitoredItem->next = *bucket;
+  *bucket = monitoredItem;
+  monitoredItem->indexed = true;
+}
+
+static void unindexMonitoredItem(struct monitored_item_t* monitoredItem)
+{
+  if (!monitoredItem->indexed)
+    return;
+
+  struct monitored_item_t** entry = &g_monitoredItemIndex[monitoredItem->hash & (g_monitoredItemIndexSize - 1)];
+  while (*entry != monitoredItem)
+    entry = &(*entry)->next;
+  *entry = monitoredItem->next;
+  monitoredItem->indexed = false;
+}
+
+// takes ownership of nodeId and key unless the handles are exhausted
+static struct monitored_item_t* allocateMonitoredItem(enum subscription_type_t type, OpcUa_NodeId* nodeId, char* key, size_t keyLength, OpcUa_UInt32 hash, OpcUa_Int32 rateClass)
+{
+  OpcUa_UInt32 handle;
+  OpcUa_Mutex_Lock(g_clientMutex);
+  struct monitored_item_t* monitoredItem = slab_alloc(&g_monitoredItems, &handle);
+  OpcUa_Mutex_Unlock(g_clientMutex);
+  if (!monitoredItem)
+    return NULL;
+  monitoredItem->handle = handle;
+  monitoredItem->type = type;
+  monitoredItem->state = MONITORED_ITEM_STATE_CREATING;
+  monitoredItem->nodeId = *nodeId;
+  monitoredItem->key = key;
+  monitoredItem->keyLength = keyLength;
+  monitoredItem->hash = hash;
+  monitoredItem->rateClass = rateClass;
+  OpcUa_ExtensionObject_Initialize(&monitoredItem->filter);
+  OpcUa_DataValue_Initialize(&monitoredItem->value);
+  monitoredItem->buffered = false;
+  monitoredItem->series = NULL;
+  monitoredItem->conditions = type == SUBSCRIPTION_TYPE_FILTER_ALARM ? condition_createTable() : NULL;
+  monitoredItem->conditionsComplete = false;
+  monitoredItem->flushQueued = false;
+  indexMonitoredItem(monitoredItem);
+  stats_add(STATS_SUBSCRIPTION_MONITORED_ITEMS, 1);
+  return monitoredItem;
+}
+
+static void attachSubscriber(struct monitored_item_t* monitoredItem, struct subscription_entry_t* sube)
+{
+  OpcUa_Mutex_Lock(g_clientMutex);
+  sube->monitoredItem = monitoredItem;
+  sube->nextSubscriber = monitoredItem->subscribers;
+  monitoredItem->subscribers = sube;
+  monitoredItem->refcount += 1;
+  OpcUa_Mutex_Unlock(g_clientMutex);
+}
+
+// returns true if the subscriber was the last one and the monitored item has been released
+static bool detachSubscriber(struct subscription_entry_t* sube)
+{
+  struct monitored_item_t* monitoredItem = sube->monitoredItem;
+  struct subscription_entry_t** entry = &monitoredItem->subscribers;
+
+  OpcUa_Mutex_Lock(g_clientMutex);
+  while (*entry != sube)
+    entry = &(*entry)->nextSubscriber;
+  *entry = sube->nextSubscriber;
+  sube->monitoredItem = NULL;
+
+  monitoredItem->refcount -= 1;
+  if (monitoredItem->refcount) {
+    OpcUa_Mutex_Unlock(g_clientMutex);
+    return false;
+  }
+
+  unindexMonitoredItem(monitoredItem);
+  OpcUa_NodeId_Clear(&monitoredItem->nodeId);
+  clearMonitoredItemFilter(&monitoredItem->filter);
+  OpcUa_DataValue_Clear(&monitoredItem->value);
+  series_delete(monitoredItem->series);
+  if (monitoredItem->flushQueued) {
+    struct monitored_item_t** queued = &g_flushQueue;
+    while (*queued != monitoredItem)
+      queued = &(*queued)->nextFlush;
+    *queued = monitoredItem->nextFlush;
+  }
+  condition_deleteTable(monitoredItem->conditions);
+  free(monitoredItem->key);
+  slab_free(&g_monitoredItems, monitoredItem->handle);
+  OpcUa_Mutex_Unlock(g_clientMutex);
+  stats_add(STATS_SUBSCRIPTION_MONITORED_ITEMS, -1);
+  return true;
+}
+
+static void publishDataValue(struct wpcp_publish_handle_t* publish_handle, const OpcUa_DataValue* dataValue)
+{
+  struct wpcp_value_t value;
+  toWpcpValue(&dataValue->Value, &value);
+  wpcp_publish_data(publish_handle, &value, toWpcpTime(&dataValue->SourceTimestamp, dataValue->SourcePicoseconds), dataValue->StatusCode, NULL, 0);
+}
+
+static void sendAlarm(struct wpcp_publish_handle_t* publish_handle, const char* key, uint32_t keyLength, bool retain, const struct wpcp_value_t* token, const struct wpcp_value_t* id, double time, OpcUa_UInt16 severity, const char* message, uint32_t messageLength, bool acknowledged, const bool* confirmed)
+{
+  struct wpcp_key_value_pair_t additional;
+
+  if (confirmed) {
+    additional.key = "confirmed";
+    additional.key_length = sizeof("confirmed") - 1;
+    additional.value.type = *confirmed ? WPCP_VALUE_TYPE_TRUE : WPCP_VALUE_TYPE_FALSE;
+  }
+
+  wpcp_publish_alarm(publish_handle, key, keyLength, retain, token, id, time, severity, message, messageLength, acknowledged, confirmed ? &additional : NULL, confirmed ? 1 : 0);
+}
+
+// a data subscription already waiting for delivery publishes the newer value instead,
+// called with the client mutex and, without a client queue, the wpcp lock held
+static void publishData(struct subscription_entry_t* sube, const OpcUa_DataValue* dataValue)
+{
+  struct client_t* client = sube->client;
+
+  if (!client) {
+    publishDataValue(sube->publish_handle, dataValue);
+    return;
+  }
+
+  if (sube->valueQueued) {
+    client->conflated += 1;
+    stats_add(STATS_CLIENT_CONFLATED, 1);
+    return;
+  }
+
+  sube->valueQueued = true;
+  sube->nextQueued = NULL;
+  *client->valuesTail = sube;
+  client->valuesTail = &sube->nextQueued;
+  stats_add(STATS_CLIENT_QUEUED, 1);
+}
+
+static uint32_t copyValueData(const struct wpcp_value_t* value, struct wpcp_value_t* copy, char* buffer)
+{
+  *copy = *value;
+  if (value->type != WPCP_VALUE_TYPE_TEXT_STRING && value->type != WPCP_VALUE_TYPE_BYTE_STRING)
+    return 0;
+
+  memcpy(buffer, value->data.byte_string, value->value.length);
+  copy->data.byte_string = buffer;
+  return value->value.length;
+}
+
+static uint32_t getValueDataLength(const struct wpcp_value_t* value)
+{
+  return value->type == WPCP_VALUE_TYPE_TEXT_STRING || value->type == WPCP_VALUE_TYPE_BYTE_STRING ? value->value.length : 0;
+}
+
+// called with the client mutex held
+static void publishAlarm(struct subscription_entry_t* sube, const char* key, uint32_t keyLength, bool retain, const struct wpcp_value_t* token, const struct wpcp_value_t* id, double time, OpcUa_UInt16 severity, const char* message, uint32_t messageLength, bool acknowledged, const bool* confirmed)
+{
+  struct client_t* client = sube->client;
+
+  if (!client) {
+    sendAlarm(sube->publish_handle, key, keyLength, retain, token, id, time, severity, message, messageLength, acknowledged, confirmed);
+    return;
+  }
+
+  struct queued_alarm_t* alarm = malloc(sizeof(struct queued_alarm_t) + keyLength + messageLength + getValueDataLength(token) + getValueDataLength(id));
+  char* data = alarm->data;
+  alarm->sube = sube;
+  alarm->retain = retain;
+  alarm->acknowledged = acknowledged;
+  alarm->hasConfirmed = confirmed != NULL;
+  alarm->confirmed = confirmed && *confirmed;
+  alarm->severity = severity;
+  alarm->time = time;
+  alarm->key = memcpy(data, key, keyLength);
+  alarm->keyLength = keyLength;
+  data += keyLength;
+  alarm->message = memcpy(data, message, messageLength);
+  alarm->messageLength = messageLength;
+  data += messageLength;
+  data += copyValueData(token, &alarm->token, data);
+  copyValueData(id, &alarm->id, data);
+
+  alarm->next = NULL;
+  *client->alarmsTail = alarm;
+  client->alarmsTail = &alarm->next;
+  stats_add(STATS_CLIENT_QUEUED, 1);
+}
+
+// every client gets the same budget per flush, alarms are delivered before values,
+// called with the wpcp lock and the client mutex held, since the notifications are encoded into the connection
+static void flushClient(struct client_t* client)
+{
+  OpcUa_UInt32 budget = g_clientBudget;
+
+  while (client->alarms && budget) {
+    struct queued_alarm_t* alarm = client->alarms;
+    client->alarms = alarm->next;
+    if (!client->alarms)
+      client->alarmsTail = &client->alarms;
+
+    if (alarm->sube->publish_handle)
+      sendAlarm(alarm->sube->publish_handle, alarm->key, alarm->keyLength, alarm->retain, &alarm->token, &alarm->id, alarm->time, alarm->severity, alarm->message, alarm->messageLength, alarm->acknowledged, alarm->hasConfirmed ? &alarm->confirmed : NULL);
+    free(alarm);
+    budget -= 1;
+  }
+
+  while (client->values && budget) {
+    struct subscription_entry_t* sube = client->values;
+    client->values = sube->nextQueued;
+    if (!client->values)
+      client->valuesTail = &client->values;
+
+    sube->valueQueued = false;
+    if (sube->publish_handle && sube->monitoredItem)
+      publishDataValue(sube->publish_handle, &sube->monitoredItem->value);
+    budget -= 1;
+  }
+
+  stats_add(STATS_CLIENT_QUEUED, -(int64_t)(g_clientBudget - budget));
+}
+
+static OpcUa_StatusCode opcua_flush_clients(OpcUa_Void* pvCallbackData, OpcUa_Timer hTimer, OpcUa_UInt32 msecElapsed)
+{
   wpcp_lws_lock();
+  OpcUa_Mutex_Lock(g_clientMutex);
+  for (struct client_t* client = g_clients; client; client = client->next)
+    flushClient(client);
+  OpcUa_Mutex_Unlock(g_clientMutex);
+  wpcp_lws_unlock();
+  return OpcUa_Good;
+}
+
+void publish_start(void)
+{
+  OpcUa_Mutex_Create(&g_clientMutex);
+  if (g_clientBudget)
+    OpcUa_Timer_Create(&g_clientTimer, CLIENT_FLUSH_INTERVAL, opcua_flush_clients, OpcUa_Null, OpcUa_Null);
+}
+
+void publish_stop(void)
+{
+  if (g_clientTimer)
+    OpcUa_Timer_Delete(&g_clientTimer);
+  OpcUa_Mutex_Delete(&g_clientMutex);
+}
+
+// the connections are numbered in the order of their first subscription
+void publish_printStats(void)
+{
+  OpcUa_Mutex_Lock(g_clientMutex);
+  for (struct client_t* client = g_clients; client; client = client->next) {
+    printf("client.%" PRIu32 ".conflated: %" PRIu64 "\n", client->id, client->conflated);
+    printf("client.%" PRIu32 ".dropped: %" PRIu64 "\n", client->id, client->dropped);
+  }
+  OpcUa_Mutex_Unlock(g_clientMutex);
+}
+
+// the server discards samples between two publishes without the overflow bit if the queue is too short for them,
+// so only items which queue every sample of a publishing interval are buffered
+static bool isBufferable(const struct monitored_item_t* monitoredItem, const OpcUa_MonitoredItemCreateResult* result)
+{
+  if (!g_historyBufferSize || monitoredItem->type != SUBSCRIPTION_TYPE_STATE_DATA || monitoredItem->keyLength || result->RevisedSamplingInterval <= 0.0)
+    return false;
+
+  return result->RevisedQueueSize * result->RevisedSamplingInterval >= g_rateClasses[monitoredItem->rateClass].publishingInterval;
+}
+
+// the request shares node and filter with the monitored item
+static void initializeMonitoredItemCreateRequest(OpcUa_MonitoredItemCreateRequest* monitoredItemCreateRequest, const struct monitored_item_t* monitoredItem)
+{
+  OpcUa_MonitoredItemCreateRequest_Initialize(monitoredItemCreateRequest);
+  monitoredItemCreateRequest->ItemToMonitor.NodeId = monitoredItem->nodeId;
+  monitoredItemCreateRequest->ItemToMonitor.AttributeId = monitoredItem->type == SUBSCRIPTION_TYPE_STATE_DATA ? OpcUa_Attributes_Value : OpcUa_Attributes_EventNotifier;
+  monitoredItemCreateRequest->MonitoringMode = OpcUa_MonitoringMode_Reporting;
+  monitoredItemCreateRequest->RequestedParameters.ClientHandle = monitoredItem->handle;
+  monitoredItemCreateRequest->RequestedParameters.SamplingInterval = monitoredItem->parameters.samplingInterval;
+  monitoredItemCreateRequest->RequestedParameters.Filter = monitoredItem->filter;
+  monitoredItemCreateRequest->RequestedParameters.QueueSize = monitoredItem->parameters.queueSize;
+  monitoredItemCreateRequest->RequestedParameters.DiscardOldest = monitoredItem->parameters.discardOldest;
+}
+
+static OpcUa_Int32 getRateClass(const struct wpcp_key_value_pair_t* additional, uint32_t additional_count)
+{
+  const struct wpcp_value_t* value = findAdditional(additional, additional_count, "rate");
+  OpcUa_Double rate;
+  OpcUa_Int32 rateClass = 0;
+
+  if (!value || OpcUa_IsBad(toDouble(value, &rate)))
+    return rateClass;
+
+  while (rateClass + 1 < RATE_CLASS_COUNT && g_rateClasses[rateClass + 1].publishingInterval <= rate)
+    ++rateClass;
+
+  return rateClass;
+}
+
+static void getDataChangeParameters(const struct wpcp_key_value_pair_t* additional, uint32_t additional_count, struct data_change_parameters_t* parameters)
+{
+  const struct wpcp_value_t* value;
+  OpcUa_Double number;
+
+  memset(parameters, 0, sizeof(*parameters));
+  parameters->trigger = OpcUa_DataChangeTrigger_StatusValue;
+
+  value = findAdditional(additional, additional_count, "deadband");
+  if (value && OpcUa_IsGood(toDouble(value, &number)) && number > 0.0) {
+    parameters->deadbandType = OpcUa_DeadbandType_Absolute;
+    parameters->deadbandValue = number;
+
+    value = findAdditional(additional, additional_count, "deadbandtype");
+    if (value && value->type == WPCP_VALUE_TYPE_TEXT_STRING && value->value.length == 7 && !memcmp(value->data.text_string, "percent", 7))
+      parameters->deadbandType = OpcUa_DeadbandType_Percent;
+  }
+
+  value = findAdditional(additional, additional_count, "trigger");
+  if (value && value->type == WPCP_VALUE_TYPE_TEXT_STRING) {
+#define XX(name, id) \
+    if (value->value.length == sizeof(name) - 1 && !memcmp(value->data.text_string, name, sizeof(name) - 1)) \
+      parameters->trigger = id;
+    XX("status", OpcUa_DataChangeTrigger_Status)
+    XX("statusvalue", OpcUa_DataChangeTrigger_StatusValue)
+    XX("statusvaluetimestamp", OpcUa_DataChangeTrigger_StatusValueTimestamp)
+#undef XX
+  }
+
+  value = findAdditional(additional, additional_count, "sampling");
+  if (value && OpcUa_IsGood(toDouble(value, &number)))
+    parameters->samplingInterval = number;
+
+  value = findAdditional(additional, additional_count, "queuesize");
+  if (value && value->type == WPCP_VALUE_TYPE_UINT64)
+    parameters->queueSize = value->value.uint > OpcUa_UInt32_Max ? OpcUa_UInt32_Max : (OpcUa_UInt32)value->value.uint;
+
+  value = findAdditional(additional, additional_count, "discardoldest");
+  if (value)
+    parameters->discardOldest = value->type == WPCP_VALUE_TYPE_TRUE;
+}
+
+static void initializeDataChangeFilter(OpcUa_ExtensionObject* filter, const struct data_change_parameters_t* parameters)
+{
+  OpcUa_DataChangeFilter* dataChangeFilter;
+
+  if (parameters->deadbandType == OpcUa_DeadbandType_None && parameters->trigger == OpcUa_DataChangeTrigger_StatusValue)
+    return;
+
+  OpcUa_EncodeableObject_CreateExtension(&OpcUa_DataChangeFilter_EncodeableType, filter, &dataChangeFilter);
+  OpcUa_DataChangeFilter_Initialize(dataChangeFilter);
+  dataChangeFilter->Trigger = parameters->trigger;
+  dataChangeFilter->DeadbandType = parameters->deadbandType;
+  dataChangeFilter->DeadbandValue = parameters->deadbandValue;
+}
+
+// drops values within the absolute deadband of the last published value
+static bool isWithinDeadband(const struct monitored_item_t* monitoredItem, const OpcUa_DataValue* dataValue)
+{
+  OpcUa_Double previous;
+  OpcUa_Double current;
+
+  if (!monitoredItem->deadband || !monitoredItem->hasValue || monitoredItem->value.StatusCode != dataValue->StatusCode)
+    return false;
+  if (OpcUa_IsBad(variantToDouble(&monitoredItem->value.Value, &previous)) || OpcUa_IsBad(variantToDouble(&dataValue->Value, &current)))
+    return false;
+
+  return fabs(current - previous) <= monitoredItem->deadband;
+}
+
+static OpcUa_StatusCode opcua_delete_group(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+{
+  return OpcUa_Good;
+}
+
+static void releaseGroup(OpcUa_Int32 rateClass, size_t count)
+{
+  struct subscription_group_t* group = &g_groups[rateClass];
+
+  assert(group->count >= count);
+  group->count -= count;
+  if (group->count || group->state != SUBSCRIPTION_GROUP_STATE_READY)
+    return;
+
+  OpcUa_UInt32 subscriptionId = group->subscriptionId;
+  group->state = SUBSCRIPTION_GROUP_STATE_NONE;
+  unregisterSubscription(subscriptionId);
+  stats_add(STATS_SUBSCRIPTION_GROUPS, -1);
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_ClientApi_BeginDeleteSubscriptions(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    1,
+    &subscriptionId,
+    opcua_delete_group,
+    OpcUa_Null);
+}
+
+// with client queues the notifications are only queued, so the wpcp lock is left to the flush of the queues
+void opcua_publishDataChangeNotification(OpcUa_UInt32 subscriptionId, OpcUa_Int32 noOfMonitoredItems, const OpcUa_MonitoredItemNotification* monitoredItems)
+{
+  if (!g_clientBudget)
+    wpcp_lws_lock();
+  OpcUa_Mutex_Lock(g_clientMutex);
   for (OpcUa_Int32 i = 0; i < noOfMonitoredItems; ++i) {
     const OpcUa_DataValue* dataValue = &monitoredItems[i].Value;
-    struct subscription_entry_t* sube = g_subs + monitoredItems[i].ClientHandle;
-    assert(sube->type == SUBSCRIPTION_TYPE_STATE_DATA);
-    assert(sube->publish_handle);
-    struct wpcp_value_t value;
-    toWpcpValue(&dataValue->Value, &value);
-    sube->receivedInitalValue = true;
-    wpcp_publish_data(sube->publish_handle, &value, toWpcpTime(&dataValue->SourceTimestamp, dataValue->SourcePicoseconds), dataValue->StatusCode, NULL, 0);
+    struct monitored_item_t* monitoredItem = slab_get(&g_monitoredItems, monitoredItems[i].ClientHandle);
+    if (!monitoredItem) {
+      stats_add(STATS_SUBSCRIPTION_STALE_NOTIFICATIONS, 1);
+      continue;
+    }
+    assert(monitoredItem->subscriptionId == subscriptionId);
+
+    if (isWithinDeadband(monitoredItem, dataValue))
+      continue;
+
+    // late subscribers of a shared item start with the last known value
+    OpcUa_DataValue_Clear(&monitoredItem->value);
+    OpcUa_DataValue_CopyTo(dataValue, &monitoredItem->value);
+    monitoredItem->hasValue = true;
+
+    // items without a key report every sample, so their values are the raw history of the node
+    if (monitoredItem->buffered) {
+      if (!monitoredItem->series)
+        monitoredItem->series = series_create();
+      series_append(monitoredItem->series, dataValue);
+    }
+
+    for (struct subscription_entry_t* sube = monitoredItem->subscribers; sube; sube = sube->nextSubscriber) {
+      if (sube->publish_handle)
+        publishData(sube, dataValue);
+    }
   }
+  OpcUa_Mutex_Unlock(g_clientMutex);
+  if (!g_clientBudget)
+    wpcp_lws_unlock();
+}
+
+// monitored items without a key forward every change of the value, so they keep the last value of a node current
+OpcUa_Boolean getCachedDataValue(const OpcUa_NodeId* nodeId, OpcUa_Double maxAge, OpcUa_DataValue* dataValue)
+{
+  OpcUa_UInt32 hash = hashNodeId(nodeId);
+  const struct monitored_item_t* cached = NULL;
+  OpcUa_UInt64 cachedTime = 0;
+
+  wpcp_lws_lock();
+  OpcUa_Mutex_Lock(g_clientMutex);
+
+  if (g_monitoredItemIndexSize) {
+    for (const struct monitored_item_t* monitoredItem = g_monitoredItemIndex[hash & (g_monitoredItemIndexSize - 1)]; monitoredItem; monitoredItem = monitoredItem->next) {
+      OpcUa_DateTime publishTime;
+      if (monitoredItem->hash != hash || monitoredItem->type != SUBSCRIPTION_TYPE_STATE_DATA || monitoredItem->keyLength || monitoredItem->state != MONITORED_ITEM_STATE_READY ||
+        !monitoredItem->hasValue || OpcUa_NodeId_Compare(&monitoredItem->nodeId, nodeId) || !getSubscriptionPublishTime(monitoredItem->subscriptionId, &publishTime))
+        continue;
+
+      if (toUInt64(&publishTime) > cachedTime) {
+        cached = monitoredItem;
+        cachedTime = toUInt64(&publishTime);
+      }
+    }
+  }
+
+  OpcUa_DateTime now = OpcUa_DateTime_UtcNow();
+  OpcUa_Boolean hit = cached && cachedTime && (OpcUa_Double)(toUInt64(&now) - cachedTime) / 10000 <= maxAge;
+  if (hit)
+    OpcUa_DataValue_CopyTo(&cached->value, dataValue);
+
+  OpcUa_Mutex_Unlock(g_clientMutex);
+  wpcp_lws_unlock();
+
+  stats_add(hit ? STATS_READ_CACHE_HITS : STATS_READ_CACHE_MISSES, 1);
+  return hit;
+}
+
+// changes are known up to the last publish response, or up to one publishing interval ago while the subscription is alive
+static OpcUa_UInt64 getBufferedEndTime(const struct monitored_item_t* monitoredItem, OpcUa_UInt64 now)
+{
+  OpcUa_DateTime publishTime;
+  if (!getSubscriptionPublishTime(monitoredItem->subscriptionId, &publishTime))
+    return 0;
+
+  const struct rate_class_t* rateClass = &g_rateClasses[monitoredItem->rateClass];
+  OpcUa_UInt64 interval = (OpcUa_UInt64)(rateClass->publishingInterval * 10000);
+  OpcUa_UInt64 published = toUInt64(&publishTime);
+  if (now > published + interval * (rateClass->maxKeepAliveCount + 1) || now < interval)
+    return published;
+  return published > now - interval ? published : now - interval;
+}
+
+// a raw read is answered from the buffer of a monitored item if the buffer covers the whole range, an open end reads up to now
+OpcUa_Boolean getBufferedHistory(const OpcUa_NodeId* nodeId, const OpcUa_DateTime* startTime, const OpcUa_DateTime* endTime, OpcUa_UInt32 maxValues, OpcUa_Int32* noOfDataValues, OpcUa_DataValue** dataValues)
+{
+  OpcUa_UInt32 hash = hashNodeId(nodeId);
+  OpcUa_UInt64 start = toUInt64(startTime);
+  OpcUa_UInt64 end = toUInt64(endTime);
+  OpcUa_DateTime utcNow = OpcUa_DateTime_UtcNow();
+  OpcUa_UInt64 now = toUInt64(&utcNow);
+  OpcUa_Boolean hit = OpcUa_False;
+
+  if (!start || (end && end <= start))
+    return OpcUa_False;
+
+  wpcp_lws_lock();
+  OpcUa_Mutex_Lock(g_clientMutex);
+
+  if (g_monitoredItemIndexSize) {
+    for (struct monitored_item_t* monitoredItem = g_monitoredItemIndex[hash & (g_monitoredItemIndexSize - 1)]; monitoredItem && !hit; monitoredItem = monitoredItem->next) {
+      if (monitoredItem->hash != hash || monitoredItem->type != SUBSCRIPTION_TYPE_STATE_DATA || monitoredItem->keyLength || monitoredItem->state != MONITORED_ITEM_STATE_READY ||
+        !monitoredItem->buffered || !monitoredItem->series || OpcUa_NodeId_Compare(&monitoredItem->nodeId, nodeId))
+        continue;
+
+      OpcUa_UInt64 bufferedEnd = getBufferedEndTime(monitoredItem, now);
+      if (end > bufferedEnd || (!end && start >= bufferedEnd))
+        continue;
+
+      hit = series_read(monitoredItem->series, start, end ? end : bufferedEnd, maxValues, noOfDataValues, dataValues);
+    }
+  }
+
+  OpcUa_Mutex_Unlock(g_clientMutex);
+  wpcp_lws_unlock();
+
+  stats_add(hit ? STATS_HISTORY_BUFFER_HITS : STATS_HISTORY_BUFFER_MISSES, 1);
+  return hit;
+}
+
+static OpcUa_StatusCode opcua_condition_refresh(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus);
+static void finishConditionRefresh(struct monitored_item_t* monitoredItem, OpcUa_StatusCode statusCode);
+
+static void beginConditionRefresh(struct monitored_item_t* monitoredItem)
+{
+  monitoredItem->refreshState = REFRESH_STATE_REQUESTED;
+  stats_add(STATS_SUBSCRIPTION_CONDITION_REFRESHES, 1);
+
+  OpcUa_CallMethodRequest callMethodRequest;
+  OpcUa_CallMethodRequest_Initialize(&callMethodRequest);
+  callMethodRequest.ObjectId.Identifier.Numeric = OpcUaId_ConditionType;
+  callMethodRequest.MethodId.Identifier.Numeric = OpcUaId_ConditionType_ConditionRefresh;
+  callMethodRequest.NoOfInputArguments = 1;
+
+  OpcUa_Variant var;
+  OpcUa_Variant_Initialize(&var);
+  var.Datatype = OpcUaType_UInt32;
+  var.Value.UInt32 = monitoredItem->subscriptionId;
+  callMethodRequest.InputArguments = &var;
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginCall(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    1,
+    &callMethodRequest,
+    opcua_condition_refresh,
+    (OpcUa_Void*)(uintptr_t)monitoredItem->handle);
+  if (!OpcUa_IsGood(statusCode))
+    finishConditionRefresh(monitoredItem, statusCode);
+}
+
+static void getConditionValues(const struct condition_t* condition, struct wpcp_value_t* token, struct wpcp_value_t* id)
+{
+  token->type = WPCP_VALUE_TYPE_TEXT_STRING;
+  token->data.text_string = condition->token;
+  token->value.length = condition->tokenLength;
+  id->type = WPCP_VALUE_TYPE_TEXT_STRING;
+  id->data.text_string = condition->id;
+  id->value.length = condition->idLength;
+}
+
+static void publishCondition(void* user, struct condition_t* condition)
+{
+  struct wpcp_publish_handle_t* publish_handle = user;
+  struct wpcp_value_t token;
+  struct wpcp_value_t id;
+
+  getConditionValues(condition, &token, &id);
+  sendAlarm(publish_handle, condition->key, condition->keyLength, condition->retain, &token, &id, condition->time, condition->severity, condition->message, condition->messageLength, condition->acknowledged, &condition->confirmed);
+}
+
+static void publishConditionToSubscribers(void* user, struct condition_t* condition)
+{
+  struct monitored_item_t* monitoredItem = user;
+  struct wpcp_value_t token;
+  struct wpcp_value_t id;
+
+  getConditionValues(condition, &token, &id);
+  for (struct subscription_entry_t* sube = monitoredItem->subscribers; sube; sube = sube->nextSubscriber) {
+    if (sube->publish_handle)
+      publishAlarm(sube, condition->key, condition->keyLength, condition->retain, &token, &id, condition->time, condition->severity, condition->message, condition->messageLength, condition->acknowledged, &condition->confirmed);
+  }
+}
+
+static void queueConditionFlush(struct monitored_item_t* monitoredItem)
+{
+  if (monitoredItem->flushQueued)
+    return;
+
+  monitoredItem->flushQueued = true;
+  monitoredItem->nextFlush = g_flushQueue;
+  g_flushQueue = monitoredItem;
+}
+
+// has to be called with the wpcp lock and the client mutex held
+static void flushConditions(void)
+{
+  while (g_flushQueue) {
+    struct monitored_item_t* monitoredItem = g_flushQueue;
+    g_flushQueue = monitoredItem->nextFlush;
+    monitoredItem->flushQueued = false;
+    condition_flush(monitoredItem->conditions, publishConditionToSubscribers, monitoredItem);
+  }
+}
+
+static OpcUa_StatusCode opcua_flush_conditions(OpcUa_Void* pvCallbackData, OpcUa_Timer hTimer, OpcUa_UInt32 msecElapsed)
+{
+  wpcp_lws_lock();
+  OpcUa_Mutex_Lock(g_clientMutex);
+  flushConditions();
+  OpcUa_Mutex_Unlock(g_clientMutex);
   wpcp_lws_unlock();
+  return OpcUa_Good;
+}
+
+void alarm_start(void)
+{
+  if (g_alarmCoalesce)
+    OpcUa_Timer_Create(&g_flushTimer, g_alarmCoalesce, opcua_flush_conditions, OpcUa_Null, OpcUa_Null);
+}
+
+void alarm_stop(void)
+{
+  if (g_flushTimer)
+    OpcUa_Timer_Delete(&g_flushTimer);
+}
+
+// subscribers asking for a republish after the RefreshStartEvent wait for the next refresh,
+// the condition table is rebuilt from the events of the refresh
+static void startConditionRefresh(struct monitored_item_t* monitoredItem)
+{
+  monitoredItem->refreshState = REFRESH_STATE_RUNNING;
+  condition_flush(monitoredItem->conditions, publishConditionToSubscribers, monitoredItem);
+  condition_clear(monitoredItem->conditions);
+  monitoredItem->conditionsComplete = false;
+
+  for (struct subscription_entry_t* sube = monitoredItem->subscribers; sube; sube = sube->nextSubscriber) {
+    if (sube->republish_publish_handle)
+      sube->refreshing = true;
+  }
+}
+
+static void finishConditionRefresh(struct monitored_item_t* monitoredItem, OpcUa_StatusCode statusCode)
+{
+  bool again = false;
+
+  for (struct subscription_entry_t* sube = monitoredItem->subscribers; sube; sube = sube->nextSubscriber) {
+    if (!sube->republish_publish_handle)
+      continue;
+
+    if (sube->refreshing || OpcUa_IsBad(statusCode)) {
+      wpcp_return_republish(sube->republish_publish_handle);
+      sube->republish_publish_handle = NULL;
+      sube->refreshing = false;
+    } else
+      again = true;
+  }
+
+  monitoredItem->refreshState = REFRESH_STATE_IDLE;
+  if (again)
+    beginConditionRefresh(monitoredItem);
+}
+
+static OpcUa_StatusCode opcua_condition_refresh(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+{
+  OpcUa_CallResponse* pCallResponse = pResponse;
+  OpcUa_StatusCode statusCode = uStatus;
+
+  if (OpcUa_IsGood(statusCode))
+    statusCode = pCallResponse->NoOfResults == 1 ? pCallResponse->Results[0].StatusCode : OpcUa_Bad;
+
+  if (OpcUa_IsGood(statusCode))
+    return OpcUa_Good;
+
+  wpcp_lws_lock();
+  OpcUa_Mutex_Lock(g_clientMutex);
+  struct monitored_item_t* monitoredItem = slab_get(&g_monitoredItems, (OpcUa_UInt32)(uintptr_t)pCallbackData);
+  if (monitoredItem && monitoredItem->refreshState == REFRESH_STATE_REQUESTED)
+    finishConditionRefresh(monitoredItem, statusCode);
+  OpcUa_Mutex_Unlock(g_clientMutex);
+  wpcp_lws_unlock();
+
+  return OpcUa_Good;
 }
 
 void opcua_publishEventNotificationList(OpcUa_UInt32 subscriptionId, OpcUa_Int32 noOfEvents, const OpcUa_EventFieldList* events)
 {
   wpcp_lws_lock();
+  OpcUa_Mutex_Lock(g_clientMutex);
 
   for (OpcUa_Int32 i = 0; i < noOfEvents; ++i) {
     const OpcUa_Variant* eventFields = events[i].EventFields;
-    struct subscription_entry_t* sube = g_subs + events[i].ClientHandle;
-    assert(sube->type == SUBSCRIPTION_TYPE_FILTER_ALARM);
-    assert(sube->subscriptionId == subscriptionId);
-    assert(sube->publish_handle);
+    struct monitored_item_t* monitoredItem = slab_get(&g_monitoredItems, events[i].ClientHandle);
+    if (!monitoredItem) {
+      stats_add(STATS_SUBSCRIPTION_STALE_NOTIFICATIONS, 1);
+      continue;
+    }
+    assert(monitoredItem->type == SUBSCRIPTION_TYPE_FILTER_ALARM);
+    assert(monitoredItem->subscriptionId == subscriptionId);
     struct wpcp_value_t handle;
     struct wpcp_value_t id;
     struct wpcp_value_t branchId;
@@ -107,9 +1201,13 @@ void opcua_publishEventNotificationList(OpcUa_UInt32 subscriptionId, OpcUa_Int32
       continue;
 
     if (eventType->Identifier.Numeric == OpcUaId_RefreshStartEventType) {
+      startConditionRefresh(monitoredItem);
       continue;
     }
     if (eventType->Identifier.Numeric == OpcUaId_RefreshEndEventType) {
+      if (monitoredItem->refreshState == REFRESH_STATE_RUNNING)
+        monitoredItem->conditionsComplete = true;
+      finishConditionRefresh(monitoredItem, OpcUa_Good);
       continue;
     }
 
@@ -120,14 +1218,17 @@ void opcua_publishEventNotificationList(OpcUa_UInt32 subscriptionId, OpcUa_Int32
     toWpcpValue2(&eventFields[5], &id, idBuffer, sizeof(idBuffer));
     toWpcpValue2(&eventFields[6], &branchId, branchIdBuffer, sizeof(branchIdBuffer));
 
+    // conditions without a branch have a null BranchId, their key is the ConditionId only
     char key[256];
     uint32_t key_length = 0;
-    if (id.type == WPCP_VALUE_TYPE_TEXT_STRING && branchId.type == WPCP_VALUE_TYPE_TEXT_STRING) {
+    if (id.type == WPCP_VALUE_TYPE_TEXT_STRING && id.value.length < sizeof(key)) {
       memcpy(key, id.data.text_string, id.value.length);
       key_length += id.value.length;
       key[key_length++] = '!';
-      memcpy(key + key_length, branchId.data.text_string, branchId.value.length);
-      key_length += branchId.value.length;
+      if (branchId.type == WPCP_VALUE_TYPE_TEXT_STRING && branchId.value.length <= sizeof(key) - key_length) {
+        memcpy(key + key_length, branchId.data.text_string, branchId.value.length);
+        key_length += branchId.value.length;
+      }
     }
 
 
@@ -143,9 +1244,32 @@ void opcua_publishEventNotificationList(OpcUa_UInt32 subscriptionId, OpcUa_Int32
       handle.data.text_string = token;
     }
 
-    wpcp_publish_alarm(sube->publish_handle, key, key_length, retain, &handle, &id, toWpcpTime(&eventFields[4].Value.DateTime, 0), severity, OpcUa_String_GetRawString(message), OpcUa_String_StrSize(message), acknowledged, NULL, 0);
+    double time = toWpcpTime(&eventFields[4].Value.DateTime, 0);
+
+    if (!key_length || handle.type != WPCP_VALUE_TYPE_TEXT_STRING) {
+      for (struct subscription_entry_t* sube = monitoredItem->subscribers; sube; sube = sube->nextSubscriber) {
+        if (sube->publish_handle)
+          publishAlarm(sube, key, key_length, retain, &handle, &id, time, severity, OpcUa_String_GetRawString(message), OpcUa_String_StrSize(message), acknowledged, NULL);
+      }
+      continue;
+    }
+
+    struct condition_t* condition = condition_update(monitoredItem->conditions, key, key_length, &handle, &id, time, severity, OpcUa_String_GetRawString(message), OpcUa_String_StrSize(message), retain, acknowledged, confirmedState);
+
+    // transitions of a refresh are delivered at once, so republish requests waiting for it see the whole state
+    if (g_alarmCoalesce && monitoredItem->refreshState != REFRESH_STATE_RUNNING) {
+      if (!condition_queue(monitoredItem->conditions, condition))
+        stats_add(STATS_ALARM_COALESCED, 1);
+      queueConditionFlush(monitoredItem);
+      continue;
+    }
+
+    publishConditionToSubscribers(monitoredItem, condition);
+    if (!condition->retain)
+      condition_remove(monitoredItem->conditions, condition);
   }
 
+  OpcUa_Mutex_Unlock(g_clientMutex);
   wpcp_lws_unlock();
 
 #if 0
@@ -166,186 +1290,481 @@ void opcua_publishEventNotificationList(OpcUa_UInt32 subscriptionId, OpcUa_Int32
 #endif
 }
 
-struct SubscribeStateDataHelperItem
+struct SubscribeHelperItem
 {
+  struct SubscribeHelper* helper;
+  struct SubscribeHelperItem* nextWaiting;
   struct wpcp_subscription_t* subscription;
+  struct monitored_item_t* monitoredItem;
   OpcUa_Int32 monitoredItemCreateRequestNr;
+  OpcUa_StatusCode monitoredItemCreateStatusCode;
+  OpcUa_NodeId nodeId;
+  OpcUa_Int32 rateClass;
+  struct data_change_parameters_t parameters;
+};
+
+struct SubscribeHelperBatch
+{
+  struct SubscribeHelper* helper;
+  struct SubscribeHelperBatch* next;
+  OpcUa_Int32 rateClass;
+  OpcUa_Int32 offset;
+  OpcUa_Int32 count;
+  OpcUa_MonitoredItemCreateRequest* monitoredItemCreateRequests;
+  struct chunker_t chunker;
+  bool retry;
 };
 
-struct SubscribeStateDataHelper
+// pending counts the outstanding batches, items waiting for a monitored item created elsewhere and the collection itself
+struct SubscribeHelper
 {
   struct wpcp_result_t* result;
+  void* user;
+  struct path_batch_t* paths;
   OpcUa_Int32 count;
-  OpcUa_Int32 countMonitoredItems;
-  struct SubscribeStateDataHelperItem* items;
+  OpcUa_Int32 pending;
+  struct SubscribeHelperItem* items;
   OpcUa_MonitoredItemCreateRequest* monitoredItemCreateRequests;
+  struct SubscribeHelperBatch batches[RATE_CLASS_COUNT];
 };
 
+static void finishSubscribe(struct SubscribeHelper* helper)
+{
+  for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+    struct SubscribeHelperItem* item = &helper->items[i];
+    struct subscription_entry_t* sube = wpcp_subscription_get_user(item->subscription);
+
+    // an item without subscription entry ran out of handles
+    if (!sube)
+      wpcp_return_subscribe_reject(helper->result, NULL, item->subscription);
+    else if (!item->monitoredItem) {
+      struct wpcp_publish_handle_t* publish_handle = wpcp_return_subscribe_accept(helper->result, NULL, item->subscription);
+      assert(sube->publish_handle == publish_handle);
+    } else if (OpcUa_IsGood(item->monitoredItemCreateStatusCode)) {
+      struct wpcp_publish_handle_t* publish_handle = wpcp_return_subscribe_accept(helper->result, NULL, item->subscription);
+      // the last known value takes the same path as the changes, so it can not overtake a queued newer one
+      OpcUa_Mutex_Lock(g_clientMutex);
+      sube->publish_handle = publish_handle;
+      if (item->monitoredItem->hasValue)
+        publishData(sube, &item->monitoredItem->value);
+      OpcUa_Mutex_Unlock(g_clientMutex);
+    } else {
+      assert(sube->publish_handle == NULL);
+      detachSubscriber(sube);
+      freeSubscriptionEntry(sube);
+      wpcp_return_subscribe_reject(helper->result, NULL, item->subscription);
+    }
+  }
+
+  free(helper);
+}
+
+static void releaseSubscribeHelper(struct SubscribeHelper* helper)
+{
+  helper->pending -= 1;
+  if (!helper->pending)
+    finishSubscribe(helper);
+}
+
+static void completeMonitoredItem(struct monitored_item_t* monitoredItem, OpcUa_StatusCode statusCode)
+{
+  struct SubscribeHelperItem* waiting = monitoredItem->waiting;
+  monitoredItem->waiting = NULL;
+
+  if (OpcUa_IsGood(statusCode))
+    monitoredItem->state = MONITORED_ITEM_STATE_READY;
+  else {
+    monitoredItem->state = MONITORED_ITEM_STATE_FAILED;
+    unindexMonitoredItem(monitoredItem);
+  }
+
+  while (waiting) {
+    struct SubscribeHelperItem* next = waiting->nextWaiting;
+    waiting->monitoredItemCreateStatusCode = statusCode;
+    releaseSubscribeHelper(waiting->helper);
+    waiting = next;
+  }
+}
+
+static void beginCreateMonitoredItems(struct SubscribeHelperBatch* batch);
+
+static bool isFilterRejected(OpcUa_StatusCode statusCode)
+{
+  return statusCode == OpcUa_BadMonitoredItemFilterUnsupported || statusCode == OpcUa_BadFilterNotAllowed || statusCode == OpcUa_BadMonitoredItemFilterInvalid;
+}
+
+// items with a rejected absolute deadband are created again without filter and get filtered by the gateway
+static struct SubscribeHelperBatch* createRetryBatch(struct chunk_t* chunk, OpcUa_Int32 countRetries)
+{
+  struct SubscribeHelperBatch* batch = chunk->chunker->context;
+  struct SubscribeHelper* helper = batch->helper;
+  OpcUa_Byte* data = malloc(sizeof(struct SubscribeHelperBatch) + countRetries * sizeof(OpcUa_MonitoredItemCreateRequest));
+  struct SubscribeHelperBatch* retry = (struct SubscribeHelperBatch*)data;
+  retry->helper = helper;
+  retry->next = NULL;
+  retry->rateClass = batch->rateClass;
+  retry->offset = helper->count + batch->offset + chunk->offset;
+  retry->count = 0;
+  retry->monitoredItemCreateRequests = (OpcUa_MonitoredItemCreateRequest*)(data + sizeof(struct SubscribeHelperBatch));
+  retry->retry = true;
+
+  for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+    struct SubscribeHelperItem* item = &helper->items[i];
+    OpcUa_Int32 nr = item->monitoredItemCreateRequestNr - batch->offset - chunk->offset;
+    if (item->monitoredItemCreateRequestNr < 0 || nr < 0 || nr >= chunk->count || item->monitoredItemCreateStatusCode != OpcUa_BadFilterNotAllowed)
+      continue;
+
+    struct monitored_item_t* monitoredItem = item->monitoredItem;
+    OpcUa_ExtensionObject_Clear(&monitoredItem->filter);
+    monitoredItem->deadband = monitoredItem->parameters.deadbandValue;
+
+    item->monitoredItemCreateRequestNr = retry->offset + retry->count;
+    initializeMonitoredItemCreateRequest(&retry->monitoredItemCreateRequests[retry->count++], monitoredItem);
+  }
+
+  return retry;
+}
 
 static OpcUa_StatusCode opcua_subscribe(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
 {
-  struct SubscribeStateDataHelper* helper = pCallbackData;
+  struct chunk_t* chunk = pCallbackData;
+  struct SubscribeHelperBatch* batch = chunk->chunker->context;
+  struct SubscribeHelper* helper = batch->helper;
   OpcUa_CreateMonitoredItemsResponse* pCreateMonitoredItemsResponse = pResponse;
   OpcUa_Int32 noOfResults = pCreateMonitoredItemsResponse ? pCreateMonitoredItemsResponse->NoOfResults : 0;
   OpcUa_MonitoredItemCreateResult* results = pCreateMonitoredItemsResponse ? pCreateMonitoredItemsResponse->Results : NULL;
+  OpcUa_Int32 countRetries = 0;
+  size_t rejected = 0;
 
   wpcp_lws_lock();
 
   for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
-    struct SubscribeStateDataHelperItem* item = &helper->items[i];
-    struct subscription_entry_t* sube = wpcp_subscription_get_user(item->subscription);
+    struct SubscribeHelperItem* item = &helper->items[i];
+    OpcUa_Int32 nr = item->monitoredItemCreateRequestNr - batch->offset - chunk->offset;
+    if (item->monitoredItemCreateRequestNr < 0 || nr < 0 || nr >= chunk->count)
+      continue;
 
-    if (item->monitoredItemCreateRequestNr < 0) {
-      struct wpcp_publish_handle_t* publish_handle = wpcp_return_subscribe_accept(helper->result, NULL, item->subscription);
-      assert(sube->publish_handle == publish_handle);
+    if (nr < noOfResults && OpcUa_IsGood(results[nr].StatusCode)) {
+      item->monitoredItem->monitoredItemId = results[nr].MonitoredItemId;
+      item->monitoredItemCreateStatusCode = OpcUa_Good;
+      OpcUa_Mutex_Lock(g_clientMutex);
+      item->monitoredItem->buffered = isBufferable(item->monitoredItem, &results[nr]);
+      OpcUa_Mutex_Unlock(g_clientMutex);
+    } else if (nr < noOfResults && isFilterRejected(results[nr].StatusCode) && !batch->retry && item->monitoredItem->parameters.deadbandType == OpcUa_DeadbandType_Absolute) {
+      item->monitoredItemCreateStatusCode = OpcUa_BadFilterNotAllowed;
+      ++countRetries;
+      continue;
     } else {
-      if (item->monitoredItemCreateRequestNr < noOfResults && OpcUa_IsGood(results[item->monitoredItemCreateRequestNr].StatusCode)) {
-        sube->monitoredItemId = results[item->monitoredItemCreateRequestNr].MonitoredItemId;
-        sube->publish_handle = wpcp_return_subscribe_accept(helper->result, NULL, item->subscription);
-      } else {
-        assert(sube->publish_handle == NULL);
-        wpcp_return_subscribe_reject(helper->result, NULL, item->subscription);
-      }
+      item->monitoredItemCreateStatusCode = nr < noOfResults ? results[nr].StatusCode : OpcUa_Bad;
+      ++rejected;
     }
+
+    completeMonitoredItem(item->monitoredItem, item->monitoredItemCreateStatusCode);
   }
 
-  wpcp_lws_unlock();
+  if (rejected)
+    releaseGroup(batch->rateClass, rejected);
 
-  free(helper);
+  if (countRetries) {
+    helper->pending += 1;
+    beginCreateMonitoredItems(createRetryBatch(chunk, countRetries));
+  }
+
+  chunk_complete(chunk);
+
+  wpcp_lws_unlock();
 
   return OpcUa_Good;
 }
 
-void subscribe_data(void* user, struct wpcp_result_t* result, struct wpcp_subscription_t* subscription, const struct wpcp_value_t* id, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count)
+// the items of a chunk fail without a request if the subscription of the group could not be created
+static void beginCreateMonitoredItemsChunk(struct chunk_t* chunk)
 {
-  struct SubscribeStateDataHelper* helper;
-  if (*context)
-    helper = (struct SubscribeStateDataHelper*) *context;
-  else {
-    OpcUa_UInt32 count = remaining + 1;
-    OpcUa_Byte* data = malloc(sizeof(struct SubscribeStateDataHelper) + count * (sizeof(struct SubscribeStateDataHelperItem) + sizeof(OpcUa_MonitoredItemCreateRequest)));
-    helper = *context = data;
-    helper->result = result;
-    helper->count = count;
-    helper->countMonitoredItems = 0;
-    helper->items = (struct SubscribeStateDataHelperItem*)(data + sizeof(struct SubscribeStateDataHelper));
-    helper->monitoredItemCreateRequests = (OpcUa_MonitoredItemCreateRequest*)(data + sizeof(struct SubscribeStateDataHelper) + count * sizeof(struct SubscribeStateDataHelperItem));
+  struct SubscribeHelperBatch* batch = chunk->chunker->context;
+  struct subscription_group_t* group = &g_groups[batch->rateClass];
+
+  if (group->state != SUBSCRIPTION_GROUP_STATE_READY) {
+    opcua_subscribe(OpcUa_Null, OpcUa_Null, OpcUa_Null, chunk, OpcUa_Bad);
+    return;
   }
 
-  OpcUa_UInt32 nr = helper->count - 1 - remaining;
-  struct SubscribeStateDataHelperItem* item = &helper->items[nr];
-  item->subscription = subscription;
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginCreateMonitoredItems(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    group->subscriptionId,
+    OpcUa_TimestampsToReturn_Source,
+    chunk->count,
+    batch->monitoredItemCreateRequests + chunk->offset,
+    opcua_subscribe,
+    chunk);
+  if (!OpcUa_IsGood(statusCode))
+    opcua_subscribe(OpcUa_Null, OpcUa_Null, OpcUa_Null, chunk, statusCode);
+}
 
-  struct subscription_entry_t* sube = wpcp_subscription_get_user(subscription);
+static void finishCreateMonitoredItems(void* context)
+{
+  struct SubscribeHelperBatch* batch = context;
+  struct SubscribeHelper* helper = batch->helper;
 
-  if (sube) {
-    sube->count += 1;
-    item->monitoredItemCreateRequestNr = -1;
-    assert(sube->publish_handle && "Handling for failing subscribe missing");
+  if (batch->retry)
+    free(batch);
+
+  releaseSubscribeHelper(helper);
+}
+
+static void beginCreateMonitoredItems(struct SubscribeHelperBatch* batch)
+{
+  struct SubscribeHelper* helper = batch->helper;
+  struct subscription_group_t* group = &g_groups[batch->rateClass];
+
+  for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+    struct SubscribeHelperItem* item = &helper->items[i];
+    OpcUa_Int32 nr = item->monitoredItemCreateRequestNr - batch->offset;
+    if (item->monitoredItemCreateRequestNr >= 0 && nr >= 0 && nr < batch->count)
+      item->monitoredItem->subscriptionId = group->subscriptionId;
   }
-  else {
-    size_t gid = g_subss++;
-    sube = &g_subs[gid];
-    sube->type = SUBSCRIPTION_TYPE_STATE_DATA;
-    sube->receivedInitalValue = false;
+
+  chunk_start(&batch->chunker, chunk_getLimit(OPERATION_LIMIT_MONITORED_ITEMS), batch->count, batch, beginCreateMonitoredItemsChunk, finishCreateMonitoredItems);
+}
+
+// has to be called with the wpcp lock held, a response of NULL fails the waiting batches
+static void completeGroup(OpcUa_Int32 rateClass, const OpcUa_CreateSubscriptionResponse* pCreateSubscriptionResponse)
+{
+  struct subscription_group_t* group = &g_groups[rateClass];
+  struct SubscribeHelperBatch* waiting = group->waiting;
+  group->waiting = NULL;
+
+  if (pCreateSubscriptionResponse && OpcUa_IsGood(pCreateSubscriptionResponse->ResponseHeader.ServiceResult)) {
+    group->state = SUBSCRIPTION_GROUP_STATE_READY;
+    group->subscriptionId = pCreateSubscriptionResponse->SubscriptionId;
+    registerSubscription(group->subscriptionId, g_rateClasses[rateClass].maxNotificationsPerPublish);
+    stats_add(STATS_SUBSCRIPTION_GROUPS, 1);
+  } else
+    group->state = SUBSCRIPTION_GROUP_STATE_NONE;
+
+  while (waiting) {
+    struct SubscribeHelperBatch* next = waiting->next;
+    beginCreateMonitoredItems(waiting);
+    waiting = next;
+  }
+}
+
+static OpcUa_StatusCode opcua_create_group(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+{
+  wpcp_lws_lock();
+  completeGroup((OpcUa_Int32)(intptr_t)pCallbackData, pResponse);
+  wpcp_lws_unlock();
+
+  return OpcUa_Good;
+}
+
+static void addToGroup(struct SubscribeHelperBatch* batch)
+{
+  struct subscription_group_t* group = &g_groups[batch->rateClass];
+
+  group->count += batch->count;
+
+  if (group->state == SUBSCRIPTION_GROUP_STATE_READY) {
+    beginCreateMonitoredItems(batch);
+    return;
+  }
+
+  batch->next = group->waiting;
+  group->waiting = batch;
+
+  if (group->state == SUBSCRIPTION_GROUP_STATE_CREATING)
+    return;
+
+  const struct rate_class_t* rateClass = &g_rateClasses[batch->rateClass];
+  group->state = SUBSCRIPTION_GROUP_STATE_CREATING;
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginCreateSubscription(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    rateClass->publishingInterval,
+    rateClass->lifetimeCount,
+    rateClass->maxKeepAliveCount,
+    rateClass->maxNotificationsPerPublish,
+    OpcUa_True,
+    0,
+    opcua_create_group,
+    (OpcUa_Void*)(intptr_t)batch->rateClass);
+  if (!OpcUa_IsGood(statusCode))
+    completeGroup(batch->rateClass, NULL);
+}
+
+// the items are matched with the monitored items once the paths of the batch are resolved
+static void startSubscribe(void* context)
+{
+  struct SubscribeHelper* helper = context;
+
+  for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+    struct SubscribeHelperItem* item = &helper->items[i];
+    struct subscription_entry_t* sube = wpcp_subscription_get_user(item->subscription);
+
+    if (sube) {
+      OpcUa_NodeId_Clear(&item->nodeId);
+      sube->count += 1;
+      item->monitoredItem = NULL;
+      assert(sube->publish_handle && "Handling for failing subscribe missing");
+      continue;
+    }
+
+    sube = allocateSubscriptionEntry(SUBSCRIPTION_TYPE_STATE_DATA, helper->user);
+    if (!sube) {
+      OpcUa_NodeId_Clear(&item->nodeId);
+      item->monitoredItem = NULL;
+      item->monitoredItemCreateStatusCode = OpcUa_BadTooManySubscriptions;
+      continue;
+    }
+
+    struct data_change_parameters_t defaultParameters;
+    char* key = NULL;
+    size_t keyLength = 0;
+    getDataChangeParameters(NULL, 0, &defaultParameters);
+    if (memcmp(&item->parameters, &defaultParameters, sizeof(item->parameters))) {
+      keyLength = sizeof(item->parameters);
+      key = malloc(keyLength);
+      memcpy(key, &item->parameters, keyLength);
+    }
+    OpcUa_UInt32 hash = hashBuffer(hashNodeId(&item->nodeId), key, keyLength);
+
+    struct monitored_item_t* monitoredItem = findMonitoredItem(SUBSCRIPTION_TYPE_STATE_DATA, &item->nodeId, key, keyLength, hash, item->rateClass);
+    if (monitoredItem) {
+      OpcUa_NodeId_Clear(&item->nodeId);
+      free(key);
+      if (monitoredItem->state == MONITORED_ITEM_STATE_CREATING) {
+        item->nextWaiting = monitoredItem->waiting;
+        monitoredItem->waiting = item;
+        helper->pending += 1;
+      }
+    } else {
+      monitoredItem = allocateMonitoredItem(SUBSCRIPTION_TYPE_STATE_DATA, &item->nodeId, key, keyLength, hash, item->rateClass);
+      if (!monitoredItem) {
+        OpcUa_NodeId_Clear(&item->nodeId);
+        free(key);
+        freeSubscriptionEntry(sube);
+        item->monitoredItem = NULL;
+        item->monitoredItemCreateStatusCode = OpcUa_BadTooManyMonitoredItems;
+        continue;
+      }
+      monitoredItem->parameters = item->parameters;
+      initializeDataChangeFilter(&monitoredItem->filter, &item->parameters);
+      item->monitoredItemCreateRequestNr = 0;
+    }
+
     sube->count = 1;
     sube->publish_handle = NULL;
-    toNodeId(id, &sube->nodeId);
-    item->monitoredItemCreateRequestNr = helper->countMonitoredItems++;
-
-    OpcUa_MonitoredItemCreateRequest* monitoredItemCreateRequest = &helper->monitoredItemCreateRequests[item->monitoredItemCreateRequestNr];
-    OpcUa_MonitoredItemCreateRequest_Initialize(monitoredItemCreateRequest);
-    monitoredItemCreateRequest->ItemToMonitor.NodeId = sube->nodeId;
-    monitoredItemCreateRequest->ItemToMonitor.AttributeId = OpcUa_Attributes_Value;
-    monitoredItemCreateRequest->MonitoringMode = OpcUa_MonitoringMode_Reporting;
-    monitoredItemCreateRequest->RequestedParameters.ClientHandle = gid;
-    wpcp_subscription_set_user(subscription, sube);
+    attachSubscriber(monitoredItem, sube);
+    item->monitoredItem = monitoredItem;
+    wpcp_subscription_set_user(item->subscription, sube);
   }
 
-  if (!remaining) {
-    if (helper->countMonitoredItems) {
-      OpcUa_RequestHeader requestHeader;
-      OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginCreateMonitoredItems(
-        setupRequestHeader(&requestHeader),
-        &requestHeader,
-        g_subscriptionId,
-        OpcUa_TimestampsToReturn_Source,
-        helper->countMonitoredItems,
-        helper->monitoredItemCreateRequests,
-        opcua_subscribe,
-        helper);
-      if (!OpcUa_IsGood(statusCode))
-        opcua_subscribe(OpcUa_Null, OpcUa_Null, OpcUa_Null, helper, statusCode);
+  // requests of the same rate class have to be contiguous for CreateMonitoredItems
+  OpcUa_Int32 countBatches = 0;
+  OpcUa_Int32 countMonitoredItems = 0;
+  for (OpcUa_Int32 rateClass = 0; rateClass < RATE_CLASS_COUNT; ++rateClass) {
+    struct SubscribeHelperBatch* batch = &helper->batches[countBatches];
+    batch->offset = countMonitoredItems;
+
+    for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+      struct SubscribeHelperItem* item = &helper->items[i];
+      if (item->monitoredItemCreateRequestNr < 0 || item->monitoredItem->rateClass != rateClass)
+        continue;
+
+      item->monitoredItemCreateRequestNr = countMonitoredItems++;
+
+      initializeMonitoredItemCreateRequest(&helper->monitoredItemCreateRequests[item->monitoredItemCreateRequestNr], item->monitoredItem);
+    }
+
+    batch->count = countMonitoredItems - batch->offset;
+    if (batch->count) {
+      batch->helper = helper;
+      batch->rateClass = rateClass;
+      batch->monitoredItemCreateRequests = helper->monitoredItemCreateRequests + batch->offset;
+      batch->retry = false;
+      countBatches += 1;
     }
-    else
-      opcua_subscribe(NULL, NULL, NULL, helper, OpcUa_Good);
   }
-}
 
-struct SubscribeMatchAlarmHelper;
+  helper->pending += countBatches;
 
-struct SubscribeMatchAlarmHelperItem
-{
-  struct SubscribeMatchAlarmHelper* helper;
-  struct wpcp_subscription_t* subscription;
-  OpcUa_Int32 monitoredItemCreateRequestNr;
-  OpcUa_StatusCode monitoredItemCreateStatusCode;
-  OpcUa_EventFilter* eventFilter;
-};
+  for (OpcUa_Int32 i = 0; i < countBatches; ++i)
+    addToGroup(&helper->batches[i]);
+  releaseSubscribeHelper(helper);
+}
 
-struct SubscribeMatchAlarmHelper
+void subscribe_data(void* user, struct wpcp_result_t* result, struct wpcp_subscription_t* subscription, const struct wpcp_value_t* id, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count)
 {
-  struct wpcp_result_t* result;
-  struct SubscribeMatchAlarmHelperItem* items;
-  struct wpcp_subscription_t* subscription;
-  OpcUa_UInt32 subscriptionId;
-  OpcUa_Int32 count;
-  OpcUa_Int32 countCallbacks;
-  OpcUa_Int32 countMonitoredItems;
-  OpcUa_ReadValueId* readValueId;
-  OpcUa_WriteValue* writeValue;
-  OpcUa_MonitoredItemCreateRequest* monitoredItemCreateRequests;
-};
+  struct SubscribeHelper* helper;
+  if (*context)
+    helper = (struct SubscribeHelper*) *context;
+  else {
+    OpcUa_UInt32 count = remaining + 1;
+    OpcUa_Byte* data = malloc(sizeof(struct SubscribeHelper) + count * (sizeof(struct SubscribeHelperItem) + sizeof(OpcUa_MonitoredItemCreateRequest)));
+    helper = *context = data;
+    helper->result = result;
+    helper->user = user;
+    helper->paths = NULL;
+    helper->count = count;
+    helper->pending = 1;
+    helper->items = (struct SubscribeHelperItem*)(data + sizeof(struct SubscribeHelper));
+    helper->monitoredItemCreateRequests = (OpcUa_MonitoredItemCreateRequest*)(data + sizeof(struct SubscribeHelper) + count * sizeof(struct SubscribeHelperItem));
+  }
+
+  // the options only live as long as this callback, a path missing in the cache is resolved with the batch
+  OpcUa_UInt32 nr = helper->count - 1 - remaining;
+  struct SubscribeHelperItem* item = &helper->items[nr];
+  item->helper = helper;
+  item->subscription = subscription;
+  item->monitoredItemCreateRequestNr = -1;
+  item->monitoredItemCreateStatusCode = OpcUa_Good;
+  item->rateClass = getRateClass(additional, additional_count);
+  getDataChangeParameters(additional, additional_count, &item->parameters);
+  toNodeIdBatched(id, &item->nodeId, &helper->paths);
+
+  if (remaining)
+    return;
+
+  wpcp_lws_lock();
+  path_resolveBatch(helper->paths, startSubscribe, helper);
+  wpcp_lws_unlock();
+}
 
 static OpcUa_StatusCode opcua_subscribe_alarm_2(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
 {
-  struct SubscribeMatchAlarmHelperItem* cbItem = pCallbackData;
-  struct SubscribeMatchAlarmHelper* helper = cbItem->helper;
+  struct SubscribeHelperItem* item = pCallbackData;
+  struct monitored_item_t* monitoredItem = item->monitoredItem;
   OpcUa_CreateMonitoredItemsResponse* pCreateMonitoredItemsResponse = pResponse;
-
-  if (pCreateMonitoredItemsResponse && pCreateMonitoredItemsResponse->NoOfResults == 1) {
-    struct subscription_entry_t* sube = wpcp_subscription_get_user(cbItem->subscription);
-    sube->monitoredItemId = pCreateMonitoredItemsResponse->Results[0].MonitoredItemId;
-    cbItem->monitoredItemCreateStatusCode = pCreateMonitoredItemsResponse->Results[0].StatusCode;
-  } else
-    cbItem->monitoredItemCreateStatusCode = OpcUa_Bad;
+  OpcUa_StatusCode statusCode = OpcUa_Bad;
 
   wpcp_lws_lock();
 
-  helper->countCallbacks += 1;
-  if (helper->countCallbacks == helper->count) {
-    for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
-      struct SubscribeMatchAlarmHelperItem* item = &helper->items[i];
-      struct subscription_entry_t* sube = wpcp_subscription_get_user(item->subscription);
+  if (pCreateMonitoredItemsResponse && pCreateMonitoredItemsResponse->NoOfResults == 1) {
+    monitoredItem->monitoredItemId = pCreateMonitoredItemsResponse->Results[0].MonitoredItemId;
+    statusCode = pCreateMonitoredItemsResponse->Results[0].StatusCode;
+  }
+  item->monitoredItemCreateStatusCode = statusCode;
 
-      if (item->monitoredItemCreateRequestNr < 0) {
-        struct wpcp_publish_handle_t* publish_handle = wpcp_return_subscribe_accept(helper->result, NULL, item->subscription);
-        assert(sube->publish_handle == publish_handle);
-      }
-      else {
-        if (OpcUa_IsGood(item->monitoredItemCreateStatusCode)) {
-          sube->publish_handle = wpcp_return_subscribe_accept(helper->result, NULL, item->subscription);
-        }
-        else {
-          assert(sube->publish_handle == NULL);
-          wpcp_return_subscribe_reject(helper->result, NULL, item->subscription);
-        }
-      }
-    }
+  if (!OpcUa_IsGood(statusCode) && monitoredItem->subscriptionId) {
+    unregisterSubscription(monitoredItem->subscriptionId);
 
-    free(helper);
+    OpcUa_RequestHeader requestHeader;
+    OpcUa_ClientApi_BeginDeleteSubscriptions(
+      setupRequestHeader(&requestHeader),
+      &requestHeader,
+      1,
+      &monitoredItem->subscriptionId,
+      opcua_delete_group,
+      OpcUa_Null);
+    monitoredItem->subscriptionId = 0;
   }
 
+  completeMonitoredItem(monitoredItem, statusCode);
+  releaseSubscribeHelper(item->helper);
+
   wpcp_lws_unlock();
 
   return OpcUa_Good;
@@ -353,80 +1772,130 @@ static OpcUa_StatusCode opcua_subscribe_alarm_2(OpcUa_Channel hChannel, OpcUa_Vo
 
 static OpcUa_StatusCode opcua_subscribe_alarm(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
 {
-  struct SubscribeMatchAlarmHelperItem* item = pCallbackData;
-  struct SubscribeMatchAlarmHelper* helper = item->helper;
+  struct SubscribeHelperItem* item = pCallbackData;
+  struct monitored_item_t* monitoredItem = item->monitoredItem;
+  OpcUa_CreateSubscriptionResponse* pCreateSubscriptionResponse = pResponse;
 
-  if (pResponse) {
-    struct subscription_entry_t* sube = wpcp_subscription_get_user(item->subscription);
-    OpcUa_CreateSubscriptionResponse * pCreateSubscriptionResponse = pResponse;
-    sube->subscriptionId = pCreateSubscriptionResponse->SubscriptionId;
+  if (!pCreateSubscriptionResponse || !OpcUa_IsGood(pCreateSubscriptionResponse->ResponseHeader.ServiceResult))
+    return opcua_subscribe_alarm_2(OpcUa_Null, OpcUa_Null, OpcUa_Null, item, uStatus);
 
-    OpcUa_RequestHeader requestHeader;
-    uStatus = OpcUa_ClientApi_BeginCreateMonitoredItems(
-      setupRequestHeader(&requestHeader),
-      &requestHeader,
-      sube->subscriptionId,
-      OpcUa_TimestampsToReturn_Source,
-      1,
-      helper->monitoredItemCreateRequests + item->monitoredItemCreateRequestNr,
-      opcua_subscribe_alarm_2,
-      item);
-    if (OpcUa_IsGood(uStatus))
-      return OpcUa_Good;
-  }
+  wpcp_lws_lock();
+  monitoredItem->subscriptionId = pCreateSubscriptionResponse->SubscriptionId;
+  registerSubscription(monitoredItem->subscriptionId, 0);
+  wpcp_lws_unlock();
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginCreateMonitoredItems(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    monitoredItem->subscriptionId,
+    OpcUa_TimestampsToReturn_Source,
+    1,
+    item->helper->monitoredItemCreateRequests + item->monitoredItemCreateRequestNr,
+    opcua_subscribe_alarm_2,
+    item);
+  if (!OpcUa_IsGood(statusCode))
+    opcua_subscribe_alarm_2(OpcUa_Null, OpcUa_Null, OpcUa_Null, item, statusCode);
 
-  return opcua_subscribe_alarm_2(OpcUa_Null, OpcUa_Null, OpcUa_Null, item, uStatus);
+  return OpcUa_Good;
 }
 
+// subscriptions with the same filter share one event subscription and monitored item on the server
 void subscribe_alarm(void* user, struct wpcp_result_t* result, struct wpcp_subscription_t* subscription, const struct wpcp_value_t* id, const struct wpcp_value_t* filter, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count)
 {
-  struct SubscribeMatchAlarmHelper* helper;
+  struct SubscribeHelper* helper;
   if (*context)
-    helper = (struct SubscribeMatchAlarmHelper*) *context;
+    helper = (struct SubscribeHelper*) *context;
   else {
     OpcUa_UInt32 count = remaining + 1;
-    OpcUa_Byte* data = malloc(sizeof(struct SubscribeMatchAlarmHelper) + count * (sizeof(struct SubscribeMatchAlarmHelperItem) + sizeof(OpcUa_MonitoredItemCreateRequest)));
+    OpcUa_Byte* data = malloc(sizeof(struct SubscribeHelper) + count * (sizeof(struct SubscribeHelperItem) + sizeof(OpcUa_MonitoredItemCreateRequest)));
     helper = *context = data;
     helper->result = result;
-    helper->subscription = subscription;
     helper->count = count;
-    helper->countCallbacks = 0;
-    helper->countMonitoredItems = 0;
-    helper->items = (struct SubscribeMatchAlarmHelperItem*)(data + sizeof(struct SubscribeMatchAlarmHelper));
-    helper->monitoredItemCreateRequests = (OpcUa_MonitoredItemCreateRequest*)(data + sizeof(struct SubscribeMatchAlarmHelper) + count * sizeof(struct SubscribeMatchAlarmHelperItem));
+    helper->pending = 1;
+    helper->items = (struct SubscribeHelperItem*)(data + sizeof(struct SubscribeHelper));
+    helper->monitoredItemCreateRequests = (OpcUa_MonitoredItemCreateRequest*)(data + sizeof(struct SubscribeHelper) + count * sizeof(struct SubscribeHelperItem));
   }
 
   OpcUa_UInt32 nr = helper->count - 1 - remaining;
-  struct SubscribeMatchAlarmHelperItem* item = &helper->items[nr];
+  struct SubscribeHelperItem* item = &helper->items[nr];
   item->helper = helper;
   item->subscription = subscription;
+  item->monitoredItemCreateRequestNr = -1;
+  item->monitoredItemCreateStatusCode = OpcUa_Good;
 
   struct subscription_entry_t* sube = wpcp_subscription_get_user(subscription);
 
   if (sube) {
     sube->count += 1;
-    item->monitoredItemCreateRequestNr = -1;
+    item->monitoredItem = NULL;
     assert(sube->publish_handle && "Handling for failing subscribe missing");
-    opcua_subscribe_alarm(OpcUa_Null, OpcUa_Null, OpcUa_Null, item, OpcUa_Good);
+  } else if (!(sube = allocateSubscriptionEntry(SUBSCRIPTION_TYPE_FILTER_ALARM, user))) {
+    item->monitoredItem = NULL;
+    item->monitoredItemCreateStatusCode = OpcUa_BadTooManySubscriptions;
   } else {
-    size_t gid = g_subss++;
-    sube = &g_subs[gid];
-    sube->type = SUBSCRIPTION_TYPE_FILTER_ALARM;
-    sube->receivedInitalValue = false;
-    sube->count = 1;
-    sube->publish_handle = NULL;
-    item->monitoredItemCreateRequestNr = helper->countMonitoredItems++;
-
-    OpcUa_MonitoredItemCreateRequest* monitoredItemCreateRequest = &helper->monitoredItemCreateRequests[item->monitoredItemCreateRequestNr];
-    OpcUa_MonitoredItemCreateRequest_Initialize(monitoredItemCreateRequest);
-    monitoredItemCreateRequest->ItemToMonitor.NodeId.Identifier.Numeric = OpcUaId_Server;
-    monitoredItemCreateRequest->ItemToMonitor.AttributeId = OpcUa_Attributes_EventNotifier;
-    monitoredItemCreateRequest->MonitoringMode = OpcUa_MonitoringMode_Reporting;
-    monitoredItemCreateRequest->RequestedParameters.ClientHandle = gid;
-    OpcUa_EncodeableObject_CreateExtension(&OpcUa_EventFilter_EncodeableType, &monitoredItemCreateRequest->RequestedParameters.Filter, &item->eventFilter);
-    OpcUa_EventFilter_Initialize(item->eventFilter);
-    item->eventFilter->SelectClauses = getSelectClauses(&item->eventFilter->NoOfSelectClauses);
-    wpcp_subscription_set_user(subscription, sube);
+    size_t keyLength = toWpcpKey(filter, NULL, 0);
+    char* key = keyLength ? malloc(keyLength) : NULL;
+    toWpcpKey(filter, key, keyLength);
+
+    // events of the source subtree are reported by the source node itself if it is an event notifier
+    OpcUa_NodeId nodeId;
+    const struct wpcp_value_t* source = findMapValue(filter, "source");
+    if (!source || OpcUa_IsBad(toNodeId(source, &nodeId))) {
+      OpcUa_NodeId_Initialize(&nodeId);
+      nodeId.Identifier.Numeric = OpcUaId_Server;
+    }
+    OpcUa_UInt32 hash = hashBuffer(hashNodeId(&nodeId), key, keyLength);
+
+    struct monitored_item_t* monitoredItem = findMonitoredItem(SUBSCRIPTION_TYPE_FILTER_ALARM, &nodeId, key, keyLength, hash, -1);
+    if (monitoredItem) {
+      free(key);
+      if (monitoredItem->state == MONITORED_ITEM_STATE_CREATING) {
+        item->nextWaiting = monitoredItem->waiting;
+        monitoredItem->waiting = item;
+        helper->pending += 1;
+      }
+    } else {
+      monitoredItem = allocateMonitoredItem(SUBSCRIPTION_TYPE_FILTER_ALARM, &nodeId, key, keyLength, hash, -1);
+      if (monitoredItem) {
+        initializeEventFilter(&monitoredItem->filter, filter);
+        item->monitoredItemCreateRequestNr = 0;
+      } else {
+        OpcUa_NodeId_Clear(&nodeId);
+        free(key);
+      }
+    }
+
+    if (monitoredItem) {
+      sube->count = 1;
+      sube->publish_handle = NULL;
+      attachSubscriber(monitoredItem, sube);
+      wpcp_subscription_set_user(subscription, sube);
+    } else {
+      freeSubscriptionEntry(sube);
+      item->monitoredItemCreateStatusCode = OpcUa_BadTooManyMonitoredItems;
+    }
+    item->monitoredItem = monitoredItem;
+  }
+
+  if (remaining)
+    return;
+
+  OpcUa_Int32 countMonitoredItems = 0;
+  for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+    item = &helper->items[i];
+    if (item->monitoredItemCreateRequestNr < 0)
+      continue;
+
+    item->monitoredItemCreateRequestNr = countMonitoredItems++;
+    initializeMonitoredItemCreateRequest(&helper->monitoredItemCreateRequests[item->monitoredItemCreateRequestNr], item->monitoredItem);
+  }
+
+  helper->pending += countMonitoredItems;
+  for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+    item = &helper->items[i];
+    if (item->monitoredItemCreateRequestNr < 0)
+      continue;
 
     OpcUa_RequestHeader requestHeader;
     OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginCreateSubscription(
@@ -443,93 +1912,135 @@ void subscribe_alarm(void* user, struct wpcp_result_t* result, struct wpcp_subsc
     if (!OpcUa_IsGood(statusCode))
       opcua_subscribe_alarm(OpcUa_Null, OpcUa_Null, OpcUa_Null, item, statusCode);
   }
+
+  wpcp_lws_lock();
+  releaseSubscribeHelper(helper);
+  wpcp_lws_unlock();
 }
 
 struct UnsubscribeStateDataHelperItem
 {
   struct wpcp_subscription_t* subscription;
-  OpcUa_Int32 deleteMonitoredItemNr;
-  OpcUa_StatusCode deleteMonitoredItemStatusCode;
+  OpcUa_Int32 bucket;
+  OpcUa_UInt32 deleteId;
+  OpcUa_Int32 deleteNr;
+  OpcUa_StatusCode deleteStatusCode;
+};
+
+struct UnsubscribeStateDataHelperBatch
+{
+  struct UnsubscribeStateDataHelper* helper;
+  OpcUa_Int32 bucket;
+  OpcUa_Int32 offset;
+  OpcUa_Int32 count;
 };
 
+// buckets 0 to RATE_CLASS_COUNT - 1 delete monitored items of a group, bucket RATE_CLASS_COUNT deletes alarm subscriptions
 struct UnsubscribeStateDataHelper
 {
   struct wpcp_result_t* result;
   OpcUa_Int32 count;
-  OpcUa_Int32 countMonitoredItems;
-  OpcUa_Int32 countSubscriptions;
+  OpcUa_Int32 countBatches;
+  OpcUa_Int32 countCallbacks;
   struct UnsubscribeStateDataHelperItem* items;
   OpcUa_UInt32* ids;
+  struct UnsubscribeStateDataHelperBatch batches[RATE_CLASS_COUNT + 1];
 };
 
-static OpcUa_StatusCode opcua_unsubscribe_2(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+static void finishUnsubscribe(struct UnsubscribeStateDataHelper* helper)
 {
-  struct UnsubscribeStateDataHelper* helper = pCallbackData;
-  OpcUa_DeleteSubscriptionsResponse* pDeleteSubscriptionsResponse = pResponse;
-  OpcUa_Int32 noOfResults = pDeleteSubscriptionsResponse ? pDeleteSubscriptionsResponse->NoOfResults : 0;
-  OpcUa_StatusCode* results = pDeleteSubscriptionsResponse ? pDeleteSubscriptionsResponse->Results : NULL;
-
-  wpcp_lws_lock();
-
   for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
     struct UnsubscribeStateDataHelperItem* item = &helper->items[i];
     struct subscription_entry_t* sube = wpcp_subscription_get_user(item->subscription);
 
     if (!sube->count) {
       sube->publish_handle = NULL;
-      OpcUa_NodeId_Clear(&sube->nodeId);
+      freeSubscriptionEntry(sube);
     }
 
-    if (item->deleteMonitoredItemNr < 0)
+    if (OpcUa_IsGood(item->deleteStatusCode))
       wpcp_return_unsubscribe(helper->result, NULL, item->subscription);
-    else if (item->deleteMonitoredItemNr < helper->countMonitoredItems) {
-      if (OpcUa_IsGood(item->deleteMonitoredItemStatusCode))
-        wpcp_return_unsubscribe(helper->result, NULL, item->subscription);
-      else {
-        wpcp_return_unsubscribe(helper->result, NULL, NULL);
-        assert(false);
-      }
-    } else {
-      OpcUa_Int32 nr = helper->count - 1 - item->deleteMonitoredItemNr;
-      if (nr < noOfResults && OpcUa_IsGood(results[nr]))
-        wpcp_return_unsubscribe(helper->result, NULL, item->subscription);
-      else {
-        wpcp_return_unsubscribe(helper->result, NULL, NULL);
-        assert(false);
-      }
+    else {
+      wpcp_return_unsubscribe(helper->result, NULL, NULL);
+      assert(false);
     }
   }
 
+  free(helper);
+}
+
+static void completeUnsubscribeBatch(struct UnsubscribeStateDataHelperBatch* batch, OpcUa_Int32 noOfResults, const OpcUa_StatusCode* results)
+{
+  struct UnsubscribeStateDataHelper* helper = batch->helper;
+
+  wpcp_lws_lock();
+
+  for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+    struct UnsubscribeStateDataHelperItem* item = &helper->items[i];
+    if (item->bucket != batch->bucket)
+      continue;
+
+    OpcUa_Int32 nr = item->deleteNr - batch->offset;
+    item->deleteStatusCode = nr < noOfResults ? results[nr] : OpcUa_Bad;
+  }
+
+  helper->countCallbacks += 1;
+  if (helper->countCallbacks == helper->countBatches)
+    finishUnsubscribe(helper);
+
   wpcp_lws_unlock();
+}
 
-  free(helper);
+static OpcUa_StatusCode opcua_unsubscribe_2(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+{
+  OpcUa_DeleteSubscriptionsResponse* pDeleteSubscriptionsResponse = pResponse;
+  OpcUa_Int32 noOfResults = pDeleteSubscriptionsResponse ? pDeleteSubscriptionsResponse->NoOfResults : 0;
+  OpcUa_StatusCode* results = pDeleteSubscriptionsResponse ? pDeleteSubscriptionsResponse->Results : NULL;
+
+  completeUnsubscribeBatch(pCallbackData, noOfResults, results);
 
   return OpcUa_Good;
 }
 
 static OpcUa_StatusCode opcua_unsubscribe(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
 {
-  struct UnsubscribeStateDataHelper* helper = pCallbackData;
   OpcUa_DeleteMonitoredItemsResponse* pDeleteMonitoredItemsResponse = pResponse;
   OpcUa_Int32 noOfResults = pDeleteMonitoredItemsResponse ? pDeleteMonitoredItemsResponse->NoOfResults : 0;
+  OpcUa_StatusCode* results = pDeleteMonitoredItemsResponse ? pDeleteMonitoredItemsResponse->Results : NULL;
 
-  for (OpcUa_Int32 i = 0; i < noOfResults; ++i)
-    helper->items[i].deleteMonitoredItemStatusCode = pDeleteMonitoredItemsResponse->Results[noOfResults - 1 - i];
+  completeUnsubscribeBatch(pCallbackData, noOfResults, results);
 
-  if (helper->countSubscriptions) {
-    OpcUa_RequestHeader requestHeader;
-    uStatus = OpcUa_ClientApi_BeginDeleteSubscriptions(
+  return OpcUa_Good;
+}
+
+static void beginUnsubscribeBatch(struct UnsubscribeStateDataHelperBatch* batch)
+{
+  struct UnsubscribeStateDataHelper* helper = batch->helper;
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_StatusCode statusCode;
+
+  if (batch->bucket < RATE_CLASS_COUNT) {
+    statusCode = OpcUa_ClientApi_BeginDeleteMonitoredItems(
+      setupRequestHeader(&requestHeader),
+      &requestHeader,
+      g_groups[batch->bucket].subscriptionId,
+      batch->count,
+      helper->ids + batch->offset,
+      opcua_unsubscribe,
+      batch);
+    if (!OpcUa_IsGood(statusCode))
+      opcua_unsubscribe(OpcUa_Null, OpcUa_Null, OpcUa_Null, batch, statusCode);
+  } else {
+    statusCode = OpcUa_ClientApi_BeginDeleteSubscriptions(
       setupRequestHeader(&requestHeader),
       &requestHeader,
-      helper->countSubscriptions,
-      helper->ids + helper->count - helper->countSubscriptions,
+      batch->count,
+      helper->ids + batch->offset,
       opcua_unsubscribe_2,
-      helper);
-    if (OpcUa_IsGood(uStatus))
-      return OpcUa_Good;
+      batch);
+    if (!OpcUa_IsGood(statusCode))
+      opcua_unsubscribe_2(OpcUa_Null, OpcUa_Null, OpcUa_Null, batch, statusCode);
   }
-
-  return opcua_unsubscribe_2(OpcUa_Null, OpcUa_Null, OpcUa_Null, helper, uStatus);
 }
 
 void unsubscribe(void* user, struct wpcp_result_t* result, struct wpcp_subscription_t* subscription, void** context, uint32_t remaining)
@@ -543,8 +2054,8 @@ void unsubscribe(void* user, struct wpcp_result_t* result, struct wpcp_subscript
     helper = *context = data;
     helper->result = result;
     helper->count = count;
-    helper->countMonitoredItems = 0;
-    helper->countSubscriptions = 0;
+    helper->countBatches = 0;
+    helper->countCallbacks = 0;
     helper->items = (struct UnsubscribeStateDataHelperItem*)(data + sizeof(struct UnsubscribeStateDataHelper));
     helper->ids = (OpcUa_UInt32*)(data + sizeof(struct UnsubscribeStateDataHelper) + count * sizeof(struct UnsubscribeStateDataHelperItem));
   }
@@ -552,70 +2063,207 @@ void unsubscribe(void* user, struct wpcp_result_t* result, struct wpcp_subscript
   OpcUa_UInt32 nr = helper->count - 1 - remaining;
   struct UnsubscribeStateDataHelperItem* item = &helper->items[nr];
   item->subscription = subscription;
-  item->deleteMonitoredItemStatusCode = OpcUa_Bad;
+  item->deleteNr = -1;
+  item->deleteStatusCode = OpcUa_Good;
 
   struct subscription_entry_t* sube = wpcp_subscription_get_user(subscription);
 
   sube->count -= 1;
 
   if (sube->count) {
-    item->deleteMonitoredItemNr = -1;
+    item->bucket = -1;
   } else if (sube->type == SUBSCRIPTION_TYPE_STATE_DATA) {
-    item->deleteMonitoredItemNr = helper->countMonitoredItems++;
-    helper->ids[item->deleteMonitoredItemNr] = sube->monitoredItemId;
+    item->bucket = sube->monitoredItem->rateClass;
+    item->deleteId = sube->monitoredItem->monitoredItemId;
+    if (!detachSubscriber(sube))
+      item->bucket = -1;
   } else if (sube->type == SUBSCRIPTION_TYPE_FILTER_ALARM) {
-    item->deleteMonitoredItemNr = helper->count - ++(helper->countSubscriptions);
-    helper->ids[item->deleteMonitoredItemNr] = sube->subscriptionId;
+    item->bucket = RATE_CLASS_COUNT;
+    item->deleteId = sube->monitoredItem->subscriptionId;
+    if (detachSubscriber(sube))
+      unregisterSubscription(item->deleteId);
+    else
+      item->bucket = -1;
   } else
     assert(false);
 
-  if (!remaining) {
-    if (helper->countMonitoredItems) {
-      OpcUa_RequestHeader requestHeader;
-      OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginDeleteMonitoredItems(
-        setupRequestHeader(&requestHeader),
-        &requestHeader,
-        g_subscriptionId,
-        helper->countMonitoredItems,
-        helper->ids,
-        opcua_unsubscribe,
-        helper);
-      if (!OpcUa_IsGood(statusCode))
-        opcua_unsubscribe(OpcUa_Null, OpcUa_Null, OpcUa_Null, helper, statusCode);
+  if (remaining)
+    return;
+
+  OpcUa_Int32 countIds = 0;
+  for (OpcUa_Int32 bucket = 0; bucket <= RATE_CLASS_COUNT; ++bucket) {
+    struct UnsubscribeStateDataHelperBatch* batch = &helper->batches[helper->countBatches];
+    batch->offset = countIds;
+
+    for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+      item = &helper->items[i];
+      if (item->bucket != bucket)
+        continue;
+
+      item->deleteNr = countIds++;
+      helper->ids[item->deleteNr] = item->deleteId;
     }
-    else
-      opcua_unsubscribe(NULL, NULL, NULL, helper, OpcUa_Good);
+
+    batch->count = countIds - batch->offset;
+    if (!batch->count)
+      continue;
+
+    // deleting the subscription of an emptied group removes its monitored items too
+    if (bucket < RATE_CLASS_COUNT && g_groups[bucket].count == (size_t)batch->count) {
+      for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+        if (helper->items[i].bucket == bucket)
+          helper->items[i].bucket = -1;
+      }
+      releaseGroup(bucket, batch->count);
+      countIds = batch->offset;
+      continue;
+    }
+
+    if (bucket < RATE_CLASS_COUNT)
+      releaseGroup(bucket, batch->count);
+
+    batch->helper = helper;
+    batch->bucket = bucket;
+    helper->countBatches += 1;
+  }
+
+  OpcUa_Int32 countBatches = helper->countBatches;
+  if (!countBatches) {
+    wpcp_lws_lock();
+    finishUnsubscribe(helper);
+    wpcp_lws_unlock();
   }
+
+  for (OpcUa_Int32 i = 0; i < countBatches; ++i)
+    beginUnsubscribeBatch(&helper->batches[i]);
 }
 
-static OpcUa_StatusCode opcua_republish_state_data(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+static OpcUa_UInt32 recreateMonitoredItems(OpcUa_UInt32 subscriptionId, OpcUa_Int32 count, const OpcUa_UInt32* handles, const OpcUa_MonitoredItemCreateRequest* monitoredItemCreateRequests)
 {
-  struct wpcp_publish_handle_t* publish_handle = pCallbackData;
-  OpcUa_ReadResponse* pReadResponse = pResponse;
-  OpcUa_Int32 noOfResults = pReadResponse->NoOfResults;
-  OpcUa_DataValue* results = pReadResponse->Results;
+  OpcUa_UInt32 rebuilt = 0;
+  OpcUa_UInt32 limit = chunk_getLimit(OPERATION_LIMIT_MONITORED_ITEMS);
+  OpcUa_Int32 size = limit && limit < MAX_MONITORED_ITEMS_PER_RECREATE ? (OpcUa_Int32)limit : MAX_MONITORED_ITEMS_PER_RECREATE;
+
+  for (OpcUa_Int32 offset = 0; offset < count; offset += size) {
+    OpcUa_Int32 chunk = count - offset < size ? count - offset : size;
+    OpcUa_RequestHeader requestHeader;
+    OpcUa_ResponseHeader responseHeader;
+    OpcUa_Int32 noOfResults = 0;
+    OpcUa_MonitoredItemCreateResult* results = NULL;
+    OpcUa_Int32 noOfDiagnosticInfos = 0;
+    OpcUa_DiagnosticInfo* diagnosticInfos = NULL;
+
+    OpcUa_ResponseHeader_Initialize(&responseHeader);
+    OpcUa_StatusCode statusCode = OpcUa_ClientApi_CreateMonitoredItems(
+      setupRequestHeader(&requestHeader),
+      &requestHeader,
+      subscriptionId,
+      OpcUa_TimestampsToReturn_Source,
+      chunk,
+      monitoredItemCreateRequests + offset,
+      &responseHeader,
+      &noOfResults,
+      &results,
+      &noOfDiagnosticInfos,
+      &diagnosticInfos);
+
+    if (OpcUa_IsGood(statusCode) && OpcUa_IsGood(responseHeader.ServiceResult)) {
+      wpcp_lws_lock();
+      OpcUa_Mutex_Lock(g_clientMutex);
+      for (OpcUa_Int32 i = 0; i < chunk && i < noOfResults; ++i) {
+        if (!OpcUa_IsGood(results[i].StatusCode))
+          continue;
+
+        struct monitored_item_t* monitoredItem = slab_get(&g_monitoredItems, handles[offset + i]);
+        if (!monitoredItem || monitoredItem->subscriptionId != subscriptionId)
+          continue;
+        monitoredItem->monitoredItemId = results[i].MonitoredItemId;
+        monitoredItem->buffered = isBufferable(monitoredItem, &results[i]);
+        ++rebuilt;
+      }
+      OpcUa_Mutex_Unlock(g_clientMutex);
+      wpcp_lws_unlock();
+    }
 
-  assert(noOfResults == 1);
+    OpcUa_ResponseHeader_Clear(&responseHeader);
+    OpcUa_Memory_Free(results);
+  }
 
-  wpcp_lws_lock();
+  return rebuilt;
+}
 
-  struct wpcp_value_t value;
-  toWpcpValue(&results->Value, &value);
-  wpcp_publish_data(publish_handle, &value, toWpcpTime(&results->SourceTimestamp, results->SourcePicoseconds), results->StatusCode, NULL, 0);
+OpcUa_UInt32 opcua_recreateSubscriptions(OpcUa_Int32 noOfSubscriptionIds, const OpcUa_UInt32* subscriptionIds)
+{
+  OpcUa_UInt32 rebuilt = 0;
+
+  for (OpcUa_Int32 i = 0; i < noOfSubscriptionIds; ++i) {
+    OpcUa_UInt32 oldSubscriptionId = subscriptionIds[i];
+    OpcUa_UInt32 newSubscriptionId;
+    OpcUa_Int32 rateClass = -1;
+    OpcUa_StatusCode statusCode;
+
+    wpcp_lws_lock();
+    for (OpcUa_Int32 j = 0; j < RATE_CLASS_COUNT; ++j) {
+      if (g_groups[j].state == SUBSCRIPTION_GROUP_STATE_READY && g_groups[j].subscriptionId == oldSubscriptionId)
+        rateClass = j;
+    }
+    wpcp_lws_unlock();
 
-  wpcp_return_republish(publish_handle);
+    if (rateClass >= 0) {
+      const struct rate_class_t* parameters = &g_rateClasses[rateClass];
+      statusCode = createSubscription(parameters->publishingInterval, parameters->lifetimeCount, parameters->maxKeepAliveCount, parameters->maxNotificationsPerPublish, &newSubscriptionId);
+    } else
+      statusCode = createSubscription(0.0, 0, 0, 0, &newSubscriptionId);
 
-  wpcp_lws_unlock();
+    if (OpcUa_IsBad(statusCode))
+      continue;
 
-  return OpcUa_Good;
-}
+    wpcp_lws_lock();
 
-static OpcUa_StatusCode opcua_republish_filter_alarm(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
-{
-  OpcUa_CallResponse* pCallResponse = pResponse;
-  assert(pCallResponse->NoOfResults == 1);
-  assert(OpcUa_IsGood(pCallResponse->Results[0].StatusCode));
-  return OpcUa_Good;
+    if (rateClass >= 0)
+      g_groups[rateClass].subscriptionId = newSubscriptionId;
+
+    // the slab has to stay the same between counting and copying the items
+    OpcUa_Mutex_Lock(g_clientMutex);
+    OpcUa_Int32 count = 0;
+    for (OpcUa_UInt32 index = 0; index < slab_size(&g_monitoredItems); ++index) {
+      struct monitored_item_t* monitoredItem = slab_at(&g_monitoredItems, index);
+      if (monitoredItem && monitoredItem->state == MONITORED_ITEM_STATE_READY && monitoredItem->subscriptionId == oldSubscriptionId)
+        ++count;
+    }
+
+    OpcUa_MonitoredItemCreateRequest* monitoredItemCreateRequests = malloc(count * (sizeof(OpcUa_MonitoredItemCreateRequest) + sizeof(OpcUa_UInt32)));
+    OpcUa_UInt32* handles = (OpcUa_UInt32*)(monitoredItemCreateRequests + count);
+    OpcUa_Int32 nr = 0;
+
+    // the requests get copies, since the monitored items may go away while the lock is released
+    for (OpcUa_UInt32 index = 0; index < slab_size(&g_monitoredItems); ++index) {
+      struct monitored_item_t* monitoredItem = slab_at(&g_monitoredItems, index);
+      if (!monitoredItem || monitoredItem->state != MONITORED_ITEM_STATE_READY || monitoredItem->subscriptionId != oldSubscriptionId)
+        continue;
+
+      OpcUa_MonitoredItemCreateRequest* monitoredItemCreateRequest = &monitoredItemCreateRequests[nr];
+      initializeMonitoredItemCreateRequest(monitoredItemCreateRequest, monitoredItem);
+      OpcUa_NodeId_CopyTo(&monitoredItem->nodeId, &monitoredItemCreateRequest->ItemToMonitor.NodeId);
+      OpcUa_ExtensionObject_CopyTo(&monitoredItem->filter, &monitoredItemCreateRequest->RequestedParameters.Filter);
+      monitoredItem->subscriptionId = newSubscriptionId;
+      // changes between the lost and the new subscription are unknown
+      series_reset(monitoredItem->series);
+      monitoredItem->conditionsComplete = false;
+      handles[nr++] = monitoredItem->handle;
+    }
+    OpcUa_Mutex_Unlock(g_clientMutex);
+
+    wpcp_lws_unlock();
+
+    rebuilt += recreateMonitoredItems(newSubscriptionId, nr, handles, monitoredItemCreateRequests);
+
+    for (OpcUa_Int32 j = 0; j < nr; ++j)
+      OpcUa_MonitoredItemCreateRequest_Clear(&monitoredItemCreateRequests[j]);
+    free(monitoredItemCreateRequests);
+  }
+
+  return rebuilt;
 }
 
 void republish(void* user, struct wpcp_publish_handle_t* publish_handle, struct wpcp_subscription_t* subscription)
@@ -623,122 +2271,228 @@ void republish(void* user, struct wpcp_publish_handle_t* publish_handle, struct
   struct subscription_entry_t* sube = wpcp_subscription_get_user(subscription);
 
   if (sube->type == SUBSCRIPTION_TYPE_STATE_DATA) {
-    if (sube->receivedInitalValue) {
-      OpcUa_ReadValueId readValueId;
-      OpcUa_ReadValueId_Initialize(&readValueId);
-      readValueId.NodeId = sube->nodeId;
-      readValueId.AttributeId = OpcUa_Attributes_Value;
-
-      OpcUa_RequestHeader requestHeader;
-      OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginRead(
-        setupRequestHeader(&requestHeader),
-        &requestHeader,
-        0.0,
-        OpcUa_TimestampsToReturn_Neither,
-        1,
-        &readValueId,
-        opcua_republish_state_data,
-        publish_handle);
-      if (!OpcUa_IsGood(statusCode))
-        opcua_republish_state_data(OpcUa_Null, OpcUa_Null, OpcUa_Null, publish_handle, statusCode);
+    // the monitored item holds the current value, an item still waiting for its first value publishes it anyway,
+    // with a client queue it follows with the next flush of the connection like every other value
+    wpcp_lws_lock();
+    OpcUa_Mutex_Lock(g_clientMutex);
+    if (sube->monitoredItem->hasValue) {
+      if (sube->client)
+        publishData(sube, &sube->monitoredItem->value);
+      else
+        publishDataValue(publish_handle, &sube->monitoredItem->value);
     }
+    OpcUa_Mutex_Unlock(g_clientMutex);
+    wpcp_return_republish(publish_handle);
+    wpcp_lws_unlock();
   } else if (sube->type == SUBSCRIPTION_TYPE_FILTER_ALARM) {
-    sube->republish_publish_handle = publish_handle;
-
-    OpcUa_CallMethodRequest callMethodRequest;
-    OpcUa_CallMethodRequest_Initialize(&callMethodRequest);
-    callMethodRequest.ObjectId.Identifier.Numeric = OpcUaId_ConditionType;
-    callMethodRequest.MethodId.Identifier.Numeric = OpcUaId_ConditionType_ConditionRefresh;
-    callMethodRequest.NoOfInputArguments = 1;
-
-    OpcUa_Variant var;
-    OpcUa_Variant_Initialize(&var);
-    var.Datatype = OpcUaType_UInt32;
-    var.Value.UInt32 = sube->subscriptionId;
-    callMethodRequest.InputArguments = &var;
+    struct monitored_item_t* monitoredItem = sube->monitoredItem;
+    // the events of the server change the condition table and the refresh state under the same locks
+    wpcp_lws_lock();
+    OpcUa_Mutex_Lock(g_clientMutex);
+
+    // the condition table holds every retained condition since the last complete refresh
+    if (monitoredItem->conditionsComplete && monitoredItem->refreshState == REFRESH_STATE_IDLE) {
+      flushConditions();
+      condition_forEach(monitoredItem->conditions, publishCondition, publish_handle);
+      wpcp_return_republish(publish_handle);
+      stats_add(STATS_ALARM_REPUBLISHED_LOCAL, 1);
+    } else {
+      // one ConditionRefresh serves all subscribers of the shared monitored item
+      sube->republish_publish_handle = publish_handle;
+      if (monitoredItem->refreshState == REFRESH_STATE_IDLE)
+        beginConditionRefresh(monitoredItem);
+    }
 
-    OpcUa_RequestHeader requestHeader;
-    OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginCall(
-      setupRequestHeader(&requestHeader),
-      &requestHeader,
-      1,
-      &callMethodRequest,
-      opcua_republish_filter_alarm,
-      publish_handle);
-    if (!OpcUa_IsGood(statusCode))
-      opcua_republish_filter_alarm(OpcUa_Null, OpcUa_Null, OpcUa_Null, publish_handle, statusCode);
+    OpcUa_Mutex_Unlock(g_clientMutex);
+    wpcp_lws_unlock();
   } else
     assert(false);
 }
 
 
+#define ALARM_MAX_CALLS_PER_TOKEN 2
+
+// the method calls of all tokens of a batch are sent together, a token succeeds if all its calls succeed
+struct HandleAlarmHelper
+{
+  struct wpcp_result_t* result;
+  OpcUa_Int32 count;
+  OpcUa_Int32 countCalls;
+  struct chunker_t chunker;
+  OpcUa_Int32* firstCall;
+  OpcUa_Int32* noOfCalls;
+  OpcUa_CallMethodRequest* callMethodRequest;
+  OpcUa_Variant* inputArguments;
+  OpcUa_StatusCode* callResult;
+};
+
 static OpcUa_StatusCode opcua_handle_alarm(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
 {
-  struct wpcp_result_t* result = pCallbackData;
+  struct chunk_t* chunk = pCallbackData;
+  struct HandleAlarmHelper* helper = chunk->chunker->context;
   OpcUa_CallResponse* pCallResponse = pResponse;
-  assert(pCallResponse->NoOfResults == 1);
+  OpcUa_Int32 noOfResults = pCallResponse && OpcUa_IsGood(pCallResponse->ResponseHeader.ServiceResult) ? pCallResponse->NoOfResults : 0;
+
+  for (OpcUa_Int32 i = 0; i < chunk->count && i < noOfResults; ++i)
+    helper->callResult[chunk->offset + i] = pCallResponse->Results[i].StatusCode;
 
   wpcp_lws_lock();
-  wpcp_return_handle_alarm(result, NULL, OpcUa_IsGood(pCallResponse->Results[0].StatusCode));
+  chunk_complete(chunk);
   wpcp_lws_unlock();
 
   return OpcUa_Good;
 }
 
-void handle_alarm(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* token, const struct wpcp_value_t* acknowledge, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count)
+static void beginHandleAlarm(struct chunk_t* chunk)
 {
-  OpcUa_CallMethodRequest callMethodRequest;
-  OpcUa_CallMethodRequest_Initialize(&callMethodRequest);
+  struct HandleAlarmHelper* helper = chunk->chunker->context;
 
-  OpcUa_Variant var[2];
-  OpcUa_Variant_Initialize(&var[0]);
-  OpcUa_Variant_Initialize(&var[1]);
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginCall(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    chunk->count,
+    &helper->callMethodRequest[chunk->offset],
+    opcua_handle_alarm,
+    chunk);
+  if (!OpcUa_IsGood(statusCode))
+    opcua_handle_alarm(OpcUa_Null, OpcUa_Null, OpcUa_Null, chunk, statusCode);
+}
 
+static void finishHandleAlarm(void* context)
+{
+  struct HandleAlarmHelper* helper = context;
 
-  OpcUa_Byte buffer[128];
+  for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+    bool success = helper->noOfCalls[i] > 0;
+    for (OpcUa_Int32 j = helper->firstCall[i]; j < helper->firstCall[i] + helper->noOfCalls[i]; ++j)
+      success = success && OpcUa_IsGood(helper->callResult[j]);
+    wpcp_return_handle_alarm(helper->result, NULL, success);
+  }
 
-  if (token) {
-    for (size_t i = token->value.length; i > 0; --i) {
-      if (token->data.text_string[i] == '!') {
-        struct wpcp_value_t tmp = *token;
-        tmp.value.length = i;
-        toNodeId(&tmp, &callMethodRequest.ObjectId);
+  for (OpcUa_Int32 i = 0; i < helper->countCalls; ++i) {
+    OpcUa_NodeId_Clear(&helper->callMethodRequest[i].ObjectId);
+    OpcUa_Variant_Clear(&helper->inputArguments[2 * i + 0]);
+    OpcUa_Variant_Clear(&helper->inputArguments[2 * i + 1]);
+  }
 
-        var[0].Datatype = OpcUaType_ByteString;
-        var[0].Value.ByteString.Length = (token->value.length - i - 1) / 2;
-        var[0].Value.ByteString.Data = buffer;
+  free(helper);
+}
 
-        for (OpcUa_Int32 j = 0; j < var[0].Value.ByteString.Length; ++j) {
-          const char* hex = token->data.text_string + i + 1 + 2 * j;
-          var[0].Value.ByteString.Data[j] =
-            (('0' <= hex[0] && hex[0] <= '9') ? (hex[0] - '0') : (10 + hex[0] - 'a')) << 4 |
-            (('0' <= hex[1] && hex[1] <= '9') ? (hex[1] - '0') : (10 + hex[1] - 'a')) << 0;
-        }
+static int toHexDigit(char c)
+{
+  if ('0' <= c && c <= '9')
+    return c - '0';
+  if ('a' <= c && c <= 'f')
+    return 10 + c - 'a';
+  if ('A' <= c && c <= 'F')
+    return 10 + c - 'A';
+  return -1;
+}
 
-        break;
-      }
+// a token is the condition id and the hex encoded event id, separated by the last '!'
+static OpcUa_Boolean parseAlarmToken(const struct wpcp_value_t* token, OpcUa_NodeId* conditionId, OpcUa_ByteString* eventId)
+{
+  if (!token || token->type != WPCP_VALUE_TYPE_TEXT_STRING)
+    return OpcUa_False;
+
+  uint32_t separator = token->value.length;
+  while (separator > 0 && token->data.text_string[separator - 1] != '!')
+    --separator;
+  if (!separator || (token->value.length - separator) % 2)
+    return OpcUa_False;
+
+  const char* hex = token->data.text_string + separator;
+  OpcUa_ByteString_Initialize(eventId);
+  eventId->Length = (token->value.length - separator) / 2;
+  eventId->Data = OpcUa_Memory_Alloc(eventId->Length ? eventId->Length : 1);
+  for (OpcUa_Int32 i = 0; i < eventId->Length; ++i) {
+    int high = toHexDigit(hex[2 * i]);
+    int low = toHexDigit(hex[2 * i + 1]);
+    if (high < 0 || low < 0) {
+      OpcUa_ByteString_Clear(eventId);
+      return OpcUa_False;
     }
+    eventId->Data[i] = (OpcUa_Byte)(high << 4 | low);
   }
 
-  if (acknowledge && acknowledge->type == WPCP_VALUE_TYPE_TRUE) {
-    callMethodRequest.MethodId.Identifier.Numeric = OpcUaId_AcknowledgeableConditionType_Acknowledge;
-    callMethodRequest.NoOfInputArguments = 2;
+  struct wpcp_value_t id = *token;
+  id.value.length = separator - 1;
+  OpcUa_NodeId_Initialize(conditionId);
+  if (OpcUa_IsBad(toNodeId(&id, conditionId))) {
+    OpcUa_ByteString_Clear(eventId);
+    return OpcUa_False;
   }
 
-  OpcUa_LocalizedText lt;
-  OpcUa_LocalizedText_Initialize(&lt);
-  var[1].Datatype = OpcUaType_LocalizedText;
-  var[1].Value.LocalizedText = &lt;
-  callMethodRequest.InputArguments = var;
+  return OpcUa_True;
+}
 
-  OpcUa_RequestHeader requestHeader;
-  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginCall(
-    setupRequestHeader(&requestHeader),
-    &requestHeader,
-    1,
-    &callMethodRequest,
-    opcua_handle_alarm,
-    result);
-  if (!OpcUa_IsGood(statusCode))
-    opcua_handle_alarm(OpcUa_Null, OpcUa_Null, OpcUa_Null, result, statusCode);
+// Acknowledge and Confirm share their arguments, the event id and a comment
+static void addAlarmCall(struct HandleAlarmHelper* helper, OpcUa_UInt32 methodId, const OpcUa_NodeId* conditionId, const OpcUa_ByteString* eventId, const struct wpcp_value_t* comment)
+{
+  OpcUa_CallMethodRequest* callMethodRequest = &helper->callMethodRequest[helper->countCalls];
+  OpcUa_Variant* inputArguments = &helper->inputArguments[2 * helper->countCalls];
+  helper->callResult[helper->countCalls] = OpcUa_BadInternalError;
+  helper->countCalls += 1;
+
+  OpcUa_CallMethodRequest_Initialize(callMethodRequest);
+  OpcUa_NodeId_CopyTo(conditionId, &callMethodRequest->ObjectId);
+  callMethodRequest->MethodId.Identifier.Numeric = methodId;
+  callMethodRequest->NoOfInputArguments = 2;
+  callMethodRequest->InputArguments = inputArguments;
+
+  OpcUa_Variant_Initialize(&inputArguments[0]);
+  inputArguments[0].Datatype = OpcUaType_ByteString;
+  OpcUa_ByteString_CopyTo(eventId, &inputArguments[0].Value.ByteString);
+
+  OpcUa_Variant_Initialize(&inputArguments[1]);
+  inputArguments[1].Datatype = OpcUaType_LocalizedText;
+  inputArguments[1].Value.LocalizedText = OpcUa_Memory_Alloc(sizeof(OpcUa_LocalizedText));
+  OpcUa_LocalizedText_Initialize(inputArguments[1].Value.LocalizedText);
+  if (comment && comment->type == WPCP_VALUE_TYPE_TEXT_STRING && comment->value.length)
+    OpcUa_String_AttachToString((OpcUa_StringA)comment->data.text_string, comment->value.length, comment->value.length, OpcUa_True, OpcUa_False, &inputArguments[1].Value.LocalizedText->Text);
+}
+
+void handle_alarm(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* token, const struct wpcp_value_t* acknowledge, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count)
+{
+  struct HandleAlarmHelper* helper;
+  if (*context)
+    helper = (struct HandleAlarmHelper*) *context;
+  else {
+    OpcUa_UInt32 count = remaining + 1;
+    OpcUa_UInt32 maxCalls = count * ALARM_MAX_CALLS_PER_TOKEN;
+    OpcUa_Byte* data = malloc(sizeof(struct HandleAlarmHelper) + maxCalls * (sizeof(OpcUa_CallMethodRequest) + 2 * sizeof(OpcUa_Variant) + sizeof(OpcUa_StatusCode)) + count * 2 * sizeof(OpcUa_Int32));
+    helper = *context = data;
+    helper->result = result;
+    helper->count = count;
+    helper->countCalls = 0;
+    helper->callMethodRequest = (OpcUa_CallMethodRequest*)(data + sizeof(struct HandleAlarmHelper));
+    helper->inputArguments = (OpcUa_Variant*)(helper->callMethodRequest + maxCalls);
+    helper->callResult = (OpcUa_StatusCode*)(helper->inputArguments + 2 * maxCalls);
+    helper->firstCall = (OpcUa_Int32*)(helper->callResult + maxCalls);
+    helper->noOfCalls = helper->firstCall + count;
+  }
+
+  OpcUa_Int32 nr = helper->count - 1 - remaining;
+  const struct wpcp_value_t* confirm = findAdditional(additional, additional_count, "confirm");
+  const struct wpcp_value_t* comment = findAdditional(additional, additional_count, "comment");
+  OpcUa_NodeId conditionId;
+  OpcUa_ByteString eventId;
+
+  helper->firstCall[nr] = helper->countCalls;
+  if (parseAlarmToken(token, &conditionId, &eventId)) {
+    if (acknowledge && acknowledge->type == WPCP_VALUE_TYPE_TRUE)
+      addAlarmCall(helper, OpcUaId_AcknowledgeableConditionType_Acknowledge, &conditionId, &eventId, comment);
+    if (confirm && confirm->type == WPCP_VALUE_TYPE_TRUE)
+      addAlarmCall(helper, OpcUaId_AcknowledgeableConditionType_Confirm, &conditionId, &eventId, comment);
+    OpcUa_NodeId_Clear(&conditionId);
+    OpcUa_ByteString_Clear(&eventId);
+  }
+  helper->noOfCalls[nr] = helper->countCalls - helper->firstCall[nr];
+
+  if (!remaining) {
+    wpcp_lws_lock();
+    chunk_start(&helper->chunker, chunk_getLimit(OPERATION_LIMIT_METHOD_CALL), helper->countCalls, helper, beginHandleAlarm, finishHandleAlarm);
+    wpcp_lws_unlock();
+  }
 }
@@ -0,0 +1,65 @@
+#include "ring.h"
+
+void ring_initialize(struct ring_t* ring)
+{
+  for (LONG i = 0; i < RING_SIZE; ++i)
+    ring->slots[i].sequence = i;
+  ring->enqueuePos = 0;
+  ring->dequeuePos = 0;
+}
+
+// returns false if the ring is full
+bool ring_push(struct ring_t* ring, const struct ring_entry_t* entry)
+{
+  struct ring_slot_t* slot;
+  LONG pos = ring->enqueuePos;
+
+  for (;;) {
+    slot = &ring->slots[pos & (RING_SIZE - 1)];
+    LONG diff = (LONG)((unsigned long)slot->sequence - (unsigned long)pos);
+
+    if (!diff) {
+      LONG previous = InterlockedCompareExchange(&ring->enqueuePos, pos + 1, pos);
+      if (previous == pos)
+        break;
+      pos = previous;
+    } else if (diff < 0)
+      return false;
+    else
+      pos = ring->enqueuePos;
+  }
+
+  slot->entry = *entry;
+  InterlockedExchange(&slot->sequence, pos + 1);
+  return true;
+}
+
+int32_t ring_take(struct ring_t* ring, struct ring_entry_t* entries, int32_t maxCount)
+{
+  int32_t count = 0;
+
+  while (count < maxCount) {
+    struct ring_slot_t* slot;
+    LONG pos = ring->dequeuePos;
+
+    for (;;) {
+      slot = &ring->slots[pos & (RING_SIZE - 1)];
+      LONG diff = (LONG)((unsigned long)slot->sequence - (unsigned long)(pos + 1));
+
+      if (!diff) {
+        LONG previous = InterlockedCompareExchange(&ring->dequeuePos, pos + 1, pos);
+        if (previous == pos)
+          break;
+        pos = previous;
+      } else if (diff < 0)
+        return count;
+      else
+        pos = ring->dequeuePos;
+    }
+
+    entries[count++] = slot->entry;
+    InterlockedExchange(&slot->sequence, pos + RING_SIZE);
+  }
+
+  return count;
+}
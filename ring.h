@@ -0,0 +1,26 @@
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RING_SIZE 4096
+
+struct ring_entry_t {
+  uint32_t subscriptionId;
+  uint32_t sequenceNumber;
+};
+
+struct ring_slot_t {
+  volatile LONG sequence;
+  struct ring_entry_t entry;
+};
+
+// bounded queue with per slot sequence numbers, safe for concurrent producers and consumers
+struct ring_t {
+  struct ring_slot_t slots[RING_SIZE];
+  volatile LONG enqueuePos;
+  volatile LONG dequeuePos;
+};
+
+void ring_initialize(struct ring_t* ring);
+bool ring_push(struct ring_t* ring, const struct ring_entry_t* entry);
+int32_t ring_take(struct ring_t* ring, struct ring_entry_t* entries, int32_t maxCount);
@@ -1,68 +1,292 @@
 #include "main.h"
+#include "slice.h"
 #include <opcua_string.h>
+#include <opcua_timer.h>
+#include <wpcp_lws.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
+OpcUa_UInt32 g_browsePageSize = 1000;
+
+// nodes are returned in order as soon as all their pages arrived, nodes of the address space index need no request
 struct BrowseHelper
 {
   struct wpcp_result_t* result;
   OpcUa_Int32 count;
+  OpcUa_Int32 countBrowses;
+  OpcUa_Int32 returned;
+  struct chunker_t chunker;
+  struct path_batch_t* paths;
+  OpcUa_BrowseDescription* browseRequest;
+  OpcUa_BrowseResult* browseResult;
+  OpcUa_Int32* itemNr;
+  OpcUa_Boolean* done;
+  struct addressspace_browse_t** local;
+  struct search_query_t** search;
   OpcUa_BrowseDescription browseDescription[1];
 };
 
-static OpcUa_StatusCode opcua_browse(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+// the continuation points stay owned by the browse results of the nodes
+struct BrowseNextPage
 {
-  struct BrowseHelper* helper = pCallbackData;
-  OpcUa_BrowseResponse* pBrowseResponse = pResponse;
-  OpcUa_Int32 noOfResults = pBrowseResponse->NoOfResults;
-  OpcUa_BrowseResult* results = pBrowseResponse->Results;
+  struct chunk_t* chunk;
+  OpcUa_Int32 count;
+  OpcUa_Int32* nodeNr;
+  OpcUa_ByteString* continuationPoint;
+};
 
-  for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
-    if (i < noOfResults) {
-      OpcUa_Int32 noOfReferences = results[i].NoOfReferences;
-      wpcp_return_browse(helper->result, NULL, noOfReferences);
-
-      for (OpcUa_Int32 j = 0; j < noOfReferences; ++j) {
-        const OpcUa_ReferenceDescription* referenceDescription = &results[i].References[j];
-        const OpcUa_String* browseName = &referenceDescription->BrowseName.Name;
-        const OpcUa_String* displayName = &referenceDescription->DisplayName.Text;
-        char idBuffer[1024];
-        char typeBuffer[1024];
-        struct wpcp_value_t id;
-        struct wpcp_value_t type;
-
-        toWpcpId(&referenceDescription->NodeId.NodeId, &id, idBuffer, sizeof(idBuffer));
-        toWpcpId(&referenceDescription->TypeDefinition.NodeId, &type, typeBuffer, sizeof(typeBuffer));
-        wpcp_return_browse_item(helper->result, &id, OpcUa_String_GetRawString(browseName), OpcUa_String_StrSize(browseName), OpcUa_String_GetRawString(displayName), OpcUa_String_StrSize(displayName), NULL, 0, &type, NULL, 0);
-      }
-    } else
-      wpcp_return_browse(helper->result, NULL, 0);
+static void returnBrowseResults(struct BrowseHelper* helper)
+{
+  while (helper->returned < helper->count && helper->done[helper->returned]) {
+    OpcUa_Int32 i = helper->returned++;
+    if (helper->search[i]) {
+      search_returnBrowse(helper->result, helper->search[i]);
+      free(helper->search[i]);
+      OpcUa_BrowseDescription_Clear(&helper->browseDescription[i]);
+      continue;
+    }
+    if (helper->local[i]) {
+      addressspace_returnBrowse(helper->result, helper->local[i]);
+      OpcUa_BrowseDescription_Clear(&helper->browseDescription[i]);
+      continue;
+    }
+
+    const OpcUa_BrowseResult* browseResult = &helper->browseResult[i];
+    OpcUa_Int32 noOfReferences = browseResult->NoOfReferences;
+    wpcp_return_browse(helper->result, NULL, noOfReferences);
+
+    for (OpcUa_Int32 j = 0; j < noOfReferences; ++j) {
+      const OpcUa_ReferenceDescription* referenceDescription = &browseResult->References[j];
+      const OpcUa_String* browseName = &referenceDescription->BrowseName.Name;
+      const OpcUa_String* displayName = &referenceDescription->DisplayName.Text;
+      char idBuffer[1024];
+      char typeBuffer[1024];
+      struct wpcp_value_t id;
+      struct wpcp_value_t type;
+
+      toWpcpId(&referenceDescription->NodeId.NodeId, &id, idBuffer, sizeof(idBuffer));
+      toWpcpId(&referenceDescription->TypeDefinition.NodeId, &type, typeBuffer, sizeof(typeBuffer));
+      search_add(id.data.text_string, id.value.length, OpcUa_String_GetRawString(browseName), OpcUa_String_StrSize(browseName), OpcUa_String_GetRawString(displayName), OpcUa_String_StrSize(displayName), type.data.text_string, type.value.length);
+      wpcp_return_browse_item(helper->result, &id, OpcUa_String_GetRawString(browseName), OpcUa_String_StrSize(browseName), OpcUa_String_GetRawString(displayName), OpcUa_String_StrSize(displayName), NULL, 0, &type, NULL, 0);
+    }
 
     OpcUa_BrowseDescription_Clear(&helper->browseDescription[i]);
+    OpcUa_BrowseResult_Clear(&helper->browseResult[i]);
   }
+}
 
-  free(helper);
+// the references are moved out of the response, the source keeps only its empty array
+static void appendBrowseResult(OpcUa_BrowseResult* target, OpcUa_BrowseResult* source)
+{
+  if (source->NoOfReferences) {
+    target->References = OpcUa_Memory_ReAlloc(target->References, sizeof(OpcUa_ReferenceDescription) * (target->NoOfReferences + source->NoOfReferences));
+    memcpy(target->References + target->NoOfReferences, source->References, sizeof(OpcUa_ReferenceDescription) * source->NoOfReferences);
+    target->NoOfReferences += source->NoOfReferences;
+    source->NoOfReferences = 0;
+  }
+
+  target->StatusCode = source->StatusCode;
+  OpcUa_ByteString_Clear(&target->ContinuationPoint);
+  target->ContinuationPoint = source->ContinuationPoint;
+  OpcUa_ByteString_Initialize(&source->ContinuationPoint);
+}
+
+static OpcUa_StatusCode opcua_browse_released(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+{
+  return OpcUa_Good;
+}
+
+static void releaseContinuationPoints(OpcUa_Int32 count, const OpcUa_ByteString* continuationPoints)
+{
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_ClientApi_BeginBrowseNext(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    OpcUa_True,
+    count,
+    continuationPoints,
+    opcua_browse_released,
+    OpcUa_Null);
+}
+
+static OpcUa_StatusCode opcua_browse_next(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus);
+static void continueBrowseNext(struct BrowseNextPage* page, OpcUa_Int32 noOfResults, OpcUa_BrowseResult* results);
+
+static void continueBrowse(struct chunk_t* chunk)
+{
+  struct BrowseHelper* helper = chunk->chunker->context;
+  OpcUa_Int32 countPending = 0;
+
+  for (OpcUa_Int32 j = chunk->offset; j < chunk->offset + chunk->count; ++j) {
+    OpcUa_Int32 i = helper->itemNr[j];
+    if (helper->done[i])
+      continue;
+    if (helper->browseResult[i].ContinuationPoint.Length > 0)
+      ++countPending;
+    else
+      helper->done[i] = OpcUa_True;
+  }
+
+  returnBrowseResults(helper);
+
+  if (!countPending) {
+    chunk_complete(chunk);
+    return;
+  }
+
+  OpcUa_Byte* data = malloc(sizeof(struct BrowseNextPage) + countPending * (sizeof(OpcUa_ByteString) + sizeof(OpcUa_Int32)));
+  struct BrowseNextPage* page = (struct BrowseNextPage*)data;
+  page->chunk = chunk;
+  page->count = 0;
+  page->continuationPoint = (OpcUa_ByteString*)(data + sizeof(struct BrowseNextPage));
+  page->nodeNr = (OpcUa_Int32*)(data + sizeof(struct BrowseNextPage) + countPending * sizeof(OpcUa_ByteString));
+
+  for (OpcUa_Int32 j = chunk->offset; j < chunk->offset + chunk->count; ++j) {
+    OpcUa_Int32 i = helper->itemNr[j];
+    if (helper->done[i])
+      continue;
+    page->nodeNr[page->count] = i;
+    page->continuationPoint[page->count++] = helper->browseResult[i].ContinuationPoint;
+  }
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginBrowseNext(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    OpcUa_False,
+    page->count,
+    page->continuationPoint,
+    opcua_browse_next,
+    page);
+  if (!OpcUa_IsGood(statusCode))
+    continueBrowseNext(page, 0, NULL);
+}
+
+// nodes without a result keep what they got so far, their continuation points are released on the server
+static void continueBrowseNext(struct BrowseNextPage* page, OpcUa_Int32 noOfResults, OpcUa_BrowseResult* results)
+{
+  struct chunk_t* chunk = page->chunk;
+  struct BrowseHelper* helper = chunk->chunker->context;
+
+  for (OpcUa_Int32 i = 0; i < page->count && i < noOfResults; ++i)
+    appendBrowseResult(&helper->browseResult[page->nodeNr[i]], &results[i]);
+
+  if (noOfResults < page->count) {
+    releaseContinuationPoints(page->count - noOfResults, &page->continuationPoint[noOfResults]);
+    for (OpcUa_Int32 i = noOfResults; i < page->count; ++i)
+      OpcUa_ByteString_Clear(&helper->browseResult[page->nodeNr[i]].ContinuationPoint);
+  }
+
+  free(page);
+  continueBrowse(chunk);
+}
+
+static OpcUa_StatusCode opcua_browse_next(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+{
+  OpcUa_BrowseNextResponse* pBrowseNextResponse = pResponse;
+  OpcUa_Int32 noOfResults = pBrowseNextResponse && OpcUa_IsGood(pBrowseNextResponse->ResponseHeader.ServiceResult) ? pBrowseNextResponse->NoOfResults : 0;
+  OpcUa_BrowseResult* results = pBrowseNextResponse ? pBrowseNextResponse->Results : NULL;
+
+  wpcp_lws_lock();
+  continueBrowseNext(pCallbackData, noOfResults, results);
+  wpcp_lws_unlock();
+
+  return OpcUa_Good;
+}
+
+static OpcUa_StatusCode opcua_browse(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+{
+  struct chunk_t* chunk = pCallbackData;
+  struct BrowseHelper* helper = chunk->chunker->context;
+  OpcUa_BrowseResponse* pBrowseResponse = pResponse;
+  OpcUa_Int32 noOfResults = pBrowseResponse ? pBrowseResponse->NoOfResults : 0;
+  OpcUa_BrowseResult* results = pBrowseResponse ? pBrowseResponse->Results : NULL;
+
+  wpcp_lws_lock();
+
+  for (OpcUa_Int32 i = 0; i < chunk->count && i < noOfResults; ++i)
+    appendBrowseResult(&helper->browseResult[helper->itemNr[chunk->offset + i]], &results[i]);
+
+  continueBrowse(chunk);
+
+  wpcp_lws_unlock();
 
   return OpcUa_Good;
 }
 
+static void beginBrowse(struct chunk_t* chunk)
+{
+  struct BrowseHelper* helper = chunk->chunker->context;
+  OpcUa_ViewDescription viewDescription;
+  OpcUa_ViewDescription_Initialize(&viewDescription);
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginBrowse(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    &viewDescription,
+    g_browsePageSize,
+    chunk->count,
+    &helper->browseRequest[chunk->offset],
+    opcua_browse,
+    chunk);
+  if (!OpcUa_IsGood(statusCode))
+    opcua_browse(OpcUa_Null, OpcUa_Null, OpcUa_Null, chunk, statusCode);
+}
+
+static void finishBrowse(void* context)
+{
+  free(context);
+}
+
+// the node ids are complete only once the paths are resolved, the requests share them with the descriptions
+static void startBrowse(void* context)
+{
+  struct BrowseHelper* helper = context;
+
+  for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+    if (helper->search[i])
+      continue;
+    helper->local[i] = addressspace_browse(&helper->browseDescription[i].NodeId);
+    if (helper->local[i])
+      helper->done[i] = OpcUa_True;
+    else {
+      helper->itemNr[helper->countBrowses] = i;
+      helper->browseRequest[helper->countBrowses++] = helper->browseDescription[i];
+    }
+  }
+
+  returnBrowseResults(helper);
+  chunk_start(&helper->chunker, chunk_getLimit(OPERATION_LIMIT_BROWSE), helper->countBrowses, helper, beginBrowse, finishBrowse);
+}
+
 void browse(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* id, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count)
 {
   struct BrowseHelper* helper;
   if (*context)
     helper = (struct BrowseHelper*) *context;
   else {
-    *context = helper = malloc(sizeof(struct BrowseHelper) + sizeof(OpcUa_BrowseDescription)* remaining);
+    OpcUa_UInt32 count = remaining + 1;
+    *context = helper = malloc(sizeof(struct BrowseHelper) + sizeof(OpcUa_BrowseDescription) * (remaining + count) + count * (sizeof(OpcUa_BrowseResult) + sizeof(struct search_query_t*) + sizeof(struct addressspace_browse_t*) + sizeof(OpcUa_Int32) + sizeof(OpcUa_Boolean)));
     helper->result = result;
-    helper->count = remaining + 1;
+    helper->count = count;
+    helper->countBrowses = 0;
+    helper->returned = 0;
+    helper->paths = NULL;
+    helper->browseRequest = &helper->browseDescription[count];
+    helper->browseResult = (OpcUa_BrowseResult*)&helper->browseRequest[count];
+    helper->search = (struct search_query_t**)&helper->browseResult[count];
+    helper->local = (struct addressspace_browse_t**)&helper->search[count];
+    helper->itemNr = (OpcUa_Int32*)&helper->local[count];
+    helper->done = (OpcUa_Boolean*)&helper->itemNr[count];
   }
 
-  OpcUa_ViewDescription viewDescription;
-  OpcUa_ViewDescription_Initialize(&viewDescription);
-
-  OpcUa_BrowseDescription* browseDescription = &helper->browseDescription[helper->count - 1 - remaining];
+  OpcUa_Int32 nr = helper->count - 1 - remaining;
+  OpcUa_BrowseDescription* browseDescription = &helper->browseDescription[nr];
   OpcUa_BrowseDescription_Initialize(browseDescription);
-  toNodeId(id, &browseDescription->NodeId);
+  OpcUa_BrowseResult_Initialize(&helper->browseResult[nr]);
+  toNodeIdBatched(id, &browseDescription->NodeId, &helper->paths);
   if (!id->value.length)
     browseDescription->NodeId.Identifier.Numeric = OpcUaId_ObjectsFolder;
   browseDescription->BrowseDirection = OpcUa_BrowseDirection_Forward;
@@ -70,111 +294,349 @@ void browse(void* user, struct wpcp_result_t* result, const struct wpcp_value_t*
   browseDescription->ReferenceTypeId.Identifier.Numeric = OpcUaId_HierarchicalReferences;
   browseDescription->ResultMask = OpcUa_BrowseResultMask_All;
 
+  helper->search[nr] = search_createQuery(additional, additional_count);
+  helper->local[nr] = NULL;
+  helper->done[nr] = helper->search[nr] != NULL;
+
   if (!remaining) {
-    OpcUa_RequestHeader requestHeader;
-    OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginBrowse(
-      setupRequestHeader(&requestHeader),
-      &requestHeader,
-      &viewDescription,
-      0,
-      helper->count,
-      helper->browseDescription,
-      opcua_browse,
-      helper);
-    if (!OpcUa_IsGood(statusCode))
-      opcua_browse(OpcUa_Null, OpcUa_Null, OpcUa_Null, helper, statusCode);
+    wpcp_lws_lock();
+    path_resolveBatch(helper->paths, startBrowse, helper);
+    wpcp_lws_unlock();
   }
 }
 
+struct ReadDataHelperItem
+{
+  OpcUa_Int32 readValueIdNr;
+  OpcUa_DataValue dataValue;
+};
+
+// items answered by the cache or the server hold their value and have no readValueIdNr anymore
 struct ReadDataHelper
 {
   struct wpcp_result_t* result;
+  struct ReadDataHelper* next;
+  OpcUa_UInt64 queued;
   OpcUa_Int32 count;
-  OpcUa_ReadValueId readValueId[1];
+  OpcUa_Int32 countReads;
+  struct path_batch_t* paths;
+  struct ReadDataHelperItem* items;
+  OpcUa_ReadValueId* readValueId;
 };
 
+// merges the queued reads of all connections, readValueIdNr of the items gets remapped to the unique reads
+struct ReadBatch
+{
+  struct ReadDataHelper* helpers;
+  OpcUa_Int32 count;
+  struct chunker_t chunker;
+  OpcUa_ReadValueId* readValueId;
+  OpcUa_DataValue* dataValue;
+  OpcUa_Boolean* received;
+};
+
+OpcUa_UInt32 g_readWindow = 1;
+
+static struct ReadDataHelper* g_readQueue;
+static struct ReadDataHelper** g_readQueueTail = &g_readQueue;
+static OpcUa_Timer g_readTimer;
+
+static OpcUa_UInt64 now(void)
+{
+  OpcUa_DateTime dateTime = OpcUa_DateTime_UtcNow();
+  return toUInt64(&dateTime);
+}
+
 static OpcUa_StatusCode opcua_read(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
 {
-  struct ReadDataHelper* readHelper = pCallbackData;
+  struct chunk_t* chunk = pCallbackData;
+  struct ReadBatch* batch = chunk->chunker->context;
   OpcUa_ReadResponse* pReadResponse = pResponse;
-  OpcUa_Int32 noOfResults = pReadResponse->NoOfResults;
-  OpcUa_DataValue* results = pReadResponse->Results;
+  OpcUa_Int32 noOfResults = pReadResponse ? pReadResponse->NoOfResults : 0;
+  OpcUa_DataValue* results = pReadResponse ? pReadResponse->Results : NULL;
+
+  for (OpcUa_Int32 i = 0; i < chunk->count && i < noOfResults; ++i) {
+    batch->dataValue[chunk->offset + i] = results[i];
+    OpcUa_DataValue_Initialize(&results[i]);
+    batch->received[chunk->offset + i] = OpcUa_True;
+  }
+
+  wpcp_lws_lock();
+  chunk_complete(chunk);
+  wpcp_lws_unlock();
+
+  return OpcUa_Good;
+}
+
+static void beginRead(struct chunk_t* chunk)
+{
+  struct ReadBatch* batch = chunk->chunker->context;
 
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginRead(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    0.0, // to force the server to read a new value from the DataSource
+    OpcUa_TimestampsToReturn_Source,
+    chunk->count,
+    &batch->readValueId[chunk->offset],
+    opcua_read,
+    chunk);
+  if (!OpcUa_IsGood(statusCode))
+    opcua_read(OpcUa_Null, OpcUa_Null, OpcUa_Null, chunk, statusCode);
+}
+
+static void finishRead(struct ReadDataHelper* readHelper)
+{
   for (OpcUa_Int32 i = 0; i < readHelper->count; ++i) {
+    struct ReadDataHelperItem* item = &readHelper->items[i];
+    const OpcUa_DataValue* dataValue = &item->dataValue;
     struct wpcp_value_t value;
 
-    if (i < noOfResults) {
-      toWpcpValue(&results[i].Value, &value);
-      wpcp_return_read_data(readHelper->result, NULL, &value, toWpcpTime(&results[i].SourceTimestamp, results[i].SourcePicoseconds), results[i].StatusCode, NULL, 0);
+    if (item->readValueIdNr < 0) {
+      toWpcpValue(&dataValue->Value, &value);
+      wpcp_return_read_data(readHelper->result, NULL, &value, toWpcpTime(&dataValue->SourceTimestamp, dataValue->SourcePicoseconds), dataValue->StatusCode, NULL, 0);
     }
     else {
       value.type = WPCP_VALUE_TYPE_UNDEFINED;
       wpcp_return_read_data(readHelper->result, NULL, &value, 0.0, OpcUa_BadInternalError, NULL, 0);
     }
 
-    OpcUa_ReadValueId_Clear(&readHelper->readValueId[i]);
+    OpcUa_DataValue_Clear(&item->dataValue);
   }
 
+  for (OpcUa_Int32 i = 0; i < readHelper->countReads; ++i)
+    OpcUa_ReadValueId_Clear(&readHelper->readValueId[i]);
+
   free(readHelper);
+}
+
+// every result is copied to all items waiting for it
+static void finishReadBatch(void* context)
+{
+  struct ReadBatch* batch = context;
+  struct ReadDataHelper* helper = batch->helpers;
 
+  while (helper) {
+    struct ReadDataHelper* next = helper->next;
+
+    for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+      struct ReadDataHelperItem* item = &helper->items[i];
+      OpcUa_Int32 nr = item->readValueIdNr;
+      if (nr < 0 || !batch->received[nr])
+        continue;
+
+      OpcUa_DataValue_CopyTo(&batch->dataValue[nr], &item->dataValue);
+      item->readValueIdNr = -1;
+    }
+
+    finishRead(helper);
+    helper = next;
+  }
+
+  for (OpcUa_Int32 i = 0; i < batch->count; ++i)
+    OpcUa_DataValue_Clear(&batch->dataValue[i]);
+
+  free(batch);
+}
+
+// has to be called with the wpcp lock held
+static void flushReads(void)
+{
+  struct ReadDataHelper* helpers = g_readQueue;
+  g_readQueue = NULL;
+  g_readQueueTail = &g_readQueue;
+
+  if (!helpers)
+    return;
+
+  OpcUa_UInt64 flushed = now();
+  OpcUa_Int32 countHelpers = 0;
+  OpcUa_Int32 countReads = 0;
+  for (struct ReadDataHelper* helper = helpers; helper; helper = helper->next) {
+    OpcUa_UInt64 latency = flushed > helper->queued ? (flushed - helper->queued) / 10 : 0;
+    stats_add(STATS_READ_WINDOW_LATENCY_TOTAL, latency);
+    stats_max(STATS_READ_WINDOW_LATENCY_MAX, latency);
+    countReads += helper->countReads;
+    ++countHelpers;
+  }
+
+  OpcUa_UInt32 indexSize = 16;
+  while (indexSize < 2 * (OpcUa_UInt32)countReads)
+    indexSize *= 2;
+
+  OpcUa_Byte* data = malloc(sizeof(struct ReadBatch) + countReads * (sizeof(OpcUa_ReadValueId) + sizeof(OpcUa_DataValue) + sizeof(OpcUa_Boolean)));
+  struct ReadBatch* batch = (struct ReadBatch*)data;
+  batch->helpers = helpers;
+  batch->count = 0;
+  batch->readValueId = (OpcUa_ReadValueId*)(data + sizeof(struct ReadBatch));
+  batch->dataValue = (OpcUa_DataValue*)(data + sizeof(struct ReadBatch) + countReads * sizeof(OpcUa_ReadValueId));
+  batch->received = (OpcUa_Boolean*)(data + sizeof(struct ReadBatch) + countReads * (sizeof(OpcUa_ReadValueId) + sizeof(OpcUa_DataValue)));
+
+  // open addressing over the unique reads, the read value ids stay owned by the helpers
+  OpcUa_Int32* index = calloc(indexSize, sizeof(OpcUa_Int32));
+  for (struct ReadDataHelper* helper = helpers; helper; helper = helper->next) {
+    for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+      struct ReadDataHelperItem* item = &helper->items[i];
+      if (item->readValueIdNr < 0)
+        continue;
+
+      const OpcUa_ReadValueId* readValueId = &helper->readValueId[item->readValueIdNr];
+      OpcUa_UInt32 hash = hashBuffer(hashNodeId(&readValueId->NodeId), &readValueId->AttributeId, sizeof(readValueId->AttributeId));
+      OpcUa_UInt32 slot = hash & (indexSize - 1);
+      while (index[slot]) {
+        const OpcUa_ReadValueId* other = &batch->readValueId[index[slot] - 1];
+        if (other->AttributeId == readValueId->AttributeId && !OpcUa_NodeId_Compare(&other->NodeId, &readValueId->NodeId))
+          break;
+        slot = (slot + 1) & (indexSize - 1);
+      }
+
+      if (!index[slot]) {
+        batch->readValueId[batch->count] = *readValueId;
+        OpcUa_DataValue_Initialize(&batch->dataValue[batch->count]);
+        batch->received[batch->count] = OpcUa_False;
+        index[slot] = ++batch->count;
+      }
+
+      item->readValueIdNr = index[slot] - 1;
+    }
+  }
+  free(index);
+
+  stats_add(STATS_READ_BATCHES, 1);
+  stats_add(STATS_READ_BATCHES_MERGED, countHelpers);
+  stats_add(STATS_READ_OPERATIONS, countReads);
+  stats_add(STATS_READ_OPERATIONS_DEDUPLICATED, countReads - batch->count);
+
+  chunk_start(&batch->chunker, chunk_getLimit(OPERATION_LIMIT_READ), batch->count, batch, beginRead, finishReadBatch);
+}
+
+static OpcUa_StatusCode opcua_flush_reads(OpcUa_Void* pvCallbackData, OpcUa_Timer hTimer, OpcUa_UInt32 msecElapsed)
+{
+  wpcp_lws_lock();
+  flushReads();
+  wpcp_lws_unlock();
   return OpcUa_Good;
 }
 
+void read_start(void)
+{
+  if (g_readWindow)
+    OpcUa_Timer_Create(&g_readTimer, g_readWindow, opcua_flush_reads, OpcUa_Null, OpcUa_Null);
+}
+
+void read_stop(void)
+{
+  if (g_readTimer)
+    OpcUa_Timer_Delete(&g_readTimer);
+}
+
+// reads of all connections arriving within the window are sent together
+static void queueRead(void* context)
+{
+  struct ReadDataHelper* helper = context;
+  helper->paths = NULL;
+
+  if (!helper->countReads) {
+    finishRead(helper);
+    return;
+  }
+
+  helper->queued = now();
+  *g_readQueueTail = helper;
+  g_readQueueTail = &helper->next;
+  if (!g_readWindow)
+    flushReads();
+}
+
 void read_data(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* id, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count)
 {
   struct ReadDataHelper* helper;
   if (*context)
     helper = (struct ReadDataHelper*) *context;
   else {
-    *context = helper = malloc(sizeof(struct ReadDataHelper) + sizeof(OpcUa_ReadValueId)* remaining);
+    OpcUa_UInt32 count = remaining + 1;
+    OpcUa_Byte* data = malloc(sizeof(struct ReadDataHelper) + count * (sizeof(struct ReadDataHelperItem) + sizeof(OpcUa_ReadValueId)));
+    *context = helper = (struct ReadDataHelper*)data;
     helper->result = result;
-    helper->count = remaining + 1;
+    helper->next = NULL;
+    helper->count = count;
+    helper->countReads = 0;
+    helper->paths = NULL;
+    helper->items = (struct ReadDataHelperItem*)(data + sizeof(struct ReadDataHelper));
+    helper->readValueId = (OpcUa_ReadValueId*)(data + sizeof(struct ReadDataHelper) + count * sizeof(struct ReadDataHelperItem));
   }
 
-  OpcUa_ReadValueId* readValueId = &helper->readValueId[helper->count - 1 - remaining];
+  struct ReadDataHelperItem* item = &helper->items[helper->count - 1 - remaining];
+  OpcUa_DataValue_Initialize(&item->dataValue);
+  item->readValueIdNr = -1;
+
+  // a path missing in the path cache is resolved into the read value id with the other paths of the batch
+  const struct wpcp_value_t* maxAgeValue = findAdditional(additional, additional_count, "maxage");
+  OpcUa_Double maxAge;
+  OpcUa_ReadValueId* readValueId = &helper->readValueId[helper->countReads];
   OpcUa_ReadValueId_Initialize(readValueId);
-  toNodeId(id, &readValueId->NodeId);
-  readValueId->AttributeId = OpcUa_Attributes_Value;
+  toNodeIdBatched(id, &readValueId->NodeId, &helper->paths);
 
-  if (!remaining) {
-    OpcUa_RequestHeader requestHeader;
-    OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginRead(
-      setupRequestHeader(&requestHeader),
-      &requestHeader,
-      0.0, // to force the server to read a new value from the DataSource
-      OpcUa_TimestampsToReturn_Source,
-      helper->count,
-      helper->readValueId,
-      opcua_read,
-      helper);
-    if (!OpcUa_IsGood(statusCode))
-      opcua_read(OpcUa_Null, OpcUa_Null, OpcUa_Null, helper, statusCode);
+  if (maxAgeValue && !OpcUa_NodeId_IsNull(&readValueId->NodeId) && OpcUa_IsGood(toDouble(maxAgeValue, &maxAge)) && getCachedDataValue(&readValueId->NodeId, maxAge, &item->dataValue))
+    OpcUa_ReadValueId_Clear(readValueId);
+  else {
+    readValueId->AttributeId = OpcUa_Attributes_Value;
+    item->readValueIdNr = helper->countReads++;
   }
+
+  if (remaining)
+    return;
+
+  wpcp_lws_lock();
+  path_resolveBatch(helper->paths, queueRead, helper);
+  wpcp_lws_unlock();
 }
 
+#define WRITE_METADATA_ATTRIBUTES 3
+
+// only nodes without cached metadata are read before writing, with WRITE_METADATA_ATTRIBUTES reads per node
 struct WriteDataHelper
 {
   struct wpcp_result_t* result;
   OpcUa_Int32 count;
+  OpcUa_Int32 countReads;
+  struct chunker_t chunker;
+  struct path_batch_t* paths;
+  OpcUa_Int32* readValueIdNr;
   OpcUa_ReadValueId* readValueId;
   OpcUa_WriteValue* writeValue;
+  OpcUa_StatusCode* writeResult;
 };
 
 static OpcUa_StatusCode opcua_write_write(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
 {
-  struct WriteDataHelper* helper = pCallbackData;
+  struct chunk_t* chunk = pCallbackData;
+  struct WriteDataHelper* helper = chunk->chunker->context;
   OpcUa_WriteResponse* pWriteResponse = pResponse;
-  OpcUa_Int32 noOfResults = pWriteResponse->NoOfResults;
-  OpcUa_StatusCode* results = pWriteResponse->Results;
+  OpcUa_Int32 noOfResults = pWriteResponse ? pWriteResponse->NoOfResults : 0;
+  OpcUa_StatusCode* results = pWriteResponse ? pWriteResponse->Results : NULL;
+
+  for (OpcUa_Int32 i = 0; i < chunk->count && i < noOfResults; ++i)
+    helper->writeResult[chunk->offset + i] = results[i];
+
+  wpcp_lws_lock();
+  chunk_complete(chunk);
+  wpcp_lws_unlock();
+
+  return OpcUa_Good;
+}
+
+static void finishWrite(void* context)
+{
+  struct WriteDataHelper* helper = context;
 
   for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
-    wpcp_return_write_data(helper->result, NULL, i < noOfResults && OpcUa_IsGood(results[i]));
+    wpcp_return_write_data(helper->result, NULL, OpcUa_IsGood(helper->writeResult[i]));
     OpcUa_WriteValue_Clear(&helper->writeValue[i]);
   }
 
   free(helper);
-
-  return OpcUa_Good;
 }
 
 static bool covertVariant(OpcUa_Variant* variant, const OpcUa_NodeId* nodeId)
@@ -317,33 +779,94 @@ static bool covertVariant(OpcUa_Variant* variant, const OpcUa_NodeId* nodeId)
   return false;
 }
 
+static void beginWrite(struct chunk_t* chunk)
+{
+  struct WriteDataHelper* helper = chunk->chunker->context;
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginWrite(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    chunk->count,
+    &helper->writeValue[chunk->offset],
+    opcua_write_write,
+    chunk);
+  if (!OpcUa_IsGood(statusCode))
+    opcua_write_write(OpcUa_Null, OpcUa_Null, OpcUa_Null, chunk, statusCode);
+}
+
+// chunks of the metadata read are counted in nodes, so the attributes of a node stay in one request
 static OpcUa_StatusCode opcua_write_read(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
 {
-  struct WriteDataHelper* helper = pCallbackData;
+  struct chunk_t* chunk = pCallbackData;
+  struct WriteDataHelper* helper = chunk->chunker->context;
   OpcUa_ReadResponse* pReadResponse = pResponse;
-  OpcUa_Int32 noOfResults = pReadResponse->NoOfResults;
-  OpcUa_DataValue* results = pReadResponse->Results;
+  OpcUa_Int32 noOfResults = pReadResponse ? pReadResponse->NoOfResults : 0;
+  OpcUa_DataValue* results = pReadResponse ? pReadResponse->Results : NULL;
 
   for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
-    if (i < noOfResults) {
-      const OpcUa_Variant* variant = &results[i].Value;
-      if (variant->Datatype == OpcUaType_NodeId)
-        covertVariant(&helper->writeValue[i].Value.Value, variant->Value.NodeId);
-    }
+    OpcUa_Int32 nr = helper->readValueIdNr[i] - chunk->offset;
+    if (helper->readValueIdNr[i] < 0 || nr < 0 || nr >= chunk->count || (nr + 1) * WRITE_METADATA_ATTRIBUTES > noOfResults)
+      continue;
+
+    const OpcUa_DataValue* dataValue = &results[nr * WRITE_METADATA_ATTRIBUTES];
+    if (OpcUa_IsBad(dataValue[0].StatusCode) || dataValue[0].Value.Datatype != OpcUaType_NodeId)
+      continue;
+
+    covertVariant(&helper->writeValue[i].Value.Value, dataValue[0].Value.Value.NodeId);
+
+    struct node_metadata_t metadata;
+    metadata.dataType = *dataValue[0].Value.Value.NodeId;
+    metadata.valueRank = dataValue[1].Value.Datatype == OpcUaType_Int32 ? dataValue[1].Value.Value.Int32 : -1;
+    metadata.accessLevel = dataValue[2].Value.Datatype == OpcUaType_Byte ? dataValue[2].Value.Value.Byte : 0;
+    metadata_put(&helper->writeValue[i].NodeId, &metadata);
   }
 
+  wpcp_lws_lock();
+  chunk_complete(chunk);
+  wpcp_lws_unlock();
+
+  return OpcUa_Good;
+}
+
+static void beginWriteRead(struct chunk_t* chunk)
+{
+  struct WriteDataHelper* helper = chunk->chunker->context;
+
   OpcUa_RequestHeader requestHeader;
-  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginWrite(
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginRead(
     setupRequestHeader(&requestHeader),
     &requestHeader,
-    helper->count,
-    helper->writeValue,
-    opcua_write_write,
-    helper);
+    0.0,
+    OpcUa_TimestampsToReturn_Neither,
+    chunk->count * WRITE_METADATA_ATTRIBUTES,
+    &helper->readValueId[chunk->offset * WRITE_METADATA_ATTRIBUTES],
+    opcua_write_read,
+    chunk);
   if (!OpcUa_IsGood(statusCode))
-    opcua_write_write(OpcUa_Null, OpcUa_Null, OpcUa_Null, helper, statusCode);
+    opcua_write_read(OpcUa_Null, OpcUa_Null, OpcUa_Null, chunk, statusCode);
+}
 
-  return OpcUa_Good;
+static void finishWriteRead(void* context)
+{
+  struct WriteDataHelper* helper = context;
+  chunk_start(&helper->chunker, chunk_getLimit(OPERATION_LIMIT_WRITE), helper->count, helper, beginWrite, finishWrite);
+}
+
+// the metadata reads share the node ids of the writes, which are complete only once the paths are resolved
+static void startWriteRead(void* context)
+{
+  struct WriteDataHelper* helper = context;
+
+  for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+    for (OpcUa_Int32 j = 0; helper->readValueIdNr[i] >= 0 && j < WRITE_METADATA_ATTRIBUTES; ++j)
+      helper->readValueId[helper->readValueIdNr[i] * WRITE_METADATA_ATTRIBUTES + j].NodeId = helper->writeValue[i].NodeId;
+  }
+
+  OpcUa_UInt32 limit = chunk_getLimit(OPERATION_LIMIT_READ);
+  if (limit)
+    limit = limit > WRITE_METADATA_ATTRIBUTES ? limit / WRITE_METADATA_ATTRIBUTES : 1;
+  chunk_start(&helper->chunker, limit, helper->countReads, helper, beginWriteRead, finishWriteRead);
 }
 
 void write_data(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* id, const struct wpcp_value_t* value, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count)
@@ -353,90 +876,652 @@ void write_data(void* user, struct wpcp_result_t* result, const struct wpcp_valu
     helper = (struct WriteDataHelper*) *context;
   else {
     OpcUa_UInt32 count = remaining + 1;
-    *context = helper = malloc(sizeof(struct WriteDataHelper) + count * sizeof(OpcUa_ReadValueId));
-    OpcUa_Byte* data = malloc(sizeof(struct WriteDataHelper) + count * (sizeof(OpcUa_ReadValueId)+sizeof(OpcUa_WriteValue)));
+    OpcUa_Byte* data = malloc(sizeof(struct WriteDataHelper) + count * (sizeof(OpcUa_WriteValue) + WRITE_METADATA_ATTRIBUTES * sizeof(OpcUa_ReadValueId) + sizeof(OpcUa_Int32) + sizeof(OpcUa_StatusCode)));
     helper = *context = data;
     helper->result = result;
     helper->count = count;
-    helper->readValueId = (OpcUa_ReadValueId*)(data + sizeof(struct WriteDataHelper));
-    helper->writeValue = (OpcUa_WriteValue*)(data + sizeof(struct WriteDataHelper) + count * sizeof(OpcUa_ReadValueId));
+    helper->countReads = 0;
+    helper->paths = NULL;
+    helper->writeValue = (OpcUa_WriteValue*)(data + sizeof(struct WriteDataHelper));
+    helper->readValueId = (OpcUa_ReadValueId*)(data + sizeof(struct WriteDataHelper) + count * sizeof(OpcUa_WriteValue));
+    helper->readValueIdNr = (OpcUa_Int32*)(data + sizeof(struct WriteDataHelper) + count * (sizeof(OpcUa_WriteValue) + WRITE_METADATA_ATTRIBUTES * sizeof(OpcUa_ReadValueId)));
+    helper->writeResult = (OpcUa_StatusCode*)(data + sizeof(struct WriteDataHelper) + count * (sizeof(OpcUa_WriteValue) + WRITE_METADATA_ATTRIBUTES * sizeof(OpcUa_ReadValueId) + sizeof(OpcUa_Int32)));
   }
 
-  OpcUa_ReadValueId* readValueId = &helper->readValueId[helper->count - 1 - remaining];
-  OpcUa_WriteValue* writeValue = &helper->writeValue[helper->count - 1 - remaining];
-  OpcUa_ReadValueId_Initialize(readValueId);
+  OpcUa_Int32 nr = helper->count - 1 - remaining;
+  OpcUa_WriteValue* writeValue = &helper->writeValue[nr];
   OpcUa_WriteValue_Initialize(writeValue);
-  toNodeId(id, &writeValue->NodeId);
+  toNodeIdBatched(id, &writeValue->NodeId, &helper->paths);
   writeValue->AttributeId = OpcUa_Attributes_Value;
   toVariant(value, &writeValue->Value.Value);
-  readValueId->NodeId = writeValue->NodeId;
-  readValueId->AttributeId = OpcUa_Attributes_DataType;
+  helper->writeResult[nr] = OpcUa_BadInternalError;
+
+  struct node_metadata_t metadata;
+  if (!OpcUa_NodeId_IsNull(&writeValue->NodeId) && metadata_get(&writeValue->NodeId, &metadata)) {
+    covertVariant(&writeValue->Value.Value, &metadata.dataType);
+    OpcUa_NodeId_Clear(&metadata.dataType);
+    helper->readValueIdNr[nr] = -1;
+  } else {
+    static const OpcUa_UInt32 attributeIds[WRITE_METADATA_ATTRIBUTES] = { OpcUa_Attributes_DataType, OpcUa_Attributes_ValueRank, OpcUa_Attributes_AccessLevel };
+    helper->readValueIdNr[nr] = helper->countReads++;
+    for (OpcUa_Int32 i = 0; i < WRITE_METADATA_ATTRIBUTES; ++i) {
+      OpcUa_ReadValueId* readValueId = &helper->readValueId[helper->readValueIdNr[nr] * WRITE_METADATA_ATTRIBUTES + i];
+      OpcUa_ReadValueId_Initialize(readValueId);
+      readValueId->NodeId = writeValue->NodeId;
+      readValueId->AttributeId = attributeIds[i];
+    }
+  }
 
   if (!remaining) {
-    OpcUa_RequestHeader requestHeader;
-    OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginRead(
-      setupRequestHeader(&requestHeader),
-      &requestHeader,
-      0.0,
-      OpcUa_TimestampsToReturn_Neither,
-      helper->count,
-      helper->readValueId,
-      opcua_write_read,
-      helper);
-    if (!OpcUa_IsGood(statusCode))
-      opcua_write_read(OpcUa_Null, OpcUa_Null, OpcUa_Null, helper, statusCode);
+    wpcp_lws_lock();
+    path_resolveBatch(helper->paths, startWriteRead, helper);
+    wpcp_lws_unlock();
   }
 }
 
-static OpcUa_StatusCode opcua_read_history_data(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+#define HISTORY_TICKS_PER_SECOND 10000000ULL
+
+OpcUa_UInt32 g_historySlice;
+OpcUa_UInt32 g_historyConcurrency = 4;
+
+enum history_kind_t {
+  HISTORY_KIND_RAW,
+  HISTORY_KIND_PROCESSED,
+  HISTORY_KIND_EVENTS
+};
+
+// items with equal parameters share one HistoryRead request per time slice
+struct history_key_t {
+  enum history_kind_t kind;
+  OpcUa_DateTime startTime;
+  OpcUa_DateTime endTime;
+  OpcUa_UInt32 numValuesPerNode;
+  OpcUa_Double processingInterval;
+  OpcUa_UInt32 aggregateType;
+  OpcUa_UInt32 points;
+};
+
+struct HistoryReadItem
 {
-  struct wpcp_result_t* result = pCallbackData;
-  OpcUa_HistoryReadResponse* pHistoryReadResponse = pResponse;
-  OpcUa_Int32 noOfResults = pHistoryReadResponse->NoOfResults;
-  OpcUa_HistoryReadResult* results = pHistoryReadResponse->Results;
-
-  if (OpcUa_IsBad(pHistoryReadResponse->ResponseHeader.ServiceResult)) {
-    wpcp_return_read_history_data(result, NULL, 0);
-    return OpcUa_Bad;
-  }
-
-  assert(noOfResults == 1);
-  for (OpcUa_Int32 i = 0; i < noOfResults; ++i) {
-    //OpcUa_BadHistoryOperationUnsupported
-    if (OpcUa_IsGood(results[i].StatusCode)) {
-      OpcUa_Int32 noOfDataValues;
-      const OpcUa_DataValue* dataValues;
-
-      const OpcUa_ExtensionObject* resultHistoryData = &results[i].HistoryData;
-      if (resultHistoryData->Encoding == OpcUa_ExtensionObjectEncoding_EncodeableObject && resultHistoryData->Body.EncodeableObject.Type->TypeId == OpcUaId_HistoryData) {
-        const OpcUa_HistoryData* historyData = resultHistoryData->Body.EncodeableObject.Object;
-        noOfDataValues = historyData->NoOfDataValues;
-        dataValues = historyData->DataValues;
-      }
-      else if (resultHistoryData->Encoding == OpcUa_ExtensionObjectEncoding_EncodeableObject && resultHistoryData->Body.EncodeableObject.Type->TypeId == OpcUaId_HistoryModifiedData) {
-        const OpcUa_HistoryModifiedData* historyModifiedData = resultHistoryData->Body.EncodeableObject.Object;
-        noOfDataValues = historyModifiedData->NoOfDataValues;
-        dataValues = historyModifiedData->DataValues;
-      }
-      else {
-        noOfDataValues = 0;
-        dataValues = NULL;
-      }
+  OpcUa_NodeId nodeId;
+  enum history_kind_t kind;
+  OpcUa_Int32 firstPart;
+  OpcUa_Int32 noOfParts;
+};
 
-      wpcp_return_read_history_data(result, NULL, noOfDataValues);
-      for (OpcUa_Int32 j = 0; j < noOfDataValues; ++j) {
-        struct wpcp_value_t value;
-        toWpcpValue(&dataValues[j].Value, &value);
-        wpcp_return_read_history_data_item(result, &value, toWpcpTime(&dataValues[j].SourceTimestamp, dataValues[j].SourcePicoseconds), dataValues[j].StatusCode, NULL, 0);
-      }
+// the values of all pages of a time slice are collected, since the count has to be returned before the values,
+// a part answered from the buffer of a monitored item has no group
+struct HistoryReadPart
+{
+  OpcUa_HistoryReadValueId nodeToRead;
+  OpcUa_StatusCode statusCode;
+  OpcUa_Int32 groupNr;
+  OpcUa_Int32 noOfValues;
+  void* values;
+  struct decimator_t* decimator;
+  OpcUa_Boolean fallback;
+  OpcUa_Boolean done;
+};
+
+struct HistoryReadGroup
+{
+  struct HistoryReadHelper* helper;
+  struct history_key_t key;
+  OpcUa_Int32 sliceNr;
+  OpcUa_Boolean fallback;
+  OpcUa_DateTime startTime;
+  OpcUa_DateTime endTime;
+  OpcUa_ExtensionObject historyReadDetails;
+  OpcUa_Int32 count;
+  OpcUa_Int32* partNr;
+  struct chunker_t chunker;
+};
+
+struct HistoryReadHelper
+{
+  struct wpcp_result_t* result;
+  OpcUa_Int32 count;
+  OpcUa_Int32 returned;
+  OpcUa_Int32 countParts;
+  OpcUa_Int32 countGroups;
+  OpcUa_Int32 nextGroup;
+  OpcUa_Int32 runningGroups;
+  OpcUa_Int32 finishedGroups;
+  OpcUa_Boolean starting;
+  enum operation_limit_t limit;
+  struct path_batch_t* paths;
+  struct HistoryReadPart* parts;
+  struct HistoryReadGroup* groups;
+  OpcUa_Int32* partNr;
+  struct HistoryReadItem items[1];
+};
+
+// the part numbers of a request shrink to the parts still having a continuation point
+struct HistoryReadRequest
+{
+  struct chunk_t* chunk;
+  OpcUa_Int32 count;
+  OpcUa_Int32 partNr[1];
+};
+
+static void returnHistoryValues(struct wpcp_result_t* result, enum history_kind_t kind, struct HistoryReadPart* part)
+{
+  OpcUa_Int32 noOfValues = OpcUa_IsGood(part->statusCode) ? part->noOfValues : 0;
+
+  if (kind == HISTORY_KIND_EVENTS) {
+    OpcUa_HistoryEventFieldList* events = part->values;
+    for (OpcUa_Int32 j = 0; j < noOfValues; ++j) {
+      struct wpcp_value_t value;
+      toWpcpValue(&events[j].EventFields[0], &value);
+      wpcp_return_read_history_alarm_item(result, NULL, 0, false, &value, &value, 0.0, 0, NULL, 0, false, NULL, 0);
+    }
+    for (OpcUa_Int32 j = 0; j < part->noOfValues; ++j)
+      OpcUa_HistoryEventFieldList_Clear(&events[j]);
+  } else {
+    OpcUa_DataValue* dataValues = part->values;
+    for (OpcUa_Int32 j = 0; j < noOfValues; ++j) {
+      struct wpcp_value_t value;
+      toWpcpValue(&dataValues[j].Value, &value);
+      wpcp_return_read_history_data_item(result, &value, toWpcpTime(&dataValues[j].SourceTimestamp, dataValues[j].SourcePicoseconds), dataValues[j].StatusCode, NULL, 0);
+    }
+    for (OpcUa_Int32 j = 0; j < part->noOfValues; ++j)
+      OpcUa_DataValue_Clear(&dataValues[j]);
+  }
+
+  OpcUa_Memory_Free(part->values);
+  part->values = NULL;
+}
+
+// an item is returned once all its slices are done, a failed slice fails the whole item
+static void returnHistoryResults(struct HistoryReadHelper* helper)
+{
+  while (helper->returned < helper->count) {
+    struct HistoryReadItem* item = &helper->items[helper->returned];
+    struct HistoryReadPart* parts = &helper->parts[item->firstPart];
+    enum history_kind_t kind = item->kind;
+    OpcUa_Int32 noOfValues = 0;
+    OpcUa_Boolean good = OpcUa_True;
+
+    for (OpcUa_Int32 i = 0; i < item->noOfParts; ++i) {
+      if (!parts[i].done)
+        return;
+      good = good && OpcUa_IsGood(parts[i].statusCode);
+      noOfValues += parts[i].noOfValues;
     }
+
+    helper->returned += 1;
+    if (kind == HISTORY_KIND_EVENTS)
+      wpcp_return_read_history_alarm(helper->result, NULL, good ? noOfValues : 0);
     else
-      wpcp_return_read_history_data(result, NULL, 0);
+      wpcp_return_read_history_data(helper->result, NULL, good ? noOfValues : 0);
+
+    for (OpcUa_Int32 i = 0; i < item->noOfParts; ++i) {
+      if (!good)
+        parts[i].statusCode = OpcUa_Bad;
+      returnHistoryValues(helper->result, kind, &parts[i]);
+      OpcUa_ByteString_Clear(&parts[i].nodeToRead.ContinuationPoint);
+    }
+    OpcUa_NodeId_Clear(&item->nodeId);
+  }
+}
+
+// the values are moved out of the response, the source keeps only its empty array
+static void appendHistoryResult(struct HistoryReadPart* part, OpcUa_HistoryReadResult* source)
+{
+  const OpcUa_ExtensionObject* historyData = &source->HistoryData;
+  OpcUa_Int32* noOfValues = NULL;
+  void* values = NULL;
+  size_t size = 0;
+
+  if (historyData->Encoding == OpcUa_ExtensionObjectEncoding_EncodeableObject && historyData->Body.EncodeableObject.Type->TypeId == OpcUaId_HistoryData) {
+    OpcUa_HistoryData* data = historyData->Body.EncodeableObject.Object;
+    noOfValues = &data->NoOfDataValues;
+    values = data->DataValues;
+    size = sizeof(OpcUa_DataValue);
+  }
+  else if (historyData->Encoding == OpcUa_ExtensionObjectEncoding_EncodeableObject && historyData->Body.EncodeableObject.Type->TypeId == OpcUaId_HistoryModifiedData) {
+    OpcUa_HistoryModifiedData* data = historyData->Body.EncodeableObject.Object;
+    noOfValues = &data->NoOfDataValues;
+    values = data->DataValues;
+    size = sizeof(OpcUa_DataValue);
+  }
+  else if (historyData->Encoding == OpcUa_ExtensionObjectEncoding_EncodeableObject && historyData->Body.EncodeableObject.Type->TypeId == OpcUaId_HistoryEvent) {
+    OpcUa_HistoryEvent* data = historyData->Body.EncodeableObject.Object;
+    noOfValues = &data->NoOfEvents;
+    values = data->Events;
+    size = sizeof(OpcUa_HistoryEventFieldList);
+  }
+
+  // a decimated part takes over each value of a page and keeps only the few it needs
+  if (noOfValues && *noOfValues > 0 && part->decimator) {
+    for (OpcUa_Int32 j = 0; j < *noOfValues; ++j)
+      decimate_add(part->decimator, &((OpcUa_DataValue*)values)[j]);
+    *noOfValues = 0;
+  }
+  else if (noOfValues && *noOfValues > 0) {
+    part->values = OpcUa_Memory_ReAlloc(part->values, size * (part->noOfValues + *noOfValues));
+    memcpy((OpcUa_Byte*)part->values + size * part->noOfValues, values, size * *noOfValues);
+    part->noOfValues += *noOfValues;
+    *noOfValues = 0;
   }
 
+  part->statusCode = source->StatusCode;
+  OpcUa_ByteString_Clear(&part->nodeToRead.ContinuationPoint);
+  part->nodeToRead.ContinuationPoint = source->ContinuationPoint;
+  OpcUa_ByteString_Initialize(&source->ContinuationPoint);
+}
+
+static OpcUa_StatusCode opcua_history_read_released(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+{
   return OpcUa_Good;
 }
 
+static OpcUa_StatusCode beginHistoryRead(struct HistoryReadGroup* group, struct HistoryReadRequest* request, OpcUa_Boolean release, OpcUa_Channel_PfnRequestComplete* callback)
+{
+  struct HistoryReadHelper* helper = group->helper;
+  OpcUa_HistoryReadValueId* nodesToRead = malloc(request->count * sizeof(OpcUa_HistoryReadValueId));
+
+  // the request shares node ids and continuation points with the parts
+  for (OpcUa_Int32 i = 0; i < request->count; ++i)
+    nodesToRead[i] = helper->parts[request->partNr[i]].nodeToRead;
+
+  OpcUa_RequestHeader requestHeader;
+  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginHistoryRead(
+    setupRequestHeader(&requestHeader),
+    &requestHeader,
+    &group->historyReadDetails,
+    OpcUa_TimestampsToReturn_Source,
+    release,
+    request->count,
+    nodesToRead,
+    callback,
+    request);
+
+  free(nodesToRead);
+  return statusCode;
+}
+
+static OpcUa_StatusCode opcua_history_read(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus);
+
+static void clearHistoryValues(struct HistoryReadPart* part)
+{
+  OpcUa_DataValue* dataValues = part->values;
+  for (OpcUa_Int32 j = 0; j < part->noOfValues; ++j)
+    OpcUa_DataValue_Clear(&dataValues[j]);
+  OpcUa_Memory_Free(part->values);
+  part->values = NULL;
+  part->noOfValues = 0;
+}
+
+// a server without the aggregate gets a raw read of the same range instead, which is aggregated by the gateway
+static OpcUa_Boolean needsAggregationFallback(const struct HistoryReadGroup* group, const struct HistoryReadPart* part)
+{
+  if (group->key.kind != HISTORY_KIND_PROCESSED || group->fallback || !aggregate_isSupported(group->key.aggregateType))
+    return OpcUa_False;
+  return part->statusCode == OpcUa_BadAggregateNotSupported || part->statusCode == OpcUa_BadHistoryOperationUnsupported;
+}
+
+static void aggregateHistoryPart(const struct HistoryReadGroup* group, struct HistoryReadPart* part)
+{
+  OpcUa_Int32 noOfResults = 0;
+  OpcUa_DataValue* results = NULL;
+
+  if (OpcUa_IsGood(part->statusCode))
+    part->statusCode = aggregate_compute(group->key.aggregateType, toUInt64(&group->startTime), toUInt64(&group->endTime), group->key.processingInterval, part->noOfValues, part->values, &noOfResults, &results);
+  clearHistoryValues(part);
+  part->noOfValues = noOfResults;
+  part->values = results;
+  stats_add(STATS_HISTORY_AGGREGATED, 1);
+}
+
+// parts without a result keep what they got so far, their continuation points are released on the server
+static void continueHistoryRead(struct HistoryReadRequest* request, OpcUa_Int32 noOfResults, OpcUa_HistoryReadResult* results, OpcUa_StatusCode statusCode)
+{
+  struct chunk_t* chunk = request->chunk;
+  struct HistoryReadGroup* group = chunk->chunker->context;
+  struct HistoryReadHelper* helper = group->helper;
+  OpcUa_Int32 countPending = 0;
+
+  for (OpcUa_Int32 i = 0; i < request->count && i < noOfResults; ++i)
+    appendHistoryResult(&helper->parts[request->partNr[i]], &results[i]);
+
+  if (noOfResults < request->count) {
+    struct HistoryReadRequest* release = malloc(sizeof(struct HistoryReadRequest) + request->count * sizeof(OpcUa_Int32));
+    release->count = 0;
+    for (OpcUa_Int32 i = noOfResults; i < request->count; ++i) {
+      struct HistoryReadPart* part = &helper->parts[request->partNr[i]];
+      if (OpcUa_IsGood(part->statusCode))
+        part->statusCode = OpcUa_IsBad(statusCode) ? statusCode : OpcUa_BadInternalError;
+      if (part->nodeToRead.ContinuationPoint.Length > 0)
+        release->partNr[release->count++] = request->partNr[i];
+    }
+    if (release->count)
+      beginHistoryRead(group, release, OpcUa_True, opcua_history_read_released);
+    for (OpcUa_Int32 i = 0; i < release->count; ++i)
+      OpcUa_ByteString_Clear(&helper->parts[release->partNr[i]].nodeToRead.ContinuationPoint);
+    free(release);
+  }
+
+  for (OpcUa_Int32 i = 0; i < request->count; ++i) {
+    struct HistoryReadPart* part = &helper->parts[request->partNr[i]];
+    if (part->nodeToRead.ContinuationPoint.Length > 0)
+      request->partNr[countPending++] = request->partNr[i];
+    else if (needsAggregationFallback(group, part))
+      part->fallback = OpcUa_True;
+    else {
+      if (group->fallback)
+        aggregateHistoryPart(group, part);
+      if (part->decimator) {
+        decimate_finish(part->decimator, &part->noOfValues, (OpcUa_DataValue**)&part->values);
+        part->decimator = NULL;
+      }
+      part->done = OpcUa_True;
+    }
+  }
+  request->count = countPending;
+
+  returnHistoryResults(helper);
+
+  if (!countPending) {
+    free(request);
+    chunk_complete(chunk);
+    return;
+  }
+
+  statusCode = beginHistoryRead(group, request, OpcUa_False, opcua_history_read);
+  if (!OpcUa_IsGood(statusCode))
+    continueHistoryRead(request, 0, NULL, statusCode);
+}
+
+static OpcUa_StatusCode opcua_history_read(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
+{
+  struct HistoryReadRequest* request = pCallbackData;
+  OpcUa_HistoryReadResponse* pHistoryReadResponse = pResponse;
+  OpcUa_StatusCode statusCode = pHistoryReadResponse ? pHistoryReadResponse->ResponseHeader.ServiceResult : uStatus;
+  OpcUa_Int32 noOfResults = pHistoryReadResponse && OpcUa_IsGood(statusCode) ? pHistoryReadResponse->NoOfResults : 0;
+  OpcUa_HistoryReadResult* results = pHistoryReadResponse ? pHistoryReadResponse->Results : NULL;
+
+  wpcp_lws_lock();
+  continueHistoryRead(request, noOfResults, results, statusCode);
+  wpcp_lws_unlock();
+
+  return OpcUa_Good;
+}
+
+static void beginHistoryReadChunk(struct chunk_t* chunk)
+{
+  struct HistoryReadGroup* group = chunk->chunker->context;
+  struct HistoryReadRequest* request = malloc(sizeof(struct HistoryReadRequest) + chunk->count * sizeof(OpcUa_Int32));
+  request->chunk = chunk;
+  request->count = chunk->count;
+  for (OpcUa_Int32 i = 0; i < chunk->count; ++i)
+    request->partNr[i] = group->partNr[chunk->offset + i];
+
+  OpcUa_StatusCode statusCode = beginHistoryRead(group, request, OpcUa_False, opcua_history_read);
+  if (!OpcUa_IsGood(statusCode))
+    opcua_history_read(OpcUa_Null, OpcUa_Null, OpcUa_Null, request, statusCode);
+}
+
+static void finishHistoryReadGroup(void* context);
+
+// at most g_historyConcurrency groups run at the same time, a group may finish synchronously while starting
+static void startHistoryReadGroups(struct HistoryReadHelper* helper)
+{
+  OpcUa_Int32 concurrency = g_historyConcurrency ? g_historyConcurrency : 1;
+
+  if (helper->starting)
+    return;
+
+  helper->starting = OpcUa_True;
+  while (helper->nextGroup < helper->countGroups && helper->runningGroups < concurrency) {
+    struct HistoryReadGroup* group = &helper->groups[helper->nextGroup++];
+    helper->runningGroups += 1;
+    chunk_start(&group->chunker, chunk_getLimit(helper->limit), group->count, group, beginHistoryReadChunk, finishHistoryReadGroup);
+  }
+  helper->starting = OpcUa_False;
+
+  if (helper->finishedGroups == helper->countGroups) {
+    free(helper->parts);
+    free(helper->groups);
+    free(helper->partNr);
+    free(helper);
+  }
+}
+
+static void createHistoryReadDetails(struct HistoryReadGroup* group)
+{
+  const struct history_key_t* key = &group->key;
+
+  if (key->kind == HISTORY_KIND_PROCESSED && !group->fallback) {
+    OpcUa_ReadProcessedDetails* readProcessedDetails = NULL;
+    OpcUa_EncodeableObject_CreateExtension(&OpcUa_ReadProcessedDetails_EncodeableType, &group->historyReadDetails, &readProcessedDetails);
+    readProcessedDetails->StartTime = group->startTime;
+    readProcessedDetails->EndTime = group->endTime;
+    readProcessedDetails->ProcessingInterval = key->processingInterval;
+    readProcessedDetails->AggregateType = OpcUa_Memory_Alloc(sizeof(OpcUa_NodeId));
+    OpcUa_NodeId_Initialize(readProcessedDetails->AggregateType);
+    readProcessedDetails->AggregateType->Identifier.Numeric = key->aggregateType;
+    readProcessedDetails->NoOfAggregateType = 1;
+  }
+  else if (key->kind != HISTORY_KIND_EVENTS) {
+    OpcUa_ReadRawModifiedDetails* readRawModifiedDetails = NULL;
+    OpcUa_EncodeableObject_CreateExtension(&OpcUa_ReadRawModifiedDetails_EncodeableType, &group->historyReadDetails, &readRawModifiedDetails);
+    readRawModifiedDetails->StartTime = group->startTime;
+    readRawModifiedDetails->EndTime = group->endTime;
+    readRawModifiedDetails->NumValuesPerNode = group->fallback ? 0 : key->numValuesPerNode;
+  }
+  else {
+    OpcUa_ReadEventDetails* readEventDetails = NULL;
+    OpcUa_EncodeableObject_CreateExtension(&OpcUa_ReadEventDetails_EncodeableType, &group->historyReadDetails, &readEventDetails);
+    readEventDetails->StartTime = group->startTime;
+    readEventDetails->EndTime = group->endTime;
+    readEventDetails->NumValuesPerNode = key->numValuesPerNode;
+  }
+}
+
+static void finishHistoryReadGroup(void* context)
+{
+  struct HistoryReadGroup* group = context;
+  struct HistoryReadHelper* helper = group->helper;
+
+  OpcUa_ExtensionObject_Clear(&group->historyReadDetails);
+
+  // the group runs a second time with a raw read of the parts the server could not aggregate
+  if (!group->fallback) {
+    OpcUa_Int32 count = 0;
+    for (OpcUa_Int32 i = 0; i < group->count; ++i) {
+      struct HistoryReadPart* part = &helper->parts[group->partNr[i]];
+      if (!part->fallback)
+        continue;
+      clearHistoryValues(part);
+      part->statusCode = OpcUa_Good;
+      group->partNr[count++] = group->partNr[i];
+    }
+    if (count) {
+      group->fallback = OpcUa_True;
+      group->count = count;
+      createHistoryReadDetails(group);
+      chunk_start(&group->chunker, chunk_getLimit(helper->limit), group->count, group, beginHistoryReadChunk, finishHistoryReadGroup);
+      return;
+    }
+  }
+
+  helper->runningGroups -= 1;
+  helper->finishedGroups += 1;
+  startHistoryReadGroups(helper);
+}
+
+static OpcUa_DateTime toDateTimeTicks(OpcUa_UInt64 ticks)
+{
+  OpcUa_DateTime dateTime;
+  dateTime.dwHighDateTime = (OpcUa_UInt32)(ticks >> 32);
+  dateTime.dwLowDateTime = (OpcUa_UInt32)(ticks & 0xFFFFFFFF);
+  return dateTime;
+}
+
+// a limited number of values per node or an open range is read in one piece
+static OpcUa_Int32 getHistorySlices(const struct history_key_t* key)
+{
+  if (key->kind != HISTORY_KIND_RAW || key->numValuesPerNode || !toUInt64(&key->startTime))
+    return 1;
+
+  return slice_count(toUInt64(&key->startTime), toUInt64(&key->endTime), (OpcUa_UInt64)g_historySlice * HISTORY_TICKS_PER_SECOND);
+}
+
+static void addHistoryReadGroups(struct HistoryReadHelper* helper, const struct history_key_t* key, OpcUa_Int32 noOfSlices)
+{
+  OpcUa_UInt64 start = toUInt64(&key->startTime);
+  OpcUa_UInt64 end = toUInt64(&key->endTime);
+
+  helper->groups = realloc(helper->groups, (helper->countGroups + noOfSlices) * sizeof(struct HistoryReadGroup));
+  for (OpcUa_Int32 i = 0; i < noOfSlices; ++i) {
+    struct HistoryReadGroup* group = &helper->groups[helper->countGroups++];
+    group->helper = helper;
+    group->key = *key;
+    group->sliceNr = i;
+    group->fallback = OpcUa_False;
+    group->count = 0;
+    group->startTime = key->startTime;
+    group->endTime = key->endTime;
+    if (noOfSlices > 1) {
+      OpcUa_UInt64 sliceStart;
+      OpcUa_UInt64 sliceEnd;
+      slice_bounds(start, end, noOfSlices, i, &sliceStart, &sliceEnd);
+      group->startTime = toDateTimeTicks(sliceStart);
+      group->endTime = toDateTimeTicks(sliceEnd);
+    }
+  }
+}
+
+// an open end is read up to now
+static OpcUa_UInt64 getHistoryEndTime(const struct history_key_t* key)
+{
+  OpcUa_DateTime now = OpcUa_DateTime_UtcNow();
+  return toUInt64(&key->endTime) ? toUInt64(&key->endTime) : toUInt64(&now);
+}
+
+static void addHistoryReadItem(struct wpcp_result_t* result, const struct wpcp_value_t* id, const struct history_key_t* key, void** context, uint32_t remaining)
+{
+  struct HistoryReadHelper* helper;
+  if (*context)
+    helper = (struct HistoryReadHelper*) *context;
+  else {
+    OpcUa_UInt32 count = remaining + 1;
+    *context = helper = malloc(sizeof(struct HistoryReadHelper) + remaining * sizeof(struct HistoryReadItem));
+    helper->result = result;
+    helper->count = count;
+    helper->returned = 0;
+    helper->countParts = 0;
+    helper->countGroups = 0;
+    helper->nextGroup = 0;
+    helper->runningGroups = 0;
+    helper->finishedGroups = 0;
+    helper->starting = OpcUa_False;
+    helper->paths = NULL;
+    helper->parts = NULL;
+    helper->groups = NULL;
+    helper->partNr = NULL;
+  }
+
+  struct HistoryReadItem* item = &helper->items[helper->count - 1 - remaining];
+  toNodeIdBatched(id, &item->nodeId, &helper->paths);
+  item->kind = key->kind;
+  item->firstPart = helper->countParts;
+
+  OpcUa_Int32 noOfDataValues;
+  OpcUa_DataValue* dataValues;
+  if (g_historyBufferSize && key->kind == HISTORY_KIND_RAW && !OpcUa_NodeId_IsNull(&item->nodeId) && getBufferedHistory(&item->nodeId, &key->startTime, &key->endTime, key->numValuesPerNode, &noOfDataValues, &dataValues)) {
+    item->noOfParts = 1;
+    helper->parts = realloc(helper->parts, (helper->countParts + 1) * sizeof(struct HistoryReadPart));
+    struct HistoryReadPart* part = &helper->parts[helper->countParts++];
+    OpcUa_HistoryReadValueId_Initialize(&part->nodeToRead);
+    part->statusCode = OpcUa_Good;
+    part->groupNr = -1;
+    part->noOfValues = noOfDataValues;
+    part->values = dataValues;
+    part->decimator = NULL;
+    part->fallback = OpcUa_False;
+    part->done = OpcUa_True;
+    if (key->points) {
+      struct decimator_t* decimator = decimate_create(toUInt64(&key->startTime), getHistoryEndTime(key), key->points);
+      for (OpcUa_Int32 j = 0; j < noOfDataValues; ++j)
+        decimate_add(decimator, &dataValues[j]);
+      OpcUa_Memory_Free(dataValues);
+      decimate_finish(decimator, &part->noOfValues, (OpcUa_DataValue**)&part->values);
+    }
+    return;
+  }
+
+  // the slices of a key are consecutive groups
+  OpcUa_Int32 groupNr;
+  for (groupNr = 0; groupNr < helper->countGroups; ++groupNr) {
+    if (!helper->groups[groupNr].sliceNr && !memcmp(&helper->groups[groupNr].key, key, sizeof(*key)))
+      break;
+  }
+  if (groupNr == helper->countGroups)
+    addHistoryReadGroups(helper, key, getHistorySlices(key));
+
+  item->noOfParts = 0;
+  while (groupNr + item->noOfParts < helper->countGroups && helper->groups[groupNr + item->noOfParts].sliceNr == item->noOfParts && !memcmp(&helper->groups[groupNr + item->noOfParts].key, key, sizeof(*key)))
+    item->noOfParts += 1;
+
+  helper->parts = realloc(helper->parts, (helper->countParts + item->noOfParts) * sizeof(struct HistoryReadPart));
+  for (OpcUa_Int32 i = 0; i < item->noOfParts; ++i) {
+    struct HistoryReadPart* part = &helper->parts[helper->countParts++];
+    OpcUa_HistoryReadValueId_Initialize(&part->nodeToRead);
+    part->nodeToRead.NodeId = item->nodeId;
+    part->statusCode = OpcUa_Good;
+    part->groupNr = groupNr + i;
+    part->noOfValues = 0;
+    part->values = NULL;
+    part->decimator = key->points ? decimate_create(toUInt64(&key->startTime), getHistoryEndTime(key), key->points) : NULL;
+    part->fallback = OpcUa_False;
+    part->done = OpcUa_False;
+    helper->groups[groupNr + i].count += 1;
+  }
+}
+
+// the parts share the node ids of the items, which are complete only once the paths are resolved
+static void startHistoryReadParts(void* context)
+{
+  struct HistoryReadHelper* helper = context;
+  OpcUa_Int32 offset = 0;
+
+  for (OpcUa_Int32 i = 0; i < helper->count; ++i) {
+    const struct HistoryReadItem* item = &helper->items[i];
+    for (OpcUa_Int32 j = item->firstPart; j < item->firstPart + item->noOfParts; ++j) {
+      if (helper->parts[j].groupNr >= 0)
+        helper->parts[j].nodeToRead.NodeId = item->nodeId;
+    }
+  }
+
+  helper->partNr = malloc(helper->countParts * sizeof(OpcUa_Int32));
+  for (OpcUa_Int32 i = 0; i < helper->countGroups; ++i) {
+    helper->groups[i].partNr = &helper->partNr[offset];
+    offset += helper->groups[i].count;
+    helper->groups[i].count = 0;
+    createHistoryReadDetails(&helper->groups[i]);
+  }
+  for (OpcUa_Int32 i = 0; i < helper->countParts; ++i) {
+    if (helper->parts[i].groupNr < 0)
+      continue;
+    struct HistoryReadGroup* group = &helper->groups[helper->parts[i].groupNr];
+    group->partNr[group->count++] = i;
+  }
+
+  // leading items answered locally go out before the first request
+  returnHistoryResults(helper);
+  startHistoryReadGroups(helper);
+}
+
+static void startHistoryRead(struct HistoryReadHelper* helper, enum operation_limit_t limit)
+{
+  helper->limit = limit;
+  wpcp_lws_lock();
+  path_resolveBatch(helper->paths, startHistoryReadParts, helper);
+  wpcp_lws_unlock();
+}
+
 OpcUa_UInt64 toUInt64(const OpcUa_DateTime* dateTime)
 {
   OpcUa_UInt64 ret = dateTime->dwHighDateTime;
@@ -445,33 +1530,27 @@ OpcUa_UInt64 toUInt64(const OpcUa_DateTime* dateTime)
 
 void read_history_data(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* id, const struct wpcp_value_t* starttime, const struct wpcp_value_t* endtime, const struct wpcp_value_t* maxresults, const struct wpcp_value_t* aggregation, const struct wpcp_value_t* interval, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count)
 {
-  OpcUa_HistoryReadValueId nodesToRead;
-  OpcUa_HistoryReadValueId_Initialize(&nodesToRead);
-  toNodeId(id, &nodesToRead.NodeId);
+  struct history_key_t key;
+  memset(&key, 0, sizeof(key));
 
-  OpcUa_ExtensionObject historyReadDetails;
-  OpcUa_ReadProcessedDetails* readProcessedDetails = NULL;
-  OpcUa_ReadRawModifiedDetails* readRawModifiedDetails = NULL;
-  OpcUa_NodeId aggregateType;
+  if (starttime)
+    toDateTime(starttime, &key.startTime);
+  if (endtime)
+    toDateTime(endtime, &key.endTime);
 
   if (aggregation) {
-    OpcUa_EncodeableObject_CreateExtension(&OpcUa_ReadProcessedDetails_EncodeableType, &historyReadDetails, &readProcessedDetails);
-    OpcUa_NodeId_Initialize(&aggregateType);
+    key.kind = HISTORY_KIND_PROCESSED;
 
-    if (starttime)
-      toDateTime(starttime, &readProcessedDetails->StartTime);
-    if (endtime)
-      toDateTime(endtime, &readProcessedDetails->EndTime);
     if (interval) {
       if (interval->type == WPCP_VALUE_TYPE_DOUBLE)
-        readProcessedDetails->ProcessingInterval = interval->value.dbl;
+        key.processingInterval = interval->value.dbl;
       else if (interval->type == WPCP_VALUE_TYPE_UINT64)
-        readProcessedDetails->ProcessingInterval = (double)interval->value.uint;
+        key.processingInterval = (double)interval->value.uint;
     }
 
 #define XX(str, opcid) \
     else if (aggregation->value.length == (sizeof(str)-1) && !memcmp(aggregation->data.text_string, str, sizeof(str)-1)) \
-      aggregateType.Identifier.Numeric = opcid;
+      key.aggregateType = opcid;
 
     if (aggregation->type != WPCP_VALUE_TYPE_TEXT_STRING)
     {
@@ -480,120 +1559,44 @@ void read_history_data(void* user, struct wpcp_result_t* result, const struct wp
     XX("minimum", OpcUaId_AggregateFunction_Minimum)
     XX("maximum", OpcUaId_AggregateFunction_Maximum)
     XX("average", OpcUaId_AggregateFunction_Average)
-
-    readProcessedDetails->AggregateType = &aggregateType;
-    readProcessedDetails->NoOfAggregateType = 1;
+    XX("end", OpcUaId_AggregateFunction_End)
+    XX("timeaverage", OpcUaId_AggregateFunction_TimeAverage)
+    XX("count", OpcUaId_AggregateFunction_Count)
+    XX("delta", OpcUaId_AggregateFunction_Delta)
+    XX("stddev", OpcUaId_AggregateFunction_StandardDeviationSample)
+#undef XX
   }
   else {
-    OpcUa_EncodeableObject_CreateExtension(&OpcUa_ReadRawModifiedDetails_EncodeableType, &historyReadDetails, &readRawModifiedDetails);
+    key.kind = HISTORY_KIND_RAW;
 
-    if (starttime)
-      toDateTime(starttime, &readRawModifiedDetails->StartTime);
-    if (endtime)
-      toDateTime(endtime, &readRawModifiedDetails->EndTime);
     if (maxresults && maxresults->type == WPCP_VALUE_TYPE_UINT64)
-      readRawModifiedDetails->NumValuesPerNode = (OpcUa_UInt32) maxresults->value.uint;
-  }
-
-  OpcUa_RequestHeader requestHeader;
-  OpcUa_StatusCode statusCode = OpcUa_ClientApi_BeginHistoryRead(
-    setupRequestHeader(&requestHeader),
-    &requestHeader,
-    &historyReadDetails,
-    OpcUa_TimestampsToReturn_Source,
-    OpcUa_False,
-    1,
-    &nodesToRead,
-    opcua_read_history_data,
-    result);
-  if (!OpcUa_IsGood(statusCode))
-    opcua_read_history_data(OpcUa_Null, OpcUa_Null, OpcUa_Null, result, statusCode);
+      key.numValuesPerNode = (OpcUa_UInt32) maxresults->value.uint;
 
-/*  if (aggregation)
-    OpcUa_EncodeableObject_Delete(&OpcUa_ReadProcessedDetails_EncodeableType, &readProcessedDetails);
-  else
-    OpcUa_EncodeableObject_Delete(&OpcUa_ReadRawModifiedDetails_EncodeableType, &readRawModifiedDetails);
-    */
-}
-
-static OpcUa_StatusCode opcua_read_history_alarm(OpcUa_Channel hChannel, OpcUa_Void* pResponse, OpcUa_EncodeableType* pResponseType, OpcUa_Void* pCallbackData, OpcUa_StatusCode uStatus)
-{
-  struct wpcp_result_t* result = pCallbackData;
-  OpcUa_HistoryReadResponse* pHistoryReadResponse = pResponse;
-  OpcUa_Int32 noOfResults = pHistoryReadResponse->NoOfResults;
-  OpcUa_HistoryReadResult* results = pHistoryReadResponse->Results;
-
-  if (OpcUa_IsBad(pHistoryReadResponse->ResponseHeader.ServiceResult)) {
-    wpcp_return_read_history_alarm(result, NULL, 0);
-    return OpcUa_Bad;
-  }
-
-  assert(noOfResults == 1);
-  for (OpcUa_Int32 i = 0; i < noOfResults; ++i) {
-    if (OpcUa_IsGood(results[i].StatusCode)) {
-      OpcUa_Int32 noOfDataValues;
-      const OpcUa_HistoryEventFieldList* events;
-
-      const OpcUa_ExtensionObject* resultHistoryData = &results[i].HistoryData;
-      if (resultHistoryData->Encoding == OpcUa_ExtensionObjectEncoding_EncodeableObject && resultHistoryData->Body.EncodeableObject.Type->TypeId == OpcUaId_HistoryEvent) {
-        const OpcUa_HistoryEvent* historyEvent = resultHistoryData->Body.EncodeableObject.Object;
-        noOfDataValues = historyEvent->NoOfEvents;
-        events = historyEvent->Events;
-      }
-      else {
-        noOfDataValues = 0;
-        events = NULL;
-      }
-
-      wpcp_return_read_history_alarm(result, NULL, noOfDataValues);
-      for (OpcUa_Int32 j = 0; j < noOfDataValues; ++j) {
-        struct wpcp_value_t value;
-        toWpcpValue(&events[j].EventFields[0].Value, &value);
-        wpcp_return_read_history_alarm_item(result, NULL, 0, false, &value, &value, 0.0, 0, NULL, 0, false, NULL, 0);
-      }
-    }
-    else
-      wpcp_return_read_history_alarm(result, NULL, 0);
+    // decimation needs a start time to place its buckets
+    const struct wpcp_value_t* points = findAdditional(additional, additional_count, "points");
+    if (points && points->type == WPCP_VALUE_TYPE_UINT64 && points->value.uint && toUInt64(&key.startTime))
+      key.points = points->value.uint < 0xFFFFFFFF ? (OpcUa_UInt32)points->value.uint : 0xFFFFFFFF;
   }
 
-  return OpcUa_Good;
+  addHistoryReadItem(result, id, &key, context, remaining);
+  if (!remaining)
+    startHistoryRead(*context, OPERATION_LIMIT_HISTORY_READ_DATA);
 }
 
 void read_history_alarm(void* user, struct wpcp_result_t* result, const struct wpcp_value_t* id, const struct wpcp_value_t* starttime, const struct wpcp_value_t* endtime, const struct wpcp_value_t* maxresults, const struct wpcp_value_t* filter, void** context, uint32_t remaining, const struct wpcp_key_value_pair_t* additional, uint32_t additional_count)
 {
-  OpcUa_HistoryReadValueId nodesToRead;
-  OpcUa_HistoryReadValueId_Initialize(&nodesToRead);
-  toNodeId(id, &nodesToRead.NodeId);
-
-  OpcUa_ExtensionObject historyReadDetails;
-  OpcUa_ReadEventDetails* readEventDetails = NULL;
-  OpcUa_NodeId aggregateType;
-  OpcUa_RequestHeader requestHeader;
-  OpcUa_StatusCode statusCode;
-
-  OpcUa_EncodeableObject_CreateExtension(&OpcUa_ReadEventDetails_EncodeableType, &historyReadDetails, &readEventDetails);
+  struct history_key_t key;
+  memset(&key, 0, sizeof(key));
+  key.kind = HISTORY_KIND_EVENTS;
 
   if (starttime)
-    toDateTime(starttime, &readEventDetails->StartTime);
+    toDateTime(starttime, &key.startTime);
   if (endtime)
-    toDateTime(endtime, &readEventDetails->EndTime);
+    toDateTime(endtime, &key.endTime);
   if (maxresults && maxresults->type == WPCP_VALUE_TYPE_UINT64)
-    readEventDetails->NumValuesPerNode = (OpcUa_UInt32)maxresults->value.uint;
-
-  statusCode = OpcUa_ClientApi_BeginHistoryRead(
-    setupRequestHeader(&requestHeader),
-    &requestHeader,
-    &historyReadDetails,
-    OpcUa_TimestampsToReturn_Source,
-    OpcUa_False,
-    1,
-    &nodesToRead,
-    opcua_read_history_alarm,
-    result);
-  if (!OpcUa_IsGood(statusCode))
-    opcua_read_history_alarm(OpcUa_Null, OpcUa_Null, OpcUa_Null, result, statusCode);
+    key.numValuesPerNode = (OpcUa_UInt32)maxresults->value.uint;
 
-  /*
-  OpcUa_EncodeableObject_Delete(&OpcUa_ReadEventDetails_EncodeableType, &readEventDetails);
-  */
+  addHistoryReadItem(result, id, &key, context, remaining);
+  if (!remaining)
+    startHistoryRead(*context, OPERATION_LIMIT_HISTORY_READ_EVENTS);
 }
@@ -0,0 +1,347 @@
+#include "main.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SEARCH_DEFAULT_LIMIT 100
+#define SEARCH_MAX_LIMIT 10000
+
+enum search_field_t {
+  SEARCH_FIELD_ID,
+  SEARCH_FIELD_BROWSE_NAME,
+  SEARCH_FIELD_DISPLAY_NAME,
+  SEARCH_FIELD_TYPE_DEFINITION,
+  SEARCH_FIELD_COUNT
+};
+
+// the fields are stored back to back in text, the last query stamp suppresses duplicate postings
+struct search_entry_t {
+  OpcUa_UInt32 hash;
+  OpcUa_UInt32 stamp;
+  OpcUa_UInt32 offset[SEARCH_FIELD_COUNT];
+  OpcUa_UInt32 length[SEARCH_FIELD_COUNT];
+  char* text;
+};
+
+// entry numbers of all entries containing a trigram, in the order they were added
+struct search_posting_t {
+  OpcUa_UInt32 trigram;
+  OpcUa_UInt32 count;
+  OpcUa_UInt32 capacity;
+  OpcUa_UInt32* entries;
+};
+
+static OpcUa_Mutex g_searchMutex;
+static struct search_entry_t* g_searchEntries;
+static OpcUa_UInt32 g_noOfSearchEntries;
+static OpcUa_UInt32 g_searchEntriesCapacity;
+static OpcUa_UInt32* g_searchEntryIndex;
+static OpcUa_UInt32 g_searchEntryIndexSize;
+static struct search_posting_t* g_searchPostings;
+static OpcUa_UInt32 g_noOfSearchPostings;
+static OpcUa_UInt32 g_searchPostingsSize;
+static OpcUa_UInt32 g_searchStamp;
+
+static OpcUa_UInt32 toTrigram(const char* text)
+{
+  return ((OpcUa_UInt32)(unsigned char)tolower((unsigned char)text[0]) << 16) |
+    ((OpcUa_UInt32)(unsigned char)tolower((unsigned char)text[1]) << 8) |
+    (OpcUa_UInt32)(unsigned char)tolower((unsigned char)text[2]);
+}
+
+// trigrams are stored incremented by one, so an empty slot is zero
+static struct search_posting_t* findPosting(OpcUa_UInt32 trigram)
+{
+  if (!g_searchPostingsSize)
+    return NULL;
+
+  OpcUa_UInt32 slot = hashBuffer(HASH_INITIAL, &trigram, sizeof(trigram)) & (g_searchPostingsSize - 1);
+  while (g_searchPostings[slot].trigram) {
+    if (g_searchPostings[slot].trigram == trigram + 1)
+      return &g_searchPostings[slot];
+    slot = (slot + 1) & (g_searchPostingsSize - 1);
+  }
+  return NULL;
+}
+
+static void insertPosting(struct search_posting_t* postings, OpcUa_UInt32 size, const struct search_posting_t* posting)
+{
+  OpcUa_UInt32 trigram = posting->trigram - 1;
+  OpcUa_UInt32 slot = hashBuffer(HASH_INITIAL, &trigram, sizeof(trigram)) & (size - 1);
+  while (postings[slot].trigram)
+    slot = (slot + 1) & (size - 1);
+  postings[slot] = *posting;
+}
+
+static void addPosting(OpcUa_UInt32 trigram, OpcUa_UInt32 entryNr)
+{
+  struct search_posting_t* posting = findPosting(trigram);
+
+  if (!posting) {
+    if (2 * (g_noOfSearchPostings + 1) > g_searchPostingsSize) {
+      OpcUa_UInt32 size = g_searchPostingsSize ? 2 * g_searchPostingsSize : 4096;
+      struct search_posting_t* postings = calloc(size, sizeof(*postings));
+      for (OpcUa_UInt32 i = 0; i < g_searchPostingsSize; ++i) {
+        if (g_searchPostings[i].trigram)
+          insertPosting(postings, size, &g_searchPostings[i]);
+      }
+      free(g_searchPostings);
+      g_searchPostings = postings;
+      g_searchPostingsSize = size;
+    }
+
+    struct search_posting_t empty = { trigram + 1, 0, 0, NULL };
+    insertPosting(g_searchPostings, g_searchPostingsSize, &empty);
+    g_noOfSearchPostings += 1;
+    posting = findPosting(trigram);
+  }
+
+  // a trigram occurring several times in an entry is listed once
+  if (posting->count && posting->entries[posting->count - 1] == entryNr)
+    return;
+
+  if (posting->count == posting->capacity) {
+    posting->capacity = posting->capacity ? 2 * posting->capacity : 4;
+    posting->entries = realloc(posting->entries, posting->capacity * sizeof(*posting->entries));
+  }
+  posting->entries[posting->count++] = entryNr;
+}
+
+static OpcUa_UInt32* findEntry(const char* id, OpcUa_UInt32 length, OpcUa_UInt32 hash)
+{
+  OpcUa_UInt32 slot = hash & (g_searchEntryIndexSize - 1);
+  while (g_searchEntryIndex[slot]) {
+    const struct search_entry_t* entry = &g_searchEntries[g_searchEntryIndex[slot] - 1];
+    if (entry->hash == hash && entry->length[SEARCH_FIELD_ID] == length && !memcmp(entry->text, id, length))
+      break;
+    slot = (slot + 1) & (g_searchEntryIndexSize - 1);
+  }
+  return &g_searchEntryIndex[slot];
+}
+
+static void growEntryIndex(void)
+{
+  OpcUa_UInt32 size = g_searchEntryIndexSize ? 2 * g_searchEntryIndexSize : 4096;
+  OpcUa_UInt32* index = calloc(size, sizeof(*index));
+
+  for (OpcUa_UInt32 i = 0; i < g_noOfSearchEntries; ++i) {
+    OpcUa_UInt32 slot = g_searchEntries[i].hash & (size - 1);
+    while (index[slot])
+      slot = (slot + 1) & (size - 1);
+    index[slot] = i + 1;
+  }
+
+  free(g_searchEntryIndex);
+  g_searchEntryIndex = index;
+  g_searchEntryIndexSize = size;
+}
+
+static OpcUa_Boolean isSameEntry(const struct search_entry_t* entry, const char* const* fields, const OpcUa_UInt32* lengths)
+{
+  for (OpcUa_Int32 i = 0; i < SEARCH_FIELD_COUNT; ++i) {
+    if (entry->length[i] != lengths[i] || memcmp(entry->text + entry->offset[i], fields[i], lengths[i]))
+      return OpcUa_False;
+  }
+  return OpcUa_True;
+}
+
+// a changed entry keeps its number and the postings of its old names, the query verifies every candidate
+void search_add(const char* id, OpcUa_UInt32 idLength, const char* browseName, OpcUa_UInt32 browseNameLength, const char* displayName, OpcUa_UInt32 displayNameLength, const char* typeDefinition, OpcUa_UInt32 typeDefinitionLength)
+{
+  const char* fields[SEARCH_FIELD_COUNT] = { id, browseName, displayName, typeDefinition };
+  OpcUa_UInt32 lengths[SEARCH_FIELD_COUNT] = { idLength, browseNameLength, displayNameLength, typeDefinitionLength };
+  OpcUa_UInt32 hash = hashBuffer(HASH_INITIAL, id, idLength);
+
+  OpcUa_Mutex_Lock(g_searchMutex);
+
+  if (2 * (g_noOfSearchEntries + 1) > g_searchEntryIndexSize)
+    growEntryIndex();
+
+  OpcUa_UInt32* slot = findEntry(id, idLength, hash);
+  if (*slot && isSameEntry(&g_searchEntries[*slot - 1], fields, lengths)) {
+    OpcUa_Mutex_Unlock(g_searchMutex);
+    return;
+  }
+
+  if (!*slot) {
+    if (g_noOfSearchEntries == g_searchEntriesCapacity) {
+      g_searchEntriesCapacity = g_searchEntriesCapacity ? 2 * g_searchEntriesCapacity : 4096;
+      g_searchEntries = realloc(g_searchEntries, g_searchEntriesCapacity * sizeof(*g_searchEntries));
+    }
+    g_searchEntries[g_noOfSearchEntries].text = NULL;
+    g_searchEntries[g_noOfSearchEntries].stamp = 0;
+    *slot = ++g_noOfSearchEntries;
+  }
+
+  OpcUa_UInt32 entryNr = *slot - 1;
+  struct search_entry_t* entry = &g_searchEntries[entryNr];
+  OpcUa_UInt32 size = 0;
+  for (OpcUa_Int32 i = 0; i < SEARCH_FIELD_COUNT; ++i)
+    size += lengths[i];
+
+  free(entry->text);
+  entry->text = malloc(size ? size : 1);
+  entry->hash = hash;
+  size = 0;
+  for (OpcUa_Int32 i = 0; i < SEARCH_FIELD_COUNT; ++i) {
+    memcpy(entry->text + size, fields[i], lengths[i]);
+    entry->offset[i] = size;
+    entry->length[i] = lengths[i];
+    size += lengths[i];
+  }
+
+  // the type definition is returned but not searched
+  for (OpcUa_Int32 i = SEARCH_FIELD_ID; i <= SEARCH_FIELD_DISPLAY_NAME; ++i) {
+    for (OpcUa_UInt32 j = 0; j + 3 <= lengths[i]; ++j)
+      addPosting(toTrigram(entry->text + entry->offset[i] + j), entryNr);
+  }
+
+  OpcUa_Mutex_Unlock(g_searchMutex);
+}
+
+static OpcUa_Boolean matchField(const char* text, OpcUa_UInt32 length, const char* query, OpcUa_UInt32 queryLength, OpcUa_Boolean prefix)
+{
+  for (OpcUa_UInt32 i = 0; i + queryLength <= length; ++i) {
+    OpcUa_UInt32 j = 0;
+    while (j < queryLength && tolower((unsigned char)text[i + j]) == tolower((unsigned char)query[j]))
+      ++j;
+    if (j == queryLength)
+      return OpcUa_True;
+    if (prefix)
+      break;
+  }
+  return OpcUa_False;
+}
+
+static OpcUa_Boolean matchEntry(const struct search_entry_t* entry, const struct search_query_t* query)
+{
+  for (OpcUa_Int32 i = SEARCH_FIELD_ID; i <= SEARCH_FIELD_DISPLAY_NAME; ++i) {
+    if (matchField(entry->text + entry->offset[i], entry->length[i], query->text, query->length, query->prefix))
+      return OpcUa_True;
+  }
+  return OpcUa_False;
+}
+
+static OpcUa_Boolean getUInt32(const struct wpcp_key_value_pair_t* additional, uint32_t additional_count, const char* key, OpcUa_UInt32* result)
+{
+  const struct wpcp_value_t* value = findAdditional(additional, additional_count, key);
+  OpcUa_Double number;
+
+  if (!value || OpcUa_IsBad(toDouble(value, &number)) || number < 0 || number > 0xFFFFFFFF)
+    return OpcUa_False;
+
+  *result = (OpcUa_UInt32)number;
+  return OpcUa_True;
+}
+
+// returns NULL if the browse is no search
+struct search_query_t* search_createQuery(const struct wpcp_key_value_pair_t* additional, uint32_t additional_count)
+{
+  const struct wpcp_value_t* text = findAdditional(additional, additional_count, "search");
+  if (!text || text->type != WPCP_VALUE_TYPE_TEXT_STRING)
+    return NULL;
+
+  const struct wpcp_value_t* match = findAdditional(additional, additional_count, "match");
+  struct search_query_t* query = malloc(sizeof(struct search_query_t) + text->value.length);
+  query->offset = 0;
+  query->limit = SEARCH_DEFAULT_LIMIT;
+  query->prefix = match && match->type == WPCP_VALUE_TYPE_TEXT_STRING && match->value.length == 6 && !memcmp(match->data.text_string, "prefix", 6);
+  query->length = text->value.length;
+  memcpy(query->text, text->data.text_string, text->value.length);
+  query->text[query->length] = '\0';
+
+  getUInt32(additional, additional_count, "offset", &query->offset);
+  getUInt32(additional, additional_count, "limit", &query->limit);
+  if (query->limit > SEARCH_MAX_LIMIT)
+    query->limit = SEARCH_MAX_LIMIT;
+
+  return query;
+}
+
+// queries shorter than a trigram scan all entries, longer ones only the shortest posting list of their trigrams
+void search_returnBrowse(struct wpcp_result_t* result, const struct search_query_t* query)
+{
+  OpcUa_Mutex_Lock(g_searchMutex);
+
+  const OpcUa_UInt32* candidates = NULL;
+  OpcUa_UInt32 noOfCandidates = g_noOfSearchEntries;
+  if (query->length >= 3) {
+    noOfCandidates = 0;
+    for (OpcUa_UInt32 i = 0; i + 3 <= query->length; ++i) {
+      const struct search_posting_t* posting = findPosting(toTrigram(query->text + i));
+      if (!posting) {
+        candidates = NULL;
+        noOfCandidates = 0;
+        break;
+      }
+      if (!candidates || posting->count < noOfCandidates) {
+        candidates = posting->entries;
+        noOfCandidates = posting->count;
+      }
+    }
+  }
+
+  OpcUa_UInt32 stamp = ++g_searchStamp;
+  OpcUa_UInt32 skipped = 0;
+  OpcUa_UInt32 count = 0;
+  OpcUa_UInt32 limit = query->limit < noOfCandidates ? query->limit : noOfCandidates;
+  OpcUa_UInt32* matches = malloc((limit ? limit : 1) * sizeof(*matches));
+  if (!matches)
+    limit = 0;
+  for (OpcUa_UInt32 i = 0; i < noOfCandidates && count < limit; ++i) {
+    OpcUa_UInt32 entryNr = candidates ? candidates[i] : i;
+    struct search_entry_t* entry = &g_searchEntries[entryNr];
+    if (entry->stamp == stamp || !matchEntry(entry, query))
+      continue;
+    entry->stamp = stamp;
+    if (skipped < query->offset)
+      ++skipped;
+    else
+      matches[count++] = entryNr;
+  }
+
+  wpcp_return_browse(result, NULL, count);
+  for (OpcUa_UInt32 i = 0; i < count; ++i) {
+    const struct search_entry_t* entry = &g_searchEntries[matches[i]];
+    struct wpcp_value_t id;
+    struct wpcp_value_t type;
+
+    id.type = WPCP_VALUE_TYPE_TEXT_STRING;
+    id.data.text_string = entry->text + entry->offset[SEARCH_FIELD_ID];
+    id.value.length = entry->length[SEARCH_FIELD_ID];
+    type.type = WPCP_VALUE_TYPE_TEXT_STRING;
+    type.data.text_string = entry->text + entry->offset[SEARCH_FIELD_TYPE_DEFINITION];
+    type.value.length = entry->length[SEARCH_FIELD_TYPE_DEFINITION];
+    wpcp_return_browse_item(result, &id,
+      entry->text + entry->offset[SEARCH_FIELD_BROWSE_NAME], entry->length[SEARCH_FIELD_BROWSE_NAME],
+      entry->text + entry->offset[SEARCH_FIELD_DISPLAY_NAME], entry->length[SEARCH_FIELD_DISPLAY_NAME],
+      NULL, 0, &type, NULL, 0);
+  }
+  free(matches);
+
+  OpcUa_Mutex_Unlock(g_searchMutex);
+}
+
+void search_initialize(void)
+{
+  OpcUa_Mutex_Create(&g_searchMutex);
+}
+
+void search_clear(void)
+{
+  for (OpcUa_UInt32 i = 0; i < g_noOfSearchEntries; ++i)
+    free(g_searchEntries[i].text);
+  for (OpcUa_UInt32 i = 0; i < g_searchPostingsSize; ++i)
+    free(g_searchPostings[i].entries);
+
+  free(g_searchEntries);
+  free(g_searchEntryIndex);
+  free(g_searchPostings);
+  g_searchEntries = NULL;
+  g_searchEntryIndex = NULL;
+  g_searchPostings = NULL;
+  g_noOfSearchEntries = g_searchEntriesCapacity = g_searchEntryIndexSize = 0;
+  g_noOfSearchPostings = g_searchPostingsSize = 0;
+
+  OpcUa_Mutex_Delete(&g_searchMutex);
+}
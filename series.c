@@ -0,0 +1,465 @@
+#include "main.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SERIES_BLOCK_SIZE 512
+#define SERIES_TICKS_PER_SECOND 10000000ULL
+
+// info type data value with the overflow bit, set by the server if the queue of the monitored item dropped values
+#define SERIES_OVERFLOW 0x00000480u
+
+// worst case of a single sample: timestamp, value and status code including their control bits
+#define SERIES_MAX_SAMPLE_BITS (4 + 64 + 2 + 5 + 6 + 64 + 1 + 32)
+
+OpcUa_UInt32 g_historyBufferSize;
+OpcUa_UInt32 g_historyBufferDepth = 600;
+
+// samples are encoded relative to their predecessor in the same block, so the oldest block can be dropped as a whole:
+// timestamps as delta of the previous delta, values as XOR with the previous value, status codes only if they changed
+struct series_block_t {
+  OpcUa_Byte datatype;
+  OpcUa_UInt32 count;
+  OpcUa_UInt32 bits;
+  OpcUa_UInt64 firstTime;
+  OpcUa_UInt64 firstValue;
+  OpcUa_StatusCode firstStatus;
+  OpcUa_UInt64 lastTime;
+  OpcUa_Int64 lastDelta;
+  OpcUa_UInt64 lastValue;
+  OpcUa_StatusCode lastStatus;
+  OpcUa_Byte leading;
+  OpcUa_Byte trailing;
+  OpcUa_Byte data[SERIES_BLOCK_SIZE];
+};
+
+// ring of blocks, the budget of g_historyBufferSize bytes is allocated with the first sample
+struct series_t {
+  OpcUa_UInt32 capacity;
+  OpcUa_UInt32 first;
+  OpcUa_UInt32 count;
+  struct series_block_t blocks[1];
+};
+
+struct series_reader_t {
+  const struct series_block_t* block;
+  OpcUa_UInt32 nr;
+  OpcUa_UInt32 bits;
+  OpcUa_UInt64 time;
+  OpcUa_Int64 delta;
+  OpcUa_UInt64 value;
+  OpcUa_StatusCode status;
+  OpcUa_Byte leading;
+  OpcUa_Byte trailing;
+};
+
+static OpcUa_UInt32 countLeadingZeros(OpcUa_UInt64 value)
+{
+  OpcUa_UInt32 count = 0;
+  while (!(value & 0x8000000000000000ULL)) {
+    value <<= 1;
+    ++count;
+  }
+  return count;
+}
+
+static OpcUa_UInt32 countTrailingZeros(OpcUa_UInt64 value)
+{
+  OpcUa_UInt32 count = 0;
+  while (!(value & 1)) {
+    value >>= 1;
+    ++count;
+  }
+  return count;
+}
+
+static OpcUa_Boolean fitsSigned(OpcUa_Int64 value, OpcUa_UInt32 bits)
+{
+  OpcUa_Int64 limit = (OpcUa_Int64)1 << (bits - 1);
+  return value >= -limit && value < limit;
+}
+
+// only scalars which survive the round trip through 64 bits unchanged are buffered
+static OpcUa_Boolean toSample(const OpcUa_Variant* variant, OpcUa_UInt64* sample)
+{
+  OpcUa_Double dbl;
+
+  if (variant->ArrayType != OpcUa_VariantArrayType_Scalar)
+    return OpcUa_False;
+
+  switch (variant->Datatype) {
+  case OpcUaType_Null:
+    *sample = 0;
+    return OpcUa_True;
+  case OpcUaType_Boolean:
+    *sample = variant->Value.Boolean ? 1 : 0;
+    return OpcUa_True;
+#define XX(type) \
+  case OpcUaType_##type: \
+    *sample = (OpcUa_UInt64)(OpcUa_Int64)variant->Value.type; \
+    return OpcUa_True;
+  XX(SByte)
+  XX(Byte)
+  XX(Int16)
+  XX(UInt16)
+  XX(Int32)
+  XX(UInt32)
+  XX(Int64)
+#undef XX
+  case OpcUaType_UInt64:
+    *sample = variant->Value.UInt64;
+    return OpcUa_True;
+  case OpcUaType_Float:
+  case OpcUaType_Double:
+    variantToDouble(variant, &dbl);
+    memcpy(sample, &dbl, sizeof(*sample));
+    return OpcUa_True;
+  default:
+    return OpcUa_False;
+  }
+}
+
+static void fromSample(OpcUa_Byte datatype, OpcUa_UInt64 sample, OpcUa_Variant* variant)
+{
+  OpcUa_Double dbl;
+
+  OpcUa_Variant_Initialize(variant);
+  variant->Datatype = datatype;
+
+  switch (datatype) {
+  case OpcUaType_Boolean:
+    variant->Value.Boolean = sample ? OpcUa_True : OpcUa_False;
+    break;
+#define XX(type) \
+  case OpcUaType_##type: \
+    variant->Value.type = (OpcUa_##type)(OpcUa_Int64)sample; \
+    break;
+  XX(SByte)
+  XX(Byte)
+  XX(Int16)
+  XX(UInt16)
+  XX(Int32)
+  XX(UInt32)
+  XX(Int64)
+#undef XX
+  case OpcUaType_UInt64:
+    variant->Value.UInt64 = sample;
+    break;
+  case OpcUaType_Float:
+    memcpy(&dbl, &sample, sizeof(dbl));
+    variant->Value.Float = (OpcUa_Float)dbl;
+    break;
+  case OpcUaType_Double:
+    memcpy(&variant->Value.Double, &sample, sizeof(sample));
+    break;
+  }
+}
+
+static void writeBits(struct series_block_t* block, OpcUa_UInt64 value, OpcUa_UInt32 length)
+{
+  while (length) {
+    OpcUa_UInt32 offset = block->bits & 7;
+    OpcUa_UInt32 n = 8 - offset < length ? 8 - offset : length;
+    OpcUa_Byte part = (OpcUa_Byte)((value >> (length - n)) & ((1u << n) - 1));
+    if (!offset)
+      block->data[block->bits >> 3] = 0;
+    block->data[block->bits >> 3] |= (OpcUa_Byte)(part << (8 - offset - n));
+    block->bits += n;
+    length -= n;
+  }
+}
+
+static OpcUa_UInt64 readBits(struct series_reader_t* reader, OpcUa_UInt32 length)
+{
+  OpcUa_UInt64 value = 0;
+
+  while (length) {
+    OpcUa_UInt32 offset = reader->bits & 7;
+    OpcUa_UInt32 n = 8 - offset < length ? 8 - offset : length;
+    OpcUa_Byte part = (OpcUa_Byte)((reader->block->data[reader->bits >> 3] >> (8 - offset - n)) & ((1u << n) - 1));
+    value = value << n | part;
+    reader->bits += n;
+    length -= n;
+  }
+
+  return value;
+}
+
+static OpcUa_Int64 readSigned(struct series_reader_t* reader, OpcUa_UInt32 length)
+{
+  OpcUa_UInt64 value = readBits(reader, length);
+  if (length < 64 && (value >> (length - 1)) & 1)
+    value |= ~0ULL << length;
+  return (OpcUa_Int64)value;
+}
+
+static void encodeTime(struct series_block_t* block, OpcUa_UInt64 time)
+{
+  OpcUa_Int64 delta = (OpcUa_Int64)(time - block->lastTime);
+  OpcUa_Int64 deltaOfDelta = delta - block->lastDelta;
+
+  if (!deltaOfDelta)
+    writeBits(block, 0x0, 1);
+  else if (fitsSigned(deltaOfDelta, 14)) {
+    writeBits(block, 0x2, 2);
+    writeBits(block, (OpcUa_UInt64)deltaOfDelta, 14);
+  }
+  else if (fitsSigned(deltaOfDelta, 20)) {
+    writeBits(block, 0x6, 3);
+    writeBits(block, (OpcUa_UInt64)deltaOfDelta, 20);
+  }
+  else if (fitsSigned(deltaOfDelta, 32)) {
+    writeBits(block, 0xE, 4);
+    writeBits(block, (OpcUa_UInt64)deltaOfDelta, 32);
+  }
+  else {
+    writeBits(block, 0xF, 4);
+    writeBits(block, (OpcUa_UInt64)deltaOfDelta, 64);
+  }
+
+  block->lastTime = time;
+  block->lastDelta = delta;
+}
+
+static void decodeTime(struct series_reader_t* reader)
+{
+  static const OpcUa_UInt32 lengths[] = { 14, 20, 32, 64 };
+  OpcUa_Int64 deltaOfDelta = 0;
+  OpcUa_UInt32 prefix = 0;
+
+  while (prefix < 4 && readBits(reader, 1))
+    ++prefix;
+  if (prefix)
+    deltaOfDelta = readSigned(reader, lengths[prefix - 1]);
+
+  reader->delta += deltaOfDelta;
+  reader->time += (OpcUa_UInt64)reader->delta;
+}
+
+// a changed value reuses the window of meaningful bits of its predecessor if it fits into it
+static void encodeValue(struct series_block_t* block, OpcUa_UInt64 value)
+{
+  OpcUa_UInt64 xor = value ^ block->lastValue;
+
+  if (!xor)
+    writeBits(block, 0x0, 1);
+  else {
+    OpcUa_UInt32 leading = countLeadingZeros(xor);
+    OpcUa_UInt32 trailing = countTrailingZeros(xor);
+    if (leading > 31)
+      leading = 31;
+
+    if (block->leading <= leading && block->trailing <= trailing) {
+      writeBits(block, 0x2, 2);
+      writeBits(block, xor >> block->trailing, 64 - block->leading - block->trailing);
+    } else {
+      OpcUa_UInt32 length = 64 - leading - trailing;
+      writeBits(block, 0x3, 2);
+      writeBits(block, leading, 5);
+      writeBits(block, length - 1, 6);
+      writeBits(block, xor >> trailing, length);
+      block->leading = (OpcUa_Byte)leading;
+      block->trailing = (OpcUa_Byte)trailing;
+    }
+  }
+
+  block->lastValue = value;
+}
+
+static void decodeValue(struct series_reader_t* reader)
+{
+  if (!readBits(reader, 1))
+    return;
+
+  if (readBits(reader, 1)) {
+    reader->leading = (OpcUa_Byte)readBits(reader, 5);
+    reader->trailing = (OpcUa_Byte)(64 - reader->leading - (readBits(reader, 6) + 1));
+  }
+  reader->value ^= readBits(reader, 64 - reader->leading - reader->trailing) << reader->trailing;
+}
+
+static void encodeStatus(struct series_block_t* block, OpcUa_StatusCode status)
+{
+  if (status == block->lastStatus)
+    writeBits(block, 0x0, 1);
+  else {
+    writeBits(block, 0x1, 1);
+    writeBits(block, status, 32);
+    block->lastStatus = status;
+  }
+}
+
+static void decodeStatus(struct series_reader_t* reader)
+{
+  if (readBits(reader, 1))
+    reader->status = (OpcUa_StatusCode)readBits(reader, 32);
+}
+
+static OpcUa_UInt32 getBlockBytes(const struct series_block_t* block)
+{
+  return sizeof(block->firstTime) + sizeof(block->firstValue) + sizeof(block->firstStatus) + (block->bits + 7) / 8;
+}
+
+static struct series_block_t* getBlock(struct series_t* series, OpcUa_UInt32 nr)
+{
+  return &series->blocks[(series->first + nr) % series->capacity];
+}
+
+static void dropFirstBlock(struct series_t* series)
+{
+  struct series_block_t* block = getBlock(series, 0);
+  stats_add(STATS_HISTORY_BUFFER_SAMPLES, -(int64_t)block->count);
+  stats_add(STATS_HISTORY_BUFFER_BYTES, -(int64_t)getBlockBytes(block));
+  series->first = (series->first + 1) % series->capacity;
+  series->count -= 1;
+}
+
+static void startBlock(struct series_block_t* block, OpcUa_Byte datatype, OpcUa_UInt64 time, OpcUa_UInt64 value, OpcUa_StatusCode status)
+{
+  block->datatype = datatype;
+  block->count = 1;
+  block->bits = 0;
+  block->firstTime = block->lastTime = time;
+  block->firstValue = block->lastValue = value;
+  block->firstStatus = block->lastStatus = status;
+  block->lastDelta = 0;
+  block->leading = 0xFF;
+  block->trailing = 0xFF;
+}
+
+static void startReader(struct series_reader_t* reader, const struct series_block_t* block)
+{
+  reader->block = block;
+  reader->nr = 0;
+  reader->bits = 0;
+  reader->time = block->firstTime;
+  reader->delta = 0;
+  reader->value = block->firstValue;
+  reader->status = block->firstStatus;
+  reader->leading = 0xFF;
+  reader->trailing = 0xFF;
+}
+
+static OpcUa_Boolean nextSample(struct series_reader_t* reader)
+{
+  if (++reader->nr >= reader->block->count)
+    return OpcUa_False;
+
+  decodeTime(reader);
+  decodeValue(reader);
+  decodeStatus(reader);
+  return OpcUa_True;
+}
+
+struct series_t* series_create(void)
+{
+  OpcUa_UInt32 capacity = g_historyBufferSize / sizeof(struct series_block_t);
+  if (!capacity)
+    capacity = 1;
+
+  struct series_t* series = malloc(sizeof(struct series_t) + (capacity - 1) * sizeof(struct series_block_t));
+  series->capacity = capacity;
+  series->first = 0;
+  series->count = 0;
+  return series;
+}
+
+void series_delete(struct series_t* series)
+{
+  if (!series)
+    return;
+
+  series_reset(series);
+  free(series);
+}
+
+// called if a gap in the notifications may have lost values, the buffered window starts again with the next sample
+void series_reset(struct series_t* series)
+{
+  if (!series)
+    return;
+
+  while (series->count)
+    dropFirstBlock(series);
+}
+
+// samples must arrive in time order and without overflow, anything else restarts the buffer to keep it gap free
+void series_append(struct series_t* series, const OpcUa_DataValue* dataValue)
+{
+  OpcUa_UInt64 time = toUInt64(&dataValue->SourceTimestamp);
+  OpcUa_Byte datatype = dataValue->Value.Datatype;
+  OpcUa_UInt64 value;
+
+  struct series_block_t* block = series->count ? getBlock(series, series->count - 1) : NULL;
+  if (!time || !toSample(&dataValue->Value, &value) || (block && time < block->lastTime)) {
+    series_reset(series);
+    return;
+  }
+  if ((dataValue->StatusCode & SERIES_OVERFLOW) == SERIES_OVERFLOW) {
+    series_reset(series);
+    block = NULL;
+  }
+
+  stats_add(STATS_HISTORY_BUFFER_SAMPLES, 1);
+
+  if (block && block->datatype == datatype && block->bits + SERIES_MAX_SAMPLE_BITS <= SERIES_BLOCK_SIZE * 8) {
+    OpcUa_UInt32 bytes = getBlockBytes(block);
+    encodeTime(block, time);
+    encodeValue(block, value);
+    encodeStatus(block, dataValue->StatusCode);
+    block->count += 1;
+    stats_add(STATS_HISTORY_BUFFER_BYTES, getBlockBytes(block) - bytes);
+  } else {
+    if (series->count == series->capacity)
+      dropFirstBlock(series);
+    block = getBlock(series, series->count++);
+    startBlock(block, datatype, time, value, dataValue->StatusCode);
+    stats_add(STATS_HISTORY_BUFFER_BYTES, getBlockBytes(block));
+  }
+
+  OpcUa_UInt64 depth = g_historyBufferDepth * SERIES_TICKS_PER_SECOND;
+  while (series->count > 1 && getBlock(series, 0)->lastTime + depth < time)
+    dropFirstBlock(series);
+}
+
+// the buffer covers everything since its first sample, returns the raw values of [startTime, endTime)
+OpcUa_Boolean series_read(struct series_t* series, OpcUa_UInt64 startTime, OpcUa_UInt64 endTime, OpcUa_UInt32 maxValues, OpcUa_Int32* noOfDataValues, OpcUa_DataValue** dataValues)
+{
+  struct series_reader_t reader;
+  OpcUa_Int32 count = 0;
+  OpcUa_Int32 size = 0;
+  OpcUa_DataValue* values = NULL;
+
+  if (!series || !series->count || startTime < getBlock(series, 0)->firstTime)
+    return OpcUa_False;
+
+  for (OpcUa_UInt32 i = 0; i < series->count; ++i) {
+    const struct series_block_t* block = getBlock(series, i);
+    if (block->lastTime < startTime)
+      continue;
+    if (block->firstTime >= endTime || (maxValues && (OpcUa_UInt32)count == maxValues))
+      break;
+
+    startReader(&reader, block);
+    do {
+      if (reader.time < startTime)
+        continue;
+      if (reader.time >= endTime || (maxValues && (OpcUa_UInt32)count == maxValues))
+        break;
+
+      if (count == size) {
+        size = size ? size * 2 : 64;
+        values = OpcUa_Memory_ReAlloc(values, size * sizeof(OpcUa_DataValue));
+      }
+      OpcUa_DataValue* dataValue = &values[count++];
+      OpcUa_DataValue_Initialize(dataValue);
+      fromSample(block->datatype, reader.value, &dataValue->Value);
+      dataValue->StatusCode = reader.status;
+      dataValue->SourceTimestamp.dwHighDateTime = (OpcUa_UInt32)(reader.time >> 32);
+      dataValue->SourceTimestamp.dwLowDateTime = (OpcUa_UInt32)(reader.time & 0xFFFFFFFF);
+    } while (nextSample(&reader));
+  }
+
+  *noOfDataValues = count;
+  *dataValues = values;
+  return OpcUa_True;
+}
@@ -0,0 +1,157 @@
+#include "main.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLAB_CHUNK_SIZE 256
+#define SLAB_INDEX_MASK ((1u << SLAB_INDEX_BITS) - 1)
+#define SLAB_HEADER_SIZE 16
+
+struct slab_slot_t {
+  OpcUa_UInt32 nextFree;
+  OpcUa_Boolean used;
+};
+
+static struct slab_slot_t* slab_slot(const struct slab_t* slab, OpcUa_UInt32 index)
+{
+  OpcUa_Byte* chunk = slab->chunks[index / SLAB_CHUNK_SIZE];
+  return (struct slab_slot_t*)(chunk + (index % SLAB_CHUNK_SIZE) * slab->slotSize);
+}
+
+static void* slab_element(struct slab_slot_t* slot)
+{
+  return (OpcUa_Byte*)slot + SLAB_HEADER_SIZE;
+}
+
+static OpcUa_Boolean slab_grow(struct slab_t* slab)
+{
+  OpcUa_UInt32 chunkNr = slab->noOfChunks;
+  OpcUa_UInt32 first = chunkNr * SLAB_CHUNK_SIZE;
+
+  if (first + SLAB_CHUNK_SIZE > SLAB_INDEX_MASK + 1)
+    return OpcUa_False;
+
+  if (!slab->slotSize)
+    slab->slotSize = SLAB_HEADER_SIZE + (slab->elementSize + SLAB_HEADER_SIZE - 1) / SLAB_HEADER_SIZE * SLAB_HEADER_SIZE;
+
+  OpcUa_Byte* chunk = malloc(SLAB_CHUNK_SIZE * slab->slotSize);
+  if (!chunk)
+    return OpcUa_False;
+
+  slab->chunks = realloc(slab->chunks, sizeof(*slab->chunks) * (chunkNr + 1));
+  slab->live = realloc(slab->live, sizeof(*slab->live) * (chunkNr + 1));
+  slab->chunks[chunkNr] = chunk;
+  slab->live[chunkNr] = 0;
+  slab->noOfChunks = chunkNr + 1;
+
+  // generations outlive released chunks, so stale handles stay detectable
+  if (slab->noOfGenerations < first + SLAB_CHUNK_SIZE) {
+    slab->generations = realloc(slab->generations, sizeof(*slab->generations) * (first + SLAB_CHUNK_SIZE));
+    memset(slab->generations + slab->noOfGenerations, 0, sizeof(*slab->generations) * (first + SLAB_CHUNK_SIZE - slab->noOfGenerations));
+    slab->noOfGenerations = first + SLAB_CHUNK_SIZE;
+  }
+
+  for (OpcUa_UInt32 i = SLAB_CHUNK_SIZE; i > 0; --i) {
+    struct slab_slot_t* slot = slab_slot(slab, first + i - 1);
+    slot->used = OpcUa_False;
+    slot->nextFree = slab->freeList;
+    slab->freeList = first + i;
+  }
+
+  return OpcUa_True;
+}
+
+// keeps one empty chunk at the end to avoid thrashing at a chunk boundary
+static void slab_shrink(struct slab_t* slab)
+{
+  OpcUa_UInt32 noOfChunks = slab->noOfChunks;
+
+  while (noOfChunks >= 2 && !slab->live[noOfChunks - 1] && !slab->live[noOfChunks - 2])
+    --noOfChunks;
+
+  if (noOfChunks == slab->noOfChunks)
+    return;
+
+  slab->freeList = 0;
+  for (OpcUa_UInt32 i = noOfChunks * SLAB_CHUNK_SIZE; i > 0; --i) {
+    struct slab_slot_t* slot = slab_slot(slab, i - 1);
+    if (!slot->used) {
+      slot->nextFree = slab->freeList;
+      slab->freeList = i;
+    }
+  }
+
+  while (slab->noOfChunks > noOfChunks)
+    free(slab->chunks[--slab->noOfChunks]);
+}
+
+void* slab_alloc(struct slab_t* slab, OpcUa_UInt32* handle)
+{
+  if (!slab->freeList && !slab_grow(slab))
+    return NULL;
+
+  OpcUa_UInt32 index = slab->freeList - 1;
+  struct slab_slot_t* slot = slab_slot(slab, index);
+  slab->freeList = slot->nextFree;
+  slot->used = OpcUa_True;
+  slab->live[index / SLAB_CHUNK_SIZE] += 1;
+  slab->count += 1;
+
+  *handle = (OpcUa_UInt32)slab->generations[index] << SLAB_INDEX_BITS | index;
+
+  void* element = slab_element(slot);
+  memset(element, 0, slab->elementSize);
+  return element;
+}
+
+void slab_free(struct slab_t* slab, OpcUa_UInt32 handle)
+{
+  OpcUa_UInt32 index = handle & SLAB_INDEX_MASK;
+  struct slab_slot_t* slot = slab_slot(slab, index);
+
+  assert(slab_get(slab, handle));
+
+  slot->used = OpcUa_False;
+  slot->nextFree = slab->freeList;
+  slab->freeList = index + 1;
+  slab->generations[index] = (slab->generations[index] + 1) & SLAB_GENERATION_MASK;
+  slab->live[index / SLAB_CHUNK_SIZE] -= 1;
+  slab->count -= 1;
+
+  slab_shrink(slab);
+}
+
+void* slab_get(const struct slab_t* slab, OpcUa_UInt32 handle)
+{
+  OpcUa_UInt32 index = handle & SLAB_INDEX_MASK;
+
+  if (index >= slab->noOfChunks * SLAB_CHUNK_SIZE || slab->generations[index] != handle >> SLAB_INDEX_BITS)
+    return NULL;
+
+  struct slab_slot_t* slot = slab_slot(slab, index);
+  return slot->used ? slab_element(slot) : NULL;
+}
+
+OpcUa_UInt32 slab_size(const struct slab_t* slab)
+{
+  return slab->noOfChunks * SLAB_CHUNK_SIZE;
+}
+
+void* slab_at(const struct slab_t* slab, OpcUa_UInt32 index)
+{
+  if (index >= slab->noOfChunks * SLAB_CHUNK_SIZE)
+    return NULL;
+
+  struct slab_slot_t* slot = slab_slot(slab, index);
+  return slot->used ? slab_element(slot) : NULL;
+}
+
+void slab_clear(struct slab_t* slab)
+{
+  while (slab->noOfChunks)
+    free(slab->chunks[--slab->noOfChunks]);
+  free(slab->chunks);
+  free(slab->live);
+  free(slab->generations);
+  memset(slab, 0, sizeof(*slab));
+}
@@ -0,0 +1,18 @@
+#include "slice.h"
+
+// a range up to one slice long, or without a slice length, is read in one piece
+int32_t slice_count(uint64_t start, uint64_t end, uint64_t length)
+{
+  if (!length || end <= start + length)
+    return 1;
+
+  uint64_t count = (end - start + length - 1) / length;
+  return count < SLICE_MAX_COUNT ? (int32_t)count : SLICE_MAX_COUNT;
+}
+
+// values are read for [start, end), so adjacent slices neither overlap nor miss a value
+void slice_bounds(uint64_t start, uint64_t end, int32_t count, int32_t nr, uint64_t* sliceStart, uint64_t* sliceEnd)
+{
+  *sliceStart = start + (end - start) * nr / count;
+  *sliceEnd = start + (end - start) * (nr + 1) / count;
+}
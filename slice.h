@@ -0,0 +1,6 @@
+#include <stdint.h>
+
+#define SLICE_MAX_COUNT 64
+
+int32_t slice_count(uint64_t start, uint64_t end, uint64_t length);
+void slice_bounds(uint64_t start, uint64_t end, int32_t count, int32_t nr, uint64_t* sliceStart, uint64_t* sliceEnd);
@@ -0,0 +1,60 @@
+#include "main.h"
+#include <opcua_timer.h>
+#include <inttypes.h>
+#include <windows.h>
+
+static const char* g_statsNames[] = {
+#define XX(id, name) name,
+  STATS_COUNTERS(XX)
+#undef XX
+};
+
+static volatile LONG64 g_stats[STATS_COUNT];
+static OpcUa_Timer g_statsTimer;
+
+void stats_add(enum stats_t stat, int64_t value)
+{
+  InterlockedExchangeAdd64(&g_stats[stat], value);
+}
+
+void stats_set(enum stats_t stat, int64_t value)
+{
+  InterlockedExchange64(&g_stats[stat], value);
+}
+
+void stats_max(enum stats_t stat, int64_t value)
+{
+  LONG64 current = g_stats[stat];
+  while (current < value) {
+    LONG64 previous = InterlockedCompareExchange64(&g_stats[stat], value, current);
+    if (previous == current)
+      break;
+    current = previous;
+  }
+}
+
+int64_t stats_get(enum stats_t stat)
+{
+  return g_stats[stat];
+}
+
+static OpcUa_StatusCode stats_print(OpcUa_Void* pvCallbackData, OpcUa_Timer hTimer, OpcUa_UInt32 msecElapsed)
+{
+  for (int i = 0; i < STATS_COUNT; ++i)
+    printf("%s: %" PRId64 "\n", g_statsNames[i], (int64_t)g_stats[i]);
+  publish_printStats();
+  printf("----\n");
+  return OpcUa_Good;
+}
+
+void stats_start(OpcUa_UInt32 interval)
+{
+  if (interval)
+    OpcUa_Timer_Create(&g_statsTimer, interval * 1000, stats_print, OpcUa_Null, OpcUa_Null);
+}
+
+void stats_stop(void)
+{
+  if (g_statsTimer)
+    OpcUa_Timer_Delete(&g_statsTimer);
+}